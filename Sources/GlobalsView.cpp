@@ -0,0 +1,259 @@
+/******************************************************************************\
+* GlobalsView.cpp                                                              *
+* A lazy view of the global variables of a Lua state.                          *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#include <cstring>
+#include <Diluculum/GlobalsView.hpp>
+#include <Diluculum/LuaUtils.hpp>
+
+
+namespace
+{
+   /** Converts the value on the top of the stack to a \c LuaValue, popping
+    *  it (even if the conversion fails).
+    */
+   Diluculum::LuaValue PopLuaValue (lua_State* ls)
+   {
+      try
+      {
+         Diluculum::LuaValue value = Diluculum::ToLuaValue (ls, -1);
+         lua_pop (ls, 1);
+         return value;
+      }
+      catch (...)
+      {
+         lua_pop (ls, 1);
+         throw;
+      }
+   }
+
+} // (anonymous) namespace
+
+
+
+namespace Diluculum
+{
+   // - GlobalsView::Entry::key ------------------------------------------------
+   LuaValue GlobalsView::Entry::key() const
+   {
+      if (keyRef_ == LUA_NOREF)
+         return Nil;
+
+      lua_rawgeti (ls_, LUA_REGISTRYINDEX, keyRef_);
+      return PopLuaValue (ls_);
+   }
+
+
+
+   // - GlobalsView::Entry::value ----------------------------------------------
+   LuaValue GlobalsView::Entry::value() const
+   {
+      if (keyRef_ == LUA_NOREF)
+         return Nil;
+
+      lua_rawgeti (ls_, LUA_REGISTRYINDEX, keyRef_);
+      lua_rawget (ls_, LUA_GLOBALSINDEX);
+      return PopLuaValue (ls_);
+   }
+
+
+
+   // - GlobalsView::Iterator::Iterator ----------------------------------------
+   GlobalsView::Iterator::Iterator (const GlobalsView* view, bool atEnd)
+      : view_(view), entry_(view->ls_)
+   {
+      if (!atEnd)
+      {
+         lua_pushnil (entry_.ls_);
+         advance();
+      }
+   }
+
+
+   GlobalsView::Iterator::Iterator (const Iterator& other)
+      : view_(other.view_), entry_(other.entry_)
+   {
+      if (entry_.keyRef_ != LUA_NOREF)
+      {
+         lua_rawgeti (entry_.ls_, LUA_REGISTRYINDEX, entry_.keyRef_);
+         entry_.keyRef_ = luaL_ref (entry_.ls_, LUA_REGISTRYINDEX);
+      }
+   }
+
+
+
+   // - GlobalsView::Iterator::~Iterator ---------------------------------------
+   GlobalsView::Iterator::~Iterator()
+   {
+      luaL_unref (entry_.ls_, LUA_REGISTRYINDEX, entry_.keyRef_);
+   }
+
+
+
+   // - GlobalsView::Iterator::operator= ---------------------------------------
+   GlobalsView::Iterator&
+   GlobalsView::Iterator::operator= (const Iterator& rhs)
+   {
+      if (this != &rhs)
+      {
+         Iterator copy (rhs);
+         std::swap (view_, copy.view_);
+         std::swap (entry_, copy.entry_);
+      }
+
+      return *this;
+   }
+
+
+
+   // - GlobalsView::Iterator::operator++ --------------------------------------
+   GlobalsView::Iterator& GlobalsView::Iterator::operator++()
+   {
+      if (entry_.keyRef_ != LUA_NOREF)
+      {
+         lua_rawgeti (entry_.ls_, LUA_REGISTRYINDEX, entry_.keyRef_);
+         advance();
+      }
+
+      return *this;
+   }
+
+
+
+   // - GlobalsView::Iterator::operator== --------------------------------------
+   bool GlobalsView::Iterator::operator== (const Iterator& rhs) const
+   {
+      if (entry_.keyRef_ == LUA_NOREF || rhs.entry_.keyRef_ == LUA_NOREF)
+         return entry_.keyRef_ == rhs.entry_.keyRef_;
+
+      lua_rawgeti (entry_.ls_, LUA_REGISTRYINDEX, entry_.keyRef_);
+      lua_rawgeti (entry_.ls_, LUA_REGISTRYINDEX, rhs.entry_.keyRef_);
+      const bool equal = lua_rawequal (entry_.ls_, -1, -2) != 0;
+      lua_pop (entry_.ls_, 2);
+
+      return equal;
+   }
+
+
+
+   // - GlobalsView::Iterator::advance -----------------------------------------
+   void GlobalsView::Iterator::advance()
+   {
+      lua_State* ls = entry_.ls_;
+
+      while (lua_next (ls, LUA_GLOBALSINDEX) != 0)
+      {
+         if (view_->accepts (ls))
+         {
+            lua_pushvalue (ls, -2);
+            if (entry_.keyRef_ == LUA_NOREF)
+               entry_.keyRef_ = luaL_ref (ls, LUA_REGISTRYINDEX);
+            else
+               lua_rawseti (ls, LUA_REGISTRYINDEX, entry_.keyRef_);
+
+            entry_.name_ = lua_type (ls, -2) == LUA_TSTRING
+               ? lua_tostring (ls, -2) : 0;
+            entry_.type_ = lua_type (ls, -1);
+
+            lua_pop (ls, 2);
+            return;
+         }
+
+         lua_pop (ls, 1);
+      }
+
+      // Reached the end
+      luaL_unref (ls, LUA_REGISTRYINDEX, entry_.keyRef_);
+      entry_.keyRef_ = LUA_NOREF;
+      entry_.name_ = 0;
+      entry_.type_ = LUA_TNIL;
+   }
+
+
+
+   // - GlobalsView::GlobalsView -----------------------------------------------
+   GlobalsView::GlobalsView (LuaState& ls)
+      : ls_(ls.getState()), type_(LUA_TNONE), excludeFunctions_(false)
+   { }
+
+
+
+   // - GlobalsView::onlyType --------------------------------------------------
+   GlobalsView& GlobalsView::onlyType (int type)
+   {
+      type_ = type;
+      return *this;
+   }
+
+
+
+   // - GlobalsView::withPrefix ------------------------------------------------
+   GlobalsView& GlobalsView::withPrefix (const std::string& prefix)
+   {
+      prefix_ = prefix;
+      return *this;
+   }
+
+
+
+   // - GlobalsView::excludingFunctions ----------------------------------------
+   GlobalsView& GlobalsView::excludingFunctions()
+   {
+      excludeFunctions_ = true;
+      return *this;
+   }
+
+
+
+   // - GlobalsView::accepts ---------------------------------------------------
+   bool GlobalsView::accepts (lua_State* ls) const
+   {
+      const int type = lua_type (ls, -1);
+
+      if (type_ != LUA_TNONE && type != type_)
+         return false;
+
+      if (excludeFunctions_ && type == LUA_TFUNCTION)
+         return false;
+
+      if (!prefix_.empty())
+      {
+         if (lua_type (ls, -2) != LUA_TSTRING)
+            return false;
+
+         size_t len;
+         const char* name = lua_tolstring (ls, -2, &len);
+         if (len < prefix_.size()
+             || std::memcmp (name, prefix_.data(), prefix_.size()) != 0)
+         {
+            return false;
+         }
+      }
+
+      return true;
+   }
+
+} // namespace Diluculum
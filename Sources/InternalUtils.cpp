@@ -26,10 +26,47 @@
 
 
 #include "InternalUtils.hpp"
+#include <Diluculum/LuaCall.hpp>
 #include <Diluculum/LuaUtils.hpp>
 #include <cstring>
 #include <boost/lexical_cast.hpp>
 
+
+namespace
+{
+   /// The registry field where the running \c LuaMetrics is stored.
+   const char* const MetricsField = "__Diluculum__Metrics";
+
+   /** The registry field where the Lua threads whose hook was set to run on
+    *  every instruction (because some execution limit was exceeded) are
+    *  stored, as keys of a table. These must have their hook restored when
+    *  the limited call finishes.
+    */
+   const char* const TrippedThreadsField = "__Diluculum__Tripped_Threads";
+
+#ifdef DILUCULUM_ENABLE_METRICS
+   /** Returns the name used by \c LuaMetrics for the function at \c index
+    *  when no name was given for it.
+    */
+   std::string CallLabel (lua_State* ls, int index)
+   {
+      lua_Debug ar;
+      lua_pushvalue (ls, index);
+      lua_getinfo (ls, ">S", &ar);
+
+      if (std::strcmp (ar.what, "C") == 0)
+         return "[C]";
+      else if (std::strcmp (ar.what, "main") == 0)
+         return std::string ("main chunk (") + ar.short_src + ")";
+      else
+         return std::string (ar.short_src) + ":"
+            + boost::lexical_cast<std::string> (ar.linedefined);
+   }
+#endif
+
+} // (anonymous) namespace
+
+
 namespace Diluculum
 {
    namespace Impl
@@ -37,29 +74,76 @@ namespace Diluculum
       // - CallFunctionOnTop ---------------------------------------------------
       LuaValueList CallFunctionOnTop (lua_State* ls, const LuaValueList& params)
       {
-         int topBefore = lua_gettop (ls);
+         LuaValueList results;
+         CallFunctionOnTop (ls, params, results);
+         return results;
+      }
+
+
+      void CallFunctionOnTop (lua_State* ls, const LuaValueList& params,
+                              LuaValueList& results)
+      {
+         const int topBefore = lua_gettop (ls);
 
          if (lua_type (ls, -1) != LUA_TFUNCTION)
             throw TypeMismatchError ("function", luaL_typename (ls, -1));
 
-         typedef LuaValueList::const_iterator iter_t;
-         for (iter_t p = params.begin(); p != params.end(); ++p)
-            PushLuaValue (ls, *p);
+         try
+         {
+            typedef LuaValueList::const_iterator iter_t;
+            for (iter_t p = params.begin(); p != params.end(); ++p)
+               PushLuaValue (ls, *p);
 
-         int status = lua_pcall (ls, params.size(), LUA_MULTRET, 0);
+            CallOnStack (ls, params.size(), LUA_MULTRET);
 
-         ThrowOnLuaError (ls, status);
+            const int numResults = lua_gettop (ls) - topBefore + 1;
 
-         int numResults = lua_gettop (ls) - topBefore + 1;
+            results.clear();
+            results.reserve (numResults);
 
-         LuaValueList results;
+            for (int i = numResults; i > 0; --i)
+               results.push_back (ToLuaValue (ls, -i));
 
-         for (int i = numResults; i > 0; --i)
-            results.push_back (ToLuaValue (ls, -i));
+            lua_pop (ls, numResults);
+         }
+         catch (...)
+         {
+            // The function is consumed even if the call fails
+            lua_settop (ls, topBefore - 1);
+            throw;
+         }
+      }
 
-         lua_pop (ls, numResults);
 
-         return results;
+      void CallFunctionOnTop (lua_State* ls, const LuaValueList& params,
+                              LuaResult& result)
+      {
+         const int topBefore = lua_gettop (ls);
+
+         try
+         {
+            typedef LuaValueList::const_iterator iter_t;
+            for (iter_t p = params.begin(); p != params.end(); ++p)
+               PushLuaValue (ls, *p);
+
+            if (ProtectedCall (ls, params.size(), LUA_MULTRET, result) != 0)
+               return;
+
+            const int numResults = lua_gettop (ls) - topBefore + 1;
+
+            result.values().reserve (numResults);
+
+            for (int i = numResults; i > 0; --i)
+               result.values().push_back (ToLuaValue (ls, -i));
+
+            lua_pop (ls, numResults);
+         }
+         catch (const LuaError& e)
+         {
+            // Parameters or results of types not supported by 'LuaValue'
+            lua_settop (ls, topBefore - 1);
+            SetErrorResult (result, LUA_ERRRUN, e.what());
+         }
       }
 
 
@@ -69,35 +153,49 @@ namespace Diluculum
       {
          if (statusCode != 0)
          {
-            std::string errorMessage;
-            if (lua_isstring (ls, -1))
-            {
-               errorMessage = lua_tostring (ls, -1);
-               lua_pop (ls, 1);
-            }
-            else
-            {
-               errorMessage =
-                  "Sorry, there is no additional information about this error.";
-            }
+            LuaResult result;
+            SetErrorResult (ls, statusCode, result);
+            result.throwIfError();
+         }
+      }
 
-            switch (statusCode)
-            {
-               case LUA_ERRRUN:
-                  throw LuaRunTimeError (errorMessage.c_str());
-               case LUA_ERRFILE:
-                  throw LuaFileError (errorMessage.c_str());
-               case LUA_ERRSYNTAX:
-                  throw LuaSyntaxError (errorMessage.c_str());
-               case LUA_ERRMEM:
-                  throw LuaMemoryError (errorMessage.c_str());
-               case LUA_ERRERR:
-                  throw LuaErrorError (errorMessage.c_str());
-               default:
-                  throw LuaError ("Unknown Lua return code passed "
-                                  "to 'Diluculum::Impl::ThrowOnLuaError()'.");
-            }
+
+
+      // - ProtectedCall -------------------------------------------------------
+      int ProtectedCall (lua_State* ls, int numArgs, int numResults,
+                         LuaResult& result, const char* name)
+      {
+#ifdef DILUCULUM_ENABLE_METRICS
+         const bool timed = GetMetrics (ls) != 0;
+         std::string label;
+         std::chrono::steady_clock::time_point start;
+         if (timed)
+         {
+            label = name != 0 ? name : CallLabel (ls, -numArgs - 1);
+            start = std::chrono::steady_clock::now();
+         }
+#endif
+
+         ExecutionLimitsScope limitsScope (ls);
+
+         const int status = lua_pcall (ls, numArgs, numResults, 0);
+
+#ifdef DILUCULUM_ENABLE_METRICS
+         if (timed)
+         {
+            const std::chrono::nanoseconds elapsed =
+               std::chrono::steady_clock::now() - start;
+
+            // Get the metrics again: they may have been stopped by the call
+            DILUCULUM_METRICS (ls, recordCall (label, elapsed.count(),
+                                               status != 0));
          }
+#endif
+
+         if (status != 0)
+            SetErrorResult (ls, status, result);
+
+         return status;
       }
 
 
@@ -139,6 +237,255 @@ namespace Diluculum
          return reinterpret_cast<const char*>(f->getData());
       }
 
+
+
+
+      // - PushAsyncCallsTable -------------------------------------------------
+      void PushAsyncCallsTable (lua_State* ls)
+      {
+         lua_getfield (ls, LUA_REGISTRYINDEX, "__Diluculum__Async_Calls");
+         if (lua_isnil (ls, -1))
+         {
+            lua_pop (ls, 1);
+            lua_newtable (ls);
+
+            // Weak keys: the threads are kept alive by registry references
+            lua_newtable (ls);
+            lua_pushstring (ls, "k");
+            lua_setfield (ls, -2, "__mode");
+            lua_setmetatable (ls, -2);
+
+            lua_pushvalue (ls, -1);
+            lua_setfield (ls, LUA_REGISTRYINDEX, "__Diluculum__Async_Calls");
+         }
+      }
+
+
+
+
+      // - LuaHook -------------------------------------------------------------
+      void LuaHook (lua_State* ls, lua_Debug* ar)
+      {
+         HookData* data = GetHookData (ls);
+         if (data == 0)
+            return;
+
+         const int count = lua_gethookcount (ls);
+         ExecutionLimits& limits = data->limits;
+
+         // Coroutines get the hook of the thread that created them, and keep
+         // it after it is no longer needed (like after stopping the profiler)
+         if ((!limits.exceeded || limits.depth == 0)
+             && count != HookInterval (data))
+         {
+            UpdateHook (ls, data);
+            if (lua_gethook (ls) != LuaHook)
+               return;
+         }
+
+         if (data->profiler != 0)
+            data->profiler->countInstructions (ls, count);
+
+         if (!limits.enabled || limits.depth == 0)
+            return;
+
+         if (!limits.exceeded)
+         {
+            limits.executed += count;
+
+            if (limits.maxInstructions > 0
+                && limits.executed >= limits.maxInstructions)
+            {
+               limits.reason = "Instruction limit exceeded.";
+            }
+            else if (limits.maxDuration.count() > 0
+                     && std::chrono::steady_clock::now() >= limits.deadline)
+            {
+               limits.reason = "Time limit exceeded.";
+            }
+            else
+            {
+               return;
+            }
+
+            limits.exceeded = true;
+         }
+
+         // From now on, check on every instruction, so that Lua code cannot
+         // keep running by catching the error with 'pcall()'. Remember the
+         // thread, to restore its hook when the call finishes.
+         lua_sethook (ls, LuaHook, LUA_MASKCOUNT, 1);
+
+         lua_getfield (ls, LUA_REGISTRYINDEX, TrippedThreadsField);
+         if (lua_isnil (ls, -1))
+         {
+            lua_pop (ls, 1);
+            lua_newtable (ls);
+            lua_pushvalue (ls, -1);
+            lua_setfield (ls, LUA_REGISTRYINDEX, TrippedThreadsField);
+         }
+         lua_pushthread (ls);
+         lua_pushboolean (ls, true);
+         lua_rawset (ls, -3);
+         lua_pop (ls, 1);
+
+         luaL_error (ls, "%s", limits.reason);
+      }
+
+
+
+      // - GetHookData ---------------------------------------------------------
+      HookData* GetHookData (lua_State* ls, bool create)
+      {
+         if (!create && lua_gethook (ls) != LuaHook)
+            return 0;
+
+         lua_getfield (ls, LUA_REGISTRYINDEX, "__Diluculum__Hook_Data");
+         HookData* data = static_cast<HookData*>(lua_touserdata (ls, -1));
+         lua_pop (ls, 1);
+
+         if (data == 0 && create)
+         {
+            data = static_cast<HookData*>(
+               lua_newuserdata (ls, sizeof (HookData)));
+            new (data) HookData();
+            lua_setfield (ls, LUA_REGISTRYINDEX, "__Diluculum__Hook_Data");
+         }
+
+         return data;
+      }
+
+
+
+      // - HookInterval --------------------------------------------------------
+      int HookInterval (const HookData* data)
+      {
+         int interval = 0;
+
+         if (data->limits.enabled)
+            interval = data->limits.checkInterval;
+
+         if (data->profiler != 0
+             && (interval == 0 || data->profiler->sampleInterval() < interval))
+         {
+            interval = data->profiler->sampleInterval();
+         }
+
+         return interval;
+      }
+
+
+
+      // - UpdateHook ----------------------------------------------------------
+      void UpdateHook (lua_State* ls, HookData* data)
+      {
+         const int interval = HookInterval (data);
+
+         if (interval > 0)
+            lua_sethook (ls, LuaHook, LUA_MASKCOUNT, interval);
+         else if (lua_gethook (ls) == LuaHook)
+            lua_sethook (ls, 0, 0, 0);
+      }
+
+
+
+      // - GetExecutionLimits --------------------------------------------------
+      ExecutionLimits* GetExecutionLimits (lua_State* ls)
+      {
+         HookData* data = GetHookData (ls);
+         if (data == 0 || !data->limits.enabled)
+            return 0;
+         else
+            return &data->limits;
+      }
+
+
+
+      // - ExecutionLimitsScope::ExecutionLimitsScope --------------------------
+      ExecutionLimitsScope::ExecutionLimitsScope (lua_State* ls)
+         : ls_(ls), data_(GetHookData (ls)), limits_(0)
+      {
+         if (data_ == 0 || !data_->limits.enabled)
+            return;
+
+         limits_ = &data_->limits;
+
+         if (limits_->depth == 0)
+         {
+            limits_->executed = 0;
+            limits_->exceeded = false;
+            limits_->deadline =
+               std::chrono::steady_clock::now() + limits_->maxDuration;
+         }
+
+         ++limits_->depth;
+      }
+
+
+
+      // - ExecutionLimitsScope::~ExecutionLimitsScope -------------------------
+      ExecutionLimitsScope::~ExecutionLimitsScope()
+      {
+         if (limits_ == 0)
+            return;
+
+         if (--limits_->depth == 0 && limits_->exceeded)
+         {
+            UpdateHook (ls_, data_);
+
+            // Restore the hook of all threads that exceeded the limits, which
+            // are not necessarily 'ls_' (they may be coroutines)
+            lua_getfield (ls_, LUA_REGISTRYINDEX, TrippedThreadsField);
+            if (lua_istable (ls_, -1))
+            {
+               lua_pushnil (ls_);
+               while (lua_next (ls_, -2) != 0)
+               {
+                  lua_pop (ls_, 1);
+                  UpdateHook (lua_tothread (ls_, -1), data_);
+               }
+               lua_pushnil (ls_);
+               lua_setfield (ls_, LUA_REGISTRYINDEX, TrippedThreadsField);
+            }
+            lua_pop (ls_, 1);
+         }
+      }
+
+
+
+      // - RunningMetrics ------------------------------------------------------
+      std::atomic<int> RunningMetrics (0);
+
+
+
+      // - GetRunningMetrics ---------------------------------------------------
+      LuaMetrics* GetRunningMetrics (lua_State* ls)
+      {
+         lua_getfield (ls, LUA_REGISTRYINDEX, MetricsField);
+         LuaMetrics* metrics = static_cast<LuaMetrics*>(lua_touserdata (ls, -1));
+         lua_pop (ls, 1);
+         return metrics;
+      }
+
+
+
+      // - SetMetrics ----------------------------------------------------------
+      void SetMetrics (lua_State* ls, LuaMetrics* metrics)
+      {
+         const bool wasSet = GetRunningMetrics (ls) != 0;
+
+         if (metrics != 0)
+            lua_pushlightuserdata (ls, metrics);
+         else
+            lua_pushnil (ls);
+         lua_setfield (ls, LUA_REGISTRYINDEX, MetricsField);
+
+         if (metrics != 0 && !wasSet)
+            ++RunningMetrics;
+         else if (metrics == 0 && wasSet)
+            --RunningMetrics;
+      }
+
    } // namespace Impl
 
 } // namespace Diluculum
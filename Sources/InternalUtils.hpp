@@ -27,6 +27,11 @@
 #ifndef _DILUCULUM_INTERNAL_UTILS_HPP_
 #define _DILUCULUM_INTERNAL_UTILS_HPP_
 
+#include <atomic>
+#include <chrono>
+#include <Diluculum/LuaMetrics.hpp>
+#include <Diluculum/LuaProfiler.hpp>
+#include <Diluculum/LuaResult.hpp>
 #include <Diluculum/LuaState.hpp>
 
 
@@ -42,6 +47,26 @@ namespace Diluculum
        */
       LuaValueList CallFunctionOnTop (lua_State* ls, const LuaValueList& params);
 
+      /** Just like the other \c CallFunctionOnTop(), but stores the values
+       *  returned by the called function in \c results (which is cleared
+       *  first, but keeps its capacity). Used to avoid allocations when the
+       *  same buffer is used for many calls.
+       */
+      void CallFunctionOnTop (lua_State* ls, const LuaValueList& params,
+                              LuaValueList& results);
+
+      /** Just like the other \c CallFunctionOnTop(), but reports errors
+       *  through \c result instead of throwing exceptions. The return values
+       *  are stored in <tt>result.values()</tt>. Parameters or return values
+       *  of types not supported by \c LuaValue are reported with the
+       *  \c LUA_ERRRUN status. (Unlike the other versions, this does not
+       *  check whether the value on the top is a function; if not, the call
+       *  fails like any other call error.) Either way, the function is
+       *  removed from the stack.
+       */
+      void CallFunctionOnTop (lua_State* ls, const LuaValueList& params,
+                              LuaResult& result);
+
       /** Throws an exception if the status code passed as parameter corresponds
        *  to an error code from a function from the Lua API.  The exception
        *  thrown is of the proper type, that is, of the subclass of \c LuaError
@@ -56,6 +81,9 @@ namespace Diluculum
        *         status code being tested was called. This is used just to get a
        *         nice error message, if an error did actually happen.
        *  @throw LuaRunTimeError If <tt>retCode == LUA_ERRRUN</tt>.
+       *  @throw LuaExecutionLimitError If <tt>retCode == LUA_ERRRUN</tt> and
+       *         the error was raised because the running call exceeded the
+       *         limits set with \c LuaState::setExecutionLimits().
        *  @throw LuaFileError If <tt>retCode == LUA_ERRFILE</tt>.
        *  @throw LuaRunTimeError If <tt>retCode == LUA_ERRRUN</tt>.
        *  @throw LuaSyntaxError If <tt>retCode == LUA_ERRSYNTAX</tt>.
@@ -64,6 +92,18 @@ namespace Diluculum
        */
       void ThrowOnLuaError (lua_State* ls, int statusCode);
 
+      /** Calls \c lua_pcall() honoring the execution limits of \c ls. If
+       *  the call fails, the error is stored in \c result (and the error
+       *  message is popped from the stack). Returns the status code
+       *  returned by \c lua_pcall(). This is the code path shared by the
+       *  throwing and the non-throwing ways to run Lua code.
+       *  @param name The name of the function being called, used by
+       *         \c LuaMetrics. If null, a name is made up from where the
+       *         function was defined (only if metrics are being gathered).
+       */
+      int ProtectedCall (lua_State* ls, int numArgs, int numResults,
+                         LuaResult& result, const char* name = 0);
+
       /** The \c lua_Writer used in the calls to \c lua_dump() when converting a
        * function implemented in Lua to a \c LuaFunction.
        */
@@ -75,9 +115,153 @@ namespace Diluculum
        */
       const char* LuaFunctionReader(lua_State* luaState, void* func,
                                     size_t* size);
+
+      /** Pushes onto the stack the table (stored in the registry) mapping
+       *  the Lua threads running calls started by \c LuaState::callAsync()
+       *  to the call identifiers. The table is created if necessary. Its
+       *  keys are weak; the threads are kept alive by registry references
+       *  owned by the \c LuaState.
+       */
+      void PushAsyncCallsTable (lua_State* ls);
+
+      /** The limits set with \c LuaState::setExecutionLimits(), along with
+       *  the accounting for the call currently running.
+       */
+      struct ExecutionLimits
+      {
+         /// Are the limits enforced?
+         bool enabled;
+
+         /// Maximum number of VM instructions per call (zero means no limit).
+         unsigned long maxInstructions;
+
+         /// Maximum duration of a call (zero means no limit).
+         std::chrono::steady_clock::duration maxDuration;
+
+         /// Number of instructions between two checks of the limits.
+         int checkInterval;
+
+         /// Nesting depth of the limited calls currently running.
+         int depth;
+
+         /// Instructions executed so far by the current call.
+         unsigned long executed;
+
+         /// When the current call must be aborted.
+         std::chrono::steady_clock::time_point deadline;
+
+         /// Has the current call exceeded some limit?
+         bool exceeded;
+
+         /// Describes the limit exceeded (if \c exceeded is \c true).
+         const char* reason;
+      };
+
+      /** Everything used by \c LuaHook(). Lua allows just one hook per Lua
+       *  thread, so the features implemented with hooks share this, which is
+       *  stored as a userdata in the registry of the Lua state.
+       */
+      struct HookData
+      {
+         /// The limits set with \c LuaState::setExecutionLimits().
+         ExecutionLimits limits;
+
+         /// The running profiler, or a null pointer if not profiling.
+         LuaProfiler* profiler;
+      };
+
+      /** The count hook used by Diluculum. It is only installed while some
+       *  feature needs it, so that Lua code runs at full speed otherwise.
+       */
+      void LuaHook (lua_State* ls, lua_Debug* ar);
+
+      /** Returns the \c HookData of a Lua state. If \c LuaHook() is not
+       *  installed, returns a null pointer, unless \c create is \c true (in
+       *  which case the \c HookData is created if necessary).
+       */
+      HookData* GetHookData (lua_State* ls, bool create = false);
+
+      /** Returns the hook count required by the features enabled in \c data
+       *  (the smallest interval required by them), or zero if none of them
+       *  needs the hook.
+       */
+      int HookInterval (const HookData* data);
+
+      /** Installs or removes \c LuaHook() on a Lua thread, according to the
+       *  features enabled in \c data, with the count returned by
+       *  \c HookInterval().
+       */
+      void UpdateHook (lua_State* ls, HookData* data);
+
+      /** Returns the \c ExecutionLimits of a Lua state, or a null pointer if
+       *  no limits are set for it.
+       */
+      ExecutionLimits* GetExecutionLimits (lua_State* ls);
+
+      /// The number of <tt>LuaMetrics</tt>s running (in any Lua state).
+      extern std::atomic<int> RunningMetrics;
+
+      /** Returns the \c LuaMetrics running on \c ls, or a null pointer if
+       *  there is none. This doesn't check \c RunningMetrics; use
+       *  \c GetMetrics() instead.
+       */
+      LuaMetrics* GetRunningMetrics (lua_State* ls);
+
+      /** Returns the \c LuaMetrics running on \c ls, or a null pointer if
+       *  there is none. Very cheap when no \c LuaMetrics is running at all.
+       */
+      inline LuaMetrics* GetMetrics (lua_State* ls)
+      {
+         if (RunningMetrics.load (std::memory_order_relaxed) == 0)
+            return 0;
+         return GetRunningMetrics (ls);
+      }
+
+      /** Sets (or, if \c metrics is null, clears) the \c LuaMetrics running
+       *  on \c ls.
+       */
+      void SetMetrics (lua_State* ls, LuaMetrics* metrics);
+
+      /** Marks the beginning and the end (on destruction) of a call subject to
+       *  the \c ExecutionLimits of a Lua state. The outermost call gets a
+       *  fresh budget; nested calls (like a C++ function calling back into
+       *  Lua) share the budget of the outermost one.
+       */
+      class ExecutionLimitsScope
+      {
+         public:
+            explicit ExecutionLimitsScope (lua_State* ls);
+            ~ExecutionLimitsScope();
+
+         private:
+            lua_State* ls_;
+            HookData* data_;
+            ExecutionLimits* limits_;
+      };
    }
 
 } // namespace Diluculum
 
 
+/** Records something in the \c LuaMetrics running on a Lua state, if any.
+ *  Compiles to nothing unless \c DILUCULUM_ENABLE_METRICS is defined.
+ *  @param LS The <tt>lua_State*</tt>.
+ *  @param CALL A call to one of the \c LuaMetrics recording methods, like
+ *         <tt>recordToLua (size)</tt>.
+ */
+#ifdef DILUCULUM_ENABLE_METRICS
+#  define DILUCULUM_METRICS(LS, CALL)                                         \
+      do                                                                      \
+      {                                                                       \
+         if (::Diluculum::LuaMetrics* diluculumMetrics =                      \
+                ::Diluculum::Impl::GetMetrics (LS))                           \
+         {                                                                    \
+            diluculumMetrics->CALL;                                           \
+         }                                                                    \
+      } while (false)
+#else
+#  define DILUCULUM_METRICS(LS, CALL) do { } while (false)
+#endif
+
+
 #endif // _DILUCULUM_INTERNAL_UTILS_HPP_
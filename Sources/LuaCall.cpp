@@ -0,0 +1,54 @@
+/******************************************************************************\
+* LuaCall.cpp                                                                  *
+* Typed calls to Lua functions.                                                *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#include <Diluculum/LuaCall.hpp>
+#include "InternalUtils.hpp"
+
+
+namespace Diluculum
+{
+   namespace Impl
+   {
+      // - CallOnStack ---------------------------------------------------------
+      void CallOnStack (lua_State* ls, int numArgs, int numResults,
+                        const char* name)
+      {
+         if (lua_type (ls, -numArgs - 1) != LUA_TFUNCTION)
+         {
+            const TypeMismatchError error (
+               "function", luaL_typename (ls, -numArgs - 1));
+            lua_pop (ls, numArgs + 1);
+            throw error;
+         }
+
+         LuaResult result;
+         ProtectedCall (ls, numArgs, numResults, result, name);
+         result.throwIfError();
+      }
+   }
+
+} // namespace Diluculum
@@ -0,0 +1,301 @@
+/******************************************************************************\
+* LuaExecutor.cpp                                                              *
+* Lua states owned by worker threads, fed through mailboxes.                   *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#include <algorithm>
+#include <memory>
+#include <Diluculum/LuaExecutor.hpp>
+
+
+namespace Diluculum
+{
+   // - LuaExecutor::LuaExecutor -----------------------------------------------
+   LuaExecutor::LuaExecutor (const SetupFunction& setup, bool loadStdLib)
+      : head_(&stub_), tail_(&stub_), pending_(0), sleeping_(false),
+        stopping_(false)
+   {
+      stub_.next = 0;
+
+      std::promise<void> ready;
+      std::future<void> isReady = ready.get_future();
+
+      thread_ = std::thread (&LuaExecutor::run, this, setup, loadStdLib,
+                             std::move (ready));
+
+      try
+      {
+         isReady.get();
+      }
+      catch(...)
+      {
+         thread_.join();
+         throw;
+      }
+   }
+
+
+
+   // - LuaExecutor::~LuaExecutor ----------------------------------------------
+   LuaExecutor::~LuaExecutor()
+   {
+      {
+         std::lock_guard<std::mutex> lock (mutex_);
+         stopping_ = true;
+         wakeUp_.notify_one();
+      }
+
+      thread_.join();
+   }
+
+
+
+   // - LuaExecutor::post ------------------------------------------------------
+   void LuaExecutor::post (const Job& job)
+   {
+      Node* node = new Node();
+      node->job = job;
+      push (node);
+   }
+
+
+
+   // - LuaExecutor::submit ----------------------------------------------------
+   std::future<LuaValueList> LuaExecutor::submit (const LuaFunction& func,
+                                                  const LuaValueList& params)
+   {
+      std::shared_ptr<std::promise<LuaValueList> > promise(
+         new std::promise<LuaValueList>());
+
+      std::future<LuaValueList> ret = promise->get_future();
+
+      LuaFunction f (func); // non-const, as required by 'LuaState::call()'
+
+      post ([promise, f, params] (LuaState& ls) mutable {
+         try
+         {
+            promise->set_value (ls.call (f, params));
+         }
+         catch(...)
+         {
+            promise->set_exception (std::current_exception());
+         }
+      });
+
+      return ret;
+   }
+
+
+
+   // - LuaExecutor::submitGlobal ----------------------------------------------
+   std::future<LuaValueList> LuaExecutor::submitGlobal(
+      const std::string& funcName, const LuaValueList& params)
+   {
+      std::shared_ptr<std::promise<LuaValueList> > promise(
+         new std::promise<LuaValueList>());
+
+      std::future<LuaValueList> ret = promise->get_future();
+
+      post ([promise, funcName, params] (LuaState& ls) {
+         try
+         {
+            promise->set_value (ls[funcName](params));
+         }
+         catch(...)
+         {
+            promise->set_exception (std::current_exception());
+         }
+      });
+
+      return ret;
+   }
+
+
+
+   // - LuaExecutor::push ------------------------------------------------------
+   void LuaExecutor::push (Node* node)
+   {
+      // Count the node before linking it, so that the consumer (which may
+      // pop and run it right away) never sees the count go below zero
+      if (node != &stub_)
+         pending_.fetch_add (1);
+
+      node->next.store (0, std::memory_order_relaxed);
+      Node* prev = head_.exchange (node, std::memory_order_acq_rel);
+      prev->next.store (node, std::memory_order_release);
+
+      if (node == &stub_)
+         return;
+
+      if (sleeping_.load())
+      {
+         std::lock_guard<std::mutex> lock (mutex_);
+         wakeUp_.notify_one();
+      }
+   }
+
+
+
+   // - LuaExecutor::pop -------------------------------------------------------
+   LuaExecutor::Node* LuaExecutor::pop()
+   {
+      Node* tail = tail_;
+      Node* next = tail->next.load (std::memory_order_acquire);
+
+      if (tail == &stub_)
+      {
+         if (next == 0)
+            return 0;
+         tail_ = next;
+         tail = next;
+         next = next->next.load (std::memory_order_acquire);
+      }
+
+      if (next != 0)
+      {
+         tail_ = next;
+         return tail;
+      }
+
+      if (tail != head_.load (std::memory_order_acquire))
+         return 0; // a producer is in the middle of a push()
+
+      push (&stub_);
+
+      next = tail->next.load (std::memory_order_acquire);
+      if (next != 0)
+      {
+         tail_ = next;
+         return tail;
+      }
+
+      return 0;
+   }
+
+
+
+   // - LuaExecutor::run -------------------------------------------------------
+   void LuaExecutor::run (const SetupFunction& setup, bool loadStdLib,
+                          std::promise<void> ready)
+   {
+      std::unique_ptr<LuaState> ls;
+
+      try
+      {
+         ls.reset (new LuaState (loadStdLib));
+         if (setup)
+            setup (*ls);
+      }
+      catch(...)
+      {
+         ready.set_exception (std::current_exception());
+         return;
+      }
+
+      ready.set_value();
+
+      while (true)
+      {
+         Node* node = pop();
+
+         if (node != 0)
+         {
+            try
+            {
+               node->job (*ls);
+            }
+            catch(...)
+            {
+               // Nobody to report to; 'submit()'ed jobs never throw.
+            }
+
+            delete node;
+            pending_.fetch_sub (1);
+            continue;
+         }
+
+         if (pending_.load() > 0)
+         {
+            // A push() is halfway done; it will be complete soon
+            std::this_thread::yield();
+            continue;
+         }
+
+         if (stopping_.load())
+            break;
+
+         sleeping_ = true;
+         {
+            std::unique_lock<std::mutex> lock (mutex_);
+            while (pending_.load() == 0 && !stopping_.load())
+               wakeUp_.wait (lock);
+         }
+         sleeping_ = false;
+      }
+   }
+
+
+
+   // - LuaExecutorGroup::LuaExecutorGroup -------------------------------------
+   LuaExecutorGroup::LuaExecutorGroup (std::size_t size,
+                                       const LuaExecutor::SetupFunction& setup,
+                                       bool loadStdLib)
+      : nextExecutor_(0)
+   {
+      if (size == 0)
+         size = std::max (1u, std::thread::hardware_concurrency());
+
+      try
+      {
+         for (std::size_t i = 0; i < size; ++i)
+            executors_.push_back (new LuaExecutor (setup, loadStdLib));
+      }
+      catch(...)
+      {
+         for (std::size_t i = 0; i < executors_.size(); ++i)
+            delete executors_[i];
+         throw;
+      }
+   }
+
+
+
+   // - LuaExecutorGroup::~LuaExecutorGroup ------------------------------------
+   LuaExecutorGroup::~LuaExecutorGroup()
+   {
+      for (std::size_t i = 0; i < executors_.size(); ++i)
+         delete executors_[i];
+   }
+
+
+
+   // - LuaExecutorGroup::next -------------------------------------------------
+   LuaExecutor& LuaExecutorGroup::next()
+   {
+      const std::size_t i =
+         nextExecutor_.fetch_add (1, std::memory_order_relaxed);
+      return *executors_[i % executors_.size()];
+   }
+
+} // namespace Diluculum
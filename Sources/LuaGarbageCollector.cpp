@@ -0,0 +1,159 @@
+/******************************************************************************\
+* LuaGarbageCollector.cpp                                                      *
+* Control over the garbage collector of a Lua state.                           *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#include <algorithm>
+#include <chrono>
+#include <Diluculum/LuaGarbageCollector.hpp>
+#include <Diluculum/LuaState.hpp>
+
+
+namespace Diluculum
+{
+   // - LuaGarbageCollector::LuaGarbageCollector -------------------------------
+   LuaGarbageCollector::LuaGarbageCollector (LuaState& ls)
+      : state_(ls.getState()), automatic_(true)
+   {
+      resetStats();
+   }
+
+
+
+   // - LuaGarbageCollector::stopAutomatic -------------------------------------
+   void LuaGarbageCollector::stopAutomatic()
+   {
+      lua_gc (state_, LUA_GCSTOP, 0);
+      automatic_ = false;
+   }
+
+
+
+   // - LuaGarbageCollector::restartAutomatic ----------------------------------
+   void LuaGarbageCollector::restartAutomatic()
+   {
+      lua_gc (state_, LUA_GCRESTART, 0);
+      automatic_ = true;
+   }
+
+
+
+   // - LuaGarbageCollector::setPause ------------------------------------------
+   int LuaGarbageCollector::setPause (int pause)
+   {
+      return lua_gc (state_, LUA_GCSETPAUSE, pause);
+   }
+
+
+
+   // - LuaGarbageCollector::setStepMultiplier ---------------------------------
+   int LuaGarbageCollector::setStepMultiplier (int stepMul)
+   {
+      return lua_gc (state_, LUA_GCSETSTEPMUL, stepMul);
+   }
+
+
+
+   // - LuaGarbageCollector::step ----------------------------------------------
+   bool LuaGarbageCollector::step (double budget, int stepSize)
+   {
+      typedef std::chrono::steady_clock clock;
+      typedef std::chrono::duration<double> seconds;
+
+      const clock::time_point start = clock::now();
+      bool cycleFinished = false;
+
+      do
+      {
+         const std::size_t memoryBefore = memoryInUse();
+         const clock::time_point stepStart = clock::now();
+
+         cycleFinished = lua_gc (state_, LUA_GCSTEP, stepSize) != 0;
+
+         const double stepTime = seconds (clock::now() - stepStart).count();
+         const std::size_t memoryAfter = memoryInUse();
+
+         // (Finalizers may allocate memory, so this may look like a growth.)
+         if (memoryAfter < memoryBefore)
+            stats_.collectedBytes += memoryBefore - memoryAfter;
+
+         ++stats_.steps;
+         stats_.totalStepTime += stepTime;
+         stats_.maxStepTime = std::max (stats_.maxStepTime, stepTime);
+         stats_.lastStepTime = stepTime;
+
+         if (cycleFinished)
+            ++stats_.cycles;
+      }
+      while (!cycleFinished && seconds (clock::now() - start).count() < budget);
+
+      keepStopped();
+
+      return cycleFinished;
+   }
+
+
+
+   // - LuaGarbageCollector::collect -------------------------------------------
+   void LuaGarbageCollector::collect()
+   {
+      lua_gc (state_, LUA_GCCOLLECT, 0);
+      keepStopped();
+   }
+
+
+
+   // - LuaGarbageCollector::keepStopped --------------------------------------
+   void LuaGarbageCollector::keepStopped()
+   {
+      // In Lua 5.1, 'LUA_GCSTEP' and 'LUA_GCCOLLECT' reset the collector
+      // threshold, which silently restarts the automatic collector
+      if (!automatic_)
+         lua_gc (state_, LUA_GCSTOP, 0);
+   }
+
+
+
+   // - LuaGarbageCollector::memoryInUse ---------------------------------------
+   std::size_t LuaGarbageCollector::memoryInUse() const
+   {
+      return static_cast<std::size_t>(lua_gc (state_, LUA_GCCOUNT, 0)) * 1024
+         + lua_gc (state_, LUA_GCCOUNTB, 0);
+   }
+
+
+
+   // - LuaGarbageCollector::resetStats ----------------------------------------
+   void LuaGarbageCollector::resetStats()
+   {
+      stats_.steps = 0;
+      stats_.cycles = 0;
+      stats_.collectedBytes = 0;
+      stats_.totalStepTime = 0.0;
+      stats_.maxStepTime = 0.0;
+      stats_.lastStepTime = 0.0;
+   }
+
+} // namespace Diluculum
@@ -0,0 +1,409 @@
+/******************************************************************************\
+* LuaMetrics.cpp                                                               *
+* Metrics about the crossings of the C++/Lua boundary.                         *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <Diluculum/LuaExceptions.hpp>
+#include <Diluculum/LuaMetrics.hpp>
+#include <Diluculum/LuaState.hpp>
+#include "InternalUtils.hpp"
+
+
+namespace
+{
+   /// Converts a number of nanoseconds to seconds.
+   double Seconds (unsigned long long nanoseconds)
+   {
+      return nanoseconds / 1e9;
+   }
+
+
+
+   /// Escapes a string for use as a label value in the Prometheus format.
+   std::string EscapeLabel (const std::string& value)
+   {
+      std::string ret;
+      ret.reserve (value.size());
+
+      for (std::string::const_iterator p = value.begin(); p != value.end(); ++p)
+      {
+         switch (*p)
+         {
+            case '\\': ret += "\\\\"; break;
+            case '"':  ret += "\\\""; break;
+            case '\n': ret += "\\n"; break;
+            default:   ret += *p;
+         }
+      }
+
+      return ret;
+   }
+
+
+
+   /// Writes a counter in the Prometheus format.
+   void WriteCounter (std::ostream& out, const std::string& prefix,
+                      const std::string& labels, const char* name,
+                      const char* help, unsigned long long value)
+   {
+      out << "# HELP " << prefix << '_' << name << ' ' << help << '\n'
+          << "# TYPE " << prefix << '_' << name << " counter\n"
+          << prefix << '_' << name;
+      if (!labels.empty())
+         out << '{' << labels << '}';
+      out << ' ' << value << '\n';
+   }
+
+} // (anonymous) namespace
+
+
+
+namespace Diluculum
+{
+   // - LuaMetrics::Histogram::Histogram ---------------------------------------
+   LuaMetrics::Histogram::Histogram()
+      : buckets_(NumBuckets, 0), count_(0), total_(0), min_(0), max_(0)
+   { }
+
+
+
+   // - LuaMetrics::Histogram::record ------------------------------------------
+   void LuaMetrics::Histogram::record (unsigned long long nanoseconds)
+   {
+      ++buckets_[bucketIndex (nanoseconds)];
+
+      if (count_ == 0 || nanoseconds < min_)
+         min_ = nanoseconds;
+      if (nanoseconds > max_)
+         max_ = nanoseconds;
+
+      ++count_;
+      total_ += nanoseconds;
+   }
+
+
+
+   // - LuaMetrics::Histogram::percentile --------------------------------------
+   unsigned long long LuaMetrics::Histogram::percentile (double q) const
+   {
+      if (count_ == 0)
+         return 0;
+
+      const double clamped = std::min (std::max (q, 0.0), 1.0);
+      const unsigned long long target = std::max (
+         1ULL, static_cast<unsigned long long>(std::ceil (clamped * count_)));
+
+      unsigned long long accumulated = 0;
+      for (int i = 0; i < NumBuckets; ++i)
+      {
+         accumulated += buckets_[i];
+         if (accumulated >= target)
+            return std::min (bucketUpperBound (i), max_);
+      }
+
+      return max_;
+   }
+
+
+
+   // - LuaMetrics::Histogram::merge -------------------------------------------
+   void LuaMetrics::Histogram::merge (const Histogram& other)
+   {
+      if (other.count_ == 0)
+         return;
+
+      for (int i = 0; i < NumBuckets; ++i)
+         buckets_[i] += other.buckets_[i];
+
+      if (count_ == 0 || other.min_ < min_)
+         min_ = other.min_;
+      max_ = std::max (max_, other.max_);
+      count_ += other.count_;
+      total_ += other.total_;
+   }
+
+
+
+   // - LuaMetrics::Histogram::reset -------------------------------------------
+   void LuaMetrics::Histogram::reset()
+   {
+      std::fill (buckets_.begin(), buckets_.end(), 0);
+      count_ = 0;
+      total_ = 0;
+      min_ = 0;
+      max_ = 0;
+   }
+
+
+
+   // - LuaMetrics::Histogram::bucketIndex -------------------------------------
+   int LuaMetrics::Histogram::bucketIndex (unsigned long long value)
+   {
+      // Values below 'SubBuckets' have buckets of their own. Above that, each
+      // power of two is divided into 'SubBuckets' buckets of equal width.
+      if (value < static_cast<unsigned long long>(SubBuckets))
+         return static_cast<int>(value);
+
+      int exponent = 4; // log2 (SubBuckets)
+      while ((value >> (exponent + 1)) != 0)
+         ++exponent;
+
+      const int index = (exponent - 3) * SubBuckets
+         + static_cast<int>((value >> (exponent - 4)) - SubBuckets);
+
+      return std::min (index, NumBuckets - 1);
+   }
+
+
+
+   // - LuaMetrics::Histogram::bucketUpperBound --------------------------------
+   unsigned long long LuaMetrics::Histogram::bucketUpperBound (int index)
+   {
+      if (index < SubBuckets)
+         return index;
+
+      const int exponent = index / SubBuckets + 3;
+      const unsigned long long sub = index % SubBuckets;
+
+      return ((SubBuckets + sub + 1) << (exponent - 4)) - 1;
+   }
+
+
+
+   // - LuaMetrics::LuaMetrics -------------------------------------------------
+   LuaMetrics::LuaMetrics (LuaState& ls)
+      : state_(ls.getState()), running_(false)
+   {
+      reset();
+   }
+
+
+
+   // - LuaMetrics::~LuaMetrics ------------------------------------------------
+   LuaMetrics::~LuaMetrics()
+   {
+      stop();
+   }
+
+
+
+   // - LuaMetrics::compiledIn -------------------------------------------------
+   bool LuaMetrics::compiledIn()
+   {
+#ifdef DILUCULUM_ENABLE_METRICS
+      return true;
+#else
+      return false;
+#endif
+   }
+
+
+
+   // - LuaMetrics::start ------------------------------------------------------
+   void LuaMetrics::start()
+   {
+      if (running_)
+         return;
+
+      if (state_ == 0)
+         throw LuaError ("The observed 'LuaState' was destroyed.");
+
+      if (Impl::GetMetrics (state_) != 0)
+         throw LuaError ("Another 'LuaMetrics' is running on this state.");
+
+      Impl::SetMetrics (state_, this);
+      running_ = true;
+   }
+
+
+
+   // - LuaMetrics::stop -------------------------------------------------------
+   void LuaMetrics::stop()
+   {
+      if (!running_)
+         return;
+
+      Impl::SetMetrics (state_, 0);
+      running_ = false;
+   }
+
+
+
+   // - LuaMetrics::detach -----------------------------------------------------
+   void LuaMetrics::detach()
+   {
+      stop();
+      state_ = 0;
+   }
+
+
+
+   // - LuaMetrics::reset ------------------------------------------------------
+   void LuaMetrics::reset()
+   {
+      counters_ = Snapshot(); // value-initialized, so all counters are zero
+      functions_.clear();
+   }
+
+
+
+   // - LuaMetrics::snapshot ---------------------------------------------------
+   LuaMetrics::Snapshot LuaMetrics::snapshot() const
+   {
+      Snapshot ret = counters_;
+      ret.functions.reserve (functions_.size());
+
+      typedef std::map<std::string, FunctionData>::const_iterator iter_t;
+      for (iter_t p = functions_.begin(); p != functions_.end(); ++p)
+      {
+         const Histogram& h = p->second.latency;
+
+         FunctionStats stats;
+         stats.name = p->first;
+         stats.calls = h.count();
+         stats.errors = p->second.errors;
+         stats.totalTime = Seconds (h.total());
+         stats.minTime = Seconds (h.min());
+         stats.maxTime = Seconds (h.max());
+         stats.p50 = Seconds (h.percentile (0.5));
+         stats.p90 = Seconds (h.percentile (0.9));
+         stats.p99 = Seconds (h.percentile (0.99));
+         stats.p999 = Seconds (h.percentile (0.999));
+
+         ret.functions.push_back (stats);
+      }
+
+      return ret;
+   }
+
+
+
+   // - LuaMetrics::histogram --------------------------------------------------
+   const LuaMetrics::Histogram* LuaMetrics::histogram (
+      const std::string& name) const
+   {
+      std::map<std::string, FunctionData>::const_iterator p =
+         functions_.find (name);
+
+      return p != functions_.end() ? &p->second.latency : 0;
+   }
+
+
+
+   // - LuaMetrics::prometheusText ---------------------------------------------
+   std::string LuaMetrics::prometheusText (const std::string& prefix,
+                                           const std::string& labels) const
+   {
+      std::ostringstream out;
+      out << std::setprecision (9);
+
+      WriteCounter (out, prefix, labels, "calls_total",
+                    "Calls from C++ into Lua.", counters_.calls);
+      WriteCounter (out, prefix, labels, "call_errors_total",
+                    "Calls from C++ into Lua that failed.",
+                    counters_.callErrors);
+      WriteCounter (out, prefix, labels, "variable_reads_total",
+                    "Values read through LuaVariables.",
+                    counters_.variableReads);
+      WriteCounter (out, prefix, labels, "variable_writes_total",
+                    "Values written through LuaVariables.",
+                    counters_.variableWrites);
+      WriteCounter (out, prefix, labels, "values_to_lua_total",
+                    "Values converted from C++ to Lua.",
+                    counters_.valuesToLua);
+      WriteCounter (out, prefix, labels, "values_from_lua_total",
+                    "Values converted from Lua to C++.",
+                    counters_.valuesFromLua);
+      WriteCounter (out, prefix, labels, "bytes_to_lua_total",
+                    "Bytes converted from C++ to Lua.",
+                    counters_.bytesToLua);
+      WriteCounter (out, prefix, labels, "bytes_from_lua_total",
+                    "Bytes converted from Lua to C++.",
+                    counters_.bytesFromLua);
+      WriteCounter (out, prefix, labels, "tables_created_total",
+                    "Lua tables created when converting values to Lua.",
+                    counters_.tablesCreated);
+      WriteCounter (out, prefix, labels, "tables_converted_total",
+                    "Lua tables converted to C++.",
+                    counters_.tablesConverted);
+
+      if (functions_.empty())
+         return out.str();
+
+      const std::string name = prefix + "_call_duration_seconds";
+      const std::string extraLabels = labels.empty() ? "" : labels + ",";
+
+      out << "# HELP " << name
+          << " Duration of calls from C++ into Lua, per function.\n"
+          << "# TYPE " << name << " summary\n";
+
+      static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+      typedef std::map<std::string, FunctionData>::const_iterator iter_t;
+      for (iter_t p = functions_.begin(); p != functions_.end(); ++p)
+      {
+         const Histogram& h = p->second.latency;
+         const std::string functionLabel =
+            extraLabels + "function=\"" + EscapeLabel (p->first) + "\"";
+
+         for (std::size_t i = 0; i < sizeof(quantiles)/sizeof(*quantiles); ++i)
+         {
+            out << name << '{' << functionLabel << ",quantile=\""
+                << quantiles[i] << "\"} "
+                << Seconds (h.percentile (quantiles[i])) << '\n';
+         }
+
+         out << name << "_sum{" << functionLabel << "} "
+             << Seconds (h.total()) << '\n'
+             << name << "_count{" << functionLabel << "} "
+             << h.count() << '\n';
+      }
+
+      return out.str();
+   }
+
+
+
+   // - LuaMetrics::recordCall -------------------------------------------------
+   void LuaMetrics::recordCall (const std::string& name,
+                                unsigned long long nanoseconds, bool failed)
+   {
+      FunctionData& data = functions_[name];
+      data.latency.record (nanoseconds);
+
+      ++counters_.calls;
+
+      if (failed)
+      {
+         ++data.errors;
+         ++counters_.callErrors;
+      }
+   }
+
+} // namespace Diluculum
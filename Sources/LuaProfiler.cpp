@@ -0,0 +1,369 @@
+/******************************************************************************\
+* LuaProfiler.cpp                                                              *
+* A sampling profiler for Lua code.                                            *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <boost/lexical_cast.hpp>
+#include <Diluculum/LuaProfiler.hpp>
+#include <Diluculum/LuaState.hpp>
+#include "InternalUtils.hpp"
+
+
+namespace
+{
+   /** Copies the C string \c src (which may be a null pointer, taken as an
+    *  empty string) to the buffer \c dst, of size \c size, truncating it if
+    *  necessary.
+    */
+   void CopyString (char* dst, const char* src, std::size_t size)
+   {
+      if (src == 0)
+         src = "";
+
+      std::strncpy (dst, src, size - 1);
+      dst[size - 1] = '\0';
+   }
+
+
+
+   /** Returns the name used to represent a stack frame in folded stacks.
+    *  Semicolons (used as frame separators) are replaced by colons.
+    */
+   template <typename Frame>
+   std::string FrameName (const Frame& frame)
+   {
+      const std::string funcName = frame.name[0] != '\0' ? frame.name : "?";
+      std::string name;
+
+      if (std::strcmp (frame.what, "C") == 0)
+      {
+         name = funcName + " [C]";
+      }
+      else if (std::strcmp (frame.what, "main") == 0)
+      {
+         name = std::string ("main chunk (") + frame.source + ")";
+      }
+      else
+      {
+         name = funcName + " (" + frame.source + ":"
+            + boost::lexical_cast<std::string> (frame.lineDefined) + ")";
+      }
+
+      std::replace (name.begin(), name.end(), ';', ':');
+
+      return name;
+   }
+
+
+
+   /// Sorts \c LuaProfiler::Entry objects by decreasing number of samples.
+   bool MoreSamples (const Diluculum::LuaProfiler::Entry& a,
+                     const Diluculum::LuaProfiler::Entry& b)
+   {
+      if (a.samples != b.samples)
+         return a.samples > b.samples;
+      else
+         return a.location < b.location;
+   }
+
+} // (anonymous) namespace
+
+
+
+namespace Diluculum
+{
+   // - LuaProfiler::LuaProfiler -----------------------------------------------
+   LuaProfiler::LuaProfiler (LuaState& ls, int sampleInterval, int maxDepth)
+      : state_(ls.getState()), sampleInterval_(sampleInterval),
+        maxDepth_(maxDepth), running_(false), instructions_(0), samples_(0),
+        droppedSamples_(0)
+   {
+      if (sampleInterval_ <= 0)
+         throw LuaError ("The sample interval must be positive.");
+
+      if (maxDepth_ <= 0)
+         throw LuaError ("The maximum stack depth must be positive.");
+
+      // Samples are buffered by the hook, which must not allocate memory.
+      // (Every sample has at least one frame.)
+      frames_.reserve (maxDepth_ > BufferedFrames ? maxDepth_ : BufferedFrames);
+      depths_.reserve (frames_.capacity());
+   }
+
+
+
+   // - LuaProfiler::~LuaProfiler ----------------------------------------------
+   LuaProfiler::~LuaProfiler()
+   {
+      removeHook();
+   }
+
+
+
+   // - LuaProfiler::start -----------------------------------------------------
+   void LuaProfiler::start()
+   {
+      if (running_)
+         return;
+
+      if (state_ == 0)
+         throw LuaError ("The profiled 'LuaState' was destroyed.");
+
+      Impl::HookData* data = Impl::GetHookData (state_, true);
+
+      if (data->profiler != 0)
+         throw LuaError ("Another profiler is already running on this state.");
+
+      data->profiler = this;
+      instructions_ = 0;
+      running_ = true;
+
+      Impl::UpdateHook (state_, data);
+   }
+
+
+
+   // - LuaProfiler::stop ------------------------------------------------------
+   void LuaProfiler::stop()
+   {
+      if (!running_)
+         return;
+
+      removeHook();
+      aggregate();
+   }
+
+
+
+   // - LuaProfiler::setSampleInterval -----------------------------------------
+   void LuaProfiler::setSampleInterval (int sampleInterval)
+   {
+      if (sampleInterval <= 0)
+         throw LuaError ("The sample interval must be positive.");
+
+      sampleInterval_ = sampleInterval;
+
+      if (running_)
+         Impl::UpdateHook (state_, Impl::GetHookData (state_, true));
+   }
+
+
+
+   // - LuaProfiler::reset -----------------------------------------------------
+   void LuaProfiler::reset()
+   {
+      samples_ = 0;
+      droppedSamples_ = 0;
+      frames_.clear();
+      depths_.clear();
+      stacks_.clear();
+      lines_.clear();
+   }
+
+
+
+   // - LuaProfiler::top -------------------------------------------------------
+   std::vector<LuaProfiler::Entry> LuaProfiler::top (std::size_t n) const
+   {
+      aggregate();
+
+      std::vector<Entry> entries;
+      entries.reserve (lines_.size());
+
+      typedef std::map<std::string, unsigned long>::const_iterator iter_t;
+      for (iter_t p = lines_.begin(); p != lines_.end(); ++p)
+      {
+         Entry entry = { p->first, p->second };
+         entries.push_back (entry);
+      }
+
+      n = std::min (n, entries.size());
+      std::partial_sort (entries.begin(), entries.begin() + n, entries.end(),
+                         MoreSamples);
+      entries.resize (n);
+
+      return entries;
+   }
+
+
+
+   // - LuaProfiler::foldedStacks ----------------------------------------------
+   std::string LuaProfiler::foldedStacks() const
+   {
+      aggregate();
+
+      std::ostringstream out;
+
+      typedef std::map<std::string, unsigned long>::const_iterator iter_t;
+      for (iter_t p = stacks_.begin(); p != stacks_.end(); ++p)
+         out << p->first << ' ' << p->second << '\n';
+
+      return out.str();
+   }
+
+
+
+   // - LuaProfiler::report ----------------------------------------------------
+   std::string LuaProfiler::report (std::size_t n) const
+   {
+      std::ostringstream out;
+
+      out << samples_ << " samples (one every " << sampleInterval_
+          << " instructions)";
+      if (droppedSamples_ > 0)
+         out << ", " << droppedSamples_ << " dropped";
+      out << '\n';
+
+      const std::vector<Entry> entries = top (n);
+      for (std::size_t i = 0; i < entries.size(); ++i)
+      {
+         const double percent = 100.0 * entries[i].samples / samples_;
+         out.width (10);
+         out << entries[i].samples << ' ';
+         out.width (6);
+         out.setf (std::ios::fixed);
+         out.precision (2);
+         out << percent << "%  " << entries[i].location << '\n';
+      }
+
+      return out.str();
+   }
+
+
+
+   // - LuaProfiler::countInstructions -----------------------------------------
+   void LuaProfiler::countInstructions (lua_State* ls, int count)
+   {
+      instructions_ += count;
+      if (instructions_ >= sampleInterval_)
+      {
+         instructions_ = 0;
+         takeSample (ls);
+      }
+   }
+
+
+
+   // - LuaProfiler::takeSample ------------------------------------------------
+   void LuaProfiler::takeSample (lua_State* ls)
+   {
+      const std::size_t firstFrame = frames_.size();
+      lua_Debug ar;
+      int depth = 0;
+
+      for (; depth < maxDepth_ && lua_getstack (ls, depth, &ar); ++depth)
+      {
+         // Aggregating here would allocate memory; drop the sample instead
+         if (frames_.size() == frames_.capacity())
+         {
+            frames_.resize (firstFrame);
+            ++droppedSamples_;
+            return;
+         }
+
+         lua_getinfo (ls, "Snl", &ar);
+
+         Frame frame;
+         CopyString (frame.what, ar.what, sizeof (frame.what));
+         CopyString (frame.name, ar.name, sizeof (frame.name));
+         CopyString (frame.source, ar.short_src, sizeof (frame.source));
+         frame.lineDefined = ar.linedefined;
+         frame.currentLine = ar.currentline;
+         frames_.push_back (frame);
+      }
+
+      if (depth == 0)
+         return;
+
+      ++samples_;
+      depths_.push_back (depth);
+   }
+
+
+
+   // - LuaProfiler::aggregate -------------------------------------------------
+   void LuaProfiler::aggregate() const
+   {
+      std::vector<Frame>::const_iterator frames = frames_.begin();
+
+      for (std::size_t i = 0; i < depths_.size(); ++i)
+      {
+         const int depth = depths_[i];
+
+         std::string stack;
+         for (int f = depth - 1; f >= 0; --f)
+         {
+            if (!stack.empty())
+               stack += ';';
+            stack += FrameName (frames[f]);
+         }
+         ++stacks_[stack];
+
+         for (int f = 0; f < depth; ++f)
+         {
+            if (frames[f].currentLine > 0)
+            {
+               ++lines_[std::string (frames[f].source) + ":"
+                        + boost::lexical_cast<std::string> (
+                           frames[f].currentLine)];
+               break;
+            }
+         }
+
+         frames += depth;
+      }
+
+      frames_.clear();
+      depths_.clear();
+   }
+
+
+
+   // - LuaProfiler::detach ----------------------------------------------------
+   void LuaProfiler::detach()
+   {
+      removeHook();
+      state_ = 0;
+   }
+
+
+
+   // - LuaProfiler::removeHook ------------------------------------------------
+   void LuaProfiler::removeHook()
+   {
+      if (!running_)
+         return;
+
+      running_ = false;
+
+      Impl::HookData* data = Impl::GetHookData (state_, true);
+      data->profiler = 0;
+      Impl::UpdateHook (state_, data);
+   }
+
+} // namespace Diluculum
@@ -0,0 +1,157 @@
+/******************************************************************************\
+* LuaRegistryRef.cpp                                                           *
+* A reference to a value anchored in the Lua registry.                         *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+
+#include <string>
+#include <utility>
+#include <Diluculum/LuaRegistryRef.hpp>
+#include <Diluculum/LuaExceptions.hpp>
+
+
+namespace Diluculum
+{
+   namespace Impl
+   {
+      // - LuaRegistryRef::LuaRegistryRef --------------------------------------
+      LuaRegistryRef::LuaRegistryRef()
+         : state_(0), ref_(LUA_NOREF)
+      { }
+
+
+      LuaRegistryRef::LuaRegistryRef (const LuaVariable& var, int type)
+         : state_(var.state_), ref_(LUA_NOREF)
+      {
+         var.pushTheReferencedValue();
+
+         try
+         {
+            anchor (-1, type);
+         }
+         catch (...)
+         {
+            lua_pop (state_, 1);
+            throw;
+         }
+
+         lua_pop (state_, 1);
+      }
+
+
+      LuaRegistryRef::LuaRegistryRef (lua_State* ls, int index, int type)
+         : state_(ls), ref_(LUA_NOREF)
+      {
+         anchor (index, type);
+      }
+
+
+      LuaRegistryRef::LuaRegistryRef (const LuaRegistryRef& other)
+         : state_(other.state_), ref_(LUA_NOREF)
+      {
+         if (other.isValid())
+         {
+            lua_rawgeti (state_, LUA_REGISTRYINDEX, other.ref_);
+            ref_ = luaL_ref (state_, LUA_REGISTRYINDEX);
+         }
+      }
+
+
+      LuaRegistryRef::LuaRegistryRef (LuaRegistryRef&& other)
+         : state_(other.state_), ref_(other.ref_)
+      {
+         other.ref_ = LUA_NOREF;
+      }
+
+
+
+      // - LuaRegistryRef::~LuaRegistryRef -------------------------------------
+      LuaRegistryRef::~LuaRegistryRef()
+      {
+         reset();
+      }
+
+
+
+      // - LuaRegistryRef::operator= -------------------------------------------
+      LuaRegistryRef& LuaRegistryRef::operator= (const LuaRegistryRef& rhs)
+      {
+         LuaRegistryRef copy (rhs);
+         return *this = std::move (copy);
+      }
+
+
+      LuaRegistryRef& LuaRegistryRef::operator= (LuaRegistryRef&& rhs)
+      {
+         std::swap (state_, rhs.state_);
+         std::swap (ref_, rhs.ref_);
+         return *this;
+      }
+
+
+
+      // - LuaRegistryRef::reset -----------------------------------------------
+      void LuaRegistryRef::reset()
+      {
+         if (isValid())
+         {
+            luaL_unref (state_, LUA_REGISTRYINDEX, ref_);
+            ref_ = LUA_NOREF;
+         }
+      }
+
+
+
+      // - LuaRegistryRef::pushReferenced --------------------------------------
+      void LuaRegistryRef::pushReferenced (const char* className) const
+      {
+         if (!isValid())
+         {
+            const std::string msg =
+               "Tried to use an invalid '" + std::string (className) + "'.";
+            throw LuaError (msg.c_str());
+         }
+
+         lua_rawgeti (state_, LUA_REGISTRYINDEX, ref_);
+      }
+
+
+
+      // - LuaRegistryRef::anchor ----------------------------------------------
+      void LuaRegistryRef::anchor (int index, int type)
+      {
+         if (lua_type (state_, index) != type)
+         {
+            throw TypeMismatchError (lua_typename (state_, type),
+                                     luaL_typename (state_, index));
+         }
+
+         lua_pushvalue (state_, index);
+         ref_ = luaL_ref (state_, LUA_REGISTRYINDEX);
+      }
+
+   } // namespace Impl
+
+} // namespace Diluculum
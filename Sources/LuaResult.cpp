@@ -0,0 +1,101 @@
+/******************************************************************************\
+* LuaResult.cpp                                                                *
+* The outcome of executing some Lua code.                                      *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#include <Diluculum/LuaExceptions.hpp>
+#include <Diluculum/LuaResult.hpp>
+#include "InternalUtils.hpp"
+
+
+namespace Diluculum
+{
+   namespace Impl
+   {
+      // - SetErrorResult ------------------------------------------------------
+      void SetErrorResult (lua_State* ls, int status, LuaResult& result)
+      {
+         result.status_ = status;
+         result.values_.clear();
+
+         if (lua_isstring (ls, -1))
+         {
+            std::size_t length;
+            const char* message = lua_tolstring (ls, -1, &length);
+            result.message_.assign (message, length);
+         }
+         else
+         {
+            result.message_ =
+               "Sorry, there is no additional information about this error.";
+         }
+
+         lua_pop (ls, 1);
+
+         ExecutionLimits* limits = GetExecutionLimits (ls);
+         result.limitExceeded_ = status == LUA_ERRRUN && limits != 0
+            && limits->depth > 0 && limits->exceeded;
+      }
+
+
+
+      void SetErrorResult (LuaResult& result, int status,
+                           const std::string& message)
+      {
+         result.status_ = status;
+         result.values_.clear();
+         result.message_ = message;
+         result.limitExceeded_ = false;
+      }
+   }
+
+
+
+   // - LuaResult::throwIfError ------------------------------------------------
+   void LuaResult::throwIfError() const
+   {
+      switch (status_)
+      {
+         case 0:
+            return;
+         case LUA_ERRRUN:
+            if (limitExceeded_)
+               throw LuaExecutionLimitError (message_.c_str());
+            throw LuaRunTimeError (message_.c_str());
+         case LUA_ERRFILE:
+            throw LuaFileError (message_.c_str());
+         case LUA_ERRSYNTAX:
+            throw LuaSyntaxError (message_.c_str());
+         case LUA_ERRMEM:
+            throw LuaMemoryError (message_.c_str());
+         case LUA_ERRERR:
+            throw LuaErrorError (message_.c_str());
+         default:
+            throw LuaError ("Unknown Lua return code passed "
+                            "to 'Diluculum::LuaResult::throwIfError()'.");
+      }
+   }
+
+} // namespace Diluculum
@@ -26,18 +26,413 @@
 
 #include <cassert>
 #include <cstring>
+#include <memory>
 #include <typeinfo>
+#include <utility>
 #include <boost/lexical_cast.hpp>
 #include <Diluculum/LuaState.hpp>
 #include <Diluculum/LuaUtils.hpp>
 #include "InternalUtils.hpp"
 
 
+namespace
+{
+   /// The Lua standard libraries, in the same order as in \c StdLib.
+   const luaL_Reg StdLibs[] =
+   {
+      { "", luaopen_base },
+      { LUA_LOADLIBNAME, luaopen_package },
+      { LUA_TABLIBNAME, luaopen_table },
+      { LUA_IOLIBNAME, luaopen_io },
+      { LUA_OSLIBNAME, luaopen_os },
+      { LUA_STRLIBNAME, luaopen_string },
+      { LUA_MATHLIBNAME, luaopen_math },
+      { LUA_DBLIBNAME, luaopen_debug },
+      { 0, 0 }
+   };
+
+   /// The field of the metatable of globals listing libraries not loaded yet.
+   const char* const LazyLibsField = "__Diluculum__Lazy_Libs";
+
+
+
+   /// Opens the standard library \c StdLibs[lib].
+   void OpenStdLib (lua_State* ls, int lib)
+   {
+      lua_pushcfunction (ls, StdLibs[lib].func);
+      lua_pushstring (ls, StdLibs[lib].name);
+      lua_call (ls, 1, 0);
+   }
+
+
+
+   /** Opens the standard library \c StdLibs[lib], which was set to be loaded
+    *  lazily, and removes it from the list of libraries not loaded yet.
+    */
+   void OpenLazyStdLib (lua_State* ls, int lib)
+   {
+      OpenStdLib (ls, lib);
+
+      if (!lua_getmetatable (ls, LUA_GLOBALSINDEX))
+         return;
+
+      lua_getfield (ls, -1, LazyLibsField);
+      if (lua_istable (ls, -1))
+      {
+         // (Clearing fields during a traversal is allowed.)
+         lua_pushnil (ls);
+         while (lua_next (ls, -2) != 0)
+         {
+            const bool isThisLib = lua_tointeger (ls, -1) == lib;
+            lua_pop (ls, 1);
+            if (isThisLib)
+            {
+               lua_pushvalue (ls, -1);
+               lua_pushnil (ls);
+               lua_rawset (ls, -4);
+            }
+         }
+      }
+
+      lua_pop (ls, 2);
+   }
+
+
+
+   /** The \c __index metamethod of the table of globals when some libraries
+    *  are loaded lazily. If the global being read is defined by one of these
+    *  libraries, loads it.
+    */
+   int LazyStdLibIndex (lua_State* ls)
+   {
+      if (!lua_getmetatable (ls, 1))
+         return 0;
+
+      lua_getfield (ls, -1, LazyLibsField);
+      if (!lua_istable (ls, -1))
+         return 0;
+
+      lua_pushvalue (ls, 2);
+      lua_rawget (ls, -2);
+      if (!lua_isnumber (ls, -1))
+         return 0;
+
+      OpenLazyStdLib (ls, static_cast<int>(lua_tointeger (ls, -1)));
+
+      lua_pushvalue (ls, 2);
+      lua_rawget (ls, 1);
+      return 1;
+   }
+
+
+
+   /** The \c __index metamethod of strings when the string library is loaded
+    *  lazily. Loads the library (which replaces the metatable of strings) and
+    *  then looks up the method.
+    */
+   int LazyStringIndex (lua_State* ls)
+   {
+      for (int i = 0; StdLibs[i].name != 0; ++i)
+      {
+         if (std::strcmp (StdLibs[i].name, LUA_STRLIBNAME) == 0)
+            OpenLazyStdLib (ls, i);
+      }
+
+      lua_getfield (ls, LUA_REGISTRYINDEX, "_LOADED");
+      lua_getfield (ls, -1, LUA_STRLIBNAME);
+      lua_pushvalue (ls, 2);
+      lua_gettable (ls, -2);
+      return 1;
+   }
+
+
+
+   /** Opens the libraries in \c libs, and sets the libraries in \c lazyLibs
+    *  to be loaded when first used.
+    */
+   void OpenStdLibs (lua_State* ls, int libs, int lazyLibs)
+   {
+      // The base library defines too many globals to be loaded lazily
+      if (lazyLibs & Diluculum::BASE_LIB)
+         libs |= Diluculum::BASE_LIB;
+
+      lazyLibs &= ~libs;
+
+      for (int i = 0; StdLibs[i].name != 0; ++i)
+      {
+         if (libs & (1 << i))
+            OpenStdLib (ls, i);
+      }
+
+      if (lazyLibs == 0)
+         return;
+
+      // The table mapping globals to the libraries defining them
+      lua_newtable (ls);
+      for (int i = 0; StdLibs[i].name != 0; ++i)
+      {
+         if ((lazyLibs & (1 << i)) == 0)
+            continue;
+
+         lua_pushinteger (ls, i);
+         lua_setfield (ls, -2, StdLibs[i].name);
+
+         if (std::strcmp (StdLibs[i].name, LUA_LOADLIBNAME) == 0)
+         {
+            lua_pushinteger (ls, i);
+            lua_setfield (ls, -2, "require");
+            lua_pushinteger (ls, i);
+            lua_setfield (ls, -2, "module");
+         }
+         else if (std::strcmp (StdLibs[i].name, LUA_STRLIBNAME) == 0)
+         {
+            lua_pushliteral (ls, "");
+            lua_newtable (ls);
+            lua_pushcfunction (ls, LazyStringIndex);
+            lua_setfield (ls, -2, "__index");
+            lua_setmetatable (ls, -2);
+            lua_pop (ls, 1);
+         }
+      }
+
+      lua_newtable (ls);
+      lua_insert (ls, -2);
+      lua_setfield (ls, -2, LazyLibsField);
+      lua_pushcfunction (ls, LazyStdLibIndex);
+      lua_setfield (ls, -2, "__index");
+      lua_setmetatable (ls, LUA_GLOBALSINDEX);
+   }
+
+
+
+   /// The maximum nesting depth of the tables recorded by a checkpoint.
+   const int MaxCheckpointDepth = 1000;
+
+
+
+   /** Records the contents and the metatable of the table at \c index, and
+    *  then (recursively) of every table reachable from it. The copies are
+    *  stored in the table at \c copies (indexed by the original tables),
+    *  the metatables in the table at \c metatables (\c false means no
+    *  metatable). Weak tables are not recorded. \c depth is the nesting
+    *  depth of the table.
+    *  @throw Diluculum::LuaError If tables are nested more than
+    *         \c MaxCheckpointDepth levels deep.
+    */
+   void CheckpointTable (lua_State* ls, int index, int copies, int metatables,
+                         int depth)
+   {
+      if (depth > MaxCheckpointDepth)
+      {
+         throw Diluculum::LuaError (
+            "Tables nested too deeply to be recorded in a checkpoint.");
+      }
+
+      if (!lua_checkstack (ls, 4))
+      {
+         throw Diluculum::LuaError (
+            "Stack overflow while creating a checkpoint.");
+      }
+
+      // Already recorded?
+      lua_pushvalue (ls, index);
+      lua_rawget (ls, copies);
+      const bool recorded = !lua_isnil (ls, -1);
+      lua_pop (ls, 1);
+      if (recorded)
+         return;
+
+      if (lua_getmetatable (ls, index))
+      {
+         lua_pushliteral (ls, "__mode");
+         lua_rawget (ls, -2);
+         const bool isWeak = !lua_isnil (ls, -1);
+         lua_pop (ls, 1);
+         if (isWeak)
+         {
+            lua_pop (ls, 1);
+            return;
+         }
+      }
+      else
+      {
+         lua_pushboolean (ls, false);
+      }
+
+      // Record the metatable
+      lua_pushvalue (ls, index);
+      lua_pushvalue (ls, -2);
+      lua_rawset (ls, metatables);
+
+      // Record the contents
+      lua_newtable (ls);
+      lua_pushvalue (ls, index);
+      lua_pushvalue (ls, -2);
+      lua_rawset (ls, copies);
+
+      const int copy = lua_gettop (ls);
+      lua_pushnil (ls);
+      while (lua_next (ls, index) != 0)
+      {
+         lua_pushvalue (ls, -2);
+         lua_insert (ls, -2);
+         lua_rawset (ls, copy);
+      }
+
+      // Recurse into keys, values and the metatable
+      lua_pushnil (ls);
+      while (lua_next (ls, copy) != 0)
+      {
+         const int top = lua_gettop (ls);
+         if (lua_istable (ls, top - 1))
+            CheckpointTable (ls, top - 1, copies, metatables, depth + 1);
+         if (lua_istable (ls, top))
+            CheckpointTable (ls, top, copies, metatables, depth + 1);
+         lua_pop (ls, 1);
+      }
+
+      lua_pop (ls, 1); // the copy
+
+      if (lua_istable (ls, -1))
+         CheckpointTable (ls, lua_gettop (ls), copies, metatables, depth + 1);
+
+      lua_pop (ls, 1); // the metatable
+   }
+
+
+
+   /** Makes the contents of the table at \c index equal to the contents of
+    *  the table at \c copy: fields created since the copy was made are
+    *  removed, changed fields get their old values back and removed fields
+    *  are recreated.
+    */
+   void RestoreTable (lua_State* ls, int index, int copy)
+   {
+      luaL_checkstack (ls, 4, "while restoring a checkpoint");
+
+      // Remove or revert fields created or changed since the copy was made.
+      // (Assigning to existing fields during a traversal is allowed.)
+      lua_pushnil (ls);
+      while (lua_next (ls, index) != 0)
+      {
+         lua_pushvalue (ls, -2);
+         lua_rawget (ls, copy);
+         if (!lua_rawequal (ls, -1, -2))
+         {
+            lua_pushvalue (ls, -3);
+            lua_insert (ls, -2);
+            lua_rawset (ls, index);
+         }
+         else
+         {
+            lua_pop (ls, 1);
+         }
+         lua_pop (ls, 1);
+      }
+
+      // Bring back fields removed since the copy was made
+      lua_pushnil (ls);
+      while (lua_next (ls, copy) != 0)
+      {
+         lua_pushvalue (ls, -2);
+         lua_rawget (ls, index);
+         const bool missing = lua_isnil (ls, -1);
+         lua_pop (ls, 1);
+
+         if (missing)
+         {
+            lua_pushvalue (ls, -2);
+            lua_insert (ls, -2);
+            lua_rawset (ls, index);
+         }
+         else
+         {
+            lua_pop (ls, 1);
+         }
+      }
+   }
+
+
+
+   /** Restores the checkpoint recorded in the registry by
+    *  \c LuaState::checkpoint(). This is meant to be called through
+    *  \c lua_cpcall(), so that errors (like running out of memory, or a
+    *  checkpoint messed with by some script) don't reach the panic function.
+    */
+   int RestoreCheckpoint (lua_State* ls)
+   {
+      lua_getfield (ls, LUA_REGISTRYINDEX, "__Diluculum__Checkpoint");
+      lua_rawgeti (ls, -1, 1);
+      lua_rawgeti (ls, -2, 2);
+      const int copies = lua_gettop (ls) - 1;
+      const int metatables = copies + 1;
+
+      if (!lua_istable (ls, copies) || !lua_istable (ls, metatables))
+         return luaL_error (ls, "The checkpoint is corrupted.");
+
+      lua_pushnil (ls);
+      while (lua_next (ls, copies) != 0)
+      {
+         const int table = lua_gettop (ls) - 1;
+         if (!lua_istable (ls, table) || !lua_istable (ls, table + 1))
+            return luaL_error (ls, "The checkpoint is corrupted.");
+
+         RestoreTable (ls, table, table + 1);
+
+         lua_pushvalue (ls, table);
+         lua_rawget (ls, metatables);
+         if (lua_istable (ls, -1))
+            lua_setmetatable (ls, table);
+         else
+         {
+            lua_pop (ls, 1);
+            lua_pushnil (ls);
+            lua_setmetatable (ls, table);
+         }
+
+         lua_pop (ls, 1); // the copy
+      }
+
+      return 0;
+   }
+
+
+
+   /** Pushes \c func onto the stack of \c ls, loading it as a chunk named
+    *  \c chunkName if it is a Lua function. Returns the status returned by
+    *  \c lua_load() (zero for C functions); in case of errors, the error
+    *  message is pushed instead of the function.
+    */
+   int PushFunction (lua_State* ls, Diluculum::LuaFunction& func,
+                     const std::string& chunkName)
+   {
+      if (func.isCFunction())
+      {
+         DILUCULUM_METRICS (ls, recordToLua (sizeof (lua_CFunction)));
+         lua_pushcfunction (ls, func.getCFunction());
+         return 0;
+      }
+
+      DILUCULUM_METRICS (ls, recordToLua (func.getSize()));
+      func.setReaderFlag (false);
+      return lua_load (ls, Diluculum::Impl::LuaFunctionReader, &func,
+                       chunkName.c_str());
+   }
+
+} // (anonymous) namespace
+
+
+
 namespace Diluculum
 {
+   // - LuaState::NoAsyncCall --------------------------------------------------
+   const LuaState::AsyncCallId LuaState::NoAsyncCall;
+
+
+
    // - LuaState::LuaState -----------------------------------------------------
    LuaState::LuaState (bool loadStdLib)
-      : state_(0), ownsState_(true)
+      : nextAsyncCallId_(1), state_(0), ownsState_(true)
    {
       state_ = luaL_newstate();
       if (state_ == 0)
@@ -48,8 +443,19 @@ namespace Diluculum
    }
 
 
+   LuaState::LuaState (StdLib libs, StdLib lazyLibs)
+      : nextAsyncCallId_(1), state_(0), ownsState_(true)
+   {
+      state_ = luaL_newstate();
+      if (state_ == 0)
+         throw LuaError ("Error opening Lua state.");
+
+      OpenStdLibs (state_, libs, lazyLibs);
+   }
+
+
    LuaState::LuaState (lua_State* state, bool loadStdLib)
-      : state_(state), ownsState_(false)
+      : nextAsyncCallId_(1), state_(state), ownsState_(false)
    {
       if (state_ == 0)
          throw LuaError ("Constructor of 'LuaState' got a NULL pointer.");
@@ -64,7 +470,24 @@ namespace Diluculum
    LuaState::~LuaState()
    {
       if (ownsState_ && state_ != 0)
+      {
+         // Don't let a running profiler or 'LuaMetrics' touch the state after
+         // it is closed (this also keeps 'Impl::RunningMetrics' right)
+         Impl::HookData* data = Impl::GetHookData (state_, true);
+         if (data->profiler != 0)
+            data->profiler->detach();
+
+         if (LuaMetrics* metrics = Impl::GetRunningMetrics (state_))
+            metrics->detach();
+
          lua_close (state_);
+      }
+      else
+      {
+         // The Lua state lives on; let the abandoned calls be collected
+         while (!asyncCalls_.empty())
+            releaseAsyncCall (asyncCalls_.begin()->first);
+      }
    }
 
 
@@ -72,45 +495,494 @@ namespace Diluculum
    // - LuaState::doStringOrFile -----------------------------------------------
    LuaValueList LuaState::doStringOrFile (bool isString, const std::string& str)
    {
-      const int stackSizeAtBeginning = lua_gettop (state_);
+      const int loadStatus = isString
+         ? luaL_loadbuffer (state_, str.c_str(), str.length(), "line")
+         : luaL_loadfile (state_, str.c_str());
+
+      Impl::ThrowOnLuaError (state_, loadStatus);
+
+      return Impl::CallFunctionOnTop (state_, LuaValueList());
+   }
+
+
+   void LuaState::doStringOrFile (bool isString, const std::string& str,
+                                  LuaResult& result)
+   {
+      const int loadStatus = isString
+         ? luaL_loadbuffer (state_, str.c_str(), str.length(), "line")
+         : luaL_loadfile (state_, str.c_str());
 
-      if (isString)
+      if (loadStatus != 0)
       {
-         Impl::ThrowOnLuaError (state_, luaL_loadbuffer (state_, str.c_str(),
-                                                         str.length(), "line"));
+         Impl::SetErrorResult (state_, loadStatus, result);
+         return;
       }
+
+      Impl::CallFunctionOnTop (state_, LuaValueList(), result);
+   }
+
+
+
+   // - LuaState::call ---------------------------------------------------------
+   LuaValueList LuaState::call (LuaFunction& func,
+                                const LuaValueList& params,
+                                const std::string& chunkName)
+   {
+      Impl::ThrowOnLuaError (state_, PushFunction (state_, func, chunkName));
+      return Impl::CallFunctionOnTop (state_, params);
+   }
+
+
+
+   // - LuaState::tryCall ------------------------------------------------------
+   LuaResult LuaState::tryCall (LuaFunction& func,
+                                const LuaValueList& params,
+                                const std::string& chunkName)
+   {
+      LuaResult result;
+
+      const int loadStatus = PushFunction (state_, func, chunkName);
+      if (loadStatus != 0)
+         Impl::SetErrorResult (state_, loadStatus, result);
       else
+         Impl::CallFunctionOnTop (state_, params, result);
+
+      return result;
+   }
+
+
+   // - LuaState::callBatch ----------------------------------------------------
+   void LuaState::callBatch (const LuaVariable& func,
+                             const std::vector<LuaValueList>& params,
+                             std::vector<LuaValueList>& results)
+   {
+      const int funcIndex = pushBatchFunction (func);
+
+      results.resize (params.size());
+
+      try
       {
-         Impl::ThrowOnLuaError (state_, luaL_loadfile (state_, str.c_str()));
+         for (std::size_t i = 0; i < params.size(); ++i)
+         {
+            lua_pushvalue (state_, funcIndex);
+            Impl::CallFunctionOnTop (state_, params[i], results[i]);
+         }
+      }
+      catch (...)
+      {
+         lua_settop (state_, funcIndex - 1);
+         throw;
       }
 
-      Impl::ThrowOnLuaError (state_, lua_pcall (state_, 0, LUA_MULTRET, 0));
+      lua_settop (state_, funcIndex - 1);
+   }
 
-      const int numResults = lua_gettop (state_) - stackSizeAtBeginning;
 
+   std::vector<LuaValueList> LuaState::callBatch (
+      const LuaVariable& func, const std::vector<LuaValueList>& params)
+   {
+      std::vector<LuaValueList> results;
+      callBatch (func, params, results);
+      return results;
+   }
+
+
+   std::size_t LuaState::callBatch (const LuaVariable& func,
+                                    const BatchSource& source,
+                                    const BatchSink& sink)
+   {
+      const int funcIndex = pushBatchFunction (func);
+
+      LuaValueList params;
       LuaValueList results;
+      std::size_t numCalls = 0;
 
-      for (int i = numResults; i > 0; --i)
-         results.push_back (ToLuaValue (state_, -i));
+      try
+      {
+         while (true)
+         {
+            params.clear();
+            if (!source (params))
+               break;
 
-      lua_pop (state_, numResults);
+            lua_pushvalue (state_, funcIndex);
+            Impl::CallFunctionOnTop (state_, params, results);
+            ++numCalls;
 
-      return results;
+            sink (results);
+         }
+      }
+      catch (...)
+      {
+         lua_settop (state_, funcIndex - 1);
+         throw;
+      }
+
+      lua_settop (state_, funcIndex - 1);
+
+      return numCalls;
    }
 
 
 
-   // - LuaState::call ---------------------------------------------------------
-   LuaValueList LuaState::call (LuaFunction& func,
-                                const LuaValueList& params,
-                                const std::string& chunkName)
+   // - LuaState::pushBatchFunction --------------------------------------------
+   int LuaState::pushBatchFunction (const LuaVariable& func)
+   {
+      func.pushTheReferencedValue();
+      const int funcIndex = lua_gettop (state_);
+
+      if (lua_type (state_, funcIndex) != LUA_TFUNCTION)
+      {
+         const std::string typeName = luaL_typename (state_, funcIndex);
+         lua_settop (state_, funcIndex - 1);
+         throw TypeMismatchError ("function", typeName);
+      }
+
+      return funcIndex;
+   }
+
+
+
+   // - LuaState::setExecutionLimits -------------------------------------------
+   void LuaState::setExecutionLimits (unsigned long maxInstructions,
+                                      double maxSeconds, int checkInterval)
+   {
+      if (maxInstructions == 0 && maxSeconds <= 0.0)
+      {
+         clearExecutionLimits();
+         return;
+      }
+
+      if (checkInterval <= 0)
+         throw LuaError ("The check interval must be positive.");
+
+      if (maxInstructions > 0
+          && maxInstructions < static_cast<unsigned long>(checkInterval))
+      {
+         checkInterval = static_cast<int>(maxInstructions);
+      }
+
+      Impl::HookData* data = Impl::GetHookData (state_, true);
+      Impl::ExecutionLimits& limits = data->limits;
+
+      limits.enabled = true;
+      limits.maxInstructions = maxInstructions;
+      limits.maxDuration =
+         std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(maxSeconds > 0.0 ? maxSeconds : 0.0));
+      limits.checkInterval = checkInterval;
+
+      Impl::UpdateHook (state_, data);
+   }
+
+
+
+   // - LuaState::clearExecutionLimits -----------------------------------------
+   void LuaState::clearExecutionLimits()
+   {
+      Impl::HookData* data = Impl::GetHookData (state_);
+      if (data != 0)
+      {
+         data->limits.enabled = false;
+         Impl::UpdateHook (state_, data);
+      }
+   }
+
+
+
+   // - LuaState::checkpoint ---------------------------------------------------
+   void LuaState::checkpoint()
+   {
+      const int top = lua_gettop (state_);
+
+      lua_createtable (state_, 2, 0);
+      lua_newtable (state_);
+      lua_rawseti (state_, -2, 1);
+      lua_newtable (state_);
+      lua_rawseti (state_, -2, 2);
+
+      // Drop the previous checkpoint before recording the new one
+      lua_pushnil (state_);
+      lua_setfield (state_, LUA_REGISTRYINDEX, "__Diluculum__Checkpoint");
+
+      lua_rawgeti (state_, top + 1, 1);
+      lua_rawgeti (state_, top + 1, 2);
+      const int copies = top + 2;
+      const int metatables = top + 3;
+
+      try
+      {
+         lua_pushvalue (state_, LUA_GLOBALSINDEX);
+         CheckpointTable (state_, lua_gettop (state_), copies, metatables, 0);
+         lua_pop (state_, 1);
+
+         lua_getfield (state_, LUA_REGISTRYINDEX, "_LOADED");
+         if (lua_istable (state_, -1))
+         {
+            CheckpointTable (state_, lua_gettop (state_), copies, metatables,
+                             0);
+         }
+         lua_pop (state_, 1);
+      }
+      catch (...)
+      {
+         lua_settop (state_, top);
+         throw;
+      }
+
+      lua_pushvalue (state_, top + 1);
+      lua_setfield (state_, LUA_REGISTRYINDEX, "__Diluculum__Checkpoint");
+
+      lua_settop (state_, top);
+   }
+
+
+
+   // - LuaState::restore ------------------------------------------------------
+   void LuaState::restore (bool collectGarbage)
+   {
+      if (!hasCheckpoint())
+         throw LuaError ("Tried to restore a state without a checkpoint.");
+
+      Impl::ThrowOnLuaError (state_, lua_cpcall (state_, RestoreCheckpoint, 0));
+
+      if (collectGarbage)
+         lua_gc (state_, LUA_GCCOLLECT, 0);
+   }
+
+
+
+   // - LuaState::hasCheckpoint ------------------------------------------------
+   bool LuaState::hasCheckpoint() const
+   {
+      lua_getfield (state_, LUA_REGISTRYINDEX, "__Diluculum__Checkpoint");
+      const bool hasIt = lua_istable (state_, -1);
+      lua_pop (state_, 1);
+      return hasIt;
+   }
+
+
+
+   // - LuaState::callAsync ----------------------------------------------------
+   LuaState::AsyncCallId LuaState::callAsync (LuaFunction& func,
+                                              const LuaValueList& params,
+                                              const AsyncCallback& callback)
    {
       func.setReaderFlag (false);
       PushLuaValue (state_, LuaValue (func));
-      return Impl::CallFunctionOnTop (state_, params);
+      return startAsync (params, callback);
+   }
+
+
+   LuaState::AsyncCallId LuaState::callAsync (const LuaVariable& func,
+                                              const LuaValueList& params,
+                                              const AsyncCallback& callback)
+   {
+      func.pushTheReferencedValue();
+      return startAsync (params, callback);
+   }
+
+
+   namespace
+   {
+      /// Creates an \c AsyncCallback that fulfills a promise.
+      LuaState::AsyncCallback
+      MakePromiseCallback (std::shared_ptr<std::promise<LuaValueList> > p)
+      {
+         return [p] (const LuaValueList& results, std::exception_ptr error) {
+            if (error)
+               p->set_exception (error);
+            else
+               p->set_value (results);
+         };
+      }
+   }
+
+
+   std::future<LuaValueList> LuaState::callAsync (LuaFunction& func,
+                                                  const LuaValueList& params)
+   {
+      std::shared_ptr<std::promise<LuaValueList> > p(
+         new std::promise<LuaValueList>());
+      std::future<LuaValueList> ret = p->get_future();
+      callAsync (func, params, MakePromiseCallback (p));
+      return ret;
+   }
+
+
+   std::future<LuaValueList> LuaState::callAsync (const LuaVariable& func,
+                                                  const LuaValueList& params)
+   {
+      std::shared_ptr<std::promise<LuaValueList> > p(
+         new std::promise<LuaValueList>());
+      std::future<LuaValueList> ret = p->get_future();
+      callAsync (func, params, MakePromiseCallback (p));
+      return ret;
+   }
+
+
+
+   // - LuaState::resumeAsync --------------------------------------------------
+   void LuaState::resumeAsync (AsyncCallId call, const LuaValueList& results)
+   {
+      std::map<AsyncCallId, AsyncCall>::const_iterator it =
+         asyncCalls_.find (call);
+
+      if (it == asyncCalls_.end())
+      {
+         throw LuaError ("'LuaState::resumeAsync()' called for an unknown "
+                         "asynchronous call.");
+      }
+
+      lua_State* thread = it->second.thread;
+
+      if (lua_status (thread) != LUA_YIELD)
+      {
+         throw LuaError ("'LuaState::resumeAsync()' called for an "
+                         "asynchronous call that is not suspended.");
+      }
+
+      // Discard anything left by the C function that yielded
+      lua_settop (thread, 0);
+
+      typedef LuaValueList::const_iterator iter_t;
+      for (iter_t p = results.begin(); p != results.end(); ++p)
+         PushLuaValue (thread, *p);
+
+      runAsync (call, results.size());
+   }
+
+
+
+   // - LuaState::getAsyncCallId -----------------------------------------------
+   LuaState::AsyncCallId LuaState::getAsyncCallId (lua_State* ls)
+   {
+      Impl::PushAsyncCallsTable (ls);
+      lua_pushthread (ls);
+      lua_rawget (ls, -2);
+      const AsyncCallId ret = lua_isnumber (ls, -1)
+         ? static_cast<AsyncCallId>(lua_tonumber (ls, -1))
+         : NoAsyncCall;
+      lua_pop (ls, 2);
+      return ret;
+   }
+
+
+
+   // - LuaState::startAsync ---------------------------------------------------
+   LuaState::AsyncCallId LuaState::startAsync (const LuaValueList& params,
+                                               const AsyncCallback& callback)
+   {
+      if (lua_type (state_, -1) != LUA_TFUNCTION)
+      {
+         const std::string foundType = luaL_typename (state_, -1);
+         lua_pop (state_, 1);
+         throw TypeMismatchError ("function", foundType);
+      }
+
+      // Create the thread, keeping a reference to it in the registry (so that
+      // it is not collected), and map it to the call identifier
+      const AsyncCallId call = nextAsyncCallId_++;
+
+      lua_State* thread = lua_newthread (state_);
+      Impl::PushAsyncCallsTable (state_);
+      lua_pushvalue (state_, -2);
+      lua_pushnumber (state_, static_cast<lua_Number>(call));
+      lua_rawset (state_, -3);
+      lua_pop (state_, 1); // the table of calls
+
+      AsyncCall& asyncCall = asyncCalls_[call];
+      asyncCall.thread = thread;
+      asyncCall.threadRef = luaL_ref (state_, LUA_REGISTRYINDEX);
+      asyncCall.callback = callback;
+
+      // Move the function to the new thread and start it
+      lua_xmove (state_, thread, 1);
+
+      typedef LuaValueList::const_iterator iter_t;
+      for (iter_t p = params.begin(); p != params.end(); ++p)
+         PushLuaValue (thread, *p);
+
+      runAsync (call, params.size());
+
+      return call;
+   }
+
+
+
+   // - LuaState::runAsync -----------------------------------------------------
+   void LuaState::runAsync (AsyncCallId call, int numArgs)
+   {
+      std::map<AsyncCallId, AsyncCall>::const_iterator it =
+         asyncCalls_.find (call);
+      lua_State* thread = it->second.thread;
+
+      // Each resumption is limited like a call of its own
+      LuaResult result;
+      int status;
+      {
+         Impl::ExecutionLimitsScope limitsScope (state_);
+
+         // The thread may have been created before the hook was changed
+         lua_sethook (thread, lua_gethook (state_), lua_gethookmask (state_),
+                      lua_gethookcount (state_));
+
+         status = lua_resume (thread, numArgs);
+
+         if (status != 0 && status != LUA_YIELD)
+            Impl::SetErrorResult (thread, status, result);
+      }
+
+      if (status == LUA_YIELD)
+         return;
+
+      // The call is finished, one way or another
+      const AsyncCallback callback = it->second.callback;
+
+      LuaValueList results;
+      std::exception_ptr error;
+
+      try
+      {
+         result.throwIfError();
+
+         const int numResults = lua_gettop (thread);
+         for (int i = 1; i <= numResults; ++i)
+            results.push_back (ToLuaValue (thread, i));
+      }
+      catch(...)
+      {
+         results.clear();
+         error = std::current_exception();
+      }
+
+      lua_settop (thread, 0);
+      releaseAsyncCall (call);
+
+      if (callback)
+         callback (results, error);
    }
 
 
+
+   // - LuaState::releaseAsyncCall ---------------------------------------------
+   void LuaState::releaseAsyncCall (AsyncCallId call)
+   {
+      std::map<AsyncCallId, AsyncCall>::iterator it = asyncCalls_.find (call);
+
+      Impl::PushAsyncCallsTable (state_);
+      lua_rawgeti (state_, LUA_REGISTRYINDEX, it->second.threadRef);
+      lua_pushnil (state_);
+      lua_rawset (state_, -3);
+      lua_pop (state_, 1);
+
+      luaL_unref (state_, LUA_REGISTRYINDEX, it->second.threadRef);
+
+      asyncCalls_.erase (it);
+   }
+
+
+
    // - LuaState::operator[] ---------------------------------------------------
    LuaVariable LuaState::operator[] (const std::string& variable)
    {
@@ -0,0 +1,282 @@
+/******************************************************************************\
+* LuaStatePool.cpp                                                             *
+* A pool of ready-to-use Lua states.                                           *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#include <cassert>
+#include <Diluculum/LuaStatePool.hpp>
+
+
+namespace Diluculum
+{
+   // - LuaStatePool::Handle::operator= ----------------------------------------
+   LuaStatePool::Handle& LuaStatePool::Handle::operator= (Handle&& rhs)
+   {
+      if (this != &rhs)
+      {
+         release();
+         pool_ = rhs.pool_;
+         slot_ = rhs.slot_;
+         rhs.pool_ = 0;
+         rhs.slot_ = 0;
+      }
+
+      return *this;
+   }
+
+
+
+   // - LuaStatePool::Handle::state --------------------------------------------
+   LuaState& LuaStatePool::Handle::state() const
+   {
+      assert (slot_ != 0 && "Tried to use an empty 'LuaStatePool::Handle'.");
+      return *slot_->state;
+   }
+
+
+
+   // - LuaStatePool::Handle::release ------------------------------------------
+   void LuaStatePool::Handle::release()
+   {
+      if (slot_ != 0)
+      {
+         pool_->checkIn (slot_, true);
+         pool_ = 0;
+         slot_ = 0;
+      }
+   }
+
+
+
+   // - LuaStatePool::Handle::discard ------------------------------------------
+   void LuaStatePool::Handle::discard()
+   {
+      if (slot_ != 0)
+      {
+         pool_->checkIn (slot_, false);
+         pool_ = 0;
+         slot_ = 0;
+      }
+   }
+
+
+
+   // - LuaStatePool::LuaStatePool ---------------------------------------------
+   LuaStatePool::LuaStatePool (std::size_t size, const SetupFunction& setup,
+                               bool resetGlobals, bool loadStdLib)
+      : size_(size), slots_(new Slot[size]), setup_(setup),
+        resetGlobals_(resetGlobals), loadStdLib_(loadStdLib),
+        nextSlot_(0), waiters_(0)
+   {
+      for (std::size_t i = 0; i < size_; ++i)
+      {
+         slots_[i].busy = false;
+         slots_[i].stale = false;
+         slots_[i].state = 0;
+      }
+
+      try
+      {
+         for (std::size_t i = 0; i < size_; ++i)
+            createState (slots_[i]);
+      }
+      catch(...)
+      {
+         for (std::size_t i = 0; i < size_; ++i)
+            delete slots_[i].state;
+         throw;
+      }
+   }
+
+
+
+   // - LuaStatePool::~LuaStatePool --------------------------------------------
+   LuaStatePool::~LuaStatePool()
+   {
+      for (std::size_t i = 0; i < size_; ++i)
+      {
+         assert (!slots_[i].busy
+                 && "'LuaStatePool' destroyed with states still checked out.");
+         delete slots_[i].state;
+      }
+   }
+
+
+
+   // - LuaStatePool::checkOut -------------------------------------------------
+   LuaStatePool::Handle LuaStatePool::checkOut()
+   {
+      Slot* slot = tryLockSlot();
+
+      if (slot == 0)
+      {
+         std::unique_lock<std::mutex> lock (mutex_);
+         ++waiters_;
+         while ((slot = tryLockSlot()) == 0)
+            slotFreed_.wait (lock);
+         --waiters_;
+      }
+
+      return makeHandle (slot);
+   }
+
+
+
+   // - LuaStatePool::tryCheckOut ----------------------------------------------
+   LuaStatePool::Handle LuaStatePool::tryCheckOut()
+   {
+      Slot* slot = tryLockSlot();
+      if (slot == 0)
+         return Handle();
+
+      return makeHandle (slot);
+   }
+
+
+
+   // - LuaStatePool::available ------------------------------------------------
+   std::size_t LuaStatePool::available() const
+   {
+      std::size_t count = 0;
+      for (std::size_t i = 0; i < size_; ++i)
+      {
+         if (!slots_[i].busy.load (std::memory_order_relaxed))
+            ++count;
+      }
+
+      return count;
+   }
+
+
+
+   // - LuaStatePool::tryLockSlot ----------------------------------------------
+   LuaStatePool::Slot* LuaStatePool::tryLockSlot()
+   {
+      const std::size_t start =
+         nextSlot_.fetch_add (1, std::memory_order_relaxed);
+
+      for (std::size_t i = 0; i < size_; ++i)
+      {
+         Slot& slot = slots_[(start + i) % size_];
+
+         if (slot.busy.load (std::memory_order_relaxed))
+            continue;
+
+         bool expected = false;
+         if (slot.busy.compare_exchange_strong (expected, true))
+            return &slot;
+      }
+
+      return 0;
+   }
+
+
+
+   // - LuaStatePool::makeHandle -----------------------------------------------
+   LuaStatePool::Handle LuaStatePool::makeHandle (Slot* slot)
+   {
+      if (slot->stale)
+      {
+         try
+         {
+            createState (*slot);
+         }
+         catch(...)
+         {
+            checkIn (slot, false);
+            throw;
+         }
+      }
+
+      return Handle (this, slot);
+   }
+
+
+
+   // - LuaStatePool::createState ----------------------------------------------
+   void LuaStatePool::createState (Slot& slot)
+   {
+      delete slot.state;
+      slot.state = 0;
+
+      slot.state = new LuaState (loadStdLib_);
+      setup_(*slot.state);
+
+      if (resetGlobals_)
+         slot.state->checkpoint();
+
+      slot.stale = false;
+   }
+
+
+
+   // - LuaStatePool::checkIn --------------------------------------------------
+   void LuaStatePool::checkIn (Slot* slot, bool healthy)
+   {
+      lua_State* ls = slot->state != 0 ? slot->state->getState() : 0;
+
+      // Leftovers on the stack mean that someone was sloppy, but the state is
+      // still usable
+      if (ls != 0)
+         lua_settop (ls, 0);
+
+      if (healthy && ls != 0 && healthCheck_)
+      {
+         try
+         {
+            healthy = healthCheck_(*slot->state);
+         }
+         catch(...)
+         {
+            healthy = false;
+         }
+      }
+
+      // (Garbage is left to the incremental collector, to keep check-ins
+      // cheap.) This may be called from the destructor of a 'Handle', so a
+      // failed restoration just makes the state stale.
+      if (healthy && ls != 0 && resetGlobals_)
+      {
+         try
+         {
+            slot->state->restore (false);
+         }
+         catch(...)
+         {
+            healthy = false;
+         }
+      }
+
+      slot->stale = !healthy || ls == 0;
+
+      slot->busy.store (false);
+
+      if (waiters_.load() > 0)
+      {
+         std::lock_guard<std::mutex> lock (mutex_);
+         slotFreed_.notify_one();
+      }
+   }
+
+} // namespace Diluculum
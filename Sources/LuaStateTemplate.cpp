@@ -0,0 +1,496 @@
+/******************************************************************************\
+* LuaStateTemplate.cpp                                                         *
+* A snapshot of a prepared Lua state, used to create new states.               *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#include <Diluculum/LuaStateTemplate.hpp>
+#include <Diluculum/LuaWrappers.hpp>
+#include "InternalUtils.hpp"
+
+
+namespace
+{
+   /// The \c lua_Writer used to dump functions into a \c std::string.
+   int StringWriter (lua_State* ls, const void* data, size_t size, void* str)
+   {
+      static_cast<std::string*>(str)->append (static_cast<const char*>(data),
+                                              size);
+      return 0;
+   }
+
+
+
+   /// What \c LuaStateTemplate::Replay() gets from \c applyTo().
+   struct ReplayData
+   {
+      /// The template being replayed.
+      const Diluculum::LuaStateTemplate* self;
+
+      /** Which objects already existed in the state (library tables)?
+       *  Allocated beforehand, since C++ exceptions must not cross the
+       *  protected call.
+       */
+      std::vector<bool>* preexisting;
+   };
+
+} // (anonymous) namespace
+
+
+
+namespace Diluculum
+{
+   // - LuaStateTemplate::LuaStateTemplate -------------------------------------
+   LuaStateTemplate::LuaStateTemplate (LuaState& prepared, bool loadStdLib)
+      : numRefs_(0), loadStdLib_(loadStdLib)
+   {
+      lua_State* ls = prepared.getState();
+      const int top = lua_gettop (ls);
+
+      // Find the library tables; these are not recreated.
+      libraries_[lua_topointer (ls, LUA_GLOBALSINDEX)] = "_G";
+
+      lua_getfield (ls, LUA_REGISTRYINDEX, "_LOADED");
+      if (lua_istable (ls, -1))
+      {
+         libraries_[lua_topointer (ls, -1)] = "_LOADED";
+
+         lua_pushnil (ls);
+         while (lua_next (ls, -2) != 0)
+         {
+            if (lua_type (ls, -2) == LUA_TSTRING && lua_istable (ls, -1))
+               libraries_[lua_topointer (ls, -1)] = lua_tostring (ls, -2);
+            lua_pop (ls, 1);
+         }
+      }
+      lua_pop (ls, 1);
+
+      try
+      {
+         // Capture everything reachable from the globals table
+         lua_pushvalue (ls, LUA_GLOBALSINDEX);
+         capture (ls, lua_gettop (ls), 0);
+         emit (Instruction::POP);
+
+         // And the metatables of the registered classes, which are stored in
+         // the registry
+         Impl::PushClassMetatables (ls);
+         if (lua_istable (ls, -1))
+         {
+            capture (ls, lua_gettop (ls), 0);
+            emit (Instruction::SET_CLASS_METATABLES);
+         }
+      }
+      catch (...)
+      {
+         lua_settop (ls, top);
+         throw;
+      }
+
+      lua_settop (ls, top);
+
+      refs_.clear();
+      libraries_.clear();
+   }
+
+
+
+   // - LuaStateTemplate::newState ---------------------------------------------
+   std::unique_ptr<LuaState> LuaStateTemplate::newState() const
+   {
+      std::unique_ptr<LuaState> ls (new LuaState (loadStdLib_));
+      applyTo (*ls);
+      return ls;
+   }
+
+
+
+   // - LuaStateTemplate::applyTo ----------------------------------------------
+   void LuaStateTemplate::applyTo (LuaState& state) const
+   {
+      lua_State* ls = state.getState();
+
+      std::vector<bool> preexisting (numRefs_ + 1, false);
+      ReplayData data = { this, &preexisting };
+
+      // The replay may run out of stack or memory, which is reported with a
+      // Lua error, so run it in protected mode
+      const int status = lua_cpcall (ls, &LuaStateTemplate::Replay, &data);
+      Impl::ThrowOnLuaError (ls, status);
+   }
+
+
+
+   // - LuaStateTemplate::Replay -----------------------------------------------
+   int LuaStateTemplate::Replay (lua_State* ls)
+   {
+      const ReplayData* data = static_cast<ReplayData*>(lua_touserdata (ls, 1));
+      data->self->replay (ls, *data->preexisting);
+      return 0;
+   }
+
+
+
+   // - LuaStateTemplate::replay -----------------------------------------------
+   void LuaStateTemplate::replay (lua_State* ls,
+                                 std::vector<bool>& preexisting) const
+   {
+      lua_createtable (ls, numRefs_, 0);
+      const int refsIndex = lua_gettop (ls);
+
+      typedef std::vector<Instruction>::const_iterator iter_t;
+      for (iter_t p = program_.begin(); p != program_.end(); ++p)
+      {
+         luaL_checkstack (ls, 3, "while replaying a 'LuaStateTemplate'");
+
+         switch (p->opCode)
+         {
+            case Instruction::PUSH_NIL:
+               lua_pushnil (ls);
+               break;
+
+            case Instruction::PUSH_BOOLEAN:
+               lua_pushboolean (ls, p->arg);
+               break;
+
+            case Instruction::PUSH_NUMBER:
+               lua_pushnumber (ls, p->number);
+               break;
+
+            case Instruction::PUSH_STRING:
+               lua_pushlstring (ls, p->data.c_str(), p->data.size());
+               break;
+
+            case Instruction::PUSH_LIGHT_UD:
+               lua_pushlightuserdata (ls, const_cast<void*>(p->pointer));
+               break;
+
+            case Instruction::PUSH_REF:
+               lua_rawgeti (ls, refsIndex, p->ref);
+               break;
+
+            case Instruction::PUSH_LIBRARY:
+            {
+               if (p->data == "_G")
+                  lua_pushvalue (ls, LUA_GLOBALSINDEX);
+               else if (p->data == "_LOADED")
+                  lua_getfield (ls, LUA_REGISTRYINDEX, "_LOADED");
+               else
+               {
+                  lua_getfield (ls, LUA_REGISTRYINDEX, "_LOADED");
+                  if (lua_istable (ls, -1))
+                     lua_getfield (ls, -1, p->data.c_str());
+                  else
+                     lua_pushnil (ls);
+                  lua_remove (ls, -2);
+               }
+
+               // Not loaded in this state: just create it
+               preexisting[p->ref] = lua_istable (ls, -1);
+               if (!preexisting[p->ref])
+               {
+                  lua_pop (ls, 1);
+                  lua_newtable (ls);
+               }
+
+               lua_pushvalue (ls, -1);
+               lua_rawseti (ls, refsIndex, p->ref);
+               break;
+            }
+
+            case Instruction::NEW_TABLE:
+               lua_createtable (ls, p->arg, p->arg2);
+               lua_pushvalue (ls, -1);
+               lua_rawseti (ls, refsIndex, p->ref);
+               break;
+
+            case Instruction::LOAD_FUNCTION:
+               if (luaL_loadbuffer (ls, p->data.c_str(), p->data.size(),
+                                    "=LuaStateTemplate") != 0)
+               {
+                  lua_pushfstring (ls, "Error loading function from template: "
+                                   "%s", lua_tostring (ls, -1));
+                  lua_error (ls);
+               }
+               lua_pushvalue (ls, -1);
+               lua_rawseti (ls, refsIndex, p->ref);
+               break;
+
+            case Instruction::PUSH_C_FUNCTION:
+               lua_pushcclosure (ls, p->cFunction, p->arg);
+               lua_pushvalue (ls, -1);
+               lua_rawseti (ls, refsIndex, p->ref);
+               break;
+
+            case Instruction::SET_FIELD:
+            {
+               // Keep the C functions of library tables, which may have been
+               // given environments or upvalues by the library itself.
+               if (preexisting[p->ref] && lua_iscfunction (ls, -1))
+               {
+                  lua_pushvalue (ls, -2);
+                  lua_rawget (ls, -4);
+                  const bool same = lua_iscfunction (ls, -1)
+                     && lua_tocfunction (ls, -1) == lua_tocfunction (ls, -2);
+                  lua_pop (ls, 1);
+
+                  if (same)
+                  {
+                     lua_pop (ls, 2);
+                     break;
+                  }
+               }
+
+               lua_rawset (ls, -3);
+               break;
+            }
+
+            case Instruction::SET_METATABLE:
+               lua_setmetatable (ls, -2);
+               break;
+
+            case Instruction::SET_UPVALUE:
+               lua_setupvalue (ls, -2, p->arg);
+               break;
+
+            case Instruction::SET_ENVIRONMENT:
+               lua_setfenv (ls, -2);
+               break;
+
+            case Instruction::SET_CLASS_METATABLES:
+               luaL_checkstack (ls, 6, "while replaying a 'LuaStateTemplate'");
+               lua_pushnil (ls);
+               while (lua_next (ls, -2) != 0)
+               {
+                  Impl::SetClassMetatable (ls, static_cast<Impl::ClassInfo*>(
+                                              lua_touserdata (ls, -2)));
+               }
+               lua_pop (ls, 1);
+               break;
+
+            case Instruction::POP:
+               lua_pop (ls, 1);
+               break;
+         }
+      }
+   }
+
+
+
+   // - LuaStateTemplate::capture ----------------------------------------------
+   void LuaStateTemplate::capture (lua_State* ls, int index, int depth)
+   {
+      // Each nesting level takes a few slots of the Lua stack when the
+      // template is replayed, so this also keeps the replay within limits
+      if (depth > MaxDepth)
+      {
+         throw LuaError ("Values nested too deeply to be captured in a "
+                         "'LuaStateTemplate'.");
+      }
+
+      if (!lua_checkstack (ls, 4))
+      {
+         throw LuaError ("Stack overflow while capturing a "
+                         "'LuaStateTemplate'.");
+      }
+
+      const int type = lua_type (ls, index);
+
+      switch (type)
+      {
+         case LUA_TBOOLEAN:
+            emit (Instruction::PUSH_BOOLEAN).arg = lua_toboolean (ls, index);
+            return;
+
+         case LUA_TNUMBER:
+            emit (Instruction::PUSH_NUMBER).number = lua_tonumber (ls, index);
+            return;
+
+         case LUA_TSTRING:
+         {
+            size_t len;
+            const char* s = lua_tolstring (ls, index, &len);
+            emit (Instruction::PUSH_STRING).data.assign (s, len);
+            return;
+         }
+
+         case LUA_TLIGHTUSERDATA:
+            emit (Instruction::PUSH_LIGHT_UD).pointer =
+               lua_touserdata (ls, index);
+            return;
+
+         case LUA_TTABLE:
+         case LUA_TFUNCTION:
+            break;
+
+         default:
+            emit (Instruction::PUSH_NIL);
+            return;
+      }
+
+      // Tables and functions: reuse what was already captured
+      const void* address = lua_topointer (ls, index);
+      std::map<const void*, int>::const_iterator p = refs_.find (address);
+      if (p != refs_.end())
+      {
+         if (p->second > 0)
+            emit (Instruction::PUSH_REF).ref = p->second;
+         else
+            emit (Instruction::PUSH_NIL); // a cycle through C upvalues
+         return;
+      }
+
+      if (type == LUA_TTABLE)
+      {
+         const int ref = ++numRefs_;
+         refs_[address] = ref;
+
+         std::map<const void*, std::string>::const_iterator lib =
+            libraries_.find (address);
+
+         if (lib != libraries_.end())
+         {
+            Instruction& i = emit (Instruction::PUSH_LIBRARY);
+            i.data = lib->second;
+            i.ref = ref;
+         }
+         else
+         {
+            int numFields = 0;
+            lua_pushnil (ls);
+            while (lua_next (ls, index) != 0)
+            {
+               ++numFields;
+               lua_pop (ls, 1);
+            }
+
+            const int arraySize = static_cast<int>(lua_objlen (ls, index));
+
+            Instruction& i = emit (Instruction::NEW_TABLE);
+            i.arg = arraySize;
+            i.arg2 = numFields > arraySize ? numFields - arraySize : 0;
+            i.ref = ref;
+         }
+
+         lua_pushnil (ls);
+         while (lua_next (ls, index) != 0)
+         {
+            const int top = lua_gettop (ls);
+            if (isCapturable (lua_type (ls, top - 1))
+                && isCapturable (lua_type (ls, top)))
+            {
+               capture (ls, top - 1, depth + 1);
+               capture (ls, top, depth + 1);
+               emit (Instruction::SET_FIELD).ref = ref;
+            }
+            lua_pop (ls, 1);
+         }
+
+         if (lua_getmetatable (ls, index))
+         {
+            capture (ls, lua_gettop (ls), depth + 1);
+            emit (Instruction::SET_METATABLE);
+            lua_pop (ls, 1);
+         }
+      }
+      else if (lua_iscfunction (ls, index))
+      {
+         refs_[address] = -1;
+
+         int numUpValues = 0;
+         while (lua_getupvalue (ls, index, numUpValues + 1) != 0)
+         {
+            ++numUpValues;
+            capture (ls, lua_gettop (ls), depth + 1);
+            lua_pop (ls, 1);
+         }
+
+         const int ref = ++numRefs_;
+         refs_[address] = ref;
+
+         Instruction& i = emit (Instruction::PUSH_C_FUNCTION);
+         i.cFunction = lua_tocfunction (ls, index);
+         i.arg = numUpValues;
+         i.ref = ref;
+      }
+      else
+      {
+         const int ref = ++numRefs_;
+         refs_[address] = ref;
+
+         std::string bytecode;
+         lua_pushvalue (ls, index);
+         lua_dump (ls, StringWriter, &bytecode);
+         lua_pop (ls, 1);
+
+         Instruction& i = emit (Instruction::LOAD_FUNCTION);
+         i.data.swap (bytecode);
+         i.ref = ref;
+
+         for (int n = 1; lua_getupvalue (ls, index, n) != 0; ++n)
+         {
+            capture (ls, lua_gettop (ls), depth + 1);
+            emit (Instruction::SET_UPVALUE).arg = n;
+            lua_pop (ls, 1);
+         }
+      }
+
+      if (type == LUA_TFUNCTION)
+      {
+         lua_getfenv (ls, index);
+         capture (ls, lua_gettop (ls), depth + 1);
+         emit (Instruction::SET_ENVIRONMENT);
+         lua_pop (ls, 1);
+      }
+   }
+
+
+
+   // - LuaStateTemplate::emit -------------------------------------------------
+   LuaStateTemplate::Instruction&
+   LuaStateTemplate::emit (Instruction::OpCode opCode)
+   {
+      Instruction i;
+      i.opCode = opCode;
+      i.arg = 0;
+      i.arg2 = 0;
+      i.ref = 0;
+      i.number = 0;
+      i.pointer = 0;
+      i.cFunction = 0;
+
+      program_.push_back (i);
+      return program_.back();
+   }
+
+
+
+   // - LuaStateTemplate::isCapturable -----------------------------------------
+   bool LuaStateTemplate::isCapturable (int type)
+   {
+      return type != LUA_TNIL && type != LUA_TUSERDATA
+         && type != LUA_TTHREAD && type != LUA_TNONE;
+   }
+
+} // namespace Diluculum
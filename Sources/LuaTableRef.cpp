@@ -0,0 +1,136 @@
+/******************************************************************************\
+* LuaTableRef.cpp                                                              *
+* A handle to a table living in a Lua state.                                   *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+
+#include <Diluculum/LuaTableRef.hpp>
+#include "InternalUtils.hpp"
+
+
+namespace
+{
+   /// Does a \c lua_gettable() on the table and key passed as arguments.
+   int GetTableField (lua_State* ls)
+   {
+      lua_gettable (ls, 1);
+      return 1;
+   }
+
+   /// Does a \c lua_settable() on the table, key and value passed as arguments.
+   int SetTableField (lua_State* ls)
+   {
+      lua_settable (ls, 1);
+      return 0;
+   }
+
+   /** Can the value at \c index of the stack of \c ls be used as a table key?
+    *  (That is, is it neither \c nil nor NaN?)
+    */
+   bool IsValidKey (lua_State* ls, int index)
+   {
+      if (lua_isnil (ls, index))
+         return false;
+
+      if (lua_type (ls, index) == LUA_TNUMBER)
+      {
+         const lua_Number n = lua_tonumber (ls, index);
+         return n == n;
+      }
+
+      return true;
+   }
+
+} // (anonymous) namespace
+
+
+namespace Diluculum
+{
+   // - LuaTableRef::create ----------------------------------------------------
+   LuaTableRef LuaTableRef::create (lua_State* ls)
+   {
+      lua_newtable (ls);
+      LuaTableRef ret (ls, -1);
+      lua_pop (ls, 1);
+      return ret;
+   }
+
+
+
+   // - LuaTableRef::rawlen ----------------------------------------------------
+   std::size_t LuaTableRef::rawlen() const
+   {
+      push();
+      const std::size_t len = lua_objlen (state_, -1);
+      lua_pop (state_, 1);
+      return len;
+   }
+
+
+
+   // - LuaTableRef::getFieldOnTop ---------------------------------------------
+   void LuaTableRef::getFieldOnTop() const
+   {
+      // Look the key up directly first; only fields that are missing and
+      // belong to tables with a metatable may require calling '__index'
+      lua_pushvalue (state_, -1);
+      lua_rawget (state_, -3);
+      if (!lua_isnil (state_, -1) || lua_getmetatable (state_, -3) == 0)
+      {
+         lua_replace (state_, -3);
+         lua_pop (state_, 1);
+         return;
+      }
+
+      lua_pop (state_, 2);
+      lua_pushcfunction (state_, GetTableField);
+      lua_insert (state_, -3);
+      Impl::CallOnStack (state_, 2, 1);
+   }
+
+
+
+   // - LuaTableRef::setFieldOnTop ---------------------------------------------
+   void LuaTableRef::setFieldOnTop() const
+   {
+      // 'lua_rawset()' raises errors only for invalid keys, and only
+      // 'lua_settable()' on tables with a metatable may call '__newindex'
+      if (IsValidKey (state_, -2))
+      {
+         if (lua_getmetatable (state_, -3) == 0)
+         {
+            lua_rawset (state_, -3);
+            lua_pop (state_, 1);
+            return;
+         }
+         lua_pop (state_, 1);
+      }
+
+      lua_pushcfunction (state_, SetTableField);
+      lua_insert (state_, -4);
+      Impl::CallOnStack (state_, 3, 0);
+   }
+
+} // namespace Diluculum
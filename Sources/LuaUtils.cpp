@@ -39,16 +39,20 @@ namespace Diluculum
       switch (lua_type (state, index))
       {
          case LUA_TNIL:
+            DILUCULUM_METRICS (state, recordFromLua (0));
             return Nil;
 
          case LUA_TNUMBER:
+            DILUCULUM_METRICS (state, recordFromLua (sizeof (lua_Number)));
             return lua_tonumber (state, index);
 
          case LUA_TBOOLEAN:
+            DILUCULUM_METRICS (state, recordFromLua (1));
             // this (instead of a cast) avoids a warning on Visual C++
             return lua_toboolean (state, index) != 0;
 
          case LUA_TSTRING:
+            DILUCULUM_METRICS (state, recordFromLua (lua_objlen(state, index)));
             return std::string(lua_tostring (state, index),
                                lua_objlen(state, index));
 
@@ -56,6 +60,7 @@ namespace Diluculum
          {
             void* addr = lua_touserdata (state, index);
             size_t size = lua_objlen (state, index);
+            DILUCULUM_METRICS (state, recordFromLua (size));
             LuaUserData ud (size);
             memcpy (ud.getData(), addr, size);
             return ud;
@@ -69,6 +74,9 @@ namespace Diluculum
             if (index < 0)
                index = lua_gettop(state) + index + 1;
 
+            DILUCULUM_METRICS (state, recordFromLua (0));
+            DILUCULUM_METRICS (state, recordTableConverted());
+
             // Traverse the table adding the key/value pairs to 'ret'
             LuaValueMap ret;
 
@@ -87,6 +95,7 @@ namespace Diluculum
          {
             if (lua_iscfunction (state, index))
             {
+               DILUCULUM_METRICS (state, recordFromLua (sizeof (lua_CFunction)));
                return lua_tocfunction (state, index);
             }
             else
@@ -95,6 +104,7 @@ namespace Diluculum
                lua_pushvalue (state, index);
                lua_dump(state, Impl::LuaFunctionWriter, &func);
                lua_pop(state, 1);
+               DILUCULUM_METRICS (state, recordFromLua (func.getSize()));
                return func;
             }
          }
@@ -118,27 +128,32 @@ namespace Diluculum
       switch (value.type())
       {
          case LUA_TNIL:
+            DILUCULUM_METRICS (state, recordToLua (0));
             lua_pushnil (state);
             break;
 
          case LUA_TNUMBER:
+            DILUCULUM_METRICS (state, recordToLua (sizeof (lua_Number)));
             lua_pushnumber (state, value.asNumber());
             break;
 
          case LUA_TSTRING:
          {
             const std::string& tmp = value.asString();
+            DILUCULUM_METRICS (state, recordToLua (tmp.length()));
             lua_pushlstring (state, tmp.c_str(), tmp.length());
             break;
          }
 
          case LUA_TBOOLEAN:
+            DILUCULUM_METRICS (state, recordToLua (1));
             lua_pushboolean (state, value.asBoolean());
             break;
 
          case LUA_TUSERDATA:
          {
             size_t size = value.asUserData().getSize();
+            DILUCULUM_METRICS (state, recordToLua (size));
             void* addr = lua_newuserdata (state, size);
             memcpy (addr, value.asUserData().getData(), size);
             break;
@@ -146,6 +161,8 @@ namespace Diluculum
 
          case LUA_TTABLE:
          {
+            DILUCULUM_METRICS (state, recordToLua (0));
+            DILUCULUM_METRICS (state, recordTableCreated());
             lua_newtable (state);
 
             typedef LuaValueMap::const_iterator iter_t;
@@ -168,10 +185,12 @@ namespace Diluculum
             const LuaFunction& f = value.asFunction();
             if (f.isCFunction())
             {
+               DILUCULUM_METRICS (state, recordToLua (sizeof (lua_CFunction)));
                lua_pushcfunction (state, f.getCFunction());
             }
             else
             {
+               DILUCULUM_METRICS (state, recordToLua (f.getSize()));
                LuaFunction* pf = const_cast<LuaFunction*>(&f); // yikes!
                pf->setReaderFlag (false);
                int status = lua_load (state, Impl::LuaFunctionReader, pf,
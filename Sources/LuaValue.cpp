@@ -409,6 +409,31 @@ namespace Diluculum
 
 
 
+   // - LuaValue::castObject ---------------------------------------------------
+   void* LuaValue::castObject (const Impl::ClassInfo* info) const
+   {
+      const LuaUserData& userData = asUserData();
+      const char* expected = info->name != 0 ? info->name : "object";
+
+      if (userData.getSize() < sizeof (Impl::CppObject))
+         throw TypeMismatchError (expected, typeName());
+
+      const Impl::CppObject* obj =
+         static_cast<const Impl::CppObject*>(userData.getData());
+
+      void* ptr = Impl::CastObject (obj->ptr, obj->classInfo, info);
+      if (ptr == 0)
+      {
+         throw TypeMismatchError (
+            expected, obj->classInfo->name != 0 ? obj->classInfo->name
+                                                 : typeName());
+      }
+
+      return ptr;
+   }
+
+
+
    // - LuaValue::operator< ----------------------------------------------------
    bool LuaValue::operator< (const LuaValue& rhs) const
    {
@@ -48,6 +48,8 @@ namespace Diluculum
    // - LuaVariable::operator= -------------------------------------------------
    const LuaValue& LuaVariable::operator= (const LuaValue& rhs)
    {
+      DILUCULUM_METRICS (state_, recordVariableWrite());
+
       pushLastTable();
       PushLuaValue (state_, keys_.back());
       PushLuaValue (state_, rhs);
@@ -62,6 +64,8 @@ namespace Diluculum
    // - LuaVariable::value -----------------------------------------------------
    LuaValue LuaVariable::value() const
    {
+      DILUCULUM_METRICS (state_, recordVariableRead());
+
       pushTheReferencedValue();
       LuaValue ret = ToLuaValue (state_, -1);
       lua_pop (state_, 1);
@@ -90,59 +94,16 @@ namespace Diluculum
       return (*this)(LuaValueList());
    }
 
-   LuaValueList LuaVariable::operator() (const LuaValue& param)
-   {
-      LuaValueList params;
-      params.push_back (param);
-      return (*this)(params);
-   }
-
-   LuaValueList LuaVariable::operator() (const LuaValue& param1,
-                                         const LuaValue& param2)
-   {
-      LuaValueList params;
-      params.push_back (param1);
-      params.push_back (param2);
-      return (*this)(params);
-   }
 
-   LuaValueList LuaVariable::operator() (const LuaValue& param1,
-                                         const LuaValue& param2,
-                                         const LuaValue& param3)
-   {
-      LuaValueList params;
-      params.push_back (param1);
-      params.push_back (param2);
-      params.push_back (param3);
-      return (*this)(params);
-   }
 
-   LuaValueList LuaVariable::operator() (const LuaValue& param1,
-                                         const LuaValue& param2,
-                                         const LuaValue& param3,
-                                         const LuaValue& param4)
+   // - LuaVariable::tryCall ---------------------------------------------------
+   LuaResult LuaVariable::tryCall (const LuaValueList& params)
    {
-      LuaValueList params;
-      params.push_back (param1);
-      params.push_back (param2);
-      params.push_back (param3);
-      params.push_back (param4);
-      return (*this)(params);
-   }
+      pushTheReferencedValue();
 
-   LuaValueList LuaVariable::operator() (const LuaValue& param1,
-                                         const LuaValue& param2,
-                                         const LuaValue& param3,
-                                         const LuaValue& param4,
-                                         const LuaValue& param5)
-   {
-      LuaValueList params;
-      params.push_back (param1);
-      params.push_back (param2);
-      params.push_back (param3);
-      params.push_back (param4);
-      params.push_back (param5);
-      return (*this)(params);
+      LuaResult result;
+      Impl::CallFunctionOnTop (state_, params, result);
+      return result;
    }
 
 
@@ -150,9 +111,9 @@ namespace Diluculum
    // - LuaVariable::pushLastTable ---------------------------------------------
    void LuaVariable::pushLastTable()
    {
-      // Push the globals table onto the stack
-      lua_pushstring (state_, "_G");
-      lua_gettable (state_, LUA_GLOBALSINDEX);
+      // Push the globals table onto the stack (not through the "_G" global,
+      // which doesn't exist if the base library is not loaded)
+      lua_pushvalue (state_, LUA_GLOBALSINDEX);
 
       // Reach the "final" table (and leave it at the stack top)
       typedef KeyList::const_iterator iter_t;
@@ -24,8 +24,78 @@
 * IN THE SOFTWARE.                                                             *
 \******************************************************************************/
 
+#include <Diluculum/LuaTypedWrappers.hpp>
 #include <Diluculum/LuaWrappers.hpp>
 #include <cassert>
+#include <boost/lexical_cast.hpp>
+
+
+namespace
+{
+   /** The registry field storing the table that maps the registry keys of
+    *  the classes registered in a state to their metatables.
+    */
+   const char* const ClassMetatablesField = "__Diluculum__Class_Metatables";
+
+   /** The registry field storing the table that maps the addresses of
+    *  objects instantiated in C++ to the userdata representing them.
+    */
+   const char* const ObjectCacheField = "__Diluculum__Object_Cache";
+
+
+
+   /** The \c __index metamethod of classes with properties. Upvalue 1 is
+    *  the table of getters, upvalue 2 is the table of methods.
+    */
+   int PropertyIndex (lua_State* ls)
+   {
+      lua_pushvalue (ls, 2);
+      lua_rawget (ls, lua_upvalueindex (1));
+      lua_CFunction getter = lua_tocfunction (ls, -1);
+      lua_pop (ls, 1);
+
+      // The getter takes the object at index 1, and ignores the key
+      if (getter != 0)
+         return getter (ls);
+
+      lua_pushvalue (ls, 2);
+      lua_rawget (ls, lua_upvalueindex (2));
+      return 1;
+   }
+
+
+
+   /** The \c __newindex metamethod of classes with properties. Upvalue 1 is
+    *  the table of setters, upvalue 2 is the table of getters.
+    */
+   int PropertyNewIndex (lua_State* ls)
+   {
+      lua_pushvalue (ls, 2);
+      lua_rawget (ls, lua_upvalueindex (1));
+      lua_CFunction setter = lua_tocfunction (ls, -1);
+      lua_pop (ls, 1);
+
+      if (setter == 0)
+      {
+         lua_pushvalue (ls, 2);
+         lua_rawget (ls, lua_upvalueindex (2));
+         const bool readOnly = !lua_isnil (ls, -1);
+         lua_pop (ls, 1);
+
+         const char* name = lua_isstring (ls, 2) ? lua_tostring (ls, 2) : "?";
+         if (readOnly)
+            return luaL_error (ls, "Property '%s' is read-only.", name);
+         else
+            return luaL_error (ls, "No property named '%s'.", name);
+      }
+
+      // The setter takes the object at index 1 and the value at index 2
+      lua_remove (ls, 2);
+      return setter (ls);
+   }
+
+} // (anonymous) namespace
+
 
 
 namespace Diluculum
@@ -47,11 +117,258 @@ namespace Diluculum
          assert (ret != 0 && "'lua_getinfo()' wasn't supposed to return '1' "
                  "here. *Nothing* could go wrong at this point! Oh, well...");
 
+         // 'ar.name' is null if the function was not called from Lua code
          const std::string msg = std::string("Error found when calling '")
-            + ar.name + "': " + what;
+            + (ar.name != 0 ? ar.name : "?") + "': " + what;
 
          lua_pushstring (ls, msg.c_str());
          lua_error (ls);
       }
+
+
+
+      // - ThrowBadArgument ----------------------------------------------------
+      void ThrowBadArgument (int index, const TypeMismatchError& error)
+      {
+         const std::string msg = "Bad argument #"
+            + boost::lexical_cast<std::string> (index) + " ("
+            + error.getExpectedType() + " expected, got "
+            + error.getFoundType() + ").";
+
+         throw LuaError (msg.c_str());
+      }
+
+
+
+      // - SetClassMetatable ---------------------------------------------------
+      void SetClassMetatable (lua_State* ls, const ClassInfo* info)
+      {
+         void* key = const_cast<ClassInfo*>(info);
+
+         // The metatable itself, for fast access
+         lua_pushlightuserdata (ls, key);
+         lua_pushvalue (ls, -2);
+         lua_rawset (ls, LUA_REGISTRYINDEX);
+
+         // And in the table of all class metatables
+         lua_getfield (ls, LUA_REGISTRYINDEX, ClassMetatablesField);
+         if (lua_isnil (ls, -1))
+         {
+            lua_pop (ls, 1);
+            lua_newtable (ls);
+            lua_pushvalue (ls, -1);
+            lua_setfield (ls, LUA_REGISTRYINDEX, ClassMetatablesField);
+         }
+
+         lua_pushlightuserdata (ls, key);
+         lua_pushvalue (ls, -3);
+         lua_rawset (ls, -3);
+
+         lua_pop (ls, 2);
+      }
+
+
+
+      // - PushClassMetatables -------------------------------------------------
+      void PushClassMetatables (lua_State* ls)
+      {
+         lua_getfield (ls, LUA_REGISTRYINDEX, ClassMetatablesField);
+      }
+
+
+
+      // - PushCppObject -------------------------------------------------------
+      void PushCppObject (lua_State* ls, void* ptr, const ClassInfo* info)
+      {
+         // Get the cache, creating it if necessary
+         lua_getfield (ls, LUA_REGISTRYINDEX, ObjectCacheField);
+         if (lua_isnil (ls, -1))
+         {
+            lua_pop (ls, 1);
+            lua_newtable (ls);
+            lua_createtable (ls, 0, 1);
+            lua_pushliteral (ls, "v");
+            lua_setfield (ls, -2, "__mode");
+            lua_setmetatable (ls, -2);
+            lua_pushvalue (ls, -1);
+            lua_setfield (ls, LUA_REGISTRYINDEX, ObjectCacheField);
+         }
+
+         const int cache = lua_gettop (ls);
+
+         lua_pushlightuserdata (ls, ptr);
+         lua_rawget (ls, cache);
+
+         // Reuse the cached userdata, unless it was created for an object of
+         // another class (which may happen, for example, if an object and its
+         // first member are both registered)
+         const CppObject* cached =
+            static_cast<const CppObject*>(lua_touserdata (ls, -1));
+
+         if (cached != 0 && cached->classInfo == info)
+         {
+            lua_replace (ls, cache);
+            return;
+         }
+
+         lua_pop (ls, 1);
+
+         // Not cached: create the userdata and cache it
+         CppObject* cppObj =
+            static_cast<CppObject*>(lua_newuserdata (ls, sizeof(CppObject)));
+         cppObj->ptr = ptr;
+         cppObj->classInfo = info;
+         cppObj->deleteMe = false;
+
+         PushClassMetatable (ls, info);
+         lua_setmetatable (ls, -2);
+
+         lua_pushlightuserdata (ls, ptr);
+         lua_pushvalue (ls, -2);
+         lua_rawset (ls, cache);
+
+         lua_replace (ls, cache);
+      }
+
+
+
+      // - CastObject ----------------------------------------------------------
+      void* CastObject (void* ptr, const ClassInfo* from, const ClassInfo* to)
+      {
+         if (from == to)
+            return ptr;
+
+         for (const BaseClassLink* p = from->bases; p != 0; p = p->next)
+         {
+            void* ret = CastObject (p->upcast (ptr), p->base, to);
+            if (ret != 0)
+               return ret;
+         }
+
+         return 0;
+      }
+
+
+
+      // - ToBaseObject --------------------------------------------------------
+      void* ToBaseObject (lua_State* ls, int index, const ClassInfo* info)
+      {
+         if (index < 0 && index > LUA_REGISTRYINDEX)
+            index = lua_gettop (ls) + index + 1;
+
+         const CppObject* cppObj =
+            static_cast<const CppObject*>(lua_touserdata (ls, index));
+
+         // Is this really one of our objects?
+         if (!lua_getmetatable (ls, index))
+            return 0;
+
+         PushClassMetatable (ls, cppObj->classInfo);
+         const bool isCppObject = lua_rawequal (ls, -1, -2) != 0;
+         lua_pop (ls, 2);
+
+         if (!isCppObject)
+            return 0;
+
+         return CastObject (cppObj->ptr, cppObj->classInfo, info);
+      }
+
+
+
+      // - ThrowNotAnObject ----------------------------------------------------
+      void ThrowNotAnObject (lua_State* ls, int index, const ClassInfo* info)
+      {
+         throw TypeMismatchError (info->name != 0 ? info->name : "object",
+                                  luaL_typename (ls, index));
+      }
+
+
+
+      // - InheritMethods ------------------------------------------------------
+      void InheritMethods (lua_State* ls, const ClassInfo* info,
+                           LuaValueMap& classTable)
+      {
+         for (const BaseClassLink* p = info->bases; p != 0; p = p->next)
+         {
+            PushClassMetatable (ls, p->base);
+
+            if (!lua_istable (ls, -1))
+            {
+               lua_pop (ls, 1);
+               const std::string msg = std::string ("A base class of '")
+                  + info->name + "' was not registered in this Lua state.";
+               throw LuaError (msg.c_str());
+            }
+
+            const LuaValue baseTable = ToLuaValue (ls, -1);
+            lua_pop (ls, 1);
+
+            // 'insert()' doesn't replace methods already defined
+            typedef LuaValueMap::const_iterator iter_t;
+            const LuaValueMap methods = baseTable.asTable();
+            for (iter_t q = methods.begin(); q != methods.end(); ++q)
+            {
+               if (q->first == "__getters" || q->first == "__setters")
+               {
+                  // Properties are merged one by one
+                  LuaValueMap properties;
+                  if (classTable.count (q->first) > 0)
+                     properties = classTable[q->first].asTable();
+                  const LuaValueMap baseProperties = q->second.asTable();
+                  properties.insert (baseProperties.begin(),
+                                     baseProperties.end());
+                  classTable[q->first] = properties;
+               }
+               else if (q->first != "__index" && q->first != "__newindex")
+               {
+                  classTable.insert (*q);
+               }
+            }
+         }
+      }
+
+
+
+      // - SetUpProperties -----------------------------------------------------
+      void SetUpProperties (lua_State* ls)
+      {
+         const int metatable = lua_gettop (ls);
+
+         lua_getfield (ls, metatable, "__getters");
+         lua_getfield (ls, metatable, "__setters");
+
+         if (lua_isnil (ls, -2) && lua_isnil (ls, -1))
+         {
+            lua_pop (ls, 2);
+            return;
+         }
+
+         // Only getters or only setters: the other table is empty
+         if (lua_isnil (ls, -2))
+         {
+            lua_newtable (ls);
+            lua_replace (ls, -3);
+         }
+         else if (lua_isnil (ls, -1))
+         {
+            lua_newtable (ls);
+            lua_replace (ls, -2);
+         }
+
+         const int getters = metatable + 1;
+         const int setters = metatable + 2;
+
+         lua_pushvalue (ls, getters);
+         lua_getfield (ls, metatable, "__index");
+         lua_pushcclosure (ls, PropertyIndex, 2);
+         lua_setfield (ls, metatable, "__index");
+
+         lua_pushvalue (ls, setters);
+         lua_pushvalue (ls, getters);
+         lua_pushcclosure (ls, PropertyNewIndex, 2);
+         lua_setfield (ls, metatable, "__newindex");
+
+         lua_pop (ls, 2);
+      }
    }
 }
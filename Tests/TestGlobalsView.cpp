@@ -0,0 +1,128 @@
+/******************************************************************************\
+* TestGlobalsView.cpp                                                          *
+* Unit tests for 'GlobalsView'.                                                *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#define BOOST_TEST_MODULE GlobalsView
+
+#include <set>
+#include <boost/lexical_cast.hpp>
+#include <boost/test/unit_test.hpp>
+#include <Diluculum/GlobalsView.hpp>
+
+
+// - TestGlobalsViewIteration --------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestGlobalsViewIteration)
+{
+   using namespace Diluculum;
+
+   LuaState ls (NO_LIBS);
+   ls.doString ("a = 1; b = 'two'; c = { 3 }; d = function() end");
+
+   GlobalsView view (ls);
+   std::map<std::string, LuaValue> seen;
+   for (GlobalsView::Iterator p = view.begin(); p != view.end(); ++p)
+   {
+      BOOST_REQUIRE (p->name() != 0);
+      seen[p->name()] = p->value();
+      BOOST_CHECK_EQUAL (p->type(), p->value().type());
+      BOOST_CHECK (p->key() == p->name());
+   }
+
+   BOOST_CHECK_EQUAL (seen.size(), 4);
+   BOOST_CHECK (seen["a"] == 1);
+   BOOST_CHECK (seen["b"] == "two");
+   BOOST_CHECK (seen["c"][1] == 3);
+   BOOST_CHECK_EQUAL (seen["d"].type(), LUA_TFUNCTION);
+
+   // The stack is left alone
+   BOOST_CHECK_EQUAL (lua_gettop (ls.getState()), 0);
+
+   // An empty view
+   LuaState empty (NO_LIBS);
+   GlobalsView emptyView (empty);
+   BOOST_CHECK (emptyView.begin() == emptyView.end());
+}
+
+
+
+// - TestGlobalsViewFilters ----------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestGlobalsViewFilters)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   ls.doString ("cfg_size = 10; cfg_name = 'x'; cfg_fn = print; other = 5");
+
+   std::set<std::string> names;
+   GlobalsView view (ls);
+   view.withPrefix ("cfg_").excludingFunctions();
+   for (GlobalsView::Iterator p = view.begin(); p != view.end(); ++p)
+      names.insert (p->name());
+
+   BOOST_CHECK_EQUAL (names.size(), 2);
+   BOOST_CHECK (names.count ("cfg_size") == 1);
+   BOOST_CHECK (names.count ("cfg_name") == 1);
+
+   // Type filter
+   names.clear();
+   GlobalsView tables (ls);
+   tables.onlyType (LUA_TTABLE);
+   for (GlobalsView::Iterator p = tables.begin(); p != tables.end(); ++p)
+      names.insert (p->name());
+
+   BOOST_CHECK (names.count ("string") == 1);
+   BOOST_CHECK (names.count ("_G") == 1);
+   BOOST_CHECK (names.count ("cfg_size") == 0);
+   BOOST_CHECK (names.count ("print") == 0);
+}
+
+
+
+// - TestGlobalsViewChanges ----------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestGlobalsViewChanges)
+{
+   using namespace Diluculum;
+
+   LuaState ls (NO_LIBS);
+   for (int i = 0; i < 100; ++i)
+      ls["v" + boost::lexical_cast<std::string>(i)] = i;
+
+   // Existing globals can be changed or cleared while iterating; iterators
+   // can be copied, and the Lua stack can be used meanwhile
+   int count = 0;
+   GlobalsView view (ls);
+   for (GlobalsView::Iterator p = view.begin(); p != view.end(); ++p)
+   {
+      GlobalsView::Iterator copy = p;
+      BOOST_CHECK (copy == p);
+      ls[p->name()] = Nil;
+      ls.doString ("local x = 1");
+      ++count;
+   }
+
+   BOOST_CHECK_EQUAL (count, 100);
+   BOOST_CHECK (GlobalsView (ls).begin() == GlobalsView (ls).end());
+}
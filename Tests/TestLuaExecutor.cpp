@@ -0,0 +1,188 @@
+/******************************************************************************\
+* TestLuaExecutor.cpp                                                          *
+* Unit tests for things declared in 'LuaExecutor.hpp'.                         *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#define BOOST_TEST_MODULE LuaExecutor
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <Diluculum/LuaExecutor.hpp>
+
+
+namespace
+{
+   /// The setup function used by the tests here.
+   void SetupState (Diluculum::LuaState& ls)
+   {
+      ls.doString ("calls = 0");
+      ls.doString ("function addMul(a, b) calls = calls + 1; "
+                   "return a + b, a * b end");
+   }
+}
+
+
+
+// - TestLuaExecutorSubmit -----------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaExecutorSubmit)
+{
+   using namespace Diluculum;
+
+   LuaExecutor executor (SetupState);
+
+   LuaValueList params;
+   params.push_back (3);
+   params.push_back (4);
+
+   std::future<LuaValueList> f1 = executor.submitGlobal ("addMul", params);
+
+   LuaFunction doubler ("return ... * 2");
+   std::future<LuaValueList> f2 = executor.submit (doubler, params);
+
+   const LuaValueList r1 = f1.get();
+   BOOST_REQUIRE_EQUAL (r1.size(), 2);
+   BOOST_CHECK (r1[0] == 7);
+   BOOST_CHECK (r1[1] == 12);
+
+   const LuaValueList r2 = f2.get();
+   BOOST_REQUIRE_EQUAL (r2.size(), 1);
+   BOOST_CHECK (r2[0] == 6);
+
+   // Tables cross the thread boundary as values
+   LuaValueMap table;
+   table["x"] = 10;
+   params.clear();
+   params.push_back (table);
+   LuaFunction getX ("local t = ...; return { x = t.x + 1 }");
+   const LuaValueList r3 = executor.submit (getX, params).get();
+   BOOST_REQUIRE_EQUAL (r3.size(), 1);
+   BOOST_CHECK (r3[0]["x"] == 11);
+}
+
+
+
+// - TestLuaExecutorErrors -----------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaExecutorErrors)
+{
+   using namespace Diluculum;
+
+   // Errors are delivered through the future
+   LuaExecutor executor (SetupState);
+   std::future<LuaValueList> f =
+      executor.submitGlobal ("addMul", LuaValueList());
+   BOOST_CHECK_THROW (f.get(), LuaRunTimeError);
+
+   // The executor is still usable afterwards
+   LuaValueList params;
+   params.push_back (1);
+   params.push_back (1);
+   BOOST_CHECK (executor.submitGlobal ("addMul", params).get()[0] == 2);
+
+   // Errors during setup are thrown by the constructor
+   BOOST_CHECK_THROW (
+      LuaExecutor ([] (LuaState& ls) { ls.doString ("error('oops')"); }),
+      LuaRunTimeError);
+}
+
+
+
+// - TestLuaExecutorManyProducers ----------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaExecutorManyProducers)
+{
+   using namespace Diluculum;
+
+   const int numThreads = 8;
+   const int numJobs = 500;
+
+   LuaExecutor executor (SetupState);
+
+   // Boost.Test checks are not thread-safe, so just count the failures here
+   std::atomic<int> wrongResults (0);
+
+   std::vector<std::thread> threads;
+   for (int i = 0; i < numThreads; ++i)
+   {
+      threads.push_back (std::thread ([&executor, &wrongResults, i] {
+         for (int j = 0; j < numJobs; ++j)
+         {
+            LuaValueList params;
+            params.push_back (i);
+            params.push_back (j);
+            if (j % 50 == 0)
+            {
+               LuaValueList r = executor.submitGlobal ("addMul", params).get();
+               if (r[0] != i + j)
+                  ++wrongResults;
+            }
+            else
+            {
+               executor.post ([] (LuaState& ls) {
+                  ls.doString ("calls = calls + 1");
+               });
+            }
+         }
+      }));
+   }
+
+   for (std::size_t i = 0; i < threads.size(); ++i)
+      threads[i].join();
+
+   BOOST_CHECK_EQUAL (wrongResults.load(), 0);
+
+   LuaFunction getCalls ("return calls");
+   const LuaValueList r = executor.submit (getCalls, LuaValueList()).get();
+   BOOST_CHECK (r[0] == numThreads * numJobs);
+}
+
+
+
+// - TestLuaExecutorGroup ------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaExecutorGroup)
+{
+   using namespace Diluculum;
+
+   LuaExecutorGroup group (3, SetupState);
+   BOOST_REQUIRE_EQUAL (group.size(), 3);
+
+   LuaValueList params;
+   params.push_back (2);
+   params.push_back (5);
+
+   std::vector<std::future<LuaValueList> > results;
+   for (int i = 0; i < 30; ++i)
+      results.push_back (group.submitGlobal ("addMul", params));
+
+   for (std::size_t i = 0; i < results.size(); ++i)
+      BOOST_CHECK (results[i].get()[1] == 10);
+
+   // Round-robin: each executor got the same share of the work
+   LuaFunction getCalls ("return calls");
+   for (std::size_t i = 0; i < group.size(); ++i)
+   {
+      BOOST_CHECK (group[i].submit (getCalls, LuaValueList()).get()[0]
+                   == 10);
+   }
+}
@@ -0,0 +1,229 @@
+/******************************************************************************\
+* TestLuaFunctionRef.cpp                                                       *
+* Tests for 'LuaFunctionRef'.                                                  *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#define BOOST_TEST_MODULE LuaFunctionRef
+
+#include <boost/test/unit_test.hpp>
+#include <Diluculum/LuaFunctionRef.hpp>
+#include <Diluculum/LuaState.hpp>
+
+
+// - TestCall ------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestCall)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   ls.doString ("function add (a, b) return a + b, a - b end");
+
+   const int top = lua_gettop (ls.getState());
+
+   LuaFunctionRef add (ls["add"]);
+   BOOST_REQUIRE (add.isValid());
+   BOOST_CHECK_EQUAL (add.getState(), ls.getState());
+
+   LuaValueList params;
+   params.push_back (5);
+   params.push_back (3);
+
+   LuaValueList ret = add (params);
+   BOOST_REQUIRE_EQUAL (ret.size(), 2U);
+   BOOST_CHECK (ret[0] == 8);
+   BOOST_CHECK (ret[1] == 2);
+
+   // The results buffer is reused
+   LuaValueList results;
+   for (int i = 0; i < 10; ++i)
+   {
+      params[0] = i;
+      add.call (params, results);
+      BOOST_REQUIRE_EQUAL (results.size(), 2U);
+      BOOST_CHECK (results[0] == i + 3);
+   }
+
+   // The reference keeps the function, even if the variable changes
+   ls.doString ("add = nil; collectgarbage()");
+   ret = add (params);
+   BOOST_REQUIRE_EQUAL (ret.size(), 2U);
+   BOOST_CHECK (ret[0] == 12);
+
+   // Errors are reported as usual
+   ls.doString ("function fail() error 'Oops' end");
+   LuaFunctionRef fail (ls["fail"]);
+   BOOST_CHECK_THROW (fail(), LuaRunTimeError);
+
+   BOOST_CHECK_EQUAL (lua_gettop (ls.getState()), top);
+}
+
+
+
+// - TestNotAFunction ----------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestNotAFunction)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   ls.doString ("x = 10; t = { }");
+
+   const int top = lua_gettop (ls.getState());
+
+   BOOST_CHECK_THROW (LuaFunctionRef f (ls["x"]), TypeMismatchError);
+   BOOST_CHECK_THROW (LuaFunctionRef f (ls["t"]), TypeMismatchError);
+   BOOST_CHECK_THROW (LuaFunctionRef f (ls["undefined"]), TypeMismatchError);
+
+   BOOST_CHECK_EQUAL (lua_gettop (ls.getState()), top);
+
+   LuaFunctionRef invalid;
+   BOOST_CHECK (!invalid.isValid());
+   BOOST_CHECK_THROW (invalid(), LuaError);
+}
+
+
+
+// - TestLifetime --------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLifetime)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   ls.doString ("weak = setmetatable ({ }, { __mode = 'v' }); "
+                "weak[1] = function() return 'alive' end; "
+                "f = weak[1]");
+
+   LuaFunctionRef f (ls["f"]);
+   ls.doString ("f = nil");
+
+   // Copies and moves reference the same function
+   LuaFunctionRef copy (f);
+   LuaFunctionRef moved (std::move (f));
+   BOOST_CHECK (!f.isValid());
+   BOOST_REQUIRE (copy.isValid());
+   BOOST_REQUIRE (moved.isValid());
+   BOOST_CHECK (copy()[0] == "alive");
+   BOOST_CHECK (moved()[0] == "alive");
+
+   LuaFunctionRef assigned;
+   assigned = copy;
+   BOOST_CHECK (assigned.isValid());
+
+   // The function stays alive while some reference exists
+   copy.reset();
+   moved.reset();
+   BOOST_CHECK (!copy.isValid());
+   ls.doString ("collectgarbage(); collectgarbage()");
+   BOOST_CHECK (ls["weak"][1].value() != Nil);
+
+   assigned.reset();
+   ls.doString ("collectgarbage(); collectgarbage()");
+   BOOST_CHECK (ls["weak"][1].value() == Nil);
+}
+
+
+
+// - TestFromStack -------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestFromStack)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   lua_State* state = ls.getState();
+
+   luaL_loadstring (state, "return 'chunk'");
+   LuaFunctionRef chunk (state, -1);
+   lua_pop (state, 1);
+
+   const LuaValueList ret = chunk();
+   BOOST_REQUIRE_EQUAL (ret.size(), 1U);
+   BOOST_CHECK (ret[0] == "chunk");
+
+   lua_pushnumber (state, 1.0);
+   BOOST_CHECK_THROW (LuaFunctionRef f (state, -1), TypeMismatchError);
+   lua_pop (state, 1);
+}
+
+
+
+// - TestTypedCall -------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestTypedCall)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   ls.doString ("function mad (a, b, c) return a * b + c, 'mad' end");
+
+   LuaFunctionRef mad (ls["mad"]);
+
+   const LuaValueList ret = mad (2, 3, 4);
+   BOOST_REQUIRE_EQUAL (ret.size(), 2U);
+   BOOST_CHECK (ret[0] == 10);
+
+   double acc = 0.0;
+   for (int i = 0; i < 100; ++i)
+      acc = mad.call<double> (acc, 1.0, 1.0);
+   BOOST_CHECK_EQUAL (acc, 100.0);
+
+   const std::tuple<int, std::string> t =
+      mad.call<std::tuple<int, std::string> > (1, 1, 1);
+   BOOST_CHECK_EQUAL (std::get<0>(t), 2);
+   BOOST_CHECK_EQUAL (std::get<1>(t), "mad");
+
+   BOOST_CHECK_EQUAL (lua_gettop (ls.getState()), 0);
+}
+
+
+
+// - TestTryCall ---------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestTryCall)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   ls.doString ("function check (x) assert (x ~= 'bad', 'bad input'); "
+                "return x end");
+
+   LuaFunctionRef check (ls["check"]);
+
+   LuaResult result = check.tryCall (LuaValueList (1, "good"));
+   BOOST_REQUIRE (result.ok());
+   BOOST_CHECK (result.values()[0] == "good");
+
+   result = check.tryCall (LuaValueList (1, "bad"));
+   BOOST_CHECK_EQUAL (result.status(), LUA_ERRRUN);
+   BOOST_CHECK (std::string (result.errorMessage()).find ("bad input")
+                != std::string::npos);
+
+   // Results of types not supported by 'LuaValue' are errors, too
+   ls.doString ("function makeThread() "
+                "   return coroutine.create (function() end) "
+                "end");
+   LuaFunctionRef makeThread (ls["makeThread"]);
+   result = makeThread.tryCall();
+   BOOST_CHECK_EQUAL (result.status(), LUA_ERRRUN);
+   BOOST_CHECK (result.values().empty());
+
+   BOOST_CHECK_EQUAL (lua_gettop (ls.getState()), 0);
+}
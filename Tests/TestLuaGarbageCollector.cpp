@@ -0,0 +1,113 @@
+/******************************************************************************\
+* TestLuaGarbageCollector.cpp                                                  *
+* Unit tests for 'LuaGarbageCollector'.                                        *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#define BOOST_TEST_MODULE LuaGarbageCollector
+
+#include <boost/test/unit_test.hpp>
+#include <Diluculum/LuaGarbageCollector.hpp>
+#include <Diluculum/LuaState.hpp>
+
+
+// - TestManualCollection ------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestManualCollection)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   LuaGarbageCollector gc (ls);
+   BOOST_CHECK (gc.isAutomatic());
+
+   gc.stopAutomatic();
+   BOOST_CHECK (!gc.isAutomatic());
+
+   // With the collector stopped, garbage accumulates
+   const std::size_t memoryBefore = gc.memoryInUse();
+   ls.doString ("for i = 1, 10000 do local t = { i, i, i } end");
+   const std::size_t memoryWithGarbage = gc.memoryInUse();
+   BOOST_CHECK (memoryWithGarbage > memoryBefore + 100000);
+
+   // Step until a cycle finishes
+   bool finished = false;
+   for (int i = 0; i < 10000 && !finished; ++i)
+      finished = gc.step (0.001);
+   BOOST_CHECK (finished);
+
+   const LuaGarbageCollector::Stats& stats = gc.stats();
+   BOOST_CHECK (stats.steps > 0);
+   BOOST_CHECK (stats.cycles >= 1);
+   BOOST_CHECK (stats.collectedBytes > 100000);
+   BOOST_CHECK (stats.totalStepTime >= stats.maxStepTime);
+   BOOST_CHECK (stats.maxStepTime >= stats.lastStepTime);
+   BOOST_CHECK (gc.memoryInUse() < memoryWithGarbage);
+
+   // Stepping doesn't restart the automatic collector
+   BOOST_CHECK (!gc.isAutomatic());
+   std::size_t memoryAfterCollection = gc.memoryInUse();
+   ls.doString ("for i = 1, 100000 do local t = { i, i, i } end");
+   BOOST_CHECK (gc.memoryInUse() > memoryAfterCollection + 1000000);
+
+   // Neither does a full collection
+   gc.collect();
+   memoryAfterCollection = gc.memoryInUse();
+   ls.doString ("for i = 1, 100000 do local t = { i, i, i } end");
+   BOOST_CHECK (gc.memoryInUse() > memoryAfterCollection + 1000000);
+
+   gc.resetStats();
+   BOOST_CHECK_EQUAL (gc.stats().steps, 0);
+   BOOST_CHECK_EQUAL (gc.stats().collectedBytes, 0);
+
+   gc.restartAutomatic();
+   BOOST_CHECK (gc.isAutomatic());
+}
+
+
+
+// - TestStepBudget ------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestStepBudget)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   LuaGarbageCollector gc (ls);
+   gc.stopAutomatic();
+
+   ls.doString ("keep = { }; for i = 1, 100000 do keep[i] = { i } end; "
+                "keep = nil");
+
+   // A tiny budget still performs one (small) step
+   BOOST_CHECK (!gc.step (0.0, 1));
+   BOOST_CHECK_EQUAL (gc.stats().steps, 1);
+
+   // Tuning parameters return the previous values
+   const int pause = gc.setPause (150);
+   BOOST_CHECK_EQUAL (gc.setPause (pause), 150);
+   const int stepMul = gc.setStepMultiplier (400);
+   BOOST_CHECK_EQUAL (gc.setStepMultiplier (stepMul), 400);
+
+   gc.collect();
+   BOOST_CHECK (gc.memoryInUse() < 100000);
+}
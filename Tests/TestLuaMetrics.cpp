@@ -0,0 +1,220 @@
+/******************************************************************************\
+* TestLuaMetrics.cpp                                                           *
+* Tests for 'LuaMetrics'.                                                      *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#define BOOST_TEST_MODULE LuaMetrics
+
+#include <memory>
+#include <string>
+#include <boost/test/unit_test.hpp>
+#include <Diluculum/LuaMetrics.hpp>
+#include <Diluculum/LuaState.hpp>
+
+
+// - TestHistogram -------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestHistogram)
+{
+   using namespace Diluculum;
+
+   LuaMetrics::Histogram h;
+   BOOST_CHECK_EQUAL (h.count(), 0U);
+   BOOST_CHECK_EQUAL (h.percentile (0.5), 0U);
+
+   for (unsigned long long i = 1; i <= 1000; ++i)
+      h.record (i * 1000);
+
+   BOOST_CHECK_EQUAL (h.count(), 1000U);
+   BOOST_CHECK_EQUAL (h.total(), 500500000U);
+   BOOST_CHECK_EQUAL (h.min(), 1000U);
+   BOOST_CHECK_EQUAL (h.max(), 1000000U);
+
+   // Percentiles are within the precision of the buckets (1/16)
+   const double p50 = static_cast<double>(h.percentile (0.5));
+   BOOST_CHECK (p50 >= 500000 && p50 <= 500000 * 17.0 / 16.0);
+   const double p99 = static_cast<double>(h.percentile (0.99));
+   BOOST_CHECK (p99 >= 990000 && p99 <= 1000000);
+   BOOST_CHECK_EQUAL (h.percentile (1.0), 1000000U);
+
+   // Small values are exact
+   LuaMetrics::Histogram small;
+   small.record (3);
+   small.record (7);
+   BOOST_CHECK_EQUAL (small.percentile (0.5), 3U);
+
+   h.merge (small);
+   BOOST_CHECK_EQUAL (h.count(), 1002U);
+   BOOST_CHECK_EQUAL (h.min(), 3U);
+
+   h.reset();
+   BOOST_CHECK_EQUAL (h.count(), 0U);
+   BOOST_CHECK_EQUAL (h.max(), 0U);
+}
+
+
+
+// - TestCounters --------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestCounters)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   ls.doString ("function add (a, b) return a + b end\n"
+                "function fail() error 'oops' end");
+
+   LuaMetrics metrics (ls);
+   BOOST_CHECK (!metrics.isRunning());
+
+   // Nothing is recorded while stopped
+   ls["add"] (1, 2);
+   BOOST_CHECK_EQUAL (metrics.snapshot().calls, 0U);
+
+   metrics.start();
+   BOOST_CHECK (metrics.isRunning());
+
+   // Only one 'LuaMetrics' per state
+   LuaMetrics other (ls);
+   BOOST_CHECK_THROW (other.start(), LuaError);
+
+   ls["x"] = "hello";
+   const LuaValue x = ls["x"].value();
+   ls["add"] (LuaValueList (2, 1.0));
+   ls.call<double> ("add", 1, 2);
+   ls["fail"].tryCall();
+
+   LuaValueMap table;
+   table["a"] = 1;
+   ls["t"] = table;
+
+   const LuaMetrics::Snapshot s = metrics.snapshot();
+
+   if (!LuaMetrics::compiledIn())
+   {
+      BOOST_CHECK_EQUAL (s.calls, 0U);
+      BOOST_CHECK (s.functions.empty());
+      return;
+   }
+
+   BOOST_CHECK_EQUAL (s.calls, 3U);
+   BOOST_CHECK_EQUAL (s.callErrors, 1U);
+   BOOST_CHECK_EQUAL (s.variableReads, 1U);
+   BOOST_CHECK_EQUAL (s.variableWrites, 2U);
+   BOOST_CHECK_EQUAL (s.tablesCreated, 1U);
+
+   // "hello" (5 bytes), the two numbers of the call, the table, its key "a"
+   // and its value, plus the names of the five variables used ("x" twice,
+   // "add", "fail" and "t"). Typed calls don't convert through 'LuaValue'.
+   BOOST_CHECK_EQUAL (s.valuesToLua, 11U);
+   BOOST_CHECK_EQUAL (s.bytesToLua, 5 + 3 * sizeof (lua_Number) + 1 + 10);
+
+   // "hello", and the result of the call
+   BOOST_CHECK_EQUAL (s.valuesFromLua, 2U);
+   BOOST_CHECK_EQUAL (s.bytesFromLua, 5 + sizeof (lua_Number));
+
+   // Per-function metrics
+   BOOST_REQUIRE_EQUAL (s.functions.size(), 3U);
+   BOOST_CHECK_EQUAL (s.functions[0].name, "[string \"line\"]:1");
+   BOOST_CHECK_EQUAL (s.functions[0].calls, 1U);
+   BOOST_CHECK_EQUAL (s.functions[1].name, "[string \"line\"]:2");
+   BOOST_CHECK_EQUAL (s.functions[1].errors, 1U);
+   BOOST_CHECK_EQUAL (s.functions[2].name, "add");
+   BOOST_CHECK (s.functions[2].totalTime > 0.0);
+   BOOST_CHECK (s.functions[2].p50 <= s.functions[2].p99);
+   BOOST_CHECK (s.functions[2].maxTime >= s.functions[2].minTime);
+
+   BOOST_REQUIRE (metrics.histogram ("add") != 0);
+   BOOST_CHECK_EQUAL (metrics.histogram ("add")->count(), 1U);
+   BOOST_CHECK (metrics.histogram ("nothing") == 0);
+
+   // Stopping and resetting
+   metrics.stop();
+   ls["add"] (1, 2);
+   BOOST_CHECK_EQUAL (metrics.snapshot().calls, 3U);
+
+   metrics.reset();
+   BOOST_CHECK_EQUAL (metrics.snapshot().calls, 0U);
+   BOOST_CHECK (metrics.snapshot().functions.empty());
+
+   // Now that it is stopped, another one can run
+   other.start();
+   ls.doString ("return 1");
+   BOOST_CHECK_EQUAL (other.snapshot().calls, 1U);
+   BOOST_CHECK_EQUAL (other.snapshot().functions[0].name,
+                      "main chunk ([string \"line\"])");
+}
+
+
+
+// - TestPrometheusText --------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestPrometheusText)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   ls.doString ("function f() end");
+
+   LuaMetrics metrics (ls);
+   metrics.start();
+   ls.call<void> ("f");
+
+   const std::string text = metrics.prometheusText ("app", "state=\"s1\"");
+
+   BOOST_CHECK (text.find ("# TYPE app_calls_total counter\n")
+                != std::string::npos);
+
+   if (!LuaMetrics::compiledIn())
+      return;
+
+   BOOST_CHECK (text.find ("app_calls_total{state=\"s1\"} 1\n")
+                != std::string::npos);
+   BOOST_CHECK (text.find ("# TYPE app_call_duration_seconds summary\n")
+                != std::string::npos);
+   BOOST_CHECK (text.find ("app_call_duration_seconds{state=\"s1\","
+                           "function=\"f\",quantile=\"0.99\"} ")
+                != std::string::npos);
+   BOOST_CHECK (text.find ("app_call_duration_seconds_count{state=\"s1\","
+                           "function=\"f\"} 1\n")
+                != std::string::npos);
+}
+
+
+
+// - TestStateDestroyedWhileRunning --------------------------------------------
+BOOST_AUTO_TEST_CASE(TestStateDestroyedWhileRunning)
+{
+   using namespace Diluculum;
+
+   std::unique_ptr<LuaState> ls (new LuaState());
+   LuaMetrics metrics (*ls);
+
+   metrics.start();
+   (*ls)["x"] = 1;
+   ls.reset();
+
+   BOOST_CHECK (!metrics.isRunning());
+   if (LuaMetrics::compiledIn())
+      BOOST_CHECK_EQUAL (metrics.snapshot().variableWrites, 1U);
+   BOOST_CHECK_THROW (metrics.start(), LuaError);
+}
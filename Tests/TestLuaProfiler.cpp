@@ -0,0 +1,253 @@
+/******************************************************************************\
+* TestLuaProfiler.cpp                                                          *
+* Unit tests for 'LuaProfiler'.                                                *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#define BOOST_TEST_MODULE LuaProfiler
+
+#include <memory>
+#include <boost/test/unit_test.hpp>
+#include <Diluculum/LuaProfiler.hpp>
+#include <Diluculum/LuaState.hpp>
+#include <Diluculum/LuaWrappers.hpp>
+
+
+namespace
+{
+   /// The profiler started and stopped by the Lua functions below.
+   Diluculum::LuaProfiler* TheProfiler;
+
+   Diluculum::LuaValueList StartProfiler (const Diluculum::LuaValueList&)
+   {
+      TheProfiler->start();
+      return Diluculum::LuaValueList();
+   }
+
+   DILUCULUM_WRAP_FUNCTION (StartProfiler)
+
+   Diluculum::LuaValueList StopProfiler (const Diluculum::LuaValueList&)
+   {
+      TheProfiler->stop();
+      return Diluculum::LuaValueList();
+   }
+
+   DILUCULUM_WRAP_FUNCTION (StopProfiler)
+}
+
+
+
+// - TestProfiling -------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestProfiling)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   ls.doString ("function hot(n)\n"
+                "   local x = 0\n"
+                "   for i = 1, n do x = x + i end\n"
+                "   return x\n"
+                "end\n"
+                "function cold() return 1 end\n"
+                "function outer(n) cold(); local x = hot(n); return x end");
+
+   LuaProfiler profiler (ls, 100);
+   BOOST_CHECK (!profiler.isRunning());
+   BOOST_CHECK (lua_gethook (ls.getState()) == 0);
+
+   // Nothing is sampled while stopped
+   ls["outer"] (100000);
+   BOOST_CHECK_EQUAL (profiler.samples(), 0);
+
+   profiler.start();
+   BOOST_CHECK (profiler.isRunning());
+   ls["outer"] (100000);
+   profiler.stop();
+
+   BOOST_CHECK (lua_gethook (ls.getState()) == 0);
+   BOOST_REQUIRE (profiler.samples() > 100);
+
+   // The loop in 'hot()' is where virtually all the time goes
+   const std::vector<LuaProfiler::Entry> top = profiler.top (3);
+   BOOST_REQUIRE (!top.empty());
+   BOOST_CHECK_EQUAL (top[0].location, "[string \"line\"]:3");
+   BOOST_CHECK (top[0].samples > profiler.samples() / 2);
+
+   // Folded stacks name the whole call chain (Lua doesn't know the name of
+   // 'outer()', because it was called from C)
+   const std::string folded = profiler.foldedStacks();
+   BOOST_CHECK (folded.find ("? ([string \"line\"]:7);"
+                             "hot ([string \"line\"]:1) ") != std::string::npos);
+
+   const std::string report = profiler.report (5);
+   BOOST_CHECK (report.find ("[string \"line\"]:3") != std::string::npos);
+
+   profiler.reset();
+   BOOST_CHECK_EQUAL (profiler.samples(), 0);
+   BOOST_CHECK (profiler.top (10).empty());
+   BOOST_CHECK (profiler.foldedStacks().empty());
+}
+
+
+
+// - TestProfilingToggledFromLua -----------------------------------------------
+BOOST_AUTO_TEST_CASE(TestProfilingToggledFromLua)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   LuaProfiler profiler (ls, 50);
+   TheProfiler = &profiler;
+
+   ls["startProfiler"] = DILUCULUM_WRAPPER_FUNCTION (StartProfiler);
+   ls["stopProfiler"] = DILUCULUM_WRAPPER_FUNCTION (StopProfiler);
+
+   ls.doString ("local x = 0\n"
+                "for i = 1, 10000 do x = x + i end\n"
+                "startProfiler()\n"
+                "for i = 1, 10000 do x = x + i end\n"
+                "stopProfiler()\n"
+                "for i = 1, 10000 do x = x + i end\n");
+
+   BOOST_REQUIRE (profiler.samples() > 0);
+   const std::vector<LuaProfiler::Entry> top = profiler.top (10);
+   for (std::size_t i = 0; i < top.size(); ++i)
+      BOOST_CHECK (top[i].location == "[string \"line\"]:4"
+                   || top[i].location == "[string \"line\"]:5");
+
+   // Only one profiler per state
+   LuaProfiler other (ls);
+   profiler.start();
+   BOOST_CHECK_THROW (other.start(), LuaError);
+   profiler.stop();
+   BOOST_CHECK_NO_THROW (other.start());
+}
+
+
+
+// - TestProfilingWithLimits ---------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestProfilingWithLimits)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   LuaProfiler profiler (ls, 1000);
+
+   ls.setExecutionLimits (100000, 0.0, 5000);
+   profiler.start();
+   BOOST_CHECK_EQUAL (lua_gethookcount (ls.getState()), 1000);
+
+   BOOST_CHECK_THROW (ls.doString ("while true do end"), LuaExecutionLimitError);
+   BOOST_CHECK (profiler.samples() >= 90 && profiler.samples() <= 110);
+
+   ls.clearExecutionLimits();
+   BOOST_CHECK_EQUAL (lua_gethookcount (ls.getState()), 1000);
+   BOOST_CHECK_NO_THROW (ls.doString ("for i = 1, 1e6 do end"));
+
+   profiler.stop();
+   BOOST_CHECK (lua_gethook (ls.getState()) == 0);
+}
+
+
+
+// - TestProfilingCoroutines ---------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestProfilingCoroutines)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   LuaProfiler profiler (ls, 100);
+
+   profiler.start();
+   ls.doString ("co = coroutine.create (function() "
+                "   while true do "
+                "      for i = 1, 10000 do end; coroutine.yield() "
+                "   end "
+                "end); "
+                "coroutine.resume (co)");
+   profiler.stop();
+
+   BOOST_CHECK (profiler.samples() > 0);
+   const unsigned long samples = profiler.samples();
+
+   // The coroutine got the hook, and drops it once it is no longer needed
+   lua_getglobal (ls.getState(), "co");
+   lua_State* co = lua_tothread (ls.getState(), -1);
+   lua_pop (ls.getState(), 1);
+   BOOST_CHECK (lua_gethook (co) != 0);
+
+   ls.doString ("coroutine.resume (co)");
+   BOOST_CHECK (lua_gethook (co) == 0);
+   BOOST_CHECK_EQUAL (profiler.samples(), samples);
+}
+
+
+
+// - TestStateDestroyedWhileProfiling ------------------------------------------
+BOOST_AUTO_TEST_CASE(TestStateDestroyedWhileProfiling)
+{
+   using namespace Diluculum;
+
+   std::unique_ptr<LuaState> ls (new LuaState());
+   LuaProfiler profiler (*ls, 100);
+
+   profiler.start();
+   ls->doString ("for i = 1, 10000 do end");
+   ls.reset();
+
+   BOOST_CHECK (!profiler.isRunning());
+   BOOST_CHECK (profiler.samples() > 0);
+   BOOST_CHECK (!profiler.top (1).empty());
+   BOOST_CHECK_THROW (profiler.start(), LuaError);
+}
+
+
+
+// - TestDroppedSamples --------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestDroppedSamples)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   LuaProfiler profiler (ls, 1, 1);
+
+   // The hook never aggregates samples, so most of these don't fit
+   profiler.start();
+   ls.doString ("for i = 1, 100000 do end");
+   profiler.stop();
+
+   const unsigned long samples = profiler.samples();
+   BOOST_CHECK (samples > 0);
+   BOOST_CHECK (profiler.droppedSamples() > 0);
+   BOOST_CHECK (profiler.report().find ("dropped") != std::string::npos);
+
+   // Stopping aggregates the samples, making room for new ones
+   profiler.start();
+   ls.doString ("for i = 1, 100 do end");
+   profiler.stop();
+   BOOST_CHECK (profiler.samples() > samples);
+
+   profiler.reset();
+   BOOST_CHECK_EQUAL (profiler.droppedSamples(), 0);
+}
@@ -30,6 +30,22 @@
 #include <Diluculum/LuaState.hpp>
 
 
+namespace
+{
+   /// The calls suspended by \c SuspendCall().
+   std::vector<Diluculum::LuaState::AsyncCallId> SuspendedCalls;
+
+   /** A C function that suspends the asynchronous call in which it is running,
+    *  leaving it in \c SuspendedCalls.
+    */
+   int SuspendCall (lua_State* ls)
+   {
+      SuspendedCalls.push_back (Diluculum::LuaState::getAsyncCallId (ls));
+      return lua_yield (ls, 0);
+   }
+}
+
+
 // - TestLuaStateNotOwner ------------------------------------------------------
 BOOST_AUTO_TEST_CASE(TestLuaStateNotOwner)
 {
@@ -294,3 +310,525 @@ BOOST_AUTO_TEST_CASE(TestGlobalsTableAccess)
    globals = state.globals();
    BOOST_CHECK_EQUAL (globals["foo"].type(), LUA_TSTRING);
 }
+
+
+
+// - TestCallAsync -------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestCallAsync)
+{
+   using namespace Diluculum;
+
+   LuaState state;
+   state["fetch"] = SuspendCall;
+   state.doString ("function fetchTwice(x) "
+                   "   local a = fetch(x) "
+                   "   local b = fetch(a) "
+                   "   return a + b, 'done' "
+                   "end");
+
+   SuspendedCalls.clear();
+
+   LuaValueList params;
+   params.push_back (1);
+   std::future<LuaValueList> f = state.callAsync (state["fetchTwice"], params);
+
+   // Suspended in the first 'fetch()'
+   BOOST_REQUIRE_EQUAL (SuspendedCalls.size(), 1);
+   BOOST_CHECK_EQUAL (state.pendingAsyncCalls(), 1);
+   BOOST_CHECK (f.wait_for (std::chrono::seconds(0))
+                == std::future_status::timeout);
+
+   // Suspended in the second 'fetch()'
+   state.resumeAsync (SuspendedCalls[0], LuaValueList (1, 10));
+   BOOST_REQUIRE_EQUAL (SuspendedCalls.size(), 2);
+   BOOST_CHECK (SuspendedCalls[0] == SuspendedCalls[1]);
+   BOOST_CHECK (f.wait_for (std::chrono::seconds(0))
+                == std::future_status::timeout);
+
+   // Finished
+   state.resumeAsync (SuspendedCalls[1], LuaValueList (1, 20));
+   BOOST_REQUIRE (f.wait_for (std::chrono::seconds(0))
+                  == std::future_status::ready);
+   BOOST_CHECK_EQUAL (state.pendingAsyncCalls(), 0);
+
+   const LuaValueList ret = f.get();
+   BOOST_REQUIRE_EQUAL (ret.size(), 2);
+   BOOST_CHECK (ret[0] == 30);
+   BOOST_CHECK (ret[1] == "done");
+
+   // A finished call cannot be resumed
+   BOOST_CHECK_THROW (state.resumeAsync (SuspendedCalls[1], LuaValueList()),
+                      LuaError);
+
+   // Not even after its thread is collected and another call starts
+   state.doString ("collectgarbage()");
+   std::future<LuaValueList> f3 = state.callAsync (state["fetchTwice"],
+                                                   params);
+   BOOST_REQUIRE_EQUAL (SuspendedCalls.size(), 3);
+   BOOST_CHECK (SuspendedCalls[2] != SuspendedCalls[1]);
+   BOOST_CHECK_THROW (state.resumeAsync (SuspendedCalls[1], LuaValueList()),
+                      LuaError);
+   BOOST_CHECK_EQUAL (state.pendingAsyncCalls(), 1);
+
+   state.resumeAsync (SuspendedCalls[2], LuaValueList (1, 1));
+   state.resumeAsync (SuspendedCalls[3], LuaValueList (1, 2));
+   BOOST_CHECK (f3.get()[0] == 3);
+
+   // Outside asynchronous calls, there is no call identifier
+   BOOST_CHECK_EQUAL (LuaState::getAsyncCallId (state.getState()),
+                      LuaState::NoAsyncCall);
+
+   // Calls that never yield finish immediately, calling the callback before
+   // 'callAsync()' returns
+   bool called = false;
+   LuaFunction f2 ("return 'quick'");
+   state.callAsync (f2, LuaValueList(),
+                    [&called] (const LuaValueList& r, std::exception_ptr e) {
+                       called = true;
+                       BOOST_CHECK (!e);
+                       BOOST_CHECK (r[0] == "quick");
+                    });
+   BOOST_CHECK (called);
+}
+
+
+
+// - TestCallAsyncMany ---------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestCallAsyncMany)
+{
+   using namespace Diluculum;
+
+   LuaState state;
+   state["fetch"] = SuspendCall;
+   state.doString ("function addFetched(x) return x + fetch() end");
+
+   SuspendedCalls.clear();
+
+   // Lots of calls in flight at the same time, in a single state
+   const int numCalls = 1000;
+   std::vector<std::future<LuaValueList> > results;
+   for (int i = 0; i < numCalls; ++i)
+      results.push_back (state.callAsync (state["addFetched"],
+                                          LuaValueList (1, i)));
+
+   BOOST_REQUIRE_EQUAL (SuspendedCalls.size(), numCalls);
+   BOOST_CHECK_EQUAL (state.pendingAsyncCalls(), numCalls);
+
+   // Resume them in reverse order
+   for (int i = numCalls - 1; i >= 0; --i)
+      state.resumeAsync (SuspendedCalls[i], LuaValueList (1, 1000));
+
+   BOOST_CHECK_EQUAL (state.pendingAsyncCalls(), 0);
+
+   for (int i = 0; i < numCalls; ++i)
+      BOOST_CHECK (results[i].get()[0] == i + 1000);
+
+   // Nothing was left on the stack
+   BOOST_CHECK_EQUAL (lua_gettop (state.getState()), 0);
+}
+
+
+
+// - TestCallAsyncErrors -------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestCallAsyncErrors)
+{
+   using namespace Diluculum;
+
+   LuaState state;
+   state["fetch"] = SuspendCall;
+   state.doString ("function failAfterFetch() fetch(); error('oops') end");
+
+   SuspendedCalls.clear();
+
+   std::future<LuaValueList> f =
+      state.callAsync (state["failAfterFetch"], LuaValueList());
+   BOOST_REQUIRE_EQUAL (SuspendedCalls.size(), 1);
+
+   state.resumeAsync (SuspendedCalls[0], LuaValueList());
+   BOOST_CHECK_THROW (f.get(), LuaRunTimeError);
+   BOOST_CHECK_EQUAL (state.pendingAsyncCalls(), 0);
+
+   // Calling something that is not a function
+   state["notAFunction"] = 123;
+   BOOST_CHECK_THROW (state.callAsync (state["notAFunction"], LuaValueList()),
+                      TypeMismatchError);
+   BOOST_CHECK_EQUAL (lua_gettop (state.getState()), 0);
+}
+
+
+
+// - TestExecutionLimits -------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestExecutionLimits)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   ls.doString ("function count(n) local x = 0; "
+                "for i = 1, n do x = x + 1 end; return x end");
+
+   // Instruction limit
+   ls.setExecutionLimits (100000);
+   BOOST_CHECK_THROW (ls.doString ("while true do end"), LuaExecutionLimitError);
+   BOOST_CHECK_THROW (ls["count"] (1000000), LuaRunTimeError);
+
+   // Each call gets its own budget
+   for (int i = 0; i < 10; ++i)
+      BOOST_CHECK_EQUAL (ls["count"] (1000)[0].asNumber(), 1000);
+
+   // Lua code cannot escape by catching the error
+   BOOST_CHECK_THROW (ls.doString ("while true do pcall(count, 1e9) end"),
+                      LuaExecutionLimitError);
+
+   // Ordinary errors are still reported as such
+   try
+   {
+      ls.doString ("error('oops')");
+      BOOST_ERROR ("An exception should have been thrown.");
+   }
+   catch (const LuaExecutionLimitError&)
+   {
+      BOOST_ERROR ("Got the wrong exception type.");
+   }
+   catch (const LuaRunTimeError&)
+   { }
+
+   // Coroutines exceeding the limits get their hook restored afterwards
+   ls.doString ("co = coroutine.create (function() while true do end end)");
+   BOOST_CHECK_THROW (ls.doString ("coroutine.resume (co); while true do end"),
+                      LuaExecutionLimitError);
+   lua_getglobal (ls.getState(), "co");
+   BOOST_CHECK_EQUAL (lua_gethookcount (lua_tothread (ls.getState(), -1)),
+                      1000);
+   lua_pop (ls.getState(), 1);
+
+   // Asynchronous calls are limited, too (each resumption separately)
+   ls["fetch"] = SuspendCall;
+   ls.doString ("function fetchAndLoop() fetch(); while true do end end");
+   SuspendedCalls.clear();
+
+   std::future<LuaValueList> f =
+      ls.callAsync (ls["fetchAndLoop"], LuaValueList());
+   BOOST_REQUIRE_EQUAL (SuspendedCalls.size(), 1);
+   ls.resumeAsync (SuspendedCalls[0], LuaValueList());
+   BOOST_CHECK_THROW (f.get(), LuaExecutionLimitError);
+   BOOST_CHECK_EQUAL (ls.pendingAsyncCalls(), 0);
+
+   // Time limit
+   ls.setExecutionLimits (0, 0.05);
+   BOOST_CHECK_THROW (ls.doString ("while true do end"), LuaExecutionLimitError);
+
+   // No limits
+   ls.clearExecutionLimits();
+   BOOST_CHECK (lua_gethook (ls.getState()) == 0);
+   BOOST_CHECK_EQUAL (ls["count"] (1000000)[0].asNumber(), 1000000);
+   BOOST_CHECK_EQUAL (lua_gettop (ls.getState()), 0);
+}
+
+
+
+// - TestCheckpoint ------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestCheckpoint)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   BOOST_CHECK (!ls.hasCheckpoint());
+   BOOST_CHECK_THROW (ls.restore(), LuaError);
+
+   ls.doString ("config = { size = 10, list = { 1, 2, 3 } }\n"
+                "shared = config.list\n"
+                "function get() return config.size end");
+   ls.checkpoint();
+   BOOST_CHECK (ls.hasCheckpoint());
+
+   const int memoryAtCheckpoint = lua_gc (ls.getState(), LUA_GCCOUNT, 0);
+
+   // Dirty the state in many ways
+   ls.doString ("garbage = { }; for i = 1, 10000 do garbage[i] = { i } end\n"
+                "config.size = 20; config.extra = 'x'; table.insert (shared, 4)\n"
+                "config.list = nil; get = nil; string.evil = true\n"
+                "setmetatable (config, { __index = function() return 1 end })\n"
+                "package.loaded.fake = { }");
+
+   ls.restore();
+
+   BOOST_CHECK (ls["garbage"] == Nil);
+   BOOST_CHECK (ls["config"]["size"] == 10);
+   BOOST_CHECK (ls["config"]["extra"] == Nil);
+   BOOST_CHECK (ls["string"]["evil"] == Nil);
+   BOOST_CHECK (ls["package"]["loaded"]["fake"] == Nil);
+   BOOST_CHECK (ls.doString ("return #shared")[0] == 3);
+   BOOST_CHECK (ls.doString ("return config.list == shared")[0] == true);
+   BOOST_CHECK (ls.doString ("return getmetatable (config)")[0] == Nil);
+   BOOST_CHECK (ls["get"]()[0] == 10);
+
+   // The garbage was collected
+   BOOST_CHECK (lua_gc (ls.getState(), LUA_GCCOUNT, 0)
+                < memoryAtCheckpoint + 100);
+
+   // The checkpoint can be restored again
+   ls.doString ("config.size = 30");
+   ls.restore (false);
+   BOOST_CHECK (ls["config"]["size"] == 10);
+   BOOST_CHECK_EQUAL (lua_gettop (ls.getState()), 0);
+
+   // Metamethods of metatables are not triggered while recording
+   ls.doString ("local meta = setmetatable ({ }, { "
+                "   __index = function() error ('touched') end }) "
+                "guarded = setmetatable ({ x = 1 }, meta)");
+   BOOST_CHECK_NO_THROW (ls.checkpoint());
+   ls.doString ("guarded.x = 2");
+   ls.restore();
+   BOOST_CHECK (ls.doString ("return rawget (guarded, 'x')")[0] == 1);
+
+   // Checkpoints messed with by scripts are reported as errors
+   ls.doString ("local cp = debug.getregistry().__Diluculum__Checkpoint; "
+                "for t in pairs (cp[1]) do cp[1][t] = 'oops' end");
+   BOOST_CHECK_THROW (ls.restore(), LuaError);
+   ls.doString ("debug.getregistry().__Diluculum__Checkpoint = { }");
+   BOOST_CHECK_THROW (ls.restore(), LuaError);
+   BOOST_CHECK_EQUAL (lua_gettop (ls.getState()), 0);
+
+   // Tables nested too deeply are not recorded
+   ls.doString ("deep = { }; "
+                "for i = 1, 5000 do deep = { next = deep } end");
+   BOOST_CHECK_THROW (ls.checkpoint(), LuaError);
+   BOOST_CHECK (!ls.hasCheckpoint());
+   BOOST_CHECK_EQUAL (lua_gettop (ls.getState()), 0);
+}
+
+
+
+// - TestSelectiveStdLibs ------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestSelectiveStdLibs)
+{
+   using namespace Diluculum;
+
+   LuaState ls (BASE_LIB | STRING_LIB | MATH_LIB);
+
+   BOOST_CHECK (ls["print"].value().type() == LUA_TFUNCTION);
+   BOOST_CHECK (ls["string"].value().type() == LUA_TTABLE);
+   BOOST_CHECK (ls["math"].value().type() == LUA_TTABLE);
+   BOOST_CHECK (ls["io"] == Nil);
+   BOOST_CHECK (ls["os"] == Nil);
+   BOOST_CHECK (ls["debug"] == Nil);
+   BOOST_CHECK (ls["require"] == Nil);
+   BOOST_CHECK (ls["table"] == Nil);
+   BOOST_CHECK (ls.doString ("return ('abc'):upper()")[0] == "ABC");
+
+   LuaState none (NO_LIBS);
+   BOOST_CHECK (none["print"] == Nil);
+}
+
+
+
+// - TestLazyStdLibs -----------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLazyStdLibs)
+{
+   using namespace Diluculum;
+
+   LuaState ls (BASE_LIB, IO_LIB | OS_LIB | STRING_LIB | PACKAGE_LIB);
+
+   // Nothing loaded yet
+   lua_State* state = ls.getState();
+   lua_getfield (state, LUA_REGISTRYINDEX, "_LOADED");
+   lua_getfield (state, -1, "os");
+   BOOST_CHECK (lua_isnil (state, -1));
+   lua_getfield (state, -2, "string");
+   BOOST_CHECK (lua_isnil (state, -1));
+   lua_settop (state, 0);
+
+   // Loaded on first use
+   BOOST_CHECK (ls.doString ("return type (os.time())")[0] == "number");
+   BOOST_CHECK (ls.doString ("return ('abc'):upper()")[0] == "ABC");
+   BOOST_CHECK (ls.doString ("return string.rep ('a', 3)")[0] == "aaa");
+   BOOST_CHECK (ls.doString ("return type (require)")[0] == "function");
+   BOOST_CHECK (ls.doString ("return package.loaded.os == os")[0] == true);
+
+   // Libraries not requested are still unavailable
+   BOOST_CHECK (ls.doString ("return debug")[0] == Nil);
+   BOOST_CHECK (ls.doString ("return undefinedGlobal")[0] == Nil);
+
+   // Survives a checkpoint/restore cycle
+   LuaState other (BASE_LIB, MATH_LIB);
+   other.checkpoint();
+   BOOST_CHECK (other.doString ("return math.floor (1.5)")[0] == 1);
+   other.restore();
+   BOOST_CHECK (other.doString ("return math.floor (2.5)")[0] == 2);
+}
+
+
+
+// - TestCallBatch -------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestCallBatch)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   ls.doString ("calls = 0\n"
+                "function score (a, b) calls = calls + 1; return a * b, a + b end");
+
+   std::vector<LuaValueList> params;
+   for (int i = 0; i < 100; ++i)
+   {
+      LuaValueList p;
+      p.push_back (i);
+      p.push_back (2);
+      params.push_back (p);
+   }
+
+   std::vector<LuaValueList> results = ls.callBatch (ls["score"], params);
+   BOOST_REQUIRE_EQUAL (results.size(), 100);
+   for (int i = 0; i < 100; ++i)
+   {
+      BOOST_REQUIRE_EQUAL (results[i].size(), 2);
+      BOOST_CHECK (results[i][0] == i * 2);
+      BOOST_CHECK (results[i][1] == i + 2);
+   }
+   BOOST_CHECK (ls["calls"] == 100);
+
+   // Reusing the results container
+   params.resize (10);
+   ls.callBatch (ls["score"], params, results);
+   BOOST_CHECK_EQUAL (results.size(), 10);
+   BOOST_CHECK (results[9][0] == 18);
+
+   // Streaming
+   int next = 0;
+   double sum = 0;
+   const std::size_t numCalls = ls.callBatch (
+      ls["score"],
+      [&next] (LuaValueList& p) {
+         if (next == 1000)
+            return false;
+         p.push_back (next++);
+         p.push_back (1);
+         return true;
+      },
+      [&sum] (const LuaValueList& r) { sum += r[0].asNumber(); });
+
+   BOOST_CHECK_EQUAL (numCalls, 1000);
+   BOOST_CHECK_EQUAL (sum, 999 * 1000 / 2);
+   BOOST_CHECK_EQUAL (lua_gettop (ls.getState()), 0);
+
+   // Errors
+   ls["notAFunction"] = 1;
+   BOOST_CHECK_THROW (ls.callBatch (ls["notAFunction"], params),
+                      TypeMismatchError);
+   params[5][1] = "oops";
+   BOOST_CHECK_THROW (ls.callBatch (ls["score"], params), LuaRunTimeError);
+   BOOST_CHECK_EQUAL (lua_gettop (ls.getState()), 0);
+}
+
+
+
+// - TestTryDoString -----------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestTryDoString)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+
+   // Success
+   LuaResult result = ls.tryDoString ("return 1, 'two'");
+   BOOST_CHECK (result.ok());
+   BOOST_CHECK (result);
+   BOOST_CHECK_EQUAL (result.status(), 0);
+   BOOST_CHECK_EQUAL (std::string (result.errorMessage()), "");
+   BOOST_REQUIRE_EQUAL (result.values().size(), 2U);
+   BOOST_CHECK (result.values()[1] == "two");
+
+   // Errors of all kinds, with no exceptions thrown
+   result = ls.tryDoString ("error ('invalid input', 0)");
+   BOOST_CHECK (!result.ok());
+   BOOST_CHECK_EQUAL (result.status(), LUA_ERRRUN);
+   BOOST_CHECK_EQUAL (std::string (result.errorMessage(),
+                                   result.errorMessageLength()),
+                      "invalid input");
+   BOOST_CHECK (!result.executionLimitExceeded());
+   BOOST_CHECK (result.values().empty());
+   BOOST_CHECK_THROW (result.throwIfError(), LuaRunTimeError);
+
+   result = ls.tryDoString ("not Lua at all");
+   BOOST_CHECK_EQUAL (result.status(), LUA_ERRSYNTAX);
+   BOOST_CHECK_THROW (result.throwIfError(), LuaSyntaxError);
+
+   result = ls.tryDoFile ("ThisFileDoesNotExist.lua");
+   BOOST_CHECK_EQUAL (result.status(), LUA_ERRFILE);
+   BOOST_CHECK_THROW (result.throwIfError(), LuaFileError);
+
+   result = ls.tryDoString ("error { }");
+   BOOST_CHECK_EQUAL (result.status(), LUA_ERRRUN);
+   BOOST_CHECK (std::string (result.errorMessage()).length() > 0);
+
+   ls.setExecutionLimits (10000);
+   result = ls.tryDoString ("while true do end");
+   BOOST_CHECK_EQUAL (result.status(), LUA_ERRRUN);
+   BOOST_CHECK (result.executionLimitExceeded());
+   BOOST_CHECK_THROW (result.throwIfError(), LuaExecutionLimitError);
+   ls.clearExecutionLimits();
+
+   // Function calls
+   ls.doString ("function validate (x) "
+                "   if x < 0 then error ('negative', 0) end; return x * 2 "
+                "end");
+
+   for (int i = 0; i < 100; ++i)
+   {
+      result = ls["validate"].tryCall (LuaValueList (1, i % 2 == 0 ? -i - 1 : i));
+      if (i % 2 == 0)
+      {
+         BOOST_REQUIRE (!result.ok());
+         BOOST_CHECK_EQUAL (std::string (result.errorMessage()), "negative");
+      }
+      else
+      {
+         BOOST_REQUIRE (result.ok());
+         BOOST_CHECK (result.values()[0] == i * 2);
+      }
+   }
+
+   result = ls["undefined"].tryCall();
+   BOOST_CHECK_EQUAL (result.status(), LUA_ERRRUN);
+
+   LuaFunction func ("return ...", 10);
+   result = ls.tryCall (func, LuaValueList (1, "echo"));
+   BOOST_REQUIRE (result.ok());
+   BOOST_CHECK (result.values()[0] == "echo");
+
+   // Errors detected on the C++ side are not thrown, either
+   LuaFunction badChunk ("not Lua at all");
+   result = ls.tryCall (badChunk, LuaValueList(), "badChunk");
+   BOOST_CHECK_EQUAL (result.status(), LUA_ERRSYNTAX);
+   BOOST_CHECK (std::string (result.errorMessage()).find ("badChunk")
+                != std::string::npos);
+
+   LuaFunction returnThread ("return coroutine.create (function() end)");
+   result = ls.tryCall (returnThread, LuaValueList());
+   BOOST_CHECK_EQUAL (result.status(), LUA_ERRRUN);
+   BOOST_CHECK (result.values().empty());
+
+   result = ls.tryDoString ("return 1, coroutine.create (function() end)");
+   BOOST_CHECK_EQUAL (result.status(), LUA_ERRRUN);
+   BOOST_CHECK (result.values().empty());
+
+   ls.doString ("function noop() end");
+   LuaVariable create = ls["coroutine"]["create"];
+   result = create.tryCall (LuaValueList (1, ls["noop"].value()));
+   BOOST_CHECK_EQUAL (result.status(), LUA_ERRRUN);
+   BOOST_CHECK (result.values().empty());
+
+   BOOST_CHECK_THROW (ls.doString ("return coroutine.create (function() end)"),
+                      LuaTypeError);
+
+   // The error message outlives later errors
+   result = ls.tryDoString ("error ('first', 0)");
+   LuaResult otherResult = ls.tryDoString ("error ('second', 0)");
+   BOOST_CHECK_EQUAL (std::string (result.errorMessage()), "first");
+   BOOST_CHECK_EQUAL (std::string (otherResult.errorMessage()), "second");
+
+   // The throwing functions are not affected
+   BOOST_CHECK_THROW (ls.doString ("error 'oops'"), LuaRunTimeError);
+
+   BOOST_CHECK_EQUAL (lua_gettop (ls.getState()), 0);
+}
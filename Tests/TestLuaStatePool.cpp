@@ -0,0 +1,238 @@
+/******************************************************************************\
+* TestLuaStatePool.cpp                                                         *
+* Unit tests for things declared in 'LuaStatePool.hpp'.                        *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#define BOOST_TEST_MODULE LuaStatePool
+
+#include <thread>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <Diluculum/LuaStatePool.hpp>
+
+
+namespace
+{
+   /// The setup function used by most tests here.
+   void SetupState (Diluculum::LuaState& ls)
+   {
+      ls.doString ("counter = 0; greeting = 'hello'");
+      ls.doString ("function bump() counter = counter + 1; return counter end");
+   }
+}
+
+
+
+// - TestLuaStatePoolCheckOut --------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaStatePoolCheckOut)
+{
+   using namespace Diluculum;
+
+   LuaStatePool pool (2, SetupState);
+   BOOST_CHECK_EQUAL (pool.size(), 2);
+   BOOST_CHECK_EQUAL (pool.available(), 2);
+
+   {
+      LuaStatePool::Handle h1 = pool.checkOut();
+      BOOST_REQUIRE (h1);
+      BOOST_CHECK (h1->doString ("return greeting")[0] == "hello");
+      BOOST_CHECK_EQUAL (pool.available(), 1);
+
+      LuaStatePool::Handle h2 = pool.tryCheckOut();
+      BOOST_REQUIRE (h2);
+      BOOST_CHECK (&*h1 != &*h2);
+      BOOST_CHECK_EQUAL (pool.available(), 0);
+
+      // Pool is exhausted now
+      LuaStatePool::Handle h3 = pool.tryCheckOut();
+      BOOST_CHECK (!h3);
+
+      // Releasing makes a state available again
+      h2.release();
+      BOOST_CHECK (!h2);
+      BOOST_CHECK_EQUAL (pool.available(), 1);
+
+      h3 = pool.tryCheckOut();
+      BOOST_CHECK (h3);
+   }
+
+   BOOST_CHECK_EQUAL (pool.available(), 2);
+}
+
+
+
+// - TestLuaStatePoolWarmReuse -------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaStatePoolWarmReuse)
+{
+   using namespace Diluculum;
+
+   // Without resetting globals, changes survive between checkouts
+   LuaStatePool pool (1, SetupState);
+
+   {
+      LuaStatePool::Handle h = pool.checkOut();
+      h->doString ("bump(); garbage = 'yes'");
+   }
+
+   {
+      LuaStatePool::Handle h = pool.checkOut();
+      BOOST_CHECK ((*h)["counter"] == 1);
+      BOOST_CHECK ((*h)["garbage"] == "yes");
+   }
+}
+
+
+
+// - TestLuaStatePoolResetGlobals ----------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaStatePoolResetGlobals)
+{
+   using namespace Diluculum;
+
+   LuaStatePool pool (1, SetupState, true);
+
+   {
+      LuaStatePool::Handle h = pool.checkOut();
+      h->doString ("bump(); garbage = 'yes'; greeting = nil; print = nil; "
+                   "string.evil = true");
+      BOOST_CHECK ((*h)["counter"] == 1);
+   }
+
+   {
+      LuaStatePool::Handle h = pool.checkOut();
+      BOOST_CHECK ((*h)["counter"] == 0);
+      BOOST_CHECK ((*h)["garbage"] == Nil);
+      BOOST_CHECK ((*h)["greeting"] == "hello");
+      BOOST_CHECK ((*h)["print"].value().type() == LUA_TFUNCTION);
+      BOOST_CHECK ((*h)["string"]["evil"] == Nil);
+      BOOST_CHECK (h->doString ("return bump()")[0] == 1);
+   }
+}
+
+
+
+// - TestLuaStatePoolLostCheckpoint --------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaStatePoolLostCheckpoint)
+{
+   using namespace Diluculum;
+
+   int setups = 0;
+   LuaStatePool pool (1, [&setups] (LuaState& ls) { ++setups; SetupState(ls); },
+                      true);
+
+   // States that cannot be restored are recreated (instead of throwing from
+   // the destructor of the 'Handle')
+   {
+      LuaStatePool::Handle h = pool.checkOut();
+      h->doString ("bump(); debug.getregistry().__Diluculum__Checkpoint = nil");
+   }
+
+   {
+      LuaStatePool::Handle h = pool.checkOut();
+      BOOST_CHECK_EQUAL (setups, 2);
+      BOOST_CHECK ((*h)["counter"] == 0);
+      h->doString ("debug.getregistry().__Diluculum__Checkpoint[1] = { 1 }");
+   }
+
+   {
+      LuaStatePool::Handle h = pool.checkOut();
+      BOOST_CHECK_EQUAL (setups, 3);
+   }
+}
+
+
+
+// - TestLuaStatePoolHealthCheck -----------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaStatePoolHealthCheck)
+{
+   using namespace Diluculum;
+
+   int setups = 0;
+   LuaStatePool pool (1, [&setups] (LuaState& ls) { ++setups; SetupState(ls); });
+   BOOST_CHECK_EQUAL (setups, 1);
+
+   // States failing the health check are recreated
+   pool.setHealthCheck ([] (LuaState& ls) { return ls["counter"] == 0; });
+
+   {
+      LuaStatePool::Handle h = pool.checkOut();
+      h->doString ("bump()");
+   }
+
+   {
+      LuaStatePool::Handle h = pool.checkOut();
+      BOOST_CHECK_EQUAL (setups, 2);
+      BOOST_CHECK ((*h)["counter"] == 0);
+   }
+
+   // Discarded states are recreated, too
+   {
+      LuaStatePool::Handle h = pool.checkOut();
+      h.discard();
+      BOOST_CHECK (!h);
+   }
+
+   {
+      LuaStatePool::Handle h = pool.checkOut();
+      BOOST_CHECK_EQUAL (setups, 3);
+   }
+}
+
+
+
+// - TestLuaStatePoolThreads ---------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaStatePoolThreads)
+{
+   using namespace Diluculum;
+
+   const int numThreads = 16;
+   const int numIterations = 200;
+
+   LuaStatePool pool (4, SetupState);
+
+   std::vector<std::thread> threads;
+   for (int i = 0; i < numThreads; ++i)
+   {
+      threads.push_back (std::thread ([&pool] {
+         for (int j = 0; j < numIterations; ++j)
+         {
+            LuaStatePool::Handle h = pool.checkOut();
+            h->doString ("bump()");
+         }
+      }));
+   }
+
+   for (std::size_t i = 0; i < threads.size(); ++i)
+      threads[i].join();
+
+   // Every call to 'bump()' must have been done by exactly one thread
+   double total = 0.0;
+   std::vector<LuaStatePool::Handle> handles;
+   for (std::size_t i = 0; i < pool.size(); ++i)
+   {
+      handles.push_back (pool.checkOut());
+      total += handles.back()->doString ("return counter")[0].asNumber();
+   }
+
+   BOOST_CHECK_EQUAL (total, numThreads * numIterations);
+}
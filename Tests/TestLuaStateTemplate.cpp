@@ -0,0 +1,152 @@
+/******************************************************************************\
+* TestLuaStateTemplate.cpp                                                     *
+* Unit tests for 'LuaStateTemplate'.                                           *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#define BOOST_TEST_MODULE LuaStateTemplate
+
+#include <boost/test/unit_test.hpp>
+#include <Diluculum/LuaStateTemplate.hpp>
+#include "WrappedClasses.hpp"
+
+
+// - TestTemplateGlobals -------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestTemplateGlobals)
+{
+   using namespace Diluculum;
+
+   LuaState prepared;
+   prepared.doString ("number = 123; text = 'hello'; flag = true\n"
+                      "config = { size = 10, names = { 'a', 'b', 'c' } }\n"
+                      "config.self = config\n"
+                      "alias = config.names\n"
+                      "function add (a, b) return a + b end\n"
+                      "local counter = 100\n"
+                      "function nextValue() counter = counter + 1; "
+                      "return counter end\n"
+                      "function string.shout (s) return s:upper() .. '!' end\n"
+                      "setmetatable (config, { __index = function() "
+                      "return 'default' end })");
+
+   LuaStateTemplate tmpl (prepared);
+   BOOST_CHECK (tmpl.size() > 0);
+
+   // Changing the prepared state after capture doesn't affect the template
+   prepared.doString ("number = 0");
+
+   std::unique_ptr<LuaState> ls = tmpl.newState();
+   LuaState& state = *ls;
+
+   BOOST_CHECK_EQUAL (state["number"].value().asNumber(), 123);
+   BOOST_CHECK_EQUAL (state["text"].value().asString(), "hello");
+   BOOST_CHECK_EQUAL (state["flag"].value().asBoolean(), true);
+   BOOST_CHECK_EQUAL (state["config"]["size"].value().asNumber(), 10);
+   BOOST_CHECK_EQUAL (state["config"]["names"][3].value().asString(), "c");
+   BOOST_CHECK_EQUAL (state["add"] (2, 3)[0].asNumber(), 5);
+
+   // Upvalues, aliasing, cycles and metatables are preserved
+   BOOST_CHECK_EQUAL (state["nextValue"]()[0].asNumber(), 101);
+   BOOST_CHECK_EQUAL (state["nextValue"]()[0].asNumber(), 102);
+   BOOST_CHECK (state.doString ("return alias == config.names")[0].asBoolean());
+   BOOST_CHECK (state.doString ("return config.self == config")[0].asBoolean());
+   BOOST_CHECK_EQUAL (state.doString ("return config.missing")[0].asString(),
+                      "default");
+   BOOST_CHECK (state.doString ("return _G == _G._G")[0].asBoolean());
+
+   // Library tables get the fields added to them, and keep working
+   BOOST_CHECK_EQUAL (state.doString ("return ('hi'):shout()")[0].asString(),
+                      "HI!");
+   BOOST_CHECK_EQUAL (state.doString ("return string.format('%d', 7)")[0]
+                      .asString(), "7");
+   BOOST_CHECK_EQUAL (state.doString ("return type(io.write)")[0].asString(),
+                      "function");
+   BOOST_CHECK_NO_THROW (state.doString ("return require('string')"));
+
+   // New states are independent from each other
+   std::unique_ptr<LuaState> other = tmpl.newState();
+   state.doString ("config.size = 20");
+   BOOST_CHECK_EQUAL ((*other)["config"]["size"].value().asNumber(), 10);
+   BOOST_CHECK_EQUAL ((*other)["nextValue"]()[0].asNumber(), 101);
+}
+
+
+
+// - TestTemplateClasses -------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestTemplateClasses)
+{
+   using namespace Diluculum;
+
+   LuaState prepared;
+   DILUCULUM_REGISTER_CLASS (prepared["Account"], Account);
+   prepared.doString ("function newRichAccount() "
+                      "return Account.new (1000000) end");
+
+   LuaStateTemplate tmpl (prepared);
+   std::unique_ptr<LuaState> ls = tmpl.newState();
+
+   ls->doString ("a = newRichAccount(); a:withdraw (1)");
+   BOOST_CHECK_EQUAL (ls->doString ("return a:balance()")[0].asNumber(),
+                      999999);
+
+   // Class metatables are kept in the registry; they must be copied, too
+   LuaValueList params;
+   params.push_back (50.0);
+   Account cppAccount (params);
+   DILUCULUM_REGISTER_OBJECT ((*ls)["cppAccount"], Account, cppAccount);
+   LuaValueList ret = ls->doString ("return cppAccount:balance()");
+   BOOST_REQUIRE (ret.size() == 1);
+   BOOST_CHECK (ret[0] == 50);
+}
+
+
+
+// - TestTemplateDeepNesting ---------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestTemplateDeepNesting)
+{
+   using namespace Diluculum;
+
+   LuaState prepared;
+   prepared.doString ("function chain (n) "
+                      "   local t = { } "
+                      "   for i = 1, n do t = { next = t } end "
+                      "   return t "
+                      "end\n"
+                      "function length (t) "
+                      "   local n = 0 "
+                      "   while t.next do n = n + 1; t = t.next end "
+                      "   return n "
+                      "end\n"
+                      "deep = chain (500)");
+
+   LuaStateTemplate tmpl (prepared);
+   std::unique_ptr<LuaState> ls = tmpl.newState();
+   BOOST_CHECK_EQUAL (ls->doString ("return length (deep)")[0].asNumber(), 500);
+
+   // Too deep to capture
+   const int top = lua_gettop (prepared.getState());
+   prepared.doString ("deep = chain (5000)");
+   BOOST_CHECK_THROW (LuaStateTemplate tooDeep (prepared), LuaError);
+   BOOST_CHECK_EQUAL (lua_gettop (prepared.getState()), top);
+}
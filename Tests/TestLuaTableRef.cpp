@@ -0,0 +1,213 @@
+/******************************************************************************\
+* TestLuaTableRef.cpp                                                          *
+* Tests for 'LuaTableRef'.                                                     *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#define BOOST_TEST_MODULE LuaTableRef
+
+#include <limits>
+#include <string>
+#include <boost/test/unit_test.hpp>
+#include <Diluculum/LuaFunctionRef.hpp>
+#include <Diluculum/LuaState.hpp>
+#include <Diluculum/LuaTableRef.hpp>
+
+
+// - TestGetSet ----------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestGetSet)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   ls.doString ("t = { x = 1.5, name = 'foo', flag = true, [10] = 'ten', "
+                "      sub = { a = 'b' } }");
+
+   const int top = lua_gettop (ls.getState());
+
+   LuaTableRef t (ls["t"]);
+   BOOST_REQUIRE (t.isValid());
+
+   BOOST_CHECK_EQUAL (t.get<double> ("x"), 1.5);
+   BOOST_CHECK_EQUAL (t.get<int> ("x"), 1);
+   BOOST_CHECK_EQUAL (t.get<std::string> ("name"), "foo");
+   BOOST_CHECK_EQUAL (t.get<std::string> (std::string("name")), "foo");
+   BOOST_CHECK_EQUAL (t.get<bool> ("flag"), true);
+   BOOST_CHECK_EQUAL (t.get<std::string> (10), "ten");
+   BOOST_CHECK (t.get<LuaValue> ("sub") == ls["t"]["sub"].value());
+
+   // Defaults for missing fields; type checking
+   BOOST_CHECK_EQUAL (t.get<int> ("missing", 42), 42);
+   BOOST_CHECK_EQUAL (t.get<std::string> ("name", "bar"), "foo");
+   BOOST_CHECK_THROW (t.get<double> ("name"), TypeMismatchError);
+   BOOST_CHECK_THROW (t.get<std::string> ("x"), TypeMismatchError);
+   BOOST_CHECK_THROW (t.get<int> ("missing"), TypeMismatchError);
+
+   // Writing
+   t.set ("x", 2.5);
+   t.set ("name", "bar");
+   t.set (11, std::string ("eleven"));
+   t.set ("value", LuaValue (true));
+   BOOST_CHECK (ls["t"]["x"].value() == 2.5);
+   BOOST_CHECK (ls["t"]["name"].value() == "bar");
+   BOOST_CHECK (ls["t"][11].value() == "eleven");
+   BOOST_CHECK (ls["t"]["value"].value() == true);
+
+   // Changes made in Lua are seen through the reference
+   ls.doString ("t.x = 10");
+   BOOST_CHECK_EQUAL (t.get<int> ("x"), 10);
+
+   // Invalid keys and errors in metamethods are reported as exceptions
+   BOOST_CHECK (t.get<LuaValue> (Nil) == Nil);
+   BOOST_CHECK_THROW (t.set (Nil, 1), LuaRunTimeError);
+   BOOST_CHECK_THROW (t.set (std::numeric_limits<double>::quiet_NaN(), 1),
+                      LuaRunTimeError);
+
+   ls.doString ("strict = setmetatable ({ }, { "
+                "   __index = function (t, k) error ('no ' .. k) end, "
+                "   __newindex = function (t, k) error ('no ' .. k) end })");
+   LuaTableRef strict (ls["strict"]);
+   BOOST_CHECK_THROW (strict.get<int> ("x"), LuaRunTimeError);
+   BOOST_CHECK_THROW (strict.set ("x", 1), LuaRunTimeError);
+   BOOST_CHECK_THROW (strict.set (Nil, 1), LuaRunTimeError);
+
+   BOOST_CHECK_EQUAL (lua_gettop (ls.getState()), top);
+}
+
+
+
+// - TestNested ----------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestNested)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   ls.doString ("config = { window = { size = { w = 640, h = 480 } }, "
+                "           title = 'x', "
+                "           onClick = function (a) return a * 2 end }");
+
+   LuaTableRef config (ls["config"]);
+   LuaTableRef size = config.ref ("window").ref ("size");
+   BOOST_CHECK_EQUAL (size.get<int> ("w"), 640);
+   BOOST_CHECK_EQUAL (size.get<int> ("h"), 480);
+
+   size.set ("w", 800);
+   BOOST_CHECK (ls["config"]["window"]["size"]["w"].value() == 800);
+
+   BOOST_CHECK_THROW (config.ref ("title"), TypeMismatchError);
+
+   // Tables and functions can be read and written as references
+   LuaFunctionRef onClick = config.get<LuaFunctionRef> ("onClick");
+   BOOST_CHECK (onClick (LuaValueList (1, 21))[0] == 42);
+
+   LuaTableRef copy = LuaTableRef::create (ls.getState());
+   copy.set ("size", size);
+   copy.set ("onClick", onClick);
+   ls["copy"] = copy.get<LuaValue> ("size");
+   ls.doString ("assert (copy.w == 800)");
+   BOOST_CHECK (copy.ref ("size").get<int> ("h") == 480);
+
+   // Metamethods are honored
+   ls.doString ("proxy = setmetatable ({ }, { __index = config })");
+   LuaTableRef proxy (ls["proxy"]);
+   BOOST_CHECK_EQUAL (proxy.get<std::string> ("title"), "x");
+   ls.doString ("setmetatable (proxy, { __newindex = config })");
+   proxy.set ("title", "y");
+   BOOST_CHECK (ls["config"]["title"].value() == "y");
+   BOOST_CHECK (ls["proxy"]["title"].value() == Nil);
+
+   BOOST_CHECK_THROW (LuaTableRef t (ls["config"]["title"]),
+                      TypeMismatchError);
+}
+
+
+
+// - TestIteration -------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestIteration)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   ls.doString ("t = { 10, 20, 30, 40; x = 'a', y = 'b' }");
+
+   const int top = lua_gettop (ls.getState());
+
+   LuaTableRef t (ls["t"]);
+   BOOST_CHECK_EQUAL (t.rawlen(), 4U);
+
+   int sum = 0;
+   std::string letters;
+   t.forEach ([&] (const LuaTableRef::Entry& e) {
+      if (e.keyType() == LUA_TNUMBER)
+         sum += e.value<int>();
+      else
+         letters += e.key<std::string>() + e.value<std::string>();
+   });
+
+   BOOST_CHECK_EQUAL (sum, 100);
+   BOOST_CHECK (letters == "xayb" || letters == "ybxa");
+
+   // Existing fields can be cleared while iterating
+   t.forEach ([&] (const LuaTableRef::Entry& e) {
+      if (e.valueType() == LUA_TSTRING)
+         t.set (e.key<std::string>(), Nil);
+   });
+   BOOST_CHECK (ls["t"]["x"].value() == Nil);
+   BOOST_CHECK (ls["t"]["y"].value() == Nil);
+
+   // Exceptions leave the stack clean
+   BOOST_CHECK_THROW (
+      t.forEach ([] (const LuaTableRef::Entry& e) { e.value<std::string>(); }),
+      TypeMismatchError);
+
+   BOOST_CHECK_EQUAL (lua_gettop (ls.getState()), top);
+}
+
+
+
+// - TestLifetime --------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLifetime)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   ls.doString ("weak = setmetatable ({ }, { __mode = 'v' }); "
+                "weak[1] = { }; t = weak[1]");
+
+   LuaTableRef t (ls["t"]);
+   ls.doString ("t = nil");
+
+   LuaTableRef copy (t);
+   LuaTableRef moved (std::move (t));
+   BOOST_CHECK (!t.isValid());
+   BOOST_CHECK_THROW (t.rawlen(), LuaError);
+
+   copy.reset();
+   ls.doString ("collectgarbage(); collectgarbage()");
+   BOOST_CHECK (ls["weak"][1].value() != Nil);
+
+   moved = LuaTableRef();
+   ls.doString ("collectgarbage(); collectgarbage()");
+   BOOST_CHECK (ls["weak"][1].value() == Nil);
+}
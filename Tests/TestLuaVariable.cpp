@@ -612,3 +612,58 @@ BOOST_AUTO_TEST_CASE(TestLuaVariablePushLastTable)
    BOOST_REQUIRE (lua_isnumber (rawState, -1));
    BOOST_CHECK (lua_tonumber (rawState, -1) == 171);
 }
+
+
+
+// - TestLuaVariableTypedCall --------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestLuaVariableTypedCall)
+{
+   using namespace Diluculum;
+
+   LuaState ls;
+   lua_State* rawState = ls.getState();
+
+   ls.doString ("function f (a, b, c) return a * b + c, 'done', c end\n"
+                "function count (...) return select ('#', ...) end\n"
+                "function nothing() end\n"
+                "t = { }");
+
+   // Variadic calls, mixing argument types
+   LuaValueList ret = ls["f"] (2, 3.5, 1);
+   BOOST_REQUIRE (ret.size() == 3);
+   BOOST_CHECK (ret[0] == 8);
+   BOOST_CHECK (ret[1] == "done");
+
+   ret = ls["count"] (1, "two", std::string ("three"), true, Nil,
+                      LuaValue (6), EmptyLuaValueMap);
+   BOOST_REQUIRE (ret.size() == 1);
+   BOOST_CHECK (ret[0] == 7);
+
+   // Typed results
+   BOOST_CHECK_EQUAL (ls["f"].call<double> (2, 3, 4), 10.0);
+   BOOST_CHECK_EQUAL (ls["f"].call<int> (1, 1, 1), 2);
+
+   std::tuple<double, std::string> t = ls["f"].call<
+      std::tuple<double, std::string> > (2, 2, 2);
+   BOOST_CHECK_EQUAL (std::get<0>(t), 6.0);
+   BOOST_CHECK_EQUAL (std::get<1>(t), "done");
+
+   ls["nothing"].call<void>();
+   BOOST_CHECK (ls["f"].call<LuaValueList> (1, 2, 3).size() == 3);
+
+   // Missing results are nil; asking for the wrong type is an error
+   BOOST_CHECK (ls["nothing"].call<LuaValue>() == Nil);
+   BOOST_CHECK_THROW (ls["nothing"].call<double>(), TypeMismatchError);
+   BOOST_CHECK_THROW (ls["f"].call<std::string> (1, 2, 3), TypeMismatchError);
+
+   // Errors
+   BOOST_CHECK_THROW (ls["f"].call<double> ("x", 2, 3), LuaRunTimeError);
+   BOOST_CHECK_THROW (ls["t"].call<double> (1), TypeMismatchError);
+
+   // The same through 'LuaState', given the function name
+   BOOST_CHECK_EQUAL (ls.call<double> ("f", 3, 3, 3), 12.0);
+   BOOST_CHECK_THROW (ls.call<double> ("undefined", 1), TypeMismatchError);
+
+   // Nothing is left on the stack
+   BOOST_CHECK_EQUAL (lua_gettop (rawState), 0);
+}
@@ -26,13 +26,103 @@
 
 #define BOOST_TEST_MODULE LuaWrappers
 
+#include <cmath>
 #include <boost/test/unit_test.hpp>
+#include <Diluculum/LuaFunctionRef.hpp>
 #include <Diluculum/LuaState.hpp>
+#include <Diluculum/LuaTableRef.hpp>
+#include <Diluculum/LuaTypedWrappers.hpp>
 #include <Diluculum/LuaWrappers.hpp>
 #include "WrappedClasses.hpp"
 #include "WrappedFunctions.hpp"
 
 
+namespace
+{
+   /// An asynchronous "double the number" request, waiting to be finished.
+   struct DoubleLaterRequest
+   {
+      Diluculum::LuaState::AsyncCallId call;
+      double number;
+   };
+
+   /// The requests made by \c DoubleLater() and not yet finished.
+   std::vector<DoubleLaterRequest> DoubleLaterRequests;
+
+   /** Starts an asynchronous operation that doubles a number. In Lua, this
+    *  takes a number and returns it doubled, after whoever is processing
+    *  \c DoubleLaterRequests finishes the operation.
+    */
+   void DoubleLater (Diluculum::LuaState::AsyncCallId call,
+                     const LuaValueList& params)
+   {
+      if (params.size() != 1 || params[0].type() != LUA_TNUMBER)
+         throw Diluculum::LuaError ("Expected one number.");
+
+      DoubleLaterRequest req = { call, params[0].asNumber() };
+      DoubleLaterRequests.push_back (req);
+   }
+
+   DILUCULUM_WRAP_ASYNC_FUNCTION (DoubleLater)
+
+
+   // Functions wrapped with 'DILUCULUM_WRAP()'
+   double Hypotenuse (double a, double b) { return std::sqrt (a*a + b*b); }
+
+   std::string Repeat (const std::string& s, int n)
+   {
+      std::string ret;
+      for (int i = 0; i < n; ++i)
+         ret += s;
+      return ret;
+   }
+
+   std::tuple<int, int> DivMod (int a, int b)
+   {
+      if (b == 0)
+         throw Diluculum::LuaError ("Division by zero.");
+      return std::make_tuple (a / b, a % b);
+   }
+
+   void SetTheGlobalTyped (int value) { TheGlobal = value; }
+
+   double CallWithFortyOne (const Diluculum::LuaFunctionRef& func)
+   {
+      return func.call<double> (41);
+   }
+
+   Diluculum::LuaFunctionRef PassFunction (Diluculum::LuaFunctionRef func)
+   {
+      return func;
+   }
+
+   Diluculum::LuaTableRef SetFoo (Diluculum::LuaTableRef table, int value)
+   {
+      table.set ("foo", value);
+      return table;
+   }
+
+   Counter TheCounter ((LuaValueList()));
+
+   Counter* GetTheCounter() { return &TheCounter; }
+
+   int AddToCounter (Counter* counter, int n)
+   {
+      counter->add (n);
+      return counter->get();
+   }
+
+   std::string NameOf (const Named* named) { return named->name(); }
+
+   bool IsNil (const Diluculum::LuaValue& value)
+   {
+      return value == Diluculum::Nil;
+   }
+}
+
+
+
+
 // - TestFunctionWrapping ------------------------------------------------------
 BOOST_AUTO_TEST_CASE(TestFunctionWrapping)
 {
@@ -123,6 +213,49 @@ BOOST_AUTO_TEST_CASE(TestFunctionWrapping)
 
 
 
+// - TestAsyncFunctionWrapping -------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestAsyncFunctionWrapping)
+{
+   using namespace Diluculum;
+   LuaState ls;
+
+   ls["DoubleLater"] = DILUCULUM_WRAPPER_FUNCTION (DoubleLater);
+   ls.doString ("function quadruple(x) return DoubleLater(DoubleLater(x)) end");
+
+   DoubleLaterRequests.clear();
+
+   // Asynchronous functions cannot be called synchronously
+   BOOST_CHECK_THROW (ls.doString ("DoubleLater(1)"), LuaRunTimeError);
+   BOOST_CHECK (DoubleLaterRequests.empty());
+
+   // Start two calls
+   std::future<LuaValueList> f1 = ls.callAsync (ls["quadruple"],
+                                                LuaValueList (1, 1.5));
+   std::future<LuaValueList> f2 = ls.callAsync (ls["quadruple"],
+                                                LuaValueList (1, 10));
+   BOOST_CHECK_EQUAL (ls.pendingAsyncCalls(), 2);
+
+   // Play the role of the I/O subsystem, processing the requests until there
+   // are no more of them
+   while (!DoubleLaterRequests.empty())
+   {
+      const DoubleLaterRequest req = DoubleLaterRequests.front();
+      DoubleLaterRequests.erase (DoubleLaterRequests.begin());
+      ls.resumeAsync (req.call, LuaValueList (1, req.number * 2));
+   }
+
+   BOOST_CHECK_EQUAL (ls.pendingAsyncCalls(), 0);
+   BOOST_CHECK (f1.get()[0] == 6);
+   BOOST_CHECK (f2.get()[0] == 40);
+
+   // Errors thrown by the wrapped function are reported as usual
+   std::future<LuaValueList> f3 = ls.callAsync (ls["quadruple"],
+                                                LuaValueList (1, "x"));
+   BOOST_CHECK_THROW (f3.get(), LuaRunTimeError);
+}
+
+
+
 // - TestClassWrapping ---------------------------------------------------------
 BOOST_AUTO_TEST_CASE(TestClassWrapping)
 {
@@ -471,6 +604,563 @@ BOOST_AUTO_TEST_CASE(TestMultipleStates)
 }
 
 
+
+// - TestClassMetatablesNotInGlobals -------------------------------------------
+BOOST_AUTO_TEST_CASE(TestClassMetatablesNotInGlobals)
+{
+   using namespace Diluculum;
+   LuaState ls;
+
+   DILUCULUM_REGISTER_CLASS (ls["Account"], Account);
+
+   LuaValueList params;
+   params.push_back (10.0);
+   Account cppAccount (params);
+
+   // Scripts can't mess with the metatables of the registered classes
+   LuaValueList ret = ls.doString ("local n = 0 "
+                                   "for k in pairs(_G) do "
+                                   "   if k:find ('Diluculum') then n=n+1 end "
+                                   "end "
+                                   "__Diluculum__Class_Metatables = 'oops' "
+                                   "return n");
+   BOOST_REQUIRE (ret.size() == 1);
+   BOOST_CHECK (ret[0] == 0);
+
+   DILUCULUM_REGISTER_OBJECT (ls["cppAccount"], Account, cppAccount);
+   ret = ls.doString ("a = Account.new (3); "
+                      "return a:balance(), cppAccount:balance()");
+   BOOST_REQUIRE (ret.size() == 2);
+   BOOST_CHECK (ret[0] == 3);
+   BOOST_CHECK (ret[1] == 10);
+}
+
+
+
+// - TestRegisteredObjectIdentity ----------------------------------------------
+BOOST_AUTO_TEST_CASE(TestRegisteredObjectIdentity)
+{
+   using namespace Diluculum;
+   LuaState ls;
+
+   DILUCULUM_REGISTER_CLASS (ls["Account"], Account);
+   DILUCULUM_REGISTER_CLASS (ls["Counter"], Counter);
+
+   LuaValueList params;
+   params.push_back (10.0);
+   Account account1 (params);
+   Account account2 (params);
+
+   const int top = lua_gettop (ls.getState());
+
+   DILUCULUM_REGISTER_OBJECT (ls["a"], Account, account1);
+   DILUCULUM_REGISTER_OBJECT (ls["b"], Account, account1);
+   DILUCULUM_REGISTER_OBJECT (ls["c"], Account, account2);
+
+   BOOST_CHECK_EQUAL (lua_gettop (ls.getState()), top);
+
+   LuaValueList ret = ls.doString ("return rawequal (a, b), rawequal (a, c)");
+   BOOST_REQUIRE (ret.size() == 2);
+   BOOST_CHECK (ret[0] == true);
+   BOOST_CHECK (ret[1] == false);
+
+   // Still works after the userdata is collected
+   ls.doString ("a, b = nil, nil; collectgarbage()");
+   DILUCULUM_REGISTER_OBJECT (ls["a"], Account, account1);
+   ret = ls.doString ("a:deposit (1); return a:balance()");
+   BOOST_REQUIRE (ret.size() == 1);
+   BOOST_CHECK (ret[0] == 11);
+
+   // The same address, but as an object of another class
+   Counter counter ((LuaValueList()));
+   DILUCULUM_REGISTER_OBJECT (ls["counter1"], Counter, counter);
+   DILUCULUM_REGISTER_OBJECT (ls["account"], Account,
+                              *reinterpret_cast<Account*>(&counter));
+   DILUCULUM_REGISTER_OBJECT (ls["counter2"], Counter, counter);
+   ret = ls.doString ("return rawequal (counter1, account), "
+                      "rawequal (counter1, counter2), counter2:get()");
+   BOOST_REQUIRE (ret.size() == 3);
+   BOOST_CHECK (ret[0] == false);
+   BOOST_CHECK (ret[2] == 0);
+}
+
+
+
+// - TestTypedFunctionWrapping -------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestTypedFunctionWrapping)
+{
+   using namespace Diluculum;
+   LuaState ls;
+
+   ls["Hypotenuse"] = DILUCULUM_WRAP (Hypotenuse);
+   ls["Repeat"] = DILUCULUM_WRAP (Repeat);
+   ls["DivMod"] = DILUCULUM_WRAP (DivMod);
+   ls["SetTheGlobal"] = DILUCULUM_WRAP (SetTheGlobalTyped);
+   ls["IsNil"] = wrap<bool(*)(const LuaValue&), &IsNil>();
+
+   LuaValueList res = ls.doString ("return Hypotenuse (3, 4)");
+   BOOST_REQUIRE (res.size() == 1);
+   BOOST_CHECK (res[0] == 5);
+
+   res = ls.doString ("return Repeat ('ab', 3)");
+   BOOST_REQUIRE (res.size() == 1);
+   BOOST_CHECK (res[0] == "ababab");
+
+   res = ls.doString ("return DivMod (17, 5)");
+   BOOST_REQUIRE (res.size() == 2);
+   BOOST_CHECK (res[0] == 3);
+   BOOST_CHECK (res[1] == 2);
+
+   TheGlobal = 0;
+   res = ls.doString ("return SetTheGlobal (171)");
+   BOOST_CHECK (res.size() == 0);
+   BOOST_CHECK (TheGlobal == 171);
+
+   res = ls.doString ("return IsNil(), IsNil (false)");
+   BOOST_REQUIRE (res.size() == 2);
+   BOOST_CHECK (res[0] == true);
+   BOOST_CHECK (res[1] == false);
+
+   // References to functions and tables
+   ls["CallWithFortyOne"] = DILUCULUM_WRAP (CallWithFortyOne);
+   ls["PassFunction"] = DILUCULUM_WRAP (PassFunction);
+   ls["SetFoo"] = DILUCULUM_WRAP (SetFoo);
+
+   res = ls.doString ("local f = function (x) return x + 1 end "
+                      "local t = { } "
+                      "return CallWithFortyOne (f), PassFunction (f) == f, "
+                      "   SetFoo (t, 7) == t, t.foo");
+   BOOST_REQUIRE (res.size() == 4);
+   BOOST_CHECK (res[0] == 42);
+   BOOST_CHECK (res[1] == true);
+   BOOST_CHECK (res[2] == true);
+   BOOST_CHECK (res[3] == 7);
+
+   // Errors: wrong argument types and exceptions thrown by the function
+   res = ls.doString ("return pcall (Repeat, 'ab', 'three')");
+   BOOST_REQUIRE (res.size() == 2);
+   BOOST_CHECK (res[0] == false);
+   BOOST_CHECK (res[1].asString().find ("Bad argument #2")
+                != std::string::npos);
+
+   res = ls.doString ("return pcall (Hypotenuse, 1)");
+   BOOST_REQUIRE (res.size() == 2);
+   BOOST_CHECK (res[0] == false);
+   BOOST_CHECK (res[1].asString().find ("nil") != std::string::npos);
+
+   // With several bad arguments, the first one is reported
+   res = ls.doString ("return pcall (Hypotenuse, 'three', 'four')");
+   BOOST_REQUIRE (res.size() == 2);
+   BOOST_CHECK (res[0] == false);
+   BOOST_CHECK (res[1].asString().find ("Bad argument #1")
+                != std::string::npos);
+
+   BOOST_CHECK_THROW (ls.doString ("DivMod (1, 0)"), LuaRunTimeError);
+
+   // Called from C++, too
+   res = ls["Hypotenuse"] (6, 8);
+   BOOST_REQUIRE (res.size() == 1);
+   BOOST_CHECK (res[0] == 10);
+}
+
+
+
+// - TestTypedMethodWrapping ---------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestTypedMethodWrapping)
+{
+   using namespace Diluculum;
+   LuaState ls;
+
+   DILUCULUM_REGISTER_CLASS (ls["Counter"], Counter);
+
+   ls.doString ("c = Counter.new (10)");
+   ls.doString ("c:add (5)");
+
+   LuaValueList res = ls.doString ("return c:get()");
+   BOOST_REQUIRE (res.size() == 1);
+   BOOST_CHECK (res[0] == 15);
+
+   res = ls.doString ("c:add (1); return c:getAndIsEven()");
+   BOOST_REQUIRE (res.size() == 2);
+   BOOST_CHECK (res[0] == 16);
+   BOOST_CHECK (res[1] == true);
+
+   res = ls.doString ("return c:describe ('apples')");
+   BOOST_REQUIRE (res.size() == 1);
+   BOOST_CHECK (res[0] == "16 apples");
+
+   // An object instantiated in C++
+   Counter cppCounter ((LuaValueList()));
+   DILUCULUM_REGISTER_OBJECT (ls["cppCounter"], Counter, cppCounter);
+   ls.doString ("cppCounter:add (-3)");
+   BOOST_CHECK_EQUAL (cppCounter.get(), -3);
+
+   // Errors
+   res = ls.doString ("return pcall (c.add, c, 'five')");
+   BOOST_REQUIRE (res.size() == 2);
+   BOOST_CHECK (res[0] == false);
+   BOOST_CHECK (res[1].asString().find ("Bad argument #2")
+                != std::string::npos);
+
+   res = ls.doString ("return pcall (c.get)");
+   BOOST_REQUIRE (res.size() == 2);
+   BOOST_CHECK (res[0] == false);
+   BOOST_CHECK (res[1].asString().find ("Bad argument #1")
+                != std::string::npos);
+
+   res = ls.doString ("return pcall (c.add, 'c', 'five')");
+   BOOST_REQUIRE (res.size() == 2);
+   BOOST_CHECK (res[0] == false);
+   BOOST_CHECK (res[1].asString().find ("Bad argument #1")
+                != std::string::npos);
+}
+
+
+
+// - TestValueClassWrapping ----------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestValueClassWrapping)
+{
+   using namespace Diluculum;
+
+   {
+      LuaState ls;
+      DILUCULUM_REGISTER_CLASS (ls["Vector2D"], Vector2D);
+
+      ls.doString ("v = Vector2D.new (3, 4); v:scale (2)");
+      BOOST_CHECK_EQUAL (Vector2D::instances, 1);
+
+      LuaValueList ret = ls.doString ("return v:x(), v:y()");
+      BOOST_REQUIRE (ret.size() == 2);
+      BOOST_CHECK (ret[0] == 6);
+      BOOST_CHECK (ret[1] == 8);
+
+      // The object lives inside the userdata block
+      lua_State* state = ls.getState();
+      lua_getglobal (state, "v");
+      char* ud = static_cast<char*>(lua_touserdata (state, -1));
+      BOOST_CHECK (reinterpret_cast<Impl::CppObject*>(ud)->ptr
+                   == ud + Impl::InPlaceObject<Vector2D>::offset);
+      BOOST_CHECK (ls["v"].value().asObjectPtr<Vector2D*>()
+                   == reinterpret_cast<Vector2D*>(
+                      ud + Impl::InPlaceObject<Vector2D>::offset));
+      lua_pop (state, 1);
+
+      // Destroyed in place when garbage-collected...
+      ls.doString ("v = nil; collectgarbage()");
+      BOOST_CHECK_EQUAL (Vector2D::instances, 0);
+
+      // ...or when explicitly deleted (but only once)
+      ls.doString ("v = Vector2D.new(); v:delete()");
+      BOOST_CHECK_EQUAL (Vector2D::instances, 0);
+      ls.doString ("v = nil; collectgarbage()");
+      BOOST_CHECK_EQUAL (Vector2D::instances, 0);
+
+      // Objects instantiated in C++ are not copied nor destroyed
+      Vector2D cppVector ((LuaValueList()));
+      DILUCULUM_REGISTER_OBJECT (ls["cppVector"], Vector2D, cppVector);
+      ls.doString ("cppVector = nil; collectgarbage()");
+      BOOST_CHECK_EQUAL (Vector2D::instances, 1);
+   }
+
+   // Closing the state destroys the remaining objects
+   {
+      LuaState ls;
+      DILUCULUM_REGISTER_CLASS (ls["Vector2D"], Vector2D);
+      ls.doString ("a, b = Vector2D.new(), Vector2D.new()");
+      BOOST_CHECK_EQUAL (Vector2D::instances, 2);
+   }
+   BOOST_CHECK_EQUAL (Vector2D::instances, 0);
+}
+
+
+
+// - TestCheckObject -----------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestCheckObject)
+{
+   using namespace Diluculum;
+   LuaState ls;
+
+   DILUCULUM_REGISTER_CLASS (ls["Account"], Account);
+   DILUCULUM_REGISTER_CLASS (ls["Counter"], Counter);
+   ls["GetTheCounter"] = DILUCULUM_WRAP (GetTheCounter);
+   ls["AddToCounter"] = DILUCULUM_WRAP (AddToCounter);
+
+   lua_State* state = ls.getState();
+
+   ls.doString ("a = Account.new (5); c = Counter.new (2)");
+
+   lua_getglobal (state, "a");
+   lua_getglobal (state, "c");
+   lua_pushnumber (state, 1.0);
+   ls.doString ("return newproxy()");
+   lua_getglobal (state, "io");
+   lua_getfield (state, -1, "stdout");
+   lua_remove (state, -2);
+
+   BOOST_CHECK (checkObject<Account> (state, -4) != 0);
+   BOOST_CHECK_EQUAL (checkObject<Counter> (state, -3)->get(), 2);
+   BOOST_CHECK_THROW (checkObject<Account> (state, -3), TypeMismatchError);
+   BOOST_CHECK_THROW (checkObject<Counter> (state, -4), TypeMismatchError);
+   BOOST_CHECK_THROW (checkObject<Counter> (state, -2), TypeMismatchError);
+   BOOST_CHECK_THROW (checkObject<Counter> (state, -1), TypeMismatchError);
+
+   try
+   {
+      checkObject<Counter> (state, -4);
+   }
+   catch (const TypeMismatchError& e)
+   {
+      BOOST_CHECK_EQUAL (e.getExpectedType(), "Counter");
+      BOOST_CHECK_EQUAL (e.getFoundType(), "userdata");
+   }
+
+   lua_pop (state, 4);
+
+   // Typed wrappers taking and returning pointers to objects
+   LuaValueList ret = ls.doString ("return AddToCounter (c, 3)");
+   BOOST_REQUIRE (ret.size() == 1);
+   BOOST_CHECK (ret[0] == 5);
+
+   ret = ls.doString ("return pcall (AddToCounter, a, 3)");
+   BOOST_REQUIRE (ret.size() == 2);
+   BOOST_CHECK (ret[0] == false);
+   BOOST_CHECK (ret[1].asString().find ("Counter expected, got userdata")
+                != std::string::npos);
+
+   ret = ls.doString ("AddToCounter (GetTheCounter(), 7) "
+                      "return rawequal (GetTheCounter(), GetTheCounter())");
+   BOOST_REQUIRE (ret.size() == 1);
+   BOOST_CHECK (ret[0] == true);
+   BOOST_CHECK_EQUAL (TheCounter.get(), 7);
+}
+
+
+
+// - TestClassInheritance ------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestClassInheritance)
+{
+   using namespace Diluculum;
+   LuaState ls;
+
+   // Base classes must be registered first
+   BOOST_CHECK_THROW (DILUCULUM_REGISTER_CLASS (ls["Square"], Square),
+                      LuaError);
+
+   DILUCULUM_REGISTER_CLASS (ls["Named"], Named);
+   DILUCULUM_REGISTER_CLASS (ls["Shape"], Shape);
+   DILUCULUM_REGISTER_CLASS (ls["Square"], Square);
+   ls["NameOf"] = DILUCULUM_WRAP (NameOf);
+
+   ls.doString ("sq = Square.new (3)");
+
+   // Own, inherited and overridden methods (virtual or not)
+   LuaValueList ret = ls.doString ("return sq:side(), sq:area(), sq:name()");
+   BOOST_REQUIRE (ret.size() == 3);
+   BOOST_CHECK (ret[0] == 3);
+   BOOST_CHECK (ret[1] == 9);
+   BOOST_CHECK (ret[2] == "the square");
+
+   // Methods of the second base class (whose subobject is elsewhere)
+   ret = ls.doString ("sq:rename ('box'); return sq:name(), NameOf (sq)");
+   BOOST_REQUIRE (ret.size() == 2);
+   BOOST_CHECK (ret[0] == "the box");
+   BOOST_CHECK (ret[1] == "box");
+
+   // Old style methods
+   ret = ls.doString ("return sq:describe()");
+   BOOST_REQUIRE (ret.size() == 1);
+   BOOST_CHECK (ret[0].asString().find ("shape with area 9") == 0);
+
+   // Inherited methods are right in the class table
+   ret = ls.doString ("local methods = getmetatable (sq) "
+                      "return rawget (methods, 'rename') ~= nil "
+                      "   and getmetatable (methods) == nil");
+   BOOST_REQUIRE (ret.size() == 1);
+   BOOST_CHECK (ret[0] == true);
+
+   // Upcasts work from C++, too
+   lua_getglobal (ls.getState(), "sq");
+   Square* square = checkObject<Square> (ls.getState(), -1);
+   BOOST_CHECK_EQUAL (checkObject<Named> (ls.getState(), -1),
+                      static_cast<Named*>(square));
+   BOOST_CHECK_EQUAL (checkObject<Shape> (ls.getState(), -1),
+                      static_cast<Shape*>(square));
+   lua_pop (ls.getState(), 1);
+
+   // Including through 'LuaValue's
+   const LuaValue sq = ls["sq"].value();
+   BOOST_CHECK_EQUAL (sq.asObjectPtr<Square*>(), square);
+   BOOST_CHECK_EQUAL (sq.asObjectPtr<Named*>(), static_cast<Named*>(square));
+   BOOST_CHECK_EQUAL (sq.asObjectPtr<const Shape*>(),
+                      static_cast<Shape*>(square));
+   BOOST_CHECK_THROW (sq.asObjectPtr<Vector2D*>(), TypeMismatchError);
+
+   // But not downcasts
+   ret = ls.doString ("n = Named.new ('n'); return pcall (Square.side, n)");
+   BOOST_REQUIRE (ret.size() == 2);
+   BOOST_CHECK (ret[0] == false);
+   BOOST_CHECK_THROW (ls["n"].value().asObjectPtr<Square*>(),
+                      TypeMismatchError);
+
+   // And objects instantiated in C++
+   Square cppSquare (LuaValueList (1, 2.0));
+   DILUCULUM_REGISTER_OBJECT (ls["cppSquare"], Square, cppSquare);
+   ret = ls.doString ("return cppSquare:area(), NameOf (cppSquare)");
+   BOOST_REQUIRE (ret.size() == 2);
+   BOOST_CHECK (ret[0] == 4);
+   BOOST_CHECK (ret[1] == "square");
+
+   // Objects can only be deleted through their own class
+   BOOST_CHECK_THROW (ls.doString ("Named.delete (sq)"), LuaRunTimeError);
+   BOOST_CHECK_THROW (ls.doString ("Shape.delete (sq)"), LuaRunTimeError);
+   BOOST_CHECK_THROW (ls.doString ("Named.delete (42)"), LuaRunTimeError);
+   BOOST_CHECK_THROW (ls.doString ("Named.delete()"), LuaRunTimeError);
+   ret = ls.doString ("return sq:area()");
+   BOOST_REQUIRE (ret.size() == 1);
+   BOOST_CHECK (ret[0] == 9);
+
+   DILUCULUM_REGISTER_CLASS (ls["Vector2D"], Vector2D);
+   BOOST_CHECK_THROW (ls.doString ("Vector2D.delete (sq)"), LuaRunTimeError);
+   ls.doString ("sq:delete()");
+}
+
+
+
+// - TestClassProperties -------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestClassProperties)
+{
+   using namespace Diluculum;
+   LuaState ls;
+
+   DILUCULUM_REGISTER_CLASS (ls["Particle"], Particle);
+
+   // Data members, properties and methods
+   ls.doString ("p = Particle.new(); p.x = 3; p.y = p.x + 1; p.speed = 10");
+   LuaValueList ret = ls.doString ("return p.x, p.y, p.speed, p:distance()");
+   BOOST_REQUIRE (ret.size() == 4);
+   BOOST_CHECK (ret[0] == 3);
+   BOOST_CHECK (ret[1] == 4);
+   BOOST_CHECK (ret[2] == 10);
+   BOOST_CHECK (ret[3] == 5);
+
+   ret = ls.doString ("return p.id > 0, p.nonexistent");
+   BOOST_REQUIRE (ret.size() == 2);
+   BOOST_CHECK (ret[0] == true);
+   BOOST_CHECK (ret[1] == Nil);
+
+   // Errors
+   BOOST_CHECK_THROW (ls.doString ("p.id = 1"), LuaRunTimeError);
+   BOOST_CHECK_THROW (ls.doString ("p.nonexistent = 1"), LuaRunTimeError);
+   BOOST_CHECK_THROW (ls.doString ("p.x = 'one'"), LuaRunTimeError);
+   BOOST_CHECK_THROW (ls.doString ("p.speed = -1"), LuaRunTimeError);
+
+   ret = ls.doString ("return p.x, p.speed");
+   BOOST_REQUIRE (ret.size() == 2);
+   BOOST_CHECK (ret[0] == 3);
+   BOOST_CHECK (ret[1] == 10);
+
+   // Objects instantiated in C++
+   Particle cppParticle ((LuaValueList()));
+   DILUCULUM_REGISTER_OBJECT (ls["cppParticle"], Particle, cppParticle);
+   ls.doString ("cppParticle.y = -2.5");
+   BOOST_CHECK_EQUAL (cppParticle.y, -2.5);
+
+   // Properties are inherited
+   DILUCULUM_REGISTER_CLASS (ls["Named"], Named);
+   DILUCULUM_REGISTER_CLASS (ls["Shape"], Shape);
+   DILUCULUM_REGISTER_CLASS (ls["Square"], Square);
+   ret = ls.doString ("sq = Square.new (2); sq.label = 'box' "
+                      "return sq.label, sq:name(), sq:area()");
+   BOOST_REQUIRE (ret.size() == 3);
+   BOOST_CHECK (ret[0] == "box");
+   BOOST_CHECK (ret[1] == "the box");
+   BOOST_CHECK (ret[2] == 4);
+}
+
+
+
+// - TestClassMetamethods ------------------------------------------------------
+BOOST_AUTO_TEST_CASE(TestClassMetamethods)
+{
+   using namespace Diluculum;
+
+   {
+      LuaState ls;
+      DILUCULUM_REGISTER_CLASS (ls["Vector2D"], Vector2D);
+
+      ls.doString ("a = Vector2D.new (3, 4); b = Vector2D.new (1, 2)");
+
+      // Arithmetic
+      LuaValueList ret = ls.doString ("local v = -(a + b * 2 - a / 2) "
+                                      "return v:x(), v:y()");
+      BOOST_REQUIRE (ret.size() == 2);
+      BOOST_CHECK (ret[0] == -3.5);
+      BOOST_CHECK (ret[1] == -6);
+
+      // The results are new objects, constructed in place
+      lua_State* state = ls.getState();
+      ls.doString ("c = a + b");
+      lua_getglobal (state, "c");
+      char* ud = static_cast<char*>(lua_touserdata (state, -1));
+      BOOST_REQUIRE (ud != 0);
+      BOOST_CHECK (reinterpret_cast<Impl::CppObject*>(ud)->ptr
+                   == ud + Impl::InPlaceObject<Vector2D>::offset);
+      BOOST_CHECK (checkObject<Vector2D> (state, -1)->x() == 4);
+      lua_pop (state, 1);
+
+      // Comparisons
+      ret = ls.doString ("return a == Vector2D.new (3, 4), a == b, "
+                         "b < a, a < b, a <= a, a > b");
+      BOOST_REQUIRE (ret.size() == 6);
+      BOOST_CHECK (ret[0] == true);
+      BOOST_CHECK (ret[1] == false);
+      BOOST_CHECK (ret[2] == true);
+      BOOST_CHECK (ret[3] == false);
+      BOOST_CHECK (ret[4] == true);
+      BOOST_CHECK (ret[5] == true);
+
+      // Length, call, conversion to string and concatenation
+      ret = ls.doString ("return #a, a(b), tostring (a), 'a = ' .. a");
+      BOOST_REQUIRE (ret.size() == 4);
+      BOOST_CHECK (ret[0] == 5);
+      BOOST_CHECK (ret[1] == 11);
+      BOOST_CHECK (ret[2] == "(3, 4)");
+      BOOST_CHECK (ret[3] == "a = (3, 4)");
+
+      // Operands are type-checked
+      BOOST_CHECK_THROW (ls.doString ("return a + 1"), LuaRunTimeError);
+      BOOST_CHECK_THROW (ls.doString ("return a * b"), LuaRunTimeError);
+
+      // Objects returned by value by non value classes are copied, too
+      DILUCULUM_REGISTER_CLASS (ls["Named"], Named);
+      ret = ls.doString ("local n = Named.new ('foo'); local m = n .. 'bar' "
+                         "return n:name(), m:name()");
+      BOOST_REQUIRE (ret.size() == 2);
+      BOOST_CHECK (ret[0] == "foo");
+      BOOST_CHECK (ret[1] == "foobar");
+
+      // All temporaries are destroyed
+      ls.doString ("a, b, c = nil, nil, nil; collectgarbage()");
+      BOOST_CHECK_EQUAL (Vector2D::instances, 0);
+   }
+
+   // Returning objects of classes not registered in the state is an error
+   {
+      LuaState ls;
+      Vector2D cppVector (1, 2);
+      lua_State* state = ls.getState();
+      lua_pushcfunction (state, DILUCULUM_WRAP (NegateVector2D));
+      PushToStack (state, &cppVector);
+      BOOST_REQUIRE (lua_pcall (state, 1, 1, 0) != 0);
+      BOOST_CHECK (std::string (lua_tostring (state, -1)).find (
+                      "not registered") != std::string::npos);
+      lua_pop (state, 1);
+   }
+   BOOST_CHECK_EQUAL (Vector2D::instances, 0);
+}
+
+
+
 #if 0
 
 //
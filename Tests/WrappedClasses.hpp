@@ -27,6 +27,11 @@
 #ifndef _DILUCULUM_TESTS_WRAPPED_CLASSES_HPP_
 #define _DILUCULUM_TESTS_WRAPPED_CLASSES_HPP_
 
+#include <cmath>
+#include <string>
+#include <tuple>
+#include <boost/lexical_cast.hpp>
+#include <Diluculum/LuaTypedWrappers.hpp>
 #include <Diluculum/LuaWrappers.hpp>
 
 namespace
@@ -150,6 +155,294 @@ namespace
    DILUCULUM_BEGIN_CLASS (DestructorTester)
    DILUCULUM_END_CLASS (DestructorTester)
 
+
+
+
+   /// A class whose methods are exported with 'DILUCULUM_CLASS_TYPED_METHOD()'
+   class Counter
+   {
+      public:
+         Counter (const LuaValueList& params)
+            : count_(params.empty() ? 0 : static_cast<int>(params[0].asInteger()))
+         { }
+
+         void add (int n) { count_ += n; }
+
+         int get() const { return count_; }
+
+         std::tuple<int, bool> getAndIsEven() const
+         {
+            return std::make_tuple (count_, count_ % 2 == 0);
+         }
+
+         std::string describe (const std::string& what) const
+         {
+            return std::to_string (count_) + " " + what;
+         }
+
+      private:
+         int count_;
+   };
+
+   DILUCULUM_BEGIN_CLASS (Counter)
+      DILUCULUM_CLASS_TYPED_METHOD (Counter, add)
+      DILUCULUM_CLASS_TYPED_METHOD (Counter, get)
+      DILUCULUM_CLASS_TYPED_METHOD (Counter, getAndIsEven)
+      DILUCULUM_CLASS_TYPED_METHOD (Counter, describe)
+   DILUCULUM_END_CLASS (Counter)
+
+
+
+
+   /// A small value class, exported with 'DILUCULUM_BEGIN_VALUE_CLASS()'
+   class Vector2D
+   {
+      public:
+         /// The number of 'Vector2D's alive.
+         static int instances;
+
+         Vector2D (const LuaValueList& params)
+            : x_(params.size() > 0 ? params[0].asNumber() : 0.0),
+              y_(params.size() > 1 ? params[1].asNumber() : 0.0)
+         {
+            ++instances;
+         }
+
+         Vector2D (double x, double y)
+            : x_(x), y_(y)
+         {
+            ++instances;
+         }
+
+         Vector2D (const Vector2D& other)
+            : x_(other.x_), y_(other.y_)
+         {
+            ++instances;
+         }
+
+         ~Vector2D() { --instances; }
+
+         double x() const { return x_; }
+         double y() const { return y_; }
+
+         void scale (double factor)
+         {
+            x_ *= factor;
+            y_ *= factor;
+         }
+
+         Vector2D operator+ (const Vector2D& other) const
+         {
+            return Vector2D (x_ + other.x_, y_ + other.y_);
+         }
+
+         Vector2D operator- (const Vector2D& other) const
+         {
+            return Vector2D (x_ - other.x_, y_ - other.y_);
+         }
+
+         bool operator== (const Vector2D& other) const
+         {
+            return x_ == other.x_ && y_ == other.y_;
+         }
+
+      private:
+         double x_;
+         double y_;
+   };
+
+   int Vector2D::instances = 0;
+
+   Vector2D MultiplyVector2D (const Vector2D& v, double factor)
+   {
+      return Vector2D (v.x() * factor, v.y() * factor);
+   }
+
+   Vector2D DivideVector2D (Vector2D v, double divisor)
+   {
+      v.scale (1.0 / divisor);
+      return v;
+   }
+
+   Vector2D NegateVector2D (const Vector2D& v)
+   {
+      return Vector2D (-v.x(), -v.y());
+   }
+
+   double Vector2DLength (const Vector2D& v)
+   {
+      return std::sqrt (v.x()*v.x() + v.y()*v.y());
+   }
+
+   bool Vector2DLessThan (const Vector2D& a, const Vector2D& b)
+   {
+      return Vector2DLength (a) < Vector2DLength (b);
+   }
+
+   bool Vector2DLessEqual (const Vector2D& a, const Vector2D& b)
+   {
+      return Vector2DLength (a) <= Vector2DLength (b);
+   }
+
+   double Vector2DDot (const Vector2D& a, const Vector2D& b)
+   {
+      return a.x()*b.x() + a.y()*b.y();
+   }
+
+   std::string Vector2DToString (const Vector2D& v)
+   {
+      return "(" + boost::lexical_cast<std::string> (v.x()) + ", "
+         + boost::lexical_cast<std::string> (v.y()) + ")";
+   }
+
+   std::string ConcatVector2D (const std::string& s, const Vector2D& v)
+   {
+      return s + Vector2DToString (v);
+   }
+
+   DILUCULUM_BEGIN_VALUE_CLASS (Vector2D)
+      DILUCULUM_CLASS_TYPED_METHOD (Vector2D, x)
+      DILUCULUM_CLASS_TYPED_METHOD (Vector2D, y)
+      DILUCULUM_CLASS_TYPED_METHOD (Vector2D, scale)
+      DILUCULUM_CLASS_OPERATOR (Vector2D, __add, operator+)
+      DILUCULUM_CLASS_OPERATOR (Vector2D, __sub, operator-)
+      DILUCULUM_CLASS_OPERATOR (Vector2D, __eq, operator==)
+      DILUCULUM_CLASS_METAMETHOD (Vector2D, __mul, MultiplyVector2D)
+      DILUCULUM_CLASS_METAMETHOD (Vector2D, __div, DivideVector2D)
+      DILUCULUM_CLASS_METAMETHOD (Vector2D, __unm, NegateVector2D)
+      DILUCULUM_CLASS_METAMETHOD (Vector2D, __len, Vector2DLength)
+      DILUCULUM_CLASS_METAMETHOD (Vector2D, __lt, Vector2DLessThan)
+      DILUCULUM_CLASS_METAMETHOD (Vector2D, __le, Vector2DLessEqual)
+      DILUCULUM_CLASS_METAMETHOD (Vector2D, __call, Vector2DDot)
+      DILUCULUM_CLASS_METAMETHOD (Vector2D, __tostring, Vector2DToString)
+      DILUCULUM_CLASS_METAMETHOD (Vector2D, __concat, ConcatVector2D)
+   DILUCULUM_END_CLASS (Vector2D)
+
+
+
+   /// A base class with typed methods
+   class Named
+   {
+      public:
+         Named (const LuaValueList& params)
+            : name_(params.empty() ? "unnamed" : params[0].asString())
+         { }
+
+         std::string name() const { return name_; }
+         void rename (const std::string& name) { name_ = name; }
+
+      private:
+         std::string name_;
+   };
+
+   Named AppendToName (const Named& named, const std::string& suffix)
+   {
+      Named result (named);
+      result.rename (named.name() + suffix);
+      return result;
+   }
+
+   DILUCULUM_BEGIN_CLASS (Named)
+      DILUCULUM_CLASS_TYPED_METHOD (Named, name)
+      DILUCULUM_CLASS_TYPED_METHOD (Named, rename)
+      DILUCULUM_CLASS_PROPERTY (Named, label, name, rename)
+      DILUCULUM_CLASS_METAMETHOD (Named, __concat, AppendToName)
+   DILUCULUM_END_CLASS (Named)
+
+
+   /// A polymorphic base class, with a method exported the old way
+   class Shape
+   {
+      public:
+         Shape (const LuaValueList&) { }
+         virtual ~Shape() { }
+
+         virtual double area() const { return 0.0; }
+
+         LuaValueList describe (const LuaValueList&)
+         {
+            LuaValueList ret;
+            ret.push_back ("shape with area " + std::to_string (area()));
+            return ret;
+         }
+   };
+
+   DILUCULUM_BEGIN_CLASS (Shape)
+      DILUCULUM_CLASS_TYPED_METHOD (Shape, area)
+      DILUCULUM_CLASS_METHOD (Shape, describe)
+   DILUCULUM_END_CLASS (Shape)
+
+
+   /** A class with two base classes. 'Named' is the second one, so that its
+    *  subobject is not at the same address as the 'Square' itself.
+    */
+   class Square: public Shape, public Named
+   {
+      public:
+         Square (const LuaValueList& params)
+            : Shape (params), Named (LuaValueList (1, "square")),
+              side_(params.empty() ? 1.0 : params[0].asNumber())
+         { }
+
+         double area() const { return side_ * side_; }
+         double side() const { return side_; }
+
+         // Hides 'Named::name()'
+         std::string name() const { return "the " + Named::name(); }
+
+      private:
+         double side_;
+   };
+
+   DILUCULUM_BEGIN_CLASS (Square)
+      DILUCULUM_CLASS_BASE (Square, Shape)
+      DILUCULUM_CLASS_BASE (Square, Named)
+      DILUCULUM_CLASS_TYPED_METHOD (Square, side)
+      DILUCULUM_CLASS_TYPED_METHOD (Square, name)
+   DILUCULUM_END_CLASS (Square)
+
+
+
+   /// A class with properties
+   class Particle
+   {
+      public:
+         Particle (const LuaValueList& params)
+            : x(0.0), y(0.0), speed_(0.0), id_(++lastId_)
+         { }
+
+         double x;
+         double y;
+
+         double speed() const { return speed_; }
+
+         void setSpeed (double speed)
+         {
+            if (speed < 0.0)
+               throw Diluculum::LuaError ("Negative speed.");
+            speed_ = speed;
+         }
+
+         int id() const { return id_; }
+
+         double distance() const { return std::sqrt (x*x + y*y); }
+
+      private:
+         double speed_;
+         int id_;
+         static int lastId_;
+   };
+
+   int Particle::lastId_ = 0;
+
+   DILUCULUM_BEGIN_VALUE_CLASS (Particle)
+      DILUCULUM_CLASS_MEMBER (Particle, x)
+      DILUCULUM_CLASS_MEMBER (Particle, y)
+      DILUCULUM_CLASS_PROPERTY (Particle, speed, speed, setSpeed)
+      DILUCULUM_CLASS_READONLY_PROPERTY (Particle, id, id)
+      DILUCULUM_CLASS_TYPED_METHOD (Particle, distance)
+   DILUCULUM_END_CLASS (Particle)
+
 } // (anonymous) namespace
 
 #endif // _DILUCULUM_TESTS_WRAPPED_CLASSES_HPP_
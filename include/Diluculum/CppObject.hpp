@@ -32,15 +32,63 @@ namespace Diluculum
 {
    namespace Impl
    {
+      struct ClassInfo;
+
+      /** A link in the list of direct base classes of a class exported to
+       *  Lua (see \c ClassInfo).
+       */
+      struct BaseClassLink
+      {
+         /// The base class.
+         const ClassInfo* base;
+
+         /** Converts a pointer to an object of the derived class to a pointer
+          *  to its base class subobject. (With multiple inheritance, this is
+          *  not necessarily the same address.)
+          */
+         void* (*upcast)(void*);
+
+         /// The next base class of the same derived class, or null.
+         BaseClassLink* next;
+      };
+
+      /** Information about a class exported to Lua. There is exactly one
+       *  \c ClassInfo per class (see \c GetClassInfo()), and its address is
+       *  used as the class identifier. Everything here is plain old data,
+       *  so that it can be set up during static initialization in any order.
+       */
+      struct ClassInfo
+      {
+         /// The class name, as known in Lua (or null, if not registered yet).
+         const char* name;
+
+         /// The direct base classes, or null if there is none.
+         BaseClassLink* bases;
+
+         /** Are the objects of this class instantiated in Lua constructed in
+          *  place (see \c DILUCULUM_BEGIN_VALUE_CLASS())?
+          */
+         bool inPlace;
+      };
+
       /** The data that is stored as userdata when a C++ object is exported to
        *  or instantiated in Lua.
        */
       struct CppObject
       {
          public:
-            /// Pointer to the actual object.
+            /** Pointer to the actual object. For objects constructed in
+             *  place (see \c DILUCULUM_BEGIN_VALUE_CLASS()), this points to
+             *  the same userdata block, right after the \c CppObject.
+             */
             void* ptr;
 
+            /** The class of the object pointed by \c ptr, used to check (in
+             *  constant time) whether the userdata really represents an
+             *  object of a given class.
+             */
+            const ClassInfo* classInfo;
+
             /** Should the \c ptr be <tt>delete</tt>d when the userdata is
              *  garbage-collected in Lua? Essentially, if the object is
              *  instantiated in Lua, it should be; if it is instantiated in C++,
@@ -49,6 +97,32 @@ namespace Diluculum
             bool deleteMe;
       };
 
+      /// Provides the one and only \c ClassInfo of the class \c T.
+      template <typename T>
+      struct ClassInfoOf
+      {
+         static ClassInfo info;
+      };
+
+      template <typename T>
+      ClassInfo ClassInfoOf<T>::info = { 0, 0, false };
+
+      /** Returns the \c ClassInfo of the class \c T. Its address identifies
+       *  the class, and is used as the registry key of the class metatable.
+       */
+      template <typename T>
+      inline ClassInfo* GetClassInfo()
+      {
+         return &ClassInfoOf<T>::info;
+      }
+
+      /** Converts \c ptr, a pointer to an object of class \c from, to a
+       *  pointer to an object of class \c to, which must be \c from itself
+       *  or one of its (direct or indirect) base classes. Returns a null
+       *  pointer if \c to is not a base class of \c from.
+       */
+      void* CastObject (void* ptr, const ClassInfo* from, const ClassInfo* to);
+
    } // namespace Impl
 
 } // namespace Diluculum
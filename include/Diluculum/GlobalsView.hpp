@@ -0,0 +1,206 @@
+/******************************************************************************\
+* GlobalsView.hpp                                                              *
+* A lazy view of the global variables of a Lua state.                          *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#ifndef _DILUCULUM_GLOBALS_VIEW_HPP_
+#define _DILUCULUM_GLOBALS_VIEW_HPP_
+
+#include <iterator>
+#include <string>
+#include <Diluculum/LuaState.hpp>
+
+
+namespace Diluculum
+{
+   /** A lazy view of the global variables of a \c LuaState. Unlike
+    *  \c LuaState::globals(), which converts every global to a \c LuaValue
+    *  upfront, a \c GlobalsView walks the table of globals as it is iterated,
+    *  and converts keys and values to <tt>LuaValue</tt>s only when asked to.
+    *  Filters can be used to skip uninteresting globals without converting
+    *  anything.
+    *  @code
+    *  GlobalsView view (ls);
+    *  view.withPrefix ("config_").excludingFunctions();
+    *  for (GlobalsView::Iterator p = view.begin(); p != view.end(); ++p)
+    *     std::cout << p->name() << " = " << p->value().typeName() << '\n';
+    *  @endcode
+    *  @note As with <tt>lua_next()</tt>, no new globals shall be created while
+    *        iterating (changing or clearing existing ones is fine).
+    *  @note The \c LuaState must outlive the \c GlobalsView and its
+    *        iterators.
+    */
+   class GlobalsView
+   {
+      public:
+         class Iterator;
+
+         /// The global an \c Iterator points to.
+         class Entry
+         {
+            friend class Iterator;
+
+            public:
+               /** Returns the name of the global, or a null pointer if its
+                *  key is not a string.
+                */
+               const char* name() const { return name_; }
+
+               /// Returns the key of the global.
+               LuaValue key() const;
+
+               /** Returns the type of the value (one of the <tt>LUA_T*</tt>
+                *  constants).
+                */
+               int type() const { return type_; }
+
+               /** Returns the value of the global. (This is converted to a
+                *  \c LuaValue every time this is called.)
+                */
+               LuaValue value() const;
+
+            private:
+               /// Constructs an \c Entry; see \c Iterator.
+               Entry (lua_State* ls)
+                  : ls_(ls), keyRef_(LUA_NOREF), name_(0), type_(LUA_TNIL)
+               { }
+
+               /// The Lua state.
+               lua_State* ls_;
+
+               /// Registry reference to the key (\c LUA_NOREF at the end).
+               int keyRef_;
+
+               /** The key, if it is a string. (The key is anchored in the
+                *  registry, so this pointer remains valid.)
+                */
+               const char* name_;
+
+               /// The type of the value.
+               int type_;
+         };
+
+         /** An input iterator over the globals of a \c GlobalsView. The
+          *  current key is anchored in the registry, so the Lua stack can be
+          *  freely used while iterating.
+          */
+         class Iterator: public std::iterator<std::input_iterator_tag, Entry>
+         {
+            friend class GlobalsView;
+
+            public:
+               /// Copy constructor.
+               Iterator (const Iterator& other);
+
+               /// Destroys the \c Iterator, releasing its registry reference.
+               ~Iterator();
+
+               /// Assignment operator.
+               Iterator& operator= (const Iterator& rhs);
+
+               /// Moves to the next global passing the filters.
+               Iterator& operator++();
+
+               /// Returns the current global.
+               const Entry& operator*() const { return entry_; }
+
+               /// Returns the current global.
+               const Entry* operator->() const { return &entry_; }
+
+               /** Are both iterators at the end, or pointing to the same
+                *  global?
+                */
+               bool operator== (const Iterator& rhs) const;
+
+               /// The opposite of \c operator==().
+               bool operator!= (const Iterator& rhs) const
+               { return !(*this == rhs); }
+
+            private:
+               /** Constructs an \c Iterator. If \c atEnd is \c false, it is
+                *  positioned at the first global passing the filters of
+                *  \c view.
+                */
+               Iterator (const GlobalsView* view, bool atEnd);
+
+               /** Advances to the next global passing the filters, starting
+                *  after the key on the top of the stack (which is popped).
+                */
+               void advance();
+
+               /// The view being iterated.
+               const GlobalsView* view_;
+
+               /// The current global.
+               Entry entry_;
+         };
+
+         /// Constructs a \c GlobalsView of \c ls, initially without filters.
+         explicit GlobalsView (LuaState& ls);
+
+         /** Only globals whose values have the given type (one of the
+          *  <tt>LUA_T*</tt> constants) are visited.
+          *  @return <tt>*this</tt>, so that filters can be chained.
+          */
+         GlobalsView& onlyType (int type);
+
+         /** Only globals whose names start with \c prefix are visited.
+          *  @return <tt>*this</tt>, so that filters can be chained.
+          */
+         GlobalsView& withPrefix (const std::string& prefix);
+
+         /** Globals whose values are functions are not visited.
+          *  @return <tt>*this</tt>, so that filters can be chained.
+          */
+         GlobalsView& excludingFunctions();
+
+         /// Returns an iterator pointing to the first global.
+         Iterator begin() const { return Iterator (this, false); }
+
+         /// Returns an iterator pointing past the last global.
+         Iterator end() const { return Iterator (this, true); }
+
+      private:
+         /** Does the key/value pair on the top of the stack (key at index -2)
+          *  pass the filters?
+          */
+         bool accepts (lua_State* ls) const;
+
+         /// The Lua state.
+         lua_State* ls_;
+
+         /// The type of values visited (\c LUA_TNONE means any).
+         int type_;
+
+         /// The prefix of the names of the globals visited.
+         std::string prefix_;
+
+         /// Are functions skipped?
+         bool excludeFunctions_;
+   };
+
+} // namespace Diluculum
+
+#endif // _DILUCULUM_GLOBALS_VIEW_HPP_
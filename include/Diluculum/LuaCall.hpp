@@ -0,0 +1,208 @@
+/******************************************************************************\
+* LuaCall.hpp                                                                  *
+* Typed calls to Lua functions.                                                *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#ifndef _DILUCULUM_LUA_CALL_HPP_
+#define _DILUCULUM_LUA_CALL_HPP_
+
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <lua.hpp>
+#include <Diluculum/LuaStack.hpp>
+
+
+namespace Diluculum
+{
+   namespace Impl
+   {
+      /** Calls the function lying just below the \c numArgs arguments on the
+       *  top of the stack of \c ls, leaving \c numResults results (which can
+       *  be \c LUA_MULTRET) in its place. Execution limits are honored, and
+       *  errors are reported exactly like in \c CallFunctionOnTop().
+       *  \c name, if not null, is the name of the function (used only for
+       *  gathering metrics; see \c LuaMetrics).
+       *  @throw TypeMismatchError If there is no function below the arguments
+       *         (in which case the arguments and the non-function are popped).
+       *  @note This is not intended to be called by Diluculum users.
+       */
+      void CallOnStack (lua_State* ls, int numArgs, int numResults,
+                        const char* name = 0);
+
+      /// Pushes nothing (this ends the recursion of \c PushArguments()).
+      inline void PushArguments (lua_State*)
+      { }
+
+      /// Pushes each of the arguments onto the stack of \c ls, in order.
+      template <typename T, typename... Args>
+      inline void PushArguments (lua_State* ls, const T& arg,
+                                 const Args&... args)
+      {
+         PushToStack (ls, arg);
+         PushArguments (ls, args...);
+      }
+
+      /// A sequence of indices, used to expand parameter packs by position.
+      template <std::size_t... I>
+      struct IndexSequence
+      { };
+
+      /// Creates an \c IndexSequence with the indices from 0 to <tt>N-1</tt>.
+      template <std::size_t N, std::size_t... I>
+      struct MakeIndexSequence
+         : MakeIndexSequence<N-1, N-1, I...>
+      { };
+
+      template <std::size_t... I>
+      struct MakeIndexSequence<0, I...>
+      {
+         typedef IndexSequence<I...> type;
+      };
+
+      /** Describes how the results of a call are returned as an \c R: how many
+       *  results are requested from Lua (\c count) and how they are read and
+       *  popped from the stack (\c pop(), which takes the index of the first
+       *  result). A single result is read with \c LuaStack<R>.
+       */
+      template <typename R>
+      struct CallResults
+      {
+         static_assert (!std::is_same<R, const char*>::value,
+                        "The string would be popped before being returned; "
+                        "use std::string instead.");
+
+         static const int count = 1;
+
+         static R pop (lua_State* ls, int first)
+         {
+            try
+            {
+               R ret = GetFromStack<R> (ls, first);
+               lua_settop (ls, first - 1);
+               return ret;
+            }
+            catch (...)
+            {
+               lua_settop (ls, first - 1);
+               throw;
+            }
+         }
+      };
+
+      /// \c CallResults specialization for calls whose results are ignored.
+      template<>
+      struct CallResults<void>
+      {
+         static const int count = 0;
+
+         static void pop (lua_State*, int)
+         { }
+      };
+
+      /// \c CallResults specialization for any number of results.
+      template<>
+      struct CallResults<LuaValueList>
+      {
+         static const int count = LUA_MULTRET;
+
+         static LuaValueList pop (lua_State* ls, int first)
+         {
+            const int top = lua_gettop (ls);
+            LuaValueList ret;
+            ret.reserve (top - first + 1);
+            for (int i = first; i <= top; ++i)
+               ret.push_back (ToLuaValue (ls, i));
+            lua_settop (ls, first - 1);
+            return ret;
+         }
+      };
+
+      /// \c CallResults specialization for a fixed number of typed results.
+      template <typename... Ts>
+      struct CallResults<std::tuple<Ts...> >
+      {
+         static const int count = sizeof...(Ts);
+
+         static std::tuple<Ts...> pop (lua_State* ls, int first)
+         {
+            try
+            {
+               std::tuple<Ts...> ret = read (
+                  ls, first, typename MakeIndexSequence<sizeof...(Ts)>::type());
+               lua_settop (ls, first - 1);
+               return ret;
+            }
+            catch (...)
+            {
+               lua_settop (ls, first - 1);
+               throw;
+            }
+         }
+
+         template <std::size_t... I>
+         static std::tuple<Ts...> read (lua_State* ls, int first,
+                                        IndexSequence<I...>)
+         {
+            return std::tuple<Ts...> (GetFromStack<Ts> (ls, first + I)...);
+         }
+      };
+
+      /** Calls the function on the top of the stack of \c ls, passing
+       *  \c args (pushed directly, without creating a \c LuaValueList) and
+       *  returning the results as an \c R (see \c CallResults). The function
+       *  is popped. \c name is passed along to \c CallOnStack().
+       *  @note This is not intended to be called by Diluculum users.
+       */
+      template <typename R, typename... Args>
+      R CallNamedOnTop (lua_State* ls, const char* name, const Args&... args)
+      {
+         const int func = lua_gettop (ls);
+
+         try
+         {
+            PushArguments (ls, args...);
+         }
+         catch (...)
+         {
+            lua_settop (ls, func - 1);
+            throw;
+         }
+
+         CallOnStack (ls, sizeof...(Args), CallResults<R>::count, name);
+         return CallResults<R>::pop (ls, func);
+      }
+
+      /// Just like \c CallNamedOnTop(), for a function without a name.
+      template <typename R, typename... Args>
+      R CallOnTop (lua_State* ls, const Args&... args)
+      {
+         return CallNamedOnTop<R> (ls, static_cast<const char*>(0), args...);
+      }
+   }
+
+} // namespace Diluculum
+
+#endif // _DILUCULUM_LUA_CALL_HPP_
@@ -63,6 +63,22 @@ namespace Diluculum
 
 
 
+   /** A Lua run-time error caused by a call exceeding the limits set with
+    *  \c LuaState::setExecutionLimits().
+    */
+   class LuaExecutionLimitError: public LuaRunTimeError
+   {
+      public:
+         /** Constructs a \c LuaExecutionLimitError object.
+          *  @param what The message associated with the error.
+          */
+         LuaExecutionLimitError (const char* what)
+            : LuaRunTimeError (what)
+         { }
+   };
+
+
+
    /// A Lua file-related error.
    class LuaFileError: public LuaError
    {
@@ -0,0 +1,226 @@
+/******************************************************************************\
+* LuaExecutor.hpp                                                              *
+* Lua states owned by worker threads, fed through mailboxes.                   *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#ifndef _DILUCULUM_LUA_EXECUTOR_HPP_
+#define _DILUCULUM_LUA_EXECUTOR_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <Diluculum/LuaState.hpp>
+
+
+namespace Diluculum
+{
+   /** A worker thread owning a \c LuaState. The state is created by the
+    *  worker thread itself and is never touched by any other thread; work is
+    *  sent to it through a lock-free, multiple-producer single-consumer
+    *  mailbox. Any thread can submit work to a \c LuaExecutor.
+    *  <p>Since <tt>LuaValue</tt>s are not bound to any Lua state, they are
+    *  what crosses the thread boundary: parameters are \c LuaValueList
+    *  objects, and results come back as <tt>std::future<LuaValueList></tt>.
+    */
+   class LuaExecutor: boost::noncopyable
+   {
+      public:
+         /** The type of the function used to prepare the state. Called in the
+          *  worker thread.
+          */
+         typedef std::function<void (LuaState&)> SetupFunction;
+
+         /// A piece of work to be executed by the worker thread.
+         typedef std::function<void (LuaState&)> Job;
+
+         /** Constructs a \c LuaExecutor, starting its worker thread and
+          *  waiting until the state is ready.
+          *  @param setup The function that prepares the state. Called in the
+          *         worker thread, right after the state is created.
+          *  @param loadStdLib Passed to the constructor of the \c LuaState.
+          *  @throw LuaError Or whatever \c setup throws.
+          */
+         explicit LuaExecutor (const SetupFunction& setup = SetupFunction(),
+                               bool loadStdLib = true);
+
+         /** Destroys the \c LuaExecutor. Jobs already submitted are executed
+          *  before the worker thread finishes.
+          */
+         ~LuaExecutor();
+
+         /** Sends a job to the worker thread. Exceptions thrown by the job are
+          *  silently ignored.
+          */
+         void post (const Job& job);
+
+         /** Calls a function in the worker thread's state.
+          *  @param func The function to be called.
+          *  @param params The parameters passed to the function.
+          *  @return A future that will hold the values returned by the
+          *          function, or the exception thrown by the call.
+          */
+         std::future<LuaValueList> submit (const LuaFunction& func,
+                                           const LuaValueList& params);
+
+         /** Calls a global function in the worker thread's state. This avoids
+          *  the cost of loading the function bytecode on every call.
+          *  @param funcName The name of the global function to be called.
+          *  @param params The parameters passed to the function.
+          *  @return A future that will hold the values returned by the
+          *          function, or the exception thrown by the call.
+          */
+         std::future<LuaValueList> submitGlobal (const std::string& funcName,
+                                                 const LuaValueList& params);
+
+         /** Returns the number of jobs submitted but not yet finished. This is
+          *  just a hint, since other threads may change it at any time.
+          */
+         std::size_t pending() const { return pending_.load(); }
+
+      private:
+         /// A node of the mailbox.
+         struct Node
+         {
+            /// The next node in the mailbox, in order of arrival.
+            std::atomic<Node*> next;
+
+            /// The job carried by this node.
+            Job job;
+         };
+
+         /** Adds a node to the mailbox. Safe to be called concurrently by any
+          *  number of threads.
+          */
+         void push (Node* node);
+
+         /** Removes the oldest node from the mailbox. Only called by the
+          *  worker thread. May return \c 0 while a concurrent \c push() is
+          *  halfway done, even if the mailbox is not empty.
+          */
+         Node* pop();
+
+         /** The worker thread main loop.
+          *  @param ready Fulfilled once the state is ready (or failed to be
+          *         set up).
+          */
+         void run (const SetupFunction& setup, bool loadStdLib,
+                   std::promise<void> ready);
+
+         /// The most recently pushed node. Producers swap themselves in here.
+         std::atomic<Node*> head_;
+
+         /// The oldest node. Only accessed by the worker thread.
+         Node* tail_;
+
+         /// Dummy node, allowing the mailbox to never be really empty.
+         Node stub_;
+
+         /// The number of jobs pushed and not yet finished.
+         std::atomic<std::size_t> pending_;
+
+         /// Is the worker thread (about to be) sleeping?
+         std::atomic<bool> sleeping_;
+
+         /// Has the destructor been called?
+         std::atomic<bool> stopping_;
+
+         /// Mutex used to sleep when the mailbox is empty.
+         std::mutex mutex_;
+
+         /// Signaled when a job arrives and the worker thread is sleeping.
+         std::condition_variable wakeUp_;
+
+         /// The worker thread.
+         std::thread thread_;
+   };
+
+
+
+   /** A group of <tt>LuaExecutor</tt>s, all of them prepared by the same setup
+    *  function. Typically, one per core. Jobs can be sent to a specific
+    *  executor (when state locality matters) or spread among all of them.
+    */
+   class LuaExecutorGroup: boost::noncopyable
+   {
+      public:
+         /** Constructs a \c LuaExecutorGroup.
+          *  @param size The number of executors. If zero, uses the number of
+          *         hardware threads.
+          *  @param setup Passed to the constructor of each \c LuaExecutor.
+          *  @param loadStdLib Passed to the constructor of each
+          *         \c LuaExecutor.
+          */
+         explicit LuaExecutorGroup (
+            std::size_t size,
+            const LuaExecutor::SetupFunction& setup
+               = LuaExecutor::SetupFunction(),
+            bool loadStdLib = true);
+
+         /// Destroys the group, after all submitted jobs are finished.
+         ~LuaExecutorGroup();
+
+         /// Returns the number of executors in the group.
+         std::size_t size() const { return executors_.size(); }
+
+         /// Returns the executor at a given index.
+         LuaExecutor& operator[] (std::size_t i) { return *executors_[i]; }
+
+         /** Returns the next executor to receive work, in round-robin
+          *  fashion.
+          */
+         LuaExecutor& next();
+
+         /// Sends a job to the next executor. See \c LuaExecutor::post().
+         void post (const LuaExecutor::Job& job) { next().post (job); }
+
+         /// Calls a function in the next executor. See \c LuaExecutor::submit().
+         std::future<LuaValueList> submit (const LuaFunction& func,
+                                           const LuaValueList& params)
+         { return next().submit (func, params); }
+
+         /** Calls a global function in the next executor. See
+          *  \c LuaExecutor::submitGlobal().
+          */
+         std::future<LuaValueList> submitGlobal (const std::string& funcName,
+                                                 const LuaValueList& params)
+         { return next().submitGlobal (funcName, params); }
+
+      private:
+         /// The executors.
+         std::vector<LuaExecutor*> executors_;
+
+         /// Used to select the next executor.
+         std::atomic<std::size_t> nextExecutor_;
+   };
+
+} // namespace Diluculum
+
+#endif // _DILUCULUM_LUA_EXECUTOR_HPP_
@@ -0,0 +1,156 @@
+/******************************************************************************\
+* LuaFunctionRef.hpp                                                           *
+* A handle to a function living in a Lua state.                                *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#ifndef _DILUCULUM_LUA_FUNCTION_REF_HPP_
+#define _DILUCULUM_LUA_FUNCTION_REF_HPP_
+
+#include <lua.hpp>
+#include <Diluculum/LuaCall.hpp>
+#include <Diluculum/LuaRegistryRef.hpp>
+#include <Diluculum/LuaResult.hpp>
+#include <Diluculum/LuaStack.hpp>
+#include <Diluculum/LuaVariable.hpp>
+
+
+namespace Diluculum
+{
+   /** A handle to a function living in a Lua state. Unlike a \c LuaVariable,
+    *  which looks its value up (through all of its keys) every time it is
+    *  used, a \c LuaFunctionRef holds a reference to the function itself
+    *  (anchored in the registry with \c luaL_ref()). Calling it costs a single
+    *  \c lua_rawgeti() before the actual call, which makes it the right tool
+    *  for callbacks called very frequently.
+    *  <p>Since it references the function, and not a variable, a
+    *  \c LuaFunctionRef keeps calling the same function even if the variable
+    *  it came from is later assigned something else. It also keeps the
+    *  function from being garbage-collected.
+    *  <p>Copying a \c LuaFunctionRef creates another reference to the same
+    *  function; the reference is released when the \c LuaFunctionRef is
+    *  destroyed.
+    *  @note A \c LuaFunctionRef must not outlive the Lua state it refers to.
+    */
+   class LuaFunctionRef: public Impl::LuaRegistryRef
+   {
+      public:
+         /// Constructs an invalid \c LuaFunctionRef (see \c isValid()).
+         LuaFunctionRef() { }
+
+         /** Constructs a \c LuaFunctionRef referencing the function currently
+          *  stored in a variable.
+          *  @throw TypeMismatchError If \c func does not hold a function.
+          */
+         explicit LuaFunctionRef (const LuaVariable& func)
+            : Impl::LuaRegistryRef (func, LUA_TFUNCTION)
+         { }
+
+         /** Constructs a \c LuaFunctionRef referencing the function at a given
+          *  index of the stack of \c ls.
+          *  @throw TypeMismatchError If the value at \c index is not a
+          *         function.
+          */
+         LuaFunctionRef (lua_State* ls, int index)
+            : Impl::LuaRegistryRef (ls, index, LUA_TFUNCTION)
+         { }
+
+         /** Calls the function and returns its return values.
+          *  @throw LuaError If this \c LuaFunctionRef is not valid.
+          *  @throw LuaRunTimeError If something bad happens while executing the
+          *         function.
+          */
+         LuaValueList operator() (const LuaValueList& params) const;
+
+         /// Calls the function without parameters.
+         LuaValueList operator()() const
+         { return (*this)(LuaValueList()); }
+
+         /** Calls the function, pushing \c params directly onto the Lua stack
+          *  (that is, without creating a \c LuaValueList for them).
+          *  @throw LuaError If this \c LuaFunctionRef is not valid.
+          *  @throw LuaRunTimeError If something bad happens while executing the
+          *         function.
+          */
+         template <typename... Params>
+         LuaValueList operator() (const Params&... params) const
+         {
+            push();
+            return Impl::CallOnTop<LuaValueList> (state_, params...);
+         }
+
+         /** Calls the function, returning its results as an \c R. See
+          *  \c LuaVariable::call() for the types \c R can be.
+          *  @throw LuaError If this \c LuaFunctionRef is not valid.
+          *  @throw TypeMismatchError If some return value is not of the
+          *         requested type.
+          *  @throw LuaRunTimeError If something bad happens while executing the
+          *         function.
+          */
+         template <typename R, typename... Params>
+         R call (const Params&... params) const
+         {
+            push();
+            return Impl::CallOnTop<R> (state_, params...);
+         }
+
+         /** Calls the function, storing its return values in \c results
+          *  (which is cleared first, but keeps its capacity).
+          *  @throw LuaError If this \c LuaFunctionRef is not valid.
+          *  @throw LuaRunTimeError If something bad happens while executing the
+          *         function.
+          */
+         void call (const LuaValueList& params, LuaValueList& results) const;
+
+         /** Just like \c operator()(), but reports errors raised while
+          *  executing the function through the returned \c LuaResult, instead
+          *  of throwing exceptions.
+          *  @throw LuaError If this \c LuaFunctionRef is not valid.
+          */
+         LuaResult tryCall (const LuaValueList& params = LuaValueList()) const;
+
+         /** Pushes the function onto the stack of its Lua state.
+          *  @throw LuaError If this \c LuaFunctionRef is not valid.
+          */
+         void push() const { pushReferenced ("LuaFunctionRef"); }
+   };
+
+
+   /// \c LuaStack specialization for \c LuaFunctionRef.
+   template<>
+   struct LuaStack<LuaFunctionRef>
+   {
+      static void push (lua_State* ls, const LuaFunctionRef& value)
+      { value.push(); lua_xmove (value.getState(), ls, 1); }
+
+      static bool is (lua_State* ls, int index)
+      { return lua_type (ls, index) == LUA_TFUNCTION; }
+
+      static LuaFunctionRef get (lua_State* ls, int index)
+      { return LuaFunctionRef (ls, index); }
+   };
+
+} // namespace Diluculum
+
+#endif // _DILUCULUM_LUA_FUNCTION_REF_HPP_
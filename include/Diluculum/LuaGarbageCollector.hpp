@@ -0,0 +1,148 @@
+/******************************************************************************\
+* LuaGarbageCollector.hpp                                                      *
+* Control over the garbage collector of a Lua state.                           *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#ifndef _DILUCULUM_LUA_GARBAGE_COLLECTOR_HPP_
+#define _DILUCULUM_LUA_GARBAGE_COLLECTOR_HPP_
+
+#include <lua.hpp>
+#include <cstddef>
+#include <boost/noncopyable.hpp>
+
+
+namespace Diluculum
+{
+   class LuaState;
+
+   /** Control over the garbage collector of a \c LuaState. This is designed
+    *  for hosts that run Lua with tight time budgets (like once per frame of
+    *  a game): the automatic collector can be stopped, and the host runs
+    *  incremental collection steps when it has the time for them, bounded by
+    *  a time budget.
+    *  <p>Statistics about the steps run through this object are kept, so
+    *  that the budget and the tuning parameters can be adjusted.
+    *  @note The \c LuaGarbageCollector must not outlive the \c LuaState it
+    *        controls.
+    */
+   class LuaGarbageCollector: boost::noncopyable
+   {
+      public:
+         /// Statistics about the collection steps run.
+         struct Stats
+         {
+            /// Number of calls to <tt>lua_gc (LUA_GCSTEP)</tt>.
+            unsigned long steps;
+
+            /// Number of collection cycles finished by these steps.
+            unsigned long cycles;
+
+            /// Number of bytes freed by these steps.
+            unsigned long long collectedBytes;
+
+            /// Total time spent in these steps, in seconds.
+            double totalStepTime;
+
+            /// Duration of the longest step, in seconds.
+            double maxStepTime;
+
+            /// Duration of the last step, in seconds.
+            double lastStepTime;
+         };
+
+         /** Constructs a \c LuaGarbageCollector for a given \c LuaState. This
+          *  does not change the state of the collector.
+          */
+         explicit LuaGarbageCollector (LuaState& ls);
+
+         /** Stops the automatic collector. From now on, memory is only
+          *  reclaimed by \c step() and \c collect().
+          */
+         void stopAutomatic();
+
+         /// Restarts the automatic collector.
+         void restartAutomatic();
+
+         /** Is the automatic collector running? (As far as this object knows:
+          *  Lua 5.1 offers no way to query this.)
+          */
+         bool isAutomatic() const { return automatic_; }
+
+         /** Sets the collector pause, that is, how long the collector waits
+          *  before starting a new cycle (see <tt>collectgarbage()</tt> in the
+          *  Lua manual).
+          *  @return The previous value of the pause.
+          */
+         int setPause (int pause);
+
+         /** Sets the collector step multiplier, that is, the speed of the
+          *  collector relative to memory allocation (see
+          *  <tt>collectgarbage()</tt> in the Lua manual).
+          *  @return The previous value of the step multiplier.
+          */
+         int setStepMultiplier (int stepMul);
+
+         /** Performs incremental collection steps until \c budget seconds are
+          *  used up or a collection cycle finishes, whatever happens first.
+          *  At least one step is performed.
+          *  @param budget The time available for collection, in seconds.
+          *  @param stepSize The size of each step, as passed to
+          *         <tt>lua_gc (LUA_GCSTEP)</tt>. Smaller steps mean finer
+          *         control over the time used.
+          *  @return \c true if a collection cycle was finished.
+          */
+         bool step (double budget, int stepSize = 0);
+
+         /// Performs a full collection cycle.
+         void collect();
+
+         /// Returns the memory used by the Lua state, in bytes.
+         std::size_t memoryInUse() const;
+
+         /// Returns the statistics about the steps run by \c step().
+         const Stats& stats() const { return stats_; }
+
+         /// Zeroes the statistics.
+         void resetStats();
+
+      private:
+         /** Stops the automatic collector again if it is supposed to be
+          *  stopped. Must be called after running the collector explicitly.
+          */
+         void keepStopped();
+
+         /// The Lua state whose collector is controlled.
+         lua_State* state_;
+
+         /// Is the automatic collector running?
+         bool automatic_;
+
+         /// Statistics about the steps run.
+         Stats stats_;
+   };
+
+} // namespace Diluculum
+
+#endif // _DILUCULUM_LUA_GARBAGE_COLLECTOR_HPP_
@@ -0,0 +1,336 @@
+/******************************************************************************\
+* LuaMetrics.hpp                                                               *
+* Metrics about the crossings of the C++/Lua boundary.                         *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#ifndef _DILUCULUM_LUA_METRICS_HPP_
+#define _DILUCULUM_LUA_METRICS_HPP_
+
+#include <lua.hpp>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+
+namespace Diluculum
+{
+   class LuaState;
+
+   /** Metrics about the crossings of the boundary between C++ and Lua in a
+    *  \c LuaState: calls from C++ into Lua (with latency histograms per
+    *  function), reads and writes of \c LuaVariable values, and conversions
+    *  of values between \c LuaValue and the Lua stack (done by
+    *  \c ToLuaValue() and \c PushLuaValue()).
+    *  <p>Gathering metrics is opt-in twice. At compile time, the
+    *  instrumentation exists only if Diluculum is built with
+    *  \c DILUCULUM_ENABLE_METRICS defined (the \c DILUCULUM_METRICS CMake
+    *  option); otherwise, it compiles to nothing and all metrics stay at
+    *  zero (see \c compiledIn()). At run time, metrics are gathered only
+    *  while a \c LuaMetrics is running on the state; until then, each
+    *  instrumentation point costs a single atomic load.
+    *  <p>Calls are identified by the name of the function, when it is known
+    *  (as in <tt>LuaState::call<R>("name", ...)</tt>). Otherwise, they are
+    *  identified by where the function was defined, as in
+    *  <tt>"script.lua:10"</tt>, or as <tt>"main chunk (source)"</tt> and
+    *  <tt>"[C]"</tt>.
+    *  <p>Typed accesses through \c LuaStack (like \c LuaTableRef::get())
+    *  don't use \c LuaValue, and therefore are not counted as conversions.
+    *  @note Only one \c LuaMetrics can be running on a given state at a
+    *        time.
+    *  @note Destroying the \c LuaState stops a \c LuaMetrics running on it
+    *        (the metrics gathered can still be read). A \c LuaMetrics must not
+    *        be started after its \c LuaState is destroyed. If the
+    *        <tt>lua_State</tt> is not owned by the \c LuaState (and is closed
+    *        by other means), the \c LuaMetrics must be stopped before it is
+    *        closed.
+    */
+   class LuaMetrics: boost::noncopyable
+   {
+      public:
+         /** A latency histogram, in the style of HdrHistogram: values (in
+          *  nanoseconds) are counted in buckets whose width grows with the
+          *  value, so that every value is represented with a relative error
+          *  below 1/16 (about 6%), with constant memory and recording time.
+          */
+         class Histogram
+         {
+            public:
+               /// Constructs an empty \c Histogram.
+               Histogram();
+
+               /// Records a value.
+               void record (unsigned long long nanoseconds);
+
+               /// Returns the number of values recorded.
+               unsigned long long count() const { return count_; }
+
+               /// Returns the sum of the values recorded.
+               unsigned long long total() const { return total_; }
+
+               /// Returns the smallest value recorded (zero if empty).
+               unsigned long long min() const { return count_ > 0 ? min_ : 0; }
+
+               /// Returns the largest value recorded.
+               unsigned long long max() const { return max_; }
+
+               /** Returns the value below which the fraction \c q (between
+                *  zero and one) of the recorded values lies. The result is
+                *  the upper bound of the bucket in which that value was
+                *  counted.
+                */
+               unsigned long long percentile (double q) const;
+
+               /// Adds the values recorded in \c other to this histogram.
+               void merge (const Histogram& other);
+
+               /// Discards all values recorded.
+               void reset();
+
+            private:
+               /// Number of buckets for each power of two.
+               static const int SubBuckets = 16;
+
+               /** Number of buckets. Values of \f$2^{48}\f$ nanoseconds (a few
+                *  days) or more are all counted in the last bucket.
+                */
+               static const int NumBuckets = (48 - 3) * SubBuckets;
+
+               /// Returns the index of the bucket for \c value.
+               static int bucketIndex (unsigned long long value);
+
+               /// Returns the largest value counted in a given bucket.
+               static unsigned long long bucketUpperBound (int index);
+
+               /// The number of values counted in each bucket.
+               std::vector<unsigned long long> buckets_;
+
+               /// The number of values recorded.
+               unsigned long long count_;
+
+               /// The sum of the values recorded.
+               unsigned long long total_;
+
+               /// The smallest value recorded.
+               unsigned long long min_;
+
+               /// The largest value recorded.
+               unsigned long long max_;
+         };
+
+         /// The metrics of calls to a given function.
+         struct FunctionStats
+         {
+            /// The function name (or location; see the class documentation).
+            std::string name;
+
+            /// The number of calls.
+            unsigned long long calls;
+
+            /// The number of calls that failed.
+            unsigned long long errors;
+
+            /// The total time spent in the calls, in seconds.
+            double totalTime;
+
+            /// The duration of the fastest call, in seconds.
+            double minTime;
+
+            /// The duration of the slowest call, in seconds.
+            double maxTime;
+
+            /// The median call duration, in seconds.
+            double p50;
+
+            /// The 90th percentile of the call duration, in seconds.
+            double p90;
+
+            /// The 99th percentile of the call duration, in seconds.
+            double p99;
+
+            /// The 99.9th percentile of the call duration, in seconds.
+            double p999;
+         };
+
+         /// The metrics gathered so far, as returned by \c snapshot().
+         struct Snapshot
+         {
+            /// Calls from C++ into Lua (including \c LuaState::doString()).
+            unsigned long long calls;
+
+            /// Calls from C++ into Lua that failed.
+            unsigned long long callErrors;
+
+            /// Values read with \c LuaVariable::value().
+            unsigned long long variableReads;
+
+            /// Values written with \c LuaVariable::operator=().
+            unsigned long long variableWrites;
+
+            /// Values converted from \c LuaValue to Lua (nested ones included).
+            unsigned long long valuesToLua;
+
+            /// Values converted from Lua to \c LuaValue (nested ones included).
+            unsigned long long valuesFromLua;
+
+            /** Bytes converted from \c LuaValue to Lua (string lengths, number
+             *  sizes, userdata sizes and so on).
+             */
+            unsigned long long bytesToLua;
+
+            /// Bytes converted from Lua to \c LuaValue.
+            unsigned long long bytesFromLua;
+
+            /// Lua tables created when converting <tt>LuaValueMap</tt>s.
+            unsigned long long tablesCreated;
+
+            /// Lua tables converted to <tt>LuaValueMap</tt>s.
+            unsigned long long tablesConverted;
+
+            /// The metrics of each function called, sorted by name.
+            std::vector<FunctionStats> functions;
+         };
+
+         /** Constructs a \c LuaMetrics for a given \c LuaState. It is created
+          *  stopped.
+          */
+         explicit LuaMetrics (LuaState& ls);
+
+         /// Destroys the \c LuaMetrics, stopping it if necessary.
+         ~LuaMetrics();
+
+         /** Was Diluculum compiled with the instrumentation needed to gather
+          *  metrics? If not, a \c LuaMetrics can be used normally, but all
+          *  metrics stay at zero.
+          */
+         static bool compiledIn();
+
+         /** Starts (or resumes) gathering metrics. Metrics gathered
+          *  previously are kept.
+          *  @throw LuaError If another \c LuaMetrics is running on the same
+          *         state, or if this \c LuaMetrics was stopped because its
+          *         \c LuaState was destroyed.
+          */
+         void start();
+
+         /// Stops gathering metrics. Metrics gathered so far are kept.
+         void stop();
+
+         /// Is this \c LuaMetrics running?
+         bool isRunning() const { return running_; }
+
+         /// Discards all metrics gathered so far.
+         void reset();
+
+         /// Returns the metrics gathered so far.
+         Snapshot snapshot() const;
+
+         /** Returns the latency histogram of calls to the function named
+          *  \c name, or a null pointer if no such call was recorded.
+          */
+         const Histogram* histogram (const std::string& name) const;
+
+         /** Returns the metrics gathered so far in the Prometheus text
+          *  exposition format. Counters are named like
+          *  <tt>prefix_calls_total</tt>; call durations are exported as a
+          *  summary named <tt>prefix_call_duration_seconds</tt>, with a
+          *  \c function label.
+          *  @param prefix The prefix of the metric names.
+          *  @param labels Extra labels added to every metric, already
+          *         formatted (like <tt>state="worker1"</tt>). May be empty.
+          */
+         std::string prometheusText (const std::string& prefix = "diluculum",
+                                     const std::string& labels = "") const;
+
+         /** @name Recording
+          *  Called by the Diluculum internals. These are public so that
+          *  bindings written directly with the Lua C API can report their own
+          *  crossings of the boundary.
+          */
+         //@{
+
+         /// Records a call to the function \c name.
+         void recordCall (const std::string& name,
+                          unsigned long long nanoseconds, bool failed);
+
+         /// Records the conversion of a value of \c bytes bytes to Lua.
+         void recordToLua (std::size_t bytes)
+         { ++counters_.valuesToLua; counters_.bytesToLua += bytes; }
+
+         /// Records the conversion of a value of \c bytes bytes from Lua.
+         void recordFromLua (std::size_t bytes)
+         { ++counters_.valuesFromLua; counters_.bytesFromLua += bytes; }
+
+         /// Records the creation of a table when converting to Lua.
+         void recordTableCreated() { ++counters_.tablesCreated; }
+
+         /// Records the conversion of a table from Lua.
+         void recordTableConverted() { ++counters_.tablesConverted; }
+
+         /// Records a read of a \c LuaVariable.
+         void recordVariableRead() { ++counters_.variableReads; }
+
+         /// Records a write to a \c LuaVariable.
+         void recordVariableWrite() { ++counters_.variableWrites; }
+
+         //@}
+
+      private:
+         friend class LuaState;
+
+         /** Stops this \c LuaMetrics because the \c LuaState it observes is
+          *  being destroyed.
+          */
+         void detach();
+
+         /// The metrics of calls to a given function.
+         struct FunctionData
+         {
+            FunctionData() : errors(0) { }
+
+            /// The call durations.
+            Histogram latency;
+
+            /// The number of calls that failed.
+            unsigned long long errors;
+         };
+
+         /// The Lua state being observed.
+         lua_State* state_;
+
+         /// Is this \c LuaMetrics running?
+         bool running_;
+
+         /// The counters (\c functions is not used here).
+         Snapshot counters_;
+
+         /// The metrics of each function called.
+         std::map<std::string, FunctionData> functions_;
+   };
+
+} // namespace Diluculum
+
+#endif // _DILUCULUM_LUA_METRICS_HPP_
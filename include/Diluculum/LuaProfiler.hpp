@@ -0,0 +1,238 @@
+/******************************************************************************\
+* LuaProfiler.hpp                                                              *
+* A sampling profiler for Lua code.                                            *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#ifndef _DILUCULUM_LUA_PROFILER_HPP_
+#define _DILUCULUM_LUA_PROFILER_HPP_
+
+#include <lua.hpp>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+
+namespace Diluculum
+{
+   class LuaState;
+
+   namespace Impl
+   {
+      void LuaHook (lua_State* ls, lua_Debug* ar);
+   }
+
+   /** A sampling profiler for the Lua code running in a \c LuaState. While
+    *  running, it samples the Lua call stack every given number of VM
+    *  instructions (using a count hook), and aggregates the samples both by
+    *  full call stack and by the source file and line being executed.
+    *  <p>Profiling can be started and stopped at any time, even while Lua code
+    *  is running (for instance, from a C++ function called by Lua). When
+    *  stopped, the profiler costs nothing.
+    *  <p>The hook itself doesn't allocate memory: samples are copied to a
+    *  buffer allocated along with the profiler, and aggregated only when
+    *  they are read or when the profiler is stopped. Samples taken while
+    *  this buffer is full are dropped (and counted by \c droppedSamples());
+    *  when profiling a long running call, reading the results from time to
+    *  time (for instance, from a C++ function called by Lua) avoids this.
+    *  @note Only one profiler can be running on a given state at a time.
+    *  @note Destroying the \c LuaState stops a profiler running on it (the
+    *        samples taken can still be read). A profiler must not be started
+    *        after its \c LuaState is destroyed.
+    *  @note The hook is installed in the main Lua thread; coroutines created
+    *        while the profiler is stopped are not profiled. Coroutines created
+    *        while it runs remove the hook themselves once it is stopped.
+    */
+   class LuaProfiler: boost::noncopyable
+   {
+      public:
+         /// A location in the Lua code, along with its number of samples.
+         struct Entry
+         {
+            /// The location, in the <tt>"source:line"</tt> format.
+            std::string location;
+
+            /// The number of samples taken at this location.
+            unsigned long samples;
+         };
+
+         /** Constructs a \c LuaProfiler for a given \c LuaState. The profiler
+          *  is created stopped.
+          *  @param ls The \c LuaState to profile.
+          *  @param sampleInterval Number of VM instructions between two
+          *         samples. This controls the overhead of profiling: smaller
+          *         values give more precise results, at a higher cost.
+          *  @param maxDepth Maximum number of stack frames recorded in each
+          *         sample (the innermost frames are kept).
+          *  @throw LuaError If \c sampleInterval or \c maxDepth is not
+          *         positive.
+          */
+         explicit LuaProfiler (LuaState& ls, int sampleInterval = 10000,
+                               int maxDepth = 64);
+
+         /// Destroys the \c LuaProfiler, stopping it if necessary.
+         ~LuaProfiler();
+
+         /** Starts (or resumes) profiling. Samples taken previously are kept.
+          *  @throw LuaError If another profiler is running on the same state,
+          *         or if the profiler was stopped because its \c LuaState was
+          *         destroyed.
+          */
+         void start();
+
+         /** Stops profiling. Samples taken so far are kept (and aggregated,
+          *  which frees the buffer used by the hook).
+          */
+         void stop();
+
+         /// Is the profiler running?
+         bool isRunning() const { return running_; }
+
+         /** Sets the number of VM instructions between two samples. This can
+          *  be called while the profiler is running.
+          *  @throw LuaError If \c sampleInterval is not positive.
+          */
+         void setSampleInterval (int sampleInterval);
+
+         /// Returns the number of VM instructions between two samples.
+         int sampleInterval() const { return sampleInterval_; }
+
+         /// Returns the total number of samples taken.
+         unsigned long samples() const { return samples_; }
+
+         /** Returns the number of samples dropped because the buffer used by
+          *  the hook was full. These are not counted by \c samples().
+          */
+         unsigned long droppedSamples() const { return droppedSamples_; }
+
+         /// Discards all samples taken so far.
+         void reset();
+
+         /** Returns the \c n source locations with more samples, sorted by
+          *  decreasing number of samples.
+          */
+         std::vector<Entry> top (std::size_t n) const;
+
+         /** Returns the samples in the "folded stacks" format used by
+          *  flame graph tools: one line per distinct call stack, with its
+          *  frames separated by semicolons (outermost first), followed by a
+          *  space and the number of samples.
+          */
+         std::string foldedStacks() const;
+
+         /** Returns a human-readable report with the \c n source locations
+          *  with more samples.
+          */
+         std::string report (std::size_t n = 20) const;
+
+      private:
+         friend class LuaState;
+         friend void Impl::LuaHook (lua_State* ls, lua_Debug* ar);
+
+         /** A stack frame, as recorded by the hook. Plain data, so that
+          *  sampling doesn't allocate memory.
+          */
+         struct Frame
+         {
+            /// What the function is (as in \c lua_Debug::what).
+            char what[8];
+
+            /// The name of the function, or an empty string if unknown.
+            char name[LUA_IDSIZE];
+
+            /// The source of the function (as in \c lua_Debug::short_src).
+            char source[LUA_IDSIZE];
+
+            /// The line where the function was defined.
+            int lineDefined;
+
+            /// The line being executed, or -1 if not available.
+            int currentLine;
+         };
+
+         /** Number of stack frames that can be buffered before being
+          *  aggregated (or \c maxDepth, if larger).
+          */
+         static const int BufferedFrames = 8192;
+
+         /** Called by the hook when \c count instructions have been executed
+          *  in the Lua thread \c ls. Takes a sample when appropriate.
+          */
+         void countInstructions (lua_State* ls, int count);
+
+         /// Samples the call stack of the Lua thread \c ls.
+         void takeSample (lua_State* ls);
+
+         /// Aggregates the buffered samples into \c stacks_ and \c lines_.
+         void aggregate() const;
+
+         /** Stops the profiler because the \c LuaState it profiles is being
+          *  destroyed.
+          */
+         void detach();
+
+         /** Removes the hook from the profiled state, without aggregating
+          *  the buffered samples. Does nothing if the profiler is stopped.
+          */
+         void removeHook();
+
+         /// The Lua state being profiled.
+         lua_State* state_;
+
+         /// Number of VM instructions between two samples.
+         int sampleInterval_;
+
+         /// Maximum number of stack frames recorded in each sample.
+         int maxDepth_;
+
+         /// Is the profiler running?
+         bool running_;
+
+         /// Instructions executed since the last sample.
+         long instructions_;
+
+         /// Total number of samples taken.
+         unsigned long samples_;
+
+         /// Number of samples dropped because the buffer was full.
+         unsigned long droppedSamples_;
+
+         /// The frames of the samples not aggregated yet, innermost first.
+         mutable std::vector<Frame> frames_;
+
+         /// The number of frames of each sample not aggregated yet.
+         mutable std::vector<int> depths_;
+
+         /// Number of samples for each call stack (in folded format).
+         mutable std::map<std::string, unsigned long> stacks_;
+
+         /// Number of samples for each <tt>"source:line"</tt> location.
+         mutable std::map<std::string, unsigned long> lines_;
+   };
+
+} // namespace Diluculum
+
+#endif // _DILUCULUM_LUA_PROFILER_HPP_
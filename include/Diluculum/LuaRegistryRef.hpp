@@ -0,0 +1,115 @@
+/******************************************************************************\
+* LuaRegistryRef.hpp                                                           *
+* A reference to a value anchored in the Lua registry.                         *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+
+#ifndef _DILUCULUM_LUA_REGISTRY_REF_HPP_
+#define _DILUCULUM_LUA_REGISTRY_REF_HPP_
+
+#include <lua.hpp>
+#include <Diluculum/LuaVariable.hpp>
+
+
+namespace Diluculum
+{
+   namespace Impl
+   {
+      /** The part shared by \c LuaFunctionRef and \c LuaTableRef: a reference
+       *  to a value anchored in the registry with \c luaL_ref(). Copying a
+       *  \c LuaRegistryRef creates another reference to the same value; the
+       *  reference is released when the \c LuaRegistryRef is destroyed.
+       *  @note This is not intended to be used directly by Diluculum users.
+       */
+      class LuaRegistryRef
+      {
+         public:
+            /// Does this reference a value?
+            bool isValid() const { return ref_ != LUA_NOREF; }
+
+            /// Releases the reference, making this \c LuaRegistryRef invalid.
+            void reset();
+
+            /// Returns the Lua state in which the referenced value lives.
+            lua_State* getState() const { return state_; }
+
+         protected:
+            /// Constructs an invalid \c LuaRegistryRef.
+            LuaRegistryRef();
+
+            /** Constructs a \c LuaRegistryRef referencing the value currently
+             *  stored in a variable.
+             *  @throw TypeMismatchError If the value is not of type \c type
+             *         (as in \c lua_type()).
+             */
+            LuaRegistryRef (const LuaVariable& var, int type);
+
+            /** Constructs a \c LuaRegistryRef referencing the value at a given
+             *  index of the stack of \c ls.
+             *  @throw TypeMismatchError If the value is not of type \c type
+             *         (as in \c lua_type()).
+             */
+            LuaRegistryRef (lua_State* ls, int index, int type);
+
+            /// Copy constructor.
+            LuaRegistryRef (const LuaRegistryRef& other);
+
+            /// Move constructor.
+            LuaRegistryRef (LuaRegistryRef&& other);
+
+            /// Destroys the \c LuaRegistryRef, releasing the reference.
+            ~LuaRegistryRef();
+
+            /// Copy assignment operator.
+            LuaRegistryRef& operator= (const LuaRegistryRef& rhs);
+
+            /// Move assignment operator.
+            LuaRegistryRef& operator= (LuaRegistryRef&& rhs);
+
+            /** Pushes the referenced value onto the stack of its Lua state.
+             *  \c className is the name of the handle, used in the error
+             *  message.
+             *  @throw LuaError If this \c LuaRegistryRef is not valid.
+             */
+            void pushReferenced (const char* className) const;
+
+            /// The Lua state in which the referenced value lives.
+            lua_State* state_;
+
+            /// The registry reference to the value.
+            int ref_;
+
+         private:
+            /** Anchors the value at \c index of the stack of \c state_, which
+             *  must be of type \c type.
+             */
+            void anchor (int index, int type);
+      };
+
+   } // namespace Impl
+
+} // namespace Diluculum
+
+#endif // _DILUCULUM_LUA_REGISTRY_REF_HPP_
@@ -0,0 +1,135 @@
+/******************************************************************************\
+* LuaResult.hpp                                                                *
+* The outcome of executing some Lua code.                                      *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#ifndef _DILUCULUM_LUA_RESULT_HPP_
+#define _DILUCULUM_LUA_RESULT_HPP_
+
+#include <cstddef>
+#include <string>
+#include <lua.hpp>
+#include <Diluculum/LuaValue.hpp>
+
+
+namespace Diluculum
+{
+   class LuaResult;
+
+   namespace Impl
+   {
+      /** Turns \c result into a failure with status \c status, taking the
+       *  error message from the top of the stack of \c ls (and popping it).
+       *  @note This is not intended to be called by Diluculum users.
+       */
+      void SetErrorResult (lua_State* ls, int status, LuaResult& result);
+
+      /** Turns \c result into a failure with status \c status and the error
+       *  message \c message. Used for errors detected on the C++ side.
+       *  @note This is not intended to be called by Diluculum users.
+       */
+      void SetErrorResult (LuaResult& result, int status,
+                           const std::string& message);
+   }
+
+
+   /** The outcome of executing some Lua code with one of the non-throwing
+    *  functions, like \c LuaState::tryDoString(): either the values returned
+    *  by the code, or a status code and an error message.
+    *  <p>These functions are meant for cases in which errors are frequent
+    *  (like validation scripts that deliberately call \c error()). Reporting
+    *  these errors as exceptions has a cost (unwinding the stack) that
+    *  \c LuaResult avoids.
+    */
+   class LuaResult
+   {
+      public:
+         /// Constructs a successful \c LuaResult, without values.
+         LuaResult()
+            : status_(0), limitExceeded_(false)
+         { }
+
+         /** Returns the status code, as returned by the Lua API functions:
+          *  zero for success, or one of \c LUA_ERRRUN, \c LUA_ERRSYNTAX,
+          *  \c LUA_ERRMEM, \c LUA_ERRERR and \c LUA_ERRFILE.
+          */
+         int status() const { return status_; }
+
+         /// Was the execution successful?
+         bool ok() const { return status_ == 0; }
+
+         /// Was the execution successful?
+         explicit operator bool() const { return ok(); }
+
+         /** Returns the error message (an empty string if the execution was
+          *  successful). The string is valid as long as this \c LuaResult.
+          */
+         const char* errorMessage() const { return message_.c_str(); }
+
+         /// Returns the length of the string returned by \c errorMessage().
+         std::size_t errorMessageLength() const { return message_.size(); }
+
+         /** Did the execution fail because it exceeded the limits set with
+          *  \c LuaState::setExecutionLimits()?
+          */
+         bool executionLimitExceeded() const { return limitExceeded_; }
+
+         /** Returns the values returned by the code (empty if the execution
+          *  failed).
+          */
+         const LuaValueList& values() const { return values_; }
+
+         /// Returns the values returned by the code.
+         LuaValueList& values() { return values_; }
+
+         /** Throws the exception that the throwing equivalent of the function
+          *  that returned this \c LuaResult would have thrown. Does nothing if
+          *  the execution was successful.
+          *  @throw LuaError The proper subclass of \c LuaError for the status
+          *         code, just like \c LuaState::doString() and friends.
+          */
+         void throwIfError() const;
+
+      private:
+         friend void Impl::SetErrorResult (lua_State*, int, LuaResult&);
+         friend void Impl::SetErrorResult (LuaResult&, int,
+                                           const std::string&);
+
+         /// The status code.
+         int status_;
+
+         /// The error message.
+         std::string message_;
+
+         /// Was an execution limit exceeded?
+         bool limitExceeded_;
+
+         /// The values returned by the code.
+         LuaValueList values_;
+   };
+
+} // namespace Diluculum
+
+#endif // _DILUCULUM_LUA_RESULT_HPP_
@@ -0,0 +1,224 @@
+/******************************************************************************\
+* LuaStack.hpp                                                                 *
+* Typed access to values on the Lua stack.                                     *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#ifndef _DILUCULUM_LUA_STACK_HPP_
+#define _DILUCULUM_LUA_STACK_HPP_
+
+#include <string>
+#include <lua.hpp>
+#include <Diluculum/LuaExceptions.hpp>
+#include <Diluculum/LuaUtils.hpp>
+
+
+namespace Diluculum
+{
+   /** Typed access to values on the Lua stack, without going through a
+    *  \c LuaValue. Each supported type \c T has a specialization providing
+    *  three static member functions:
+    *  <ul>
+    *     <li><tt>void push (lua_State* ls, const T& value)</tt>, which pushes
+    *        \c value onto the stack;
+    *     <li><tt>bool is (lua_State* ls, int index)</tt>, which checks whether
+    *        the value at \c index can be read as a \c T;
+    *     <li><tt>T get (lua_State* ls, int index)</tt>, which reads the value
+    *        at \c index, throwing a \c TypeMismatchError if it is not of the
+    *        proper type.
+    *  </ul>
+    *  Conversions are strict: a string is not read as a number, nor a number
+    *  as a string (just like \c LuaValue::asNumber() and
+    *  \c LuaValue::asString() do). As usual, the stack is kept untouched by
+    *  \c is() and \c get().
+    *  <p>Supported types are \c bool, the arithmetic types, \c std::string,
+    *  <tt>const char*</tt> (which, when read, is valid only while the value
+    *  stays on the stack) and \c LuaValue (which converts any value, just like
+    *  \c ToLuaValue()). Other Diluculum headers add further specializations.
+    *  <p>The \c Enable parameter is there just to allow partial
+    *  specializations for whole families of types (with \c std::enable_if).
+    */
+   template <typename T, typename Enable = void>
+   struct LuaStack;
+
+
+   /// \c LuaStack specialization for \c bool.
+   template<>
+   struct LuaStack<bool>
+   {
+      static void push (lua_State* ls, bool value)
+      { lua_pushboolean (ls, value); }
+
+      static bool is (lua_State* ls, int index)
+      { return lua_type (ls, index) == LUA_TBOOLEAN; }
+
+      static bool get (lua_State* ls, int index)
+      {
+         if (!is (ls, index))
+            throw TypeMismatchError ("boolean", luaL_typename (ls, index));
+         return lua_toboolean (ls, index) != 0;
+      }
+   };
+
+
+/** Defines the \c LuaStack specialization for an arithmetic type.
+ *  @param TYPE The arithmetic type.
+ */
+#define DILUCULUM_LUA_STACK_NUMBER(TYPE)                                      \
+   template<>                                                                 \
+   struct LuaStack<TYPE>                                                      \
+   {                                                                          \
+      static void push (lua_State* ls, TYPE value)                            \
+      { lua_pushnumber (ls, static_cast<lua_Number>(value)); }                \
+                                                                              \
+      static bool is (lua_State* ls, int index)                               \
+      { return lua_type (ls, index) == LUA_TNUMBER; }                         \
+                                                                              \
+      static TYPE get (lua_State* ls, int index)                              \
+      {                                                                       \
+         if (!is (ls, index))                                                 \
+            throw TypeMismatchError ("number", luaL_typename (ls, index));    \
+         return static_cast<TYPE>(lua_tonumber (ls, index));                  \
+      }                                                                       \
+   };
+
+   DILUCULUM_LUA_STACK_NUMBER (short)
+   DILUCULUM_LUA_STACK_NUMBER (unsigned short)
+   DILUCULUM_LUA_STACK_NUMBER (int)
+   DILUCULUM_LUA_STACK_NUMBER (unsigned)
+   DILUCULUM_LUA_STACK_NUMBER (long)
+   DILUCULUM_LUA_STACK_NUMBER (unsigned long)
+   DILUCULUM_LUA_STACK_NUMBER (long long)
+   DILUCULUM_LUA_STACK_NUMBER (unsigned long long)
+   DILUCULUM_LUA_STACK_NUMBER (float)
+   DILUCULUM_LUA_STACK_NUMBER (double)
+   DILUCULUM_LUA_STACK_NUMBER (long double)
+
+#undef DILUCULUM_LUA_STACK_NUMBER
+
+
+   /// \c LuaStack specialization for \c std::string.
+   template<>
+   struct LuaStack<std::string>
+   {
+      static void push (lua_State* ls, const std::string& value)
+      { lua_pushlstring (ls, value.c_str(), value.length()); }
+
+      static bool is (lua_State* ls, int index)
+      { return lua_type (ls, index) == LUA_TSTRING; }
+
+      static std::string get (lua_State* ls, int index)
+      {
+         if (!is (ls, index))
+            throw TypeMismatchError ("string", luaL_typename (ls, index));
+         return std::string (lua_tostring (ls, index), lua_objlen (ls, index));
+      }
+   };
+
+
+   /// \c LuaStack specialization for <tt>const char*</tt>.
+   template<>
+   struct LuaStack<const char*>
+   {
+      static void push (lua_State* ls, const char* value)
+      { lua_pushstring (ls, value); }
+
+      static bool is (lua_State* ls, int index)
+      { return lua_type (ls, index) == LUA_TSTRING; }
+
+      static const char* get (lua_State* ls, int index)
+      {
+         if (!is (ls, index))
+            throw TypeMismatchError ("string", luaL_typename (ls, index));
+         return lua_tostring (ls, index);
+      }
+   };
+
+
+   /// \c LuaStack specialization for \c LuaValue.
+   template<>
+   struct LuaStack<LuaValue>
+   {
+      static void push (lua_State* ls, const LuaValue& value)
+      { PushLuaValue (ls, value); }
+
+      static bool is (lua_State* ls, int index)
+      { return lua_type (ls, index) != LUA_TTHREAD; }
+
+      static LuaValue get (lua_State* ls, int index)
+      { return ToLuaValue (ls, index); }
+   };
+
+
+
+   namespace Impl
+   {
+      /// Pushes \c value using \c LuaStack<T> (preferred, if it exists).
+      template <typename T>
+      inline auto PushToStackImpl (lua_State* ls, const T& value, int)
+         -> decltype (LuaStack<T>::push (ls, value))
+      {
+         LuaStack<T>::push (ls, value);
+      }
+
+      /// Pushes \c value by converting it to a \c LuaValue.
+      template <typename T>
+      inline void PushToStackImpl (lua_State* ls, const T& value, long)
+      {
+         PushLuaValue (ls, LuaValue (value));
+      }
+   }
+
+   /** Pushes \c value onto the stack of \c ls, using the proper \c LuaStack
+    *  specialization. Types without a \c LuaStack specialization (like
+    *  \c LuaValueMap or \c LuaUserData) are pushed by converting them to a
+    *  \c LuaValue.
+    */
+   template <typename T>
+   inline void PushToStack (lua_State* ls, const T& value)
+   {
+      Impl::PushToStackImpl (ls, value, 0);
+   }
+
+   /** Pushes a string onto the stack of \c ls. (This overload exists so that
+    *  string literals can be passed to \c PushToStack().)
+    */
+   inline void PushToStack (lua_State* ls, const char* value)
+   {
+      lua_pushstring (ls, value);
+   }
+
+   /** Reads the value at \c index of the stack of \c ls as a \c T, using the
+    *  proper \c LuaStack specialization.
+    *  @throw TypeMismatchError If the value is not of the proper type.
+    */
+   template <typename T>
+   inline T GetFromStack (lua_State* ls, int index)
+   {
+      return LuaStack<T>::get (ls, index);
+   }
+
+} // namespace Diluculum
+
+#endif // _DILUCULUM_LUA_STACK_HPP_
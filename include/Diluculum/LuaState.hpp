@@ -29,9 +29,14 @@
 #define _DILUCULUM_LUA_STATE_HPP_
 
 #include <lua.hpp>
+#include <exception>
+#include <functional>
+#include <future>
+#include <map>
 #include <string>
 #include <vector>
 #include <Diluculum/LuaExceptions.hpp>
+#include <Diluculum/LuaResult.hpp>
 #include <Diluculum/LuaValue.hpp>
 #include <Diluculum/LuaVariable.hpp>
 #include <Diluculum/Types.hpp>
@@ -39,6 +44,29 @@
 
 namespace Diluculum
 {
+   /** The Lua standard libraries, used to select which of them are loaded
+    *  in a \c LuaState. These are bit flags that can be combined with
+    *  <tt>operator|</tt>.
+    */
+   enum StdLib
+   {
+      NO_LIBS     = 0,
+      BASE_LIB    = 1 << 0,  ///< Basic functions and \c coroutine.
+      PACKAGE_LIB = 1 << 1,  ///< \c package, \c require() and \c module().
+      TABLE_LIB   = 1 << 2,  ///< \c table.
+      IO_LIB      = 1 << 3,  ///< \c io.
+      OS_LIB      = 1 << 4,  ///< \c os.
+      STRING_LIB  = 1 << 5,  ///< \c string.
+      MATH_LIB    = 1 << 6,  ///< \c math.
+      DEBUG_LIB   = 1 << 7,  ///< \c debug.
+      ALL_LIBS    = (1 << 8) - 1
+   };
+
+   /// Combines two sets of <tt>StdLib</tt>s.
+   inline StdLib operator| (StdLib lhs, StdLib rhs)
+   { return static_cast<StdLib>(static_cast<int>(lhs) | rhs); }
+
+
 
    /** \c LuaState: The Next Generation. The pleasant way to do perform relevant
     *  operations on a Lua state.
@@ -50,6 +78,38 @@ namespace Diluculum
    class LuaState
    {
       public:
+         /** Identifies a call started by \c callAsync(). Identifiers are
+          *  never reused by a \c LuaState, so an identifier of a call that
+          *  has already finished never refers to another call. C functions
+          *  called during the call can get it from their
+          *  <tt>lua_State*</tt> parameter with \c getAsyncCallId().
+          */
+         typedef unsigned long AsyncCallId;
+
+         /// An \c AsyncCallId that doesn't identify any call.
+         static const AsyncCallId NoAsyncCall = 0;
+
+         /** The type of the function that receives the outcome of a call
+          *  started by \c callAsync(). If the call succeeded, \c error is
+          *  null and \c results holds the values returned by the function.
+          *  Otherwise, \c error holds the exception that would have been
+          *  thrown by \c call() (some subclass of \c LuaError).
+          */
+         typedef std::function<void (const LuaValueList& results,
+                                     std::exception_ptr error)> AsyncCallback;
+
+         /** The type of the function that provides the parameters for the
+          *  calls made by the streaming \c callBatch(). It must fill
+          *  \c params (which is passed empty) and return \c true, or return
+          *  \c false when there are no more calls to make.
+          */
+         typedef std::function<bool (LuaValueList& params)> BatchSource;
+
+         /** The type of the function that receives the results of each call
+          *  made by the streaming \c callBatch().
+          */
+         typedef std::function<void (const LuaValueList& results)> BatchSink;
+
          /** Constructs a \c LuaState that owns a <tt>lua_State*</tt>. In other
           *  words, this will create the underlying Lua state on construction
           *  and destroy it when this \c LuaState is destroyed.
@@ -59,6 +119,20 @@ namespace Diluculum
           */
          explicit LuaState (bool loadStdLib = true);
 
+         /** Constructs a \c LuaState that owns a <tt>lua_State*</tt>, loading
+          *  only some of the standard libraries.
+          *  @param libs The libraries loaded right away.
+          *  @param lazyLibs The libraries loaded only when first used, that is,
+          *         when the global variable they define (like \c io or
+          *         \c require) is first read, or, for \c STRING_LIB, when a
+          *         string method is first called. This is implemented by a
+          *         metatable set for the table of globals, so it stops
+          *         working if Lua code replaces this metatable. \c BASE_LIB
+          *         is always loaded right away.
+          *  @throw LuaError If something goes wrong.
+          */
+         explicit LuaState (StdLib libs, StdLib lazyLibs = NO_LIBS);
+
          /** Constructs a \c LuaState that doesn't own the underlying Lua state.
           *  In other words, this \c LuaState will use a user-supplied
           *  <tt>lua_State*</tt> and its destructor will not \c lua_close() it.
@@ -107,6 +181,30 @@ namespace Diluculum
          LuaValueList doString (const std::string& what)
          { return doStringOrFile (true, what); }
 
+         /** Just like \c doFile(), but reports errors through the returned
+          *  \c LuaResult instead of throwing exceptions. Use this when errors
+          *  are expected to be frequent. Return values of types not supported
+          *  by \c LuaValue are reported with the \c LUA_ERRRUN status.
+          */
+         LuaResult tryDoFile (const std::string& fileName)
+         {
+            LuaResult result;
+            doStringOrFile (false, fileName, result);
+            return result;
+         }
+
+         /** Just like \c doString(), but reports errors through the returned
+          *  \c LuaResult instead of throwing exceptions. Use this when errors
+          *  are expected to be frequent. Return values of types not supported
+          *  by \c LuaValue are reported with the \c LUA_ERRRUN status.
+          */
+         LuaResult tryDoString (const std::string& what)
+         {
+            LuaResult result;
+            doStringOrFile (true, what, result);
+            return result;
+         }
+
          /** Calls a given Lua function on this Lua state.
           *  @param func The function to be called.
           *  @param params the list of parameters to pass to the function.
@@ -120,6 +218,207 @@ namespace Diluculum
                             const LuaValueList& params,
                             const std::string& chunkName = "Diluculum chunk");
 
+         /** Just like \c call(), but reports errors through the returned
+          *  \c LuaResult instead of throwing exceptions. This includes
+          *  errors found on the C++ side, like parameters or return values
+          *  of types not supported by \c LuaValue (which are reported with
+          *  the \c LUA_ERRRUN status).
+          */
+         LuaResult tryCall (LuaFunction& func,
+                            const LuaValueList& params,
+                            const std::string& chunkName = "Diluculum chunk");
+
+         /** Calls the global function named \c function, passing \c params
+          *  (pushed directly onto the Lua stack) and returning its results as
+          *  an \c R. This is the cheapest way to call a global function: no
+          *  \c LuaVariable or \c LuaValueList is created along the way.
+          *  See \c LuaVariable::call() for the types \c R can be.
+          *  @throw TypeMismatchError If \c function is not a function, or if
+          *         some return value is not of the requested type.
+          *  @throw LuaError (or any of its subclasses), if some error is found
+          *         during the function execution.
+          */
+         template <typename R, typename... Params>
+         R call (const char* function, const Params&... params)
+         {
+            lua_getfield (state_, LUA_GLOBALSINDEX, function);
+            return Impl::CallNamedOnTop<R> (state_, function, params...);
+         }
+
+         /** Calls the same function many times, once for each list of
+          *  parameters in \c params. This is much cheaper than calling
+          *  \c LuaVariable::operator()() in a loop: the function is looked up
+          *  only once, and the result lists are reused.
+          *  @param func The function to be called.
+          *  @param params The parameters for each call.
+          *  @param results Receives the values returned by each call
+          *         (<tt>results[i]</tt> are the results of the call with
+          *         <tt>params[i]</tt>). It is resized as needed, and the
+          *         lists it already contains are reused, so passing the same
+          *         \c results to many batches avoids reallocations.
+          *  @throw TypeMismatchError If \c func is not a function.
+          *  @throw LuaError (or any of its subclasses), if some call fails.
+          *         The remaining calls are not made.
+          */
+         void callBatch (const LuaVariable& func,
+                         const std::vector<LuaValueList>& params,
+                         std::vector<LuaValueList>& results);
+
+         /** Just like the other \c callBatch(), but returns the results.
+          */
+         std::vector<LuaValueList> callBatch (
+            const LuaVariable& func, const std::vector<LuaValueList>& params);
+
+         /** Calls the same function many times, streaming parameters in and
+          *  results out, so that large batches don't need to be held in
+          *  memory. The same parameter and result lists are reused for all
+          *  calls.
+          *  @param func The function to be called.
+          *  @param source Provides the parameters of each call.
+          *  @param sink Receives the results of each call.
+          *  @return The number of calls made.
+          *  @throw TypeMismatchError If \c func is not a function.
+          *  @throw LuaError (or any of its subclasses), if some call fails.
+          *         (Also, whatever \c source and \c sink throw.)
+          */
+         std::size_t callBatch (const LuaVariable& func,
+                                const BatchSource& source,
+                                const BatchSink& sink);
+
+         /** Limits the resources used by each subsequent call to \c doFile(),
+          *  \c doString(), \c call() or \c LuaVariable::operator()() on this
+          *  state. Each call gets its own budget; calls made from C++
+          *  functions called by Lua share the budget of the outermost call. A
+          *  call exceeding its budget is aborted with a
+          *  \c LuaExecutionLimitError.
+          *  <p>The limits are enforced by a Lua count hook, which is only
+          *  installed while some limit is set.
+          *  @param maxInstructions Maximum number of Lua VM instructions
+          *         executed per call. Zero means no limit.
+          *  @param maxSeconds Maximum (wall-clock) duration of a call, in
+          *         seconds. Zero means no limit.
+          *  @param checkInterval Number of instructions executed between two
+          *         checks of the limits. Larger values mean less overhead and
+          *         less precision.
+          *  @throw LuaError If \c checkInterval is not positive.
+          *  @note Time spent in C functions is only accounted for when Lua
+          *        code runs again, so a blocking C function cannot be
+          *        interrupted.
+          *  @note Each resumption of a call started by \c callAsync() is
+          *        limited like a call of its own.
+          *  @note The hook is installed in the main Lua thread; coroutines
+          *        created before the limits were set are not limited.
+          */
+         void setExecutionLimits (unsigned long maxInstructions,
+                                  double maxSeconds = 0.0,
+                                  int checkInterval = 1000);
+
+         /// Removes the limits set with \c setExecutionLimits().
+         void clearExecutionLimits();
+
+         /** Records the current global environment, so that it can be brought
+          *  back later by \c restore(). This records the contents and the
+          *  metatables of the table of globals, of the tables of loaded
+          *  modules (<tt>package.loaded</tt>), and of every table reachable
+          *  from them. Typically called right after a state is set up.
+          *  <p>Any previous checkpoint is discarded.
+          *  @throw LuaError If the recorded tables are nested more than 1000
+          *         levels deep. The state is left without a checkpoint in this
+          *         case.
+          *  @note Weak tables are not recorded. The contents of userdata and
+          *        the environments and upvalues of functions are not
+          *        recorded either.
+          */
+         void checkpoint();
+
+         /** Brings the global environment back to what it was when
+          *  \c checkpoint() was called: fields created since then in the
+          *  recorded tables are removed, changed fields get their old values
+          *  back and removed fields are recreated. Metatables are restored,
+          *  too. Then, unless \c collectGarbage is \c false, a full garbage
+          *  collection cycle is performed, freeing whatever was created since
+          *  the checkpoint.
+          *  <p>The checkpoint is kept, so this can be called again later.
+          *  @throw LuaError If \c checkpoint() was never called, or if the
+          *         restoration fails (for instance, because some script
+          *         messed with the checkpoint). In the latter case the state
+          *         may be left partially restored.
+          */
+         void restore (bool collectGarbage = true);
+
+         /// Was \c checkpoint() called for this state?
+         bool hasCheckpoint() const;
+
+         /** Calls a given Lua function on this Lua state, in a new Lua thread
+          *  (a coroutine), so that it can be suspended while waiting for
+          *  something. The call is suspended whenever a C function called by
+          *  it yields, typically by being wrapped with
+          *  \c DILUCULUM_WRAP_ASYNC_FUNCTION(). It is resumed when
+          *  \c resumeAsync() is called.
+          *  <p>If the function finishes without yielding, \c callback is
+          *  called before \c callAsync() returns.
+          *  @param func The function to be called.
+          *  @param params the list of parameters to pass to the function.
+          *  @param callback The function that receives the results (or the
+          *         error) when the call finishes.
+          *  @return The identifier of the call.
+          *  @throw TypeMismatchError If \c func is not a function.
+          *  @note Lua 5.1 does not allow yielding across metamethods, across
+          *        \c pcall() or from functions called from C. Only C
+          *        functions called directly by Lua code can suspend the call.
+          *  @note This \c LuaState must be alive until the call finishes.
+          *        Calls still suspended when it is destroyed are abandoned,
+          *        without calling their callbacks (and their Lua threads are
+          *        released).
+          */
+         AsyncCallId callAsync (LuaFunction& func,
+                                const LuaValueList& params,
+                                const AsyncCallback& callback);
+
+         /** Just like the other \c callAsync(), but calls the function stored
+          *  in a \c LuaVariable (and thus already loaded in the Lua state).
+          */
+         AsyncCallId callAsync (const LuaVariable& func,
+                                const LuaValueList& params,
+                                const AsyncCallback& callback);
+
+         /** Just like the other \c callAsync(), but returns the results
+          *  through a future. (The future will be ready as soon as the call
+          *  finishes, that is, during some call to \c resumeAsync().)
+          */
+         std::future<LuaValueList> callAsync (LuaFunction& func,
+                                              const LuaValueList& params);
+
+         /** Just like the other \c callAsync(), but calls the function stored
+          *  in a \c LuaVariable and returns the results through a future.
+          */
+         std::future<LuaValueList> callAsync (const LuaVariable& func,
+                                              const LuaValueList& params);
+
+         /** Resumes a call suspended in a C function. From Lua's point of
+          *  view, \c results are the values returned by the C function that
+          *  suspended the call.
+          *  @param call The call to be resumed.
+          *  @param results The values returned to the Lua side.
+          *  @throw LuaError If \c call is not a suspended call started by
+          *         this \c LuaState.
+          *  @note Like everything else in a \c LuaState, this must be called
+          *        by the thread using the state. An asynchronous operation
+          *        finishing in another thread has to hand its results to the
+          *        right thread (for example, via \c LuaExecutor::post()).
+          */
+         void resumeAsync (AsyncCallId call, const LuaValueList& results);
+
+         /// Returns the number of calls started and not yet finished.
+         std::size_t pendingAsyncCalls() const { return asyncCalls_.size(); }
+
+         /** Returns the identifier of the call started by \c callAsync()
+          *  running in the Lua thread \c ls, or \c NoAsyncCall if \c ls is
+          *  not running such a call. This is meant to be used by C functions
+          *  that suspend the call.
+          */
+         static AsyncCallId getAsyncCallId (lua_State* ls);
+
          /** Returns a \c LuaVariable representing the global variable named
           *  \c variable. Since the returned value also has a subscript
           *  operator, this is a handy way to access variables stored in tables.
@@ -142,6 +441,9 @@ namespace Diluculum
           *       themselves in a infinitely recursive manner. In Lua, tables
           *       are reference types, so this recursion is OK. In Diluculum,
           *       tables are value types, so this would result in a crash.
+          * @note This converts every global (including whole library tables)
+          *       to a \c LuaValue. Use a \c GlobalsView to walk the globals
+          *       lazily, converting only what is needed.
           * @return The table of global variables in this Lua state.
           */
          LuaValueMap globals();
@@ -166,6 +468,55 @@ namespace Diluculum
           */
          LuaValueList doStringOrFile (bool isString, const std::string& str);
 
+         /** Just like the other \c doStringOrFile(), but reports errors through
+          *  \c result. This is what \c tryDoString() and \c tryDoFile() end
+          *  up calling.
+          */
+         void doStringOrFile (bool isString, const std::string& str,
+                              LuaResult& result);
+
+         /** Pushes the function to be called by \c callBatch(), and returns
+          *  its stack index.
+          *  @throw TypeMismatchError If \c func is not a function.
+          */
+         int pushBatchFunction (const LuaVariable& func);
+
+         /** Starts an asynchronous call to the function on the top of the
+          *  stack. This is the common implementation of \c callAsync().
+          */
+         AsyncCallId startAsync (const LuaValueList& params,
+                                 const AsyncCallback& callback);
+
+         /** Resumes the thread of the call \c call, passing the \c numArgs
+          *  values on its stack, subject to the execution limits. If the call
+          *  finishes, collects the results and calls its callback.
+          */
+         void runAsync (AsyncCallId call, int numArgs);
+
+         /** Stops tracking the call \c call, letting its Lua thread be
+          *  collected.
+          */
+         void releaseAsyncCall (AsyncCallId call);
+
+         /// A call started by \c callAsync() and not yet finished.
+         struct AsyncCall
+         {
+            /// The Lua thread (coroutine) in which the call runs.
+            lua_State* thread;
+
+            /// The reference to \c thread in the registry.
+            int threadRef;
+
+            /// The function receiving the outcome of the call.
+            AsyncCallback callback;
+         };
+
+         /// The calls started by \c callAsync() and not yet finished.
+         std::map<AsyncCallId, AsyncCall> asyncCalls_;
+
+         /// The identifier of the next call started by \c callAsync().
+         AsyncCallId nextAsyncCallId_;
+
          /// The underlying \c lua_State*.
          lua_State* state_;
 
@@ -0,0 +1,261 @@
+/******************************************************************************\
+* LuaStatePool.hpp                                                             *
+* A pool of ready-to-use Lua states.                                           *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+#ifndef _DILUCULUM_LUA_STATE_POOL_HPP_
+#define _DILUCULUM_LUA_STATE_POOL_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <Diluculum/LuaState.hpp>
+
+
+namespace Diluculum
+{
+   /** A fixed-size pool of <tt>LuaState</tt>s, all of them prepared by the same
+    *  setup function. A \c LuaState is not thread-safe, but a
+    *  \c LuaStatePool is: any number of threads can check states out of the
+    *  pool concurrently, each one getting exclusive access to its state until
+    *  it is checked back in.
+    *  <p>Checking out is lock-free as long as there is a free state in the
+    *  pool; threads only block (on a condition variable) when all states are
+    *  in use.
+    */
+   class LuaStatePool: boost::noncopyable
+   {
+      public:
+         /** The type of the function used to prepare each state in the pool.
+          *  This is where standard libraries are loaded, bootstrap files are
+          *  executed and classes are registered.
+          */
+         typedef std::function<void (LuaState&)> SetupFunction;
+
+         /** The type of the function used to check whether a state being
+          *  checked back in the pool is still good for use. It must return
+          *  \c false if the state shall be discarded.
+          */
+         typedef std::function<bool (LuaState&)> HealthCheckFunction;
+
+      private:
+         /// A single position in the pool.
+         struct Slot
+         {
+            /// Is this slot currently checked out?
+            std::atomic<bool> busy;
+
+            /** Must \c state be recreated before being checked out again? This
+             *  is only accessed by the thread that owns the slot.
+             */
+            bool stale;
+
+            /// The state itself.
+            LuaState* state;
+         };
+
+      public:
+         /** A checked-out state. When a \c Handle is destroyed, the state it
+          *  refers to is returned to the pool it came from. A \c Handle can be
+          *  moved, but not copied.
+          */
+         class Handle
+         {
+            friend class LuaStatePool;
+
+            public:
+               /// Constructs an empty \c Handle, not referring to any state.
+               Handle()
+                  : pool_(0), slot_(0)
+               { }
+
+               /// Move constructor. \c other is left empty.
+               Handle (Handle&& other)
+                  : pool_(other.pool_), slot_(other.slot_)
+               {
+                  other.pool_ = 0;
+                  other.slot_ = 0;
+               }
+
+               /// Move assignment. \c rhs is left empty.
+               Handle& operator= (Handle&& rhs);
+
+               /// Returns the state to the pool (if not empty).
+               ~Handle() { release(); }
+
+               /// Is this \c Handle referring to some state?
+               bool isValid() const { return slot_ != 0; }
+
+               /// Is this \c Handle referring to some state?
+               explicit operator bool() const { return isValid(); }
+
+               /** Returns the checked-out state.
+                *  @note Will \c assert() if the \c Handle is empty.
+                */
+               LuaState& state() const;
+
+               /// Returns the checked-out state.
+               LuaState& operator*() const { return state(); }
+
+               /// Returns the checked-out state.
+               LuaState* operator->() const { return &state(); }
+
+               /** Returns the state to the pool before the \c Handle is
+                *  destroyed. The \c Handle is left empty.
+                */
+               void release();
+
+               /** Returns the state to the pool, flagging it as unusable. The
+                *  pool will recreate it (running the setup function again)
+                *  before it is checked out again. Use this when something bad
+                *  (like a \c LuaMemoryError) happened while using the state.
+                *  The \c Handle is left empty.
+                */
+               void discard();
+
+            private:
+               /// Constructs a \c Handle referring to a given slot.
+               Handle (LuaStatePool* pool, Slot* slot)
+                  : pool_(pool), slot_(slot)
+               { }
+
+               /// The pool from where the state was checked out.
+               LuaStatePool* pool_;
+
+               /// The slot of \c pool_ holding the state.
+               Slot* slot_;
+         };
+
+         /** Constructs a \c LuaStatePool, creating all its states upfront.
+          *  @param size The number of states in the pool.
+          *  @param setup The function that prepares each state. It is called
+          *         once for each state, right after it is created (with the
+          *         standard libraries already loaded, if \c loadStdLib is
+          *         \c true).
+          *  @param resetGlobals If \c true, the global environment of every
+          *         state is restored to what it was after \c setup whenever
+          *         the state is checked back in (see \c LuaState::checkpoint()
+          *         and \c LuaState::restore()).
+          *  @param loadStdLib Passed to the constructor of each \c LuaState.
+          *  @throw LuaError Or whatever \c setup throws.
+          */
+         LuaStatePool (std::size_t size, const SetupFunction& setup,
+                       bool resetGlobals = false, bool loadStdLib = true);
+
+         /** Destroys the pool and all of its states.
+          *  @note All <tt>Handle</tt>s must have been released by now.
+          */
+         ~LuaStatePool();
+
+         /** Checks out a state, blocking until one is available.
+          *  @throw LuaError Or whatever the setup function throws, if the
+          *         state had to be recreated.
+          */
+         Handle checkOut();
+
+         /** Checks out a state if one is available; returns an empty \c Handle
+          *  otherwise. Never blocks.
+          *  @throw LuaError Or whatever the setup function throws, if the
+          *         state had to be recreated.
+          */
+         Handle tryCheckOut();
+
+         /** Sets the function used to check the health of states being checked
+          *  back in. States failing the check are recreated before being
+          *  checked out again. By default, no check other than the
+          *  verification of the Lua stack is done.
+          *  @note This is not thread-safe. Call it before sharing the pool
+          *        among threads.
+          */
+         void setHealthCheck (const HealthCheckFunction& healthCheck)
+         { healthCheck_ = healthCheck; }
+
+         /// Returns the number of states in the pool.
+         std::size_t size() const { return size_; }
+
+         /** Returns the number of states currently available for checkout.
+          *  This is just a hint, since other threads may change it at any
+          *  time.
+          */
+         std::size_t available() const;
+
+      private:
+         /** Tries to lock a free slot, without blocking. Returns the locked
+          *  slot, or \c 0 if all slots are busy.
+          */
+         Slot* tryLockSlot();
+
+         /** Prepares a slot that was just locked to be handed out, recreating
+          *  its state if necessary.
+          */
+         Handle makeHandle (Slot* slot);
+
+         /// (Re)creates the state stored in a given slot.
+         void createState (Slot& slot);
+
+         /** Returns a slot to the pool. Called by <tt>Handle</tt>s.
+          *  @param healthy If \c false, the state is flagged for recreation.
+          */
+         void checkIn (Slot* slot, bool healthy);
+
+         /// The number of slots.
+         const std::size_t size_;
+
+         /// The slots themselves.
+         boost::scoped_array<Slot> slots_;
+
+         /// The function used to prepare new states.
+         SetupFunction setup_;
+
+         /// The function used to check the health of returned states.
+         HealthCheckFunction healthCheck_;
+
+         /// Shall the globals be restored when a state is checked in?
+         const bool resetGlobals_;
+
+         /// Shall the standard library be loaded in new states?
+         const bool loadStdLib_;
+
+         /** Where to start looking for a free slot. Incremented on every
+          *  checkout, so that concurrent threads tend to try different slots.
+          */
+         std::atomic<std::size_t> nextSlot_;
+
+         /// The number of threads blocked in \c checkOut().
+         std::atomic<int> waiters_;
+
+         /// Mutex protecting \c slotFreed_.
+         std::mutex mutex_;
+
+         /// Signaled when a slot is returned and there are waiters.
+         std::condition_variable slotFreed_;
+   };
+
+} // namespace Diluculum
+
+#endif // _DILUCULUM_LUA_STATE_POOL_HPP_
@@ -0,0 +1,178 @@
+/******************************************************************************\
+* LuaStateTemplate.hpp                                                         *
+* A snapshot of a prepared Lua state, used to create new states.               *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#ifndef _DILUCULUM_LUA_STATE_TEMPLATE_HPP_
+#define _DILUCULUM_LUA_STATE_TEMPLATE_HPP_
+
+#include <lua.hpp>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <Diluculum/LuaState.hpp>
+
+
+namespace Diluculum
+{
+   /** A snapshot of the global environment of a prepared \c LuaState, used
+    *  to create new states equivalent to it much faster than by running the
+    *  setup again.
+    *  <p>When a \c LuaStateTemplate is constructed, everything reachable from
+    *  the globals table of the prepared state (functions, tables, classes
+    *  registered with \c DILUCULUM_REGISTER_CLASS() and so on) is compiled to
+    *  a flat sequence of instructions. Creating a state from the template
+    *  just replays these instructions: functions are loaded from
+    *  precompiled bytecode (no parsing involved) and tables are created
+    *  with their final sizes.
+    *  <p>Tables shared by several references (or referencing themselves) are
+    *  shared in the new states, too; metatables of tables, function
+    *  environments and upvalues are preserved. The tables of the libraries
+    *  loaded in the prepared state (like \c string or \c _G itself) are not
+    *  recreated: the new state gets the fields added to them in the prepared
+    *  state.
+    *  @note Some things cannot be copied from a state to another, and are
+    *        not part of the template: userdata (including objects registered
+    *        with \c DILUCULUM_REGISTER_OBJECT()), Lua threads, and whatever
+    *        is stored only in the registry (except for the metatables of the
+    *        registered classes, which are copied). Upvalues shared by several
+    *        functions are copied separately to each one of them.
+    */
+   class LuaStateTemplate
+   {
+      public:
+         /** Constructs a \c LuaStateTemplate from a prepared state.
+          *  @param prepared The state to take a snapshot of.
+          *  @param loadStdLib Shall the standard libraries be loaded in the
+          *         states created by \c newState()? This should match the way
+          *         \c prepared was created.
+          *  @throw LuaError If something goes wrong (like finding values
+          *         nested more than \c MaxDepth levels deep).
+          */
+         explicit LuaStateTemplate (LuaState& prepared, bool loadStdLib = true);
+
+         /** Creates a new \c LuaState from this template.
+          *  @throw LuaError If something goes wrong.
+          */
+         std::unique_ptr<LuaState> newState() const;
+
+         /** Copies the global environment captured in this template to a
+          *  given state, which is expected to be freshly created (with the
+          *  same standard libraries loaded as the prepared one). This is what
+          *  \c newState() does after creating the state.
+          *  @throw LuaError If something goes wrong.
+          */
+         void applyTo (LuaState& ls) const;
+
+         /// Returns the number of instructions run to replay this template.
+         std::size_t size() const { return program_.size(); }
+
+         /** The maximum nesting depth of the captured values (counting
+          *  table fields, metatables, upvalues and function environments).
+          */
+         static const int MaxDepth = 1000;
+
+      private:
+         /// An instruction used to recreate the captured environment.
+         struct Instruction
+         {
+            /// The possible instructions.
+            enum OpCode
+            {
+               PUSH_NIL,           ///< Pushes \c nil.
+               PUSH_BOOLEAN,       ///< Pushes the boolean \c arg.
+               PUSH_NUMBER,        ///< Pushes \c number.
+               PUSH_STRING,        ///< Pushes \c data.
+               PUSH_LIGHT_UD,      ///< Pushes the light userdata \c pointer.
+               PUSH_REF,           ///< Pushes the object \c ref.
+               PUSH_LIBRARY,       ///< Pushes the library table \c data.
+               NEW_TABLE,          ///< Pushes a table, \c arg/\c arg2 sized.
+               LOAD_FUNCTION,      ///< Pushes the function compiled in \c data.
+               PUSH_C_FUNCTION,    ///< Pushes \c cFunction, \c arg upvalues.
+               SET_FIELD,          ///< Sets a field of table \c ref.
+               SET_METATABLE,      ///< Sets the metatable of a table.
+               SET_UPVALUE,        ///< Sets the upvalue \c arg of a function.
+               SET_ENVIRONMENT,    ///< Sets the environment of a function.
+               SET_CLASS_METATABLES, ///< Registers the class metatables.
+               POP                 ///< Pops a value.
+            };
+
+            OpCode opCode;
+            int arg;
+            int arg2;
+            int ref;
+            lua_Number number;
+            std::string data;
+            const void* pointer;
+            lua_CFunction cFunction;
+         };
+
+         /** Appends to the program the instructions that push the value at
+          *  index \c index of the prepared state \c ls, which is nested
+          *  \c depth levels deep.
+          *  @throw LuaError If the value is nested deeper than \c MaxDepth.
+          */
+         void capture (lua_State* ls, int index, int depth);
+
+         /** The \c lua_CFunction that replays the template in protected mode.
+          *  Takes the \c ReplayData passed by \c applyTo() as a light
+          *  userdata.
+          */
+         static int Replay (lua_State* ls);
+
+         /** Runs the program in \c ls. \c preexisting must have one element
+          *  per object (plus one).
+          */
+         void replay (lua_State* ls, std::vector<bool>& preexisting) const;
+
+         /// Appends an instruction to the program.
+         Instruction& emit (Instruction::OpCode opCode);
+
+         /// Is a value of this type something that can be captured?
+         static bool isCapturable (int type);
+
+         /// The instructions that recreate the captured environment.
+         std::vector<Instruction> program_;
+
+         /// The number of objects (tables and functions) in the program.
+         int numRefs_;
+
+         /** The objects already captured, indexed by their address in the
+          *  prepared state. Negative values mean the object is still being
+          *  captured. Only used during construction.
+          */
+         std::map<const void*, int> refs_;
+
+         /// Names of the library tables of the prepared state, by address.
+         std::map<const void*, std::string> libraries_;
+
+         /// Shall the standard libraries be loaded by \c newState()?
+         bool loadStdLib_;
+   };
+
+} // namespace Diluculum
+
+#endif // _DILUCULUM_LUA_STATE_TEMPLATE_HPP_
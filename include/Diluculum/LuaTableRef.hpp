@@ -0,0 +1,286 @@
+/******************************************************************************\
+* LuaTableRef.hpp                                                              *
+* A handle to a table living in a Lua state.                                   *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#ifndef _DILUCULUM_LUA_TABLE_REF_HPP_
+#define _DILUCULUM_LUA_TABLE_REF_HPP_
+
+#include <cstddef>
+#include <lua.hpp>
+#include <Diluculum/LuaRegistryRef.hpp>
+#include <Diluculum/LuaStack.hpp>
+#include <Diluculum/LuaVariable.hpp>
+
+
+namespace Diluculum
+{
+   /** A handle to a table living in a Lua state. A \c LuaTableRef holds a
+    *  reference to the table itself (anchored in the registry with
+    *  \c luaL_ref()), and reads and writes its fields directly in the Lua
+    *  state, without converting the table to a \c LuaValueMap. Compared to
+    *  the equivalent \c LuaVariable operations, which look the table up
+    *  (through all of its keys) every time, this makes accessing the fields of
+    *  a table from C++ much cheaper.
+    *  <p>Keys and values can be of any type supported by \c LuaStack (like
+    *  numbers, strings and \c LuaValue). Field accesses are not raw, that is,
+    *  metamethods are honored. They run in protected mode, so errors (raised by
+    *  metamethods, or caused by invalid keys like \c nil) are thrown as
+    *  \c LuaRunTimeError exceptions. Tables without a metatable are accessed
+    *  directly, with \c lua_rawget() and \c lua_rawset().
+    *  <p>Copying a \c LuaTableRef creates another reference to the same table;
+    *  the reference is released when the \c LuaTableRef is destroyed.
+    *  @note A \c LuaTableRef must not outlive the Lua state it refers to.
+    */
+   class LuaTableRef: public Impl::LuaRegistryRef
+   {
+      public:
+         /** A field of the table, as seen while iterating over it with
+          *  \c forEach(). Valid only during the call to the function passed
+          *  to \c forEach().
+          */
+         class Entry
+         {
+            public:
+               /// Returns the key of the field, as a \c T.
+               template <typename T>
+               T key() const { return GetFromStack<T> (state_, -2); }
+
+               /// Returns the value of the field, as a \c T.
+               template <typename T>
+               T value() const { return GetFromStack<T> (state_, -1); }
+
+               /// Returns the type of the key (as in \c lua_type()).
+               int keyType() const { return lua_type (state_, -2); }
+
+               /// Returns the type of the value (as in \c lua_type()).
+               int valueType() const { return lua_type (state_, -1); }
+
+            private:
+               friend class LuaTableRef;
+
+               explicit Entry (lua_State* state)
+                  : state_(state)
+               { }
+
+               /// The Lua state, with the key and the value on its stack top.
+               lua_State* state_;
+         };
+
+         /// Constructs an invalid \c LuaTableRef (see \c isValid()).
+         LuaTableRef() { }
+
+         /** Constructs a \c LuaTableRef referencing the table currently stored
+          *  in a variable.
+          *  @throw TypeMismatchError If \c table does not hold a table.
+          */
+         explicit LuaTableRef (const LuaVariable& table)
+            : Impl::LuaRegistryRef (table, LUA_TTABLE)
+         { }
+
+         /** Constructs a \c LuaTableRef referencing the table at a given
+          *  index of the stack of \c ls.
+          *  @throw TypeMismatchError If the value at \c index is not a table.
+          */
+         LuaTableRef (lua_State* ls, int index)
+            : Impl::LuaRegistryRef (ls, index, LUA_TTABLE)
+         { }
+
+         /** Creates a new, empty table in \c ls and returns a reference to
+          *  it.
+          */
+         static LuaTableRef create (lua_State* ls);
+
+         /** Returns the value stored under \c key, as a \c T.
+          *  @throw LuaError If this \c LuaTableRef is not valid.
+          *  @throw TypeMismatchError If the value is not a \c T.
+          *  @throw LuaRunTimeError If an \c __index metamethod raises an
+          *         error.
+          */
+         template <typename T, typename K>
+         T get (const K& key) const
+         {
+            pushField (key);
+            return popAs<T>();
+         }
+
+         /** Returns the value stored under \c key, as a \c T, or
+          *  \c defaultValue if that value is \c nil.
+          *  @throw LuaError If this \c LuaTableRef is not valid.
+          *  @throw TypeMismatchError If the value is neither \c nil nor a
+          *         \c T.
+          *  @throw LuaRunTimeError If an \c __index metamethod raises an
+          *         error.
+          */
+         template <typename T, typename K>
+         T get (const K& key, const T& defaultValue) const
+         {
+            pushField (key);
+            if (lua_isnil (state_, -1))
+            {
+               lua_pop (state_, 1);
+               return defaultValue;
+            }
+            return popAs<T>();
+         }
+
+         /** Stores \c value under \c key.
+          *  @throw LuaError If this \c LuaTableRef is not valid.
+          *  @throw LuaRunTimeError If \c key is \c nil or NaN, or if a
+          *         \c __newindex metamethod raises an error.
+          */
+         template <typename K, typename V>
+         void set (const K& key, const V& value)
+         {
+            push();
+            const int top = lua_gettop (state_);
+            try
+            {
+               PushToStack (state_, key);
+               PushToStack (state_, value);
+            }
+            catch (...)
+            {
+               lua_settop (state_, top - 1);
+               throw;
+            }
+            setFieldOnTop();
+         }
+
+         /** Returns a reference to the table stored under \c key. This is the
+          *  way to reach nested tables.
+          *  @throw LuaError If this \c LuaTableRef is not valid.
+          *  @throw TypeMismatchError If the value is not a table.
+          */
+         template <typename K>
+         LuaTableRef ref (const K& key) const
+         {
+            pushField (key);
+            return popAs<LuaTableRef>();
+         }
+
+         /** Returns the length of the table, as in the Lua \c # operator, but
+          *  ignoring the \c __len metamethod.
+          *  @throw LuaError If this \c LuaTableRef is not valid.
+          */
+         std::size_t rawlen() const;
+
+         /** Calls \c func once for each field of the table, passing an
+          *  \c Entry describing the field. The iteration order is unspecified
+          *  (as in the Lua \c next() function).
+          *  <p>\c func may change or remove existing fields of the table, but
+          *  must not add new fields.
+          *  @throw LuaError If this \c LuaTableRef is not valid.
+          */
+         template <typename F>
+         void forEach (F func) const
+         {
+            push();
+            lua_pushnil (state_);
+            while (lua_next (state_, -2) != 0)
+            {
+               try
+               {
+                  func (Entry (state_));
+               }
+               catch (...)
+               {
+                  lua_pop (state_, 3);
+                  throw;
+               }
+               lua_pop (state_, 1);
+            }
+            lua_pop (state_, 1);
+         }
+
+         /** Pushes the table onto the stack of its Lua state.
+          *  @throw LuaError If this \c LuaTableRef is not valid.
+          */
+         void push() const { pushReferenced ("LuaTableRef"); }
+
+      private:
+         /// Pushes the value stored under \c key.
+         template <typename K>
+         void pushField (const K& key) const
+         {
+            push();
+            try
+            {
+               PushToStack (state_, key);
+            }
+            catch (...)
+            {
+               lua_pop (state_, 1);
+               throw;
+            }
+            getFieldOnTop();
+         }
+
+         /** Replaces the table and the key on the top of the stack with the
+          *  value stored in the table under that key.
+          */
+         void getFieldOnTop() const;
+
+         /** Pops the table, the key and the value on the top of the stack,
+          *  storing the value in the table under that key.
+          */
+         void setFieldOnTop() const;
+
+         /// Pops the value on the stack top, returning it as a \c T.
+         template <typename T>
+         T popAs() const
+         {
+            try
+            {
+               T ret = GetFromStack<T> (state_, -1);
+               lua_pop (state_, 1);
+               return ret;
+            }
+            catch (...)
+            {
+               lua_pop (state_, 1);
+               throw;
+            }
+         }
+   };
+
+
+   /// \c LuaStack specialization for \c LuaTableRef.
+   template<>
+   struct LuaStack<LuaTableRef>
+   {
+      static void push (lua_State* ls, const LuaTableRef& value)
+      { value.push(); lua_xmove (value.getState(), ls, 1); }
+
+      static bool is (lua_State* ls, int index)
+      { return lua_type (ls, index) == LUA_TTABLE; }
+
+      static LuaTableRef get (lua_State* ls, int index)
+      { return LuaTableRef (ls, index); }
+   };
+
+} // namespace Diluculum
+
+#endif // _DILUCULUM_LUA_TABLE_REF_HPP_
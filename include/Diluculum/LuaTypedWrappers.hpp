@@ -0,0 +1,618 @@
+/******************************************************************************\
+* LuaTypedWrappers.hpp                                                         *
+* Wrappers for C++ functions with arbitrary signatures.                        *
+*                                                                              *
+*                                                                              *
+* Copyright (C) 2013 by Leandro Motta Barros.                                  *
+*                                                                              *
+* Permission is hereby granted, free of charge, to any person obtaining a copy *
+* of this software and associated documentation files (the "Software"), to     *
+* deal in the Software without restriction, including without limitation the   *
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or  *
+* sell copies of the Software, and to permit persons to whom the Software is   *
+* furnished to do so, subject to the following conditions:                     *
+*                                                                              *
+* The above copyright notice and this permission notice shall be included in   *
+* all copies or substantial portions of the Software.                          *
+*                                                                              *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR   *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,     *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER       *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      *
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+* IN THE SOFTWARE.                                                             *
+\******************************************************************************/
+
+
+#ifndef _DILUCULUM_LUA_TYPED_WRAPPERS_HPP_
+#define _DILUCULUM_LUA_TYPED_WRAPPERS_HPP_
+
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <lua.hpp>
+#include <Diluculum/LuaCall.hpp>
+#include <Diluculum/LuaStack.hpp>
+#include <Diluculum/LuaWrappers.hpp>
+
+
+namespace Diluculum
+{
+   namespace Impl
+   {
+      /** Throws a \c LuaError telling that the argument at \c index has the
+       *  wrong type (as described by \c error).
+       *  @note This is not intended to be called by Diluculum users.
+       */
+      void ThrowBadArgument (int index, const TypeMismatchError& error);
+
+      /** Reads the argument at \c index of the stack of \c ls as a \c T,
+       *  throwing a \c LuaError that identifies the argument if it is not of
+       *  the proper type.
+       */
+      template <typename T>
+      inline T GetArgument (lua_State* ls, int index)
+      {
+         try
+         {
+            return GetFromStack<T> (ls, index);
+         }
+         catch (const TypeMismatchError& e)
+         {
+            ThrowBadArgument (index, e);
+            throw; // not reached
+         }
+      }
+
+      /** The type in which a parameter of type \c T is read from the stack:
+       *  \c T without references and top-level \c const (so that, for
+       *  instance, a <tt>const std::string&</tt> parameter is read as an
+       *  \c std::string).
+       */
+      template <typename T>
+      struct ArgumentType
+      {
+         typedef typename std::remove_cv<
+            typename std::remove_reference<T>::type>::type type;
+      };
+
+      /// Tells whether there is a \c LuaStack specialization for \c T.
+      template <typename T>
+      struct HasLuaStack
+      {
+         private:
+            template <typename U>
+            static auto test (int)
+               -> decltype (LuaStack<U>::get (0, 0), std::true_type());
+
+            template <typename U>
+            static std::false_type test (long);
+
+         public:
+            static const bool value = decltype (test<T> (0))::value;
+      };
+
+      /** Tells whether \c T is a class exported to Lua (with the
+       *  \c DILUCULUM_BEGIN_CLASS() family of macros), as opposed to a type
+       *  handled by \c LuaStack (like \c LuaFunctionRef) or converted to a
+       *  \c LuaValue (like \c LuaValueMap). Objects of these classes are
+       *  passed by reference to the wrapped functions, and returned by value
+       *  as new objects owned by Lua.
+       */
+      template <typename T>
+      struct IsExportedClass
+         : std::integral_constant<bool,
+                                  std::is_class<T>::value
+                                  && !HasLuaStack<T>::value
+                                  && !std::is_convertible<T, LuaValue>::value>
+      { };
+
+      /** Reads the argument at \c index of the stack of \c ls, for a
+       *  parameter of type \c T (which may be a reference).
+       */
+      template <typename T, typename Enable = void>
+      struct ArgumentReader
+      {
+         typedef typename ArgumentType<T>::type type;
+
+         /// The type returned by \c get().
+         typedef type result;
+
+         static type get (lua_State* ls, int index)
+         {
+            return GetArgument<type> (ls, index);
+         }
+      };
+
+      /** \c ArgumentReader specialization for exported classes: the object
+       *  is not copied, the parameter refers to the object stored in Lua.
+       */
+      template <typename T>
+      struct ArgumentReader<
+         T, typename std::enable_if<
+               IsExportedClass<typename ArgumentType<T>::type>::value>::type>
+      {
+         typedef typename ArgumentType<T>::type type;
+
+         /// The type returned by \c get().
+         typedef type& result;
+
+         static type& get (lua_State* ls, int index)
+         {
+            try
+            {
+               return *checkObject<type> (ls, index);
+            }
+            catch (const TypeMismatchError& e)
+            {
+               ThrowBadArgument (index, e);
+               throw; // not reached
+            }
+         }
+      };
+
+      /** Pushes a value returned by a wrapped function: an object of an
+       *  exported class is copied to a new object owned by Lua; anything
+       *  else is pushed with \c PushToStack().
+       */
+      template <typename T>
+      inline typename std::enable_if<!IsExportedClass<T>::value>::type
+      PushReturnValue (lua_State* ls, const T& value)
+      {
+         PushToStack (ls, value);
+      }
+
+      template <typename T>
+      inline typename std::enable_if<IsExportedClass<T>::value>::type
+      PushReturnValue (lua_State* ls, const T& value)
+      {
+         PushObjectCopy (ls, value);
+      }
+
+      /** Pushes the value returned by a wrapped function, returning the number
+       *  of values pushed. A single value is pushed with
+       *  \c PushReturnValue().
+       */
+      template <typename R>
+      struct ReturnPusher
+      {
+         static int push (lua_State* ls, const R& value)
+         {
+            PushReturnValue (ls, value);
+            return 1;
+         }
+      };
+
+      /// \c ReturnPusher specialization for multiple return values.
+      template <typename... Ts>
+      struct ReturnPusher<std::tuple<Ts...> >
+      {
+         static int push (lua_State* ls, const std::tuple<Ts...>& values)
+         {
+            pushElements (ls, values,
+                          typename MakeIndexSequence<sizeof...(Ts)>::type());
+            return sizeof...(Ts);
+         }
+
+         template <std::size_t... I>
+         static void pushElements (lua_State* ls,
+                                   const std::tuple<Ts...>& values,
+                                   IndexSequence<I...>)
+         {
+            PushArguments (ls, std::get<I>(values)...);
+         }
+      };
+
+      /// \c ReturnPusher specialization for any number of return values.
+      template<>
+      struct ReturnPusher<LuaValueList>
+      {
+         static int push (lua_State* ls, const LuaValueList& values)
+         {
+            typedef LuaValueList::const_iterator iter_t;
+            for (iter_t p = values.begin(); p != values.end(); ++p)
+               PushLuaValue (ls, *p);
+            return static_cast<int>(values.size());
+         }
+      };
+
+      /** Calls a function and pushes its return values (if any), returning
+       *  the number of values pushed.
+       */
+      template <typename R>
+      struct Invoker
+      {
+         template <typename F, typename... Args>
+         static int invoke (lua_State* ls, F&& func, Args&&... args)
+         {
+            return ReturnPusher<typename ArgumentType<R>::type>::push (
+               ls, func (std::forward<Args>(args)...));
+         }
+
+         template <typename C, typename M, typename... Args>
+         static int invokeMethod (lua_State* ls, C* obj, M method,
+                                  Args&&... args)
+         {
+            return ReturnPusher<typename ArgumentType<R>::type>::push (
+               ls, (obj->*method) (std::forward<Args>(args)...));
+         }
+      };
+
+      /// \c Invoker specialization for functions returning \c void.
+      template<>
+      struct Invoker<void>
+      {
+         template <typename F, typename... Args>
+         static int invoke (lua_State*, F&& func, Args&&... args)
+         {
+            func (std::forward<Args>(args)...);
+            return 0;
+         }
+
+         template <typename C, typename M, typename... Args>
+         static int invokeMethod (lua_State*, C* obj, M method, Args&&... args)
+         {
+            (obj->*method) (std::forward<Args>(args)...);
+            return 0;
+         }
+      };
+
+      /** Calls \c body (which returns the number of values it pushed),
+       *  translating any exception it throws to a Lua error, just like the
+       *  wrappers created by \c DILUCULUM_WRAP_FUNCTION() do.
+       */
+      template <typename Body>
+      inline int CallReportingErrors (lua_State* ls, Body body)
+      {
+         try
+         {
+            return body();
+         }
+         catch (LuaError& e)
+         {
+            ReportErrorFromCFunction (ls, e.what());
+            return 0;
+         }
+         catch(...)
+         {
+            ReportErrorFromCFunction (ls, "Unknown exception caught by wrapper.");
+            return 0;
+         }
+      }
+
+      /** The \c lua_CFunction wrapping the function \c func, whose type is
+       *  \c F. This is what \c Diluculum::wrap() returns.
+       */
+      template <typename F, F func>
+      struct FunctionWrapper;
+
+      template <typename R, typename... Args, R (*func)(Args...)>
+      struct FunctionWrapper<R (*)(Args...), func>
+      {
+         static int call (lua_State* ls)
+         {
+            return CallReportingErrors (ls, [ls]() {
+               return invoke (
+                  ls, typename MakeIndexSequence<sizeof...(Args)>::type());
+            });
+         }
+
+         template <std::size_t... I>
+         static int invoke (lua_State* ls, IndexSequence<I...>)
+         {
+            // Missing arguments are 'nil'
+            if (lua_gettop (ls) < static_cast<int>(sizeof...(I)))
+               lua_settop (ls, sizeof...(I));
+
+            // Unlike function arguments, the elements of a braced initializer
+            // are evaluated in order, so errors report the first bad argument
+            std::tuple<typename ArgumentReader<Args>::result...> args {
+               ArgumentReader<Args>::get (ls, I + 1)... };
+
+            return Invoker<R>::invoke (
+               ls, func, std::get<I>(std::move (args))...);
+         }
+      };
+
+      /** Returns the object whose method is being called (the \c self
+       *  argument, at the stack index 1), which must be an object of class
+       *  \c T (or of a class derived from it) exported to Lua.
+       */
+      template <typename T>
+      inline T* GetSelf (lua_State* ls)
+      {
+         try
+         {
+            return checkObject<T> (ls, 1);
+         }
+         catch (const TypeMismatchError& e)
+         {
+            ThrowBadArgument (1, e);
+            throw; // not reached
+         }
+      }
+
+      /** The \c lua_CFunction wrapping the method \c method (whose type is
+       *  \c F) of the class \c C. This is what \c Diluculum::wrapMethod()
+       *  returns.
+       */
+      template <typename C, typename F, F method>
+      struct MethodWrapper;
+
+      /** Implementation of \c MethodWrapper, shared by the const and non
+       *  const versions.
+       */
+      template <typename C, typename F, F method, typename R,
+                typename... Args>
+      struct MethodWrapperImpl
+      {
+         static int call (lua_State* ls)
+         {
+            return CallReportingErrors (ls, [ls]() {
+               return invoke (
+                  ls, typename MakeIndexSequence<sizeof...(Args)>::type());
+            });
+         }
+
+         template <std::size_t... I>
+         static int invoke (lua_State* ls, IndexSequence<I...>)
+         {
+            // Missing arguments are 'nil'
+            if (lua_gettop (ls) < static_cast<int>(sizeof...(I)) + 1)
+               lua_settop (ls, sizeof...(I) + 1);
+
+            // Read 'self' and then the arguments, in order (see
+            // 'FunctionWrapper::invoke()')
+            C* self = GetSelf<C> (ls);
+            std::tuple<typename ArgumentReader<Args>::result...> args {
+               ArgumentReader<Args>::get (ls, I + 2)... };
+
+            return Invoker<R>::invokeMethod (
+               ls, self, method, std::get<I>(std::move (args))...);
+         }
+      };
+
+      template <typename C, typename B, typename R, typename... Args,
+                R (B::*method)(Args...)>
+      struct MethodWrapper<C, R (B::*)(Args...), method>
+         : MethodWrapperImpl<C, R (B::*)(Args...), method, R, Args...>
+      { };
+
+      template <typename C, typename B, typename R, typename... Args,
+                R (B::*method)(Args...) const>
+      struct MethodWrapper<C, R (B::*)(Args...) const, method>
+         : MethodWrapperImpl<C, R (B::*)(Args...) const, method, R, Args...>
+      { };
+
+      /** The <tt>lua_CFunction</tt>s reading and writing the data member
+       *  \c member (whose type is \c F) of the class \c C. Used by
+       *  \c DILUCULUM_CLASS_MEMBER().
+       */
+      template <typename C, typename F, F member>
+      struct MemberWrapper;
+
+      template <typename C, typename B, typename T, T B::*member>
+      struct MemberWrapper<C, T B::*, member>
+      {
+         /// Pushes the member of the object at index 1.
+         static int get (lua_State* ls)
+         {
+            return CallReportingErrors (ls, [ls]() {
+               PushToStack (ls, GetSelf<C>(ls)->*member);
+               return 1;
+            });
+         }
+
+         /// Sets the member of the object at index 1 to the value at index 2.
+         static int set (lua_State* ls)
+         {
+            return CallReportingErrors (ls, [ls]() {
+               GetSelf<C>(ls)->*member =
+                  GetArgument<typename ArgumentType<T>::type> (ls, 2);
+               return 0;
+            });
+         }
+      };
+   }
+
+   /** Returns a \c lua_CFunction that wraps the C++ function \c func, whose
+    *  signature (given by \c F) can be pretty much anything, like
+    *  <tt>double (*)(int, const std::string&)</tt>. Unlike the wrappers
+    *  created by \c DILUCULUM_WRAP_FUNCTION(), no \c LuaValueList is
+    *  involved: each parameter is read (and type-checked) directly from its
+    *  stack slot, and the return value is pushed directly onto the stack.
+    *  <p>Parameters and return values can be of any type supported by
+    *  \c LuaStack (a \c LuaValue parameter accepts anything). To return
+    *  several values, return an \c std::tuple (or a \c LuaValueList).
+    *  Extra arguments passed by Lua are ignored; missing ones are \c nil.
+    *  <p>Errors are reported just like in \c DILUCULUM_WRAP_FUNCTION(): the
+    *  wrapped function throws a \c LuaError, and the wrapper translates it to
+    *  a Lua error. Arguments of the wrong type are reported this way, too.
+    *  <p>The \c DILUCULUM_WRAP() macro saves some typing:
+    *  <tt>DILUCULUM_WRAP(f)</tt> is the same as
+    *  <tt>Diluculum::wrap<decltype(&f), &f>()</tt>. (Overloaded functions
+    *  must use the latter form, with the desired signature.)
+    */
+   template <typename F, F func>
+   inline lua_CFunction wrap()
+   {
+      return &Impl::FunctionWrapper<F, func>::call;
+   }
+
+   /** Returns a \c lua_CFunction that wraps the method \c method of the
+    *  class \c C, which must be exported to Lua with the
+    *  \c DILUCULUM_BEGIN_CLASS() family of macros. This is the method
+    *  counterpart of \c wrap(): \c method can have any signature (and can be
+    *  \c const), parameters are read directly from the stack, and return
+    *  values are pushed directly onto the stack. The object itself is the
+    *  first argument (that is, the wrapper is meant to be called with the
+    *  colon syntax, <tt>obj:method(...)</tt>).
+    *  <p>\c F is the type of \c method, which may be a method inherited by
+    *  \c C, like <tt>void (Base::*)(int)</tt>. Usually, methods are
+    *  exported with \c DILUCULUM_CLASS_TYPED_METHOD(), which calls this.
+    */
+   template <typename C, typename F, F method>
+   inline lua_CFunction wrapMethod()
+   {
+      return &Impl::MethodWrapper<C, F, method>::call;
+   }
+
+} // namespace Diluculum
+
+
+
+/** Returns a \c lua_CFunction that wraps the function \c FUNC, whose
+ *  signature is deduced at compile time. See \c Diluculum::wrap().
+ *  @param FUNC The function to be wrapped.
+ */
+#define DILUCULUM_WRAP(FUNC) \
+   (Diluculum::wrap<decltype(&FUNC), &FUNC>())
+
+
+
+/** Exports a given class' method, which can have pretty much any signature.
+ *  This is the typed counterpart of \c DILUCULUM_CLASS_METHOD(), and, just
+ *  like it, must be called between calls to \c DILUCULUM_BEGIN_CLASS() and
+ *  \c DILUCULUM_END_CLASS(). See \c Diluculum::wrapMethod() for details.
+ *  @param CLASS The class whose method is being exported.
+ *  @param METHOD The method being exported. It cannot be overloaded.
+ */
+#define DILUCULUM_CLASS_TYPED_METHOD(CLASS, METHOD)                           \
+namespace                                                                     \
+{                                                                             \
+   Diluculum::Impl::ClassTableFiller                                          \
+      Diluculum__ ## CLASS ## _ ## METHOD ## __ ## Filler(                    \
+         DILUCULUM_CLASS_TABLE(CLASS),                                        \
+         #METHOD,                                                             \
+         Diluculum::wrapMethod<CLASS, decltype(&CLASS::METHOD),               \
+                               &CLASS::METHOD>());                            \
+}
+
+
+/** Exports a property of a class, that is, something that Lua code reads
+ *  and writes like a field (<tt>obj.NAME</tt>), but is implemented in C++
+ *  by a getter and a setter method. Must be called between calls to
+ *  \c DILUCULUM_BEGIN_CLASS() and \c DILUCULUM_END_CLASS().
+ *  <p>Classes with properties get \c __index and \c __newindex metamethods
+ *  that look up the property in a table of getters (or setters) first; if
+ *  not found, \c __index falls back to the methods. Both the getter and the
+ *  setter are wrapped like in \c DILUCULUM_CLASS_TYPED_METHOD(), so their
+ *  types are checked and no \c LuaValue is involved. Properties are
+ *  inherited by derived classes.
+ *  @param CLASS The class whose property is being exported.
+ *  @param NAME The property name, as known in Lua.
+ *  @param GETTER A method taking no parameters, returning the value.
+ *  @param SETTER A method taking the new value as its only parameter.
+ */
+#define DILUCULUM_CLASS_PROPERTY(CLASS, NAME, GETTER, SETTER)                 \
+namespace                                                                     \
+{                                                                             \
+   Diluculum::Impl::PropertyFiller                                            \
+      Diluculum__ ## CLASS ## _ ## NAME ## __ ## Property_Filler(             \
+         DILUCULUM_CLASS_TABLE(CLASS),                                        \
+         #NAME,                                                               \
+         Diluculum::wrapMethod<CLASS, decltype(&CLASS::GETTER),               \
+                               &CLASS::GETTER>(),                             \
+         Diluculum::wrapMethod<CLASS, decltype(&CLASS::SETTER),               \
+                               &CLASS::SETTER>());                            \
+}
+
+
+
+/** Exports a read-only property of a class. Just like
+ *  \c DILUCULUM_CLASS_PROPERTY(), but without a setter; assigning to the
+ *  property raises an error.
+ *  @param CLASS The class whose property is being exported.
+ *  @param NAME The property name, as known in Lua.
+ *  @param GETTER A method taking no parameters, returning the value.
+ */
+#define DILUCULUM_CLASS_READONLY_PROPERTY(CLASS, NAME, GETTER)                \
+namespace                                                                     \
+{                                                                             \
+   Diluculum::Impl::PropertyFiller                                            \
+      Diluculum__ ## CLASS ## _ ## NAME ## __ ## Property_Filler(             \
+         DILUCULUM_CLASS_TABLE(CLASS),                                        \
+         #NAME,                                                               \
+         Diluculum::wrapMethod<CLASS, decltype(&CLASS::GETTER),               \
+                               &CLASS::GETTER>());                            \
+}
+
+
+
+/** Exports a public data member of a class as a property with the same
+ *  name, read and written directly through a member pointer. See
+ *  \c DILUCULUM_CLASS_PROPERTY().
+ *  @param CLASS The class whose data member is being exported.
+ *  @param MEMBER The data member. Its type must be supported by
+ *         \c LuaStack.
+ */
+#define DILUCULUM_CLASS_MEMBER(CLASS, MEMBER)                                 \
+namespace                                                                     \
+{                                                                             \
+   Diluculum::Impl::PropertyFiller                                            \
+      Diluculum__ ## CLASS ## _ ## MEMBER ## __ ## Property_Filler(           \
+         DILUCULUM_CLASS_TABLE(CLASS),                                        \
+         #MEMBER,                                                             \
+         &Diluculum::Impl::MemberWrapper<CLASS, decltype(&CLASS::MEMBER),     \
+                                         &CLASS::MEMBER>::get,                \
+         &Diluculum::Impl::MemberWrapper<CLASS, decltype(&CLASS::MEMBER),     \
+                                         &CLASS::MEMBER>::set);               \
+}
+
+
+
+/** Exports a metamethod of a class, implemented by the function \c FUNC,
+ *  which is wrapped with \c Diluculum::wrap() (and thus can have pretty much
+ *  any signature). Must be called between calls to
+ *  \c DILUCULUM_BEGIN_CLASS() and \c DILUCULUM_END_CLASS().
+ *  <p>This is meant for arithmetic, comparison and other operators, like
+ *  \c __add, \c __sub, \c __mul, \c __div, \c __unm, \c __eq, \c __lt,
+ *  \c __le, \c __len, \c __call, \c __concat and \c __tostring. The
+ *  parameters of \c FUNC are the operands, in the order Lua passes them
+ *  (so, in <tt>2 * v</tt>, the first one is a number). Parameters whose
+ *  type is an exported class (or a reference to one) refer directly to the
+ *  objects stored in Lua, and objects returned by value are copied to new
+ *  objects owned by Lua (constructed in place for classes exported with
+ *  \c DILUCULUM_BEGIN_VALUE_CLASS()), so no \c LuaValue is involved. Like
+ *  methods, metamethods are inherited by derived classes.
+ *  @param CLASS The class whose metamethod is being exported.
+ *  @param EVENT The metamethod name, like \c __add.
+ *  @param FUNC The function implementing the metamethod. It cannot be
+ *         overloaded.
+ */
+#define DILUCULUM_CLASS_METAMETHOD(CLASS, EVENT, FUNC)                        \
+namespace                                                                     \
+{                                                                             \
+   Diluculum::Impl::ClassTableFiller                                          \
+      Diluculum__ ## CLASS ## _ ## EVENT ## __ ## Metamethod_Filler(          \
+         DILUCULUM_CLASS_TABLE(CLASS),                                        \
+         #EVENT,                                                              \
+         DILUCULUM_WRAP(FUNC));                                               \
+}
+
+
+
+/** Exports a metamethod of a class, implemented by the method \c METHOD of
+ *  the class itself, which is typically an operator, like
+ *  <tt>DILUCULUM_CLASS_OPERATOR (Vector, __add, operator+)</tt>. The object
+ *  is the first operand, and the method parameters are the remaining ones.
+ *  Otherwise, this is just like \c DILUCULUM_CLASS_METAMETHOD().
+ *  @param CLASS The class whose metamethod is being exported.
+ *  @param EVENT The metamethod name, like \c __add.
+ *  @param METHOD The method implementing the metamethod. It cannot be
+ *         overloaded.
+ */
+#define DILUCULUM_CLASS_OPERATOR(CLASS, EVENT, METHOD)                        \
+namespace                                                                     \
+{                                                                             \
+   Diluculum::Impl::ClassTableFiller                                          \
+      Diluculum__ ## CLASS ## _ ## EVENT ## __ ## Metamethod_Filler(          \
+         DILUCULUM_CLASS_TABLE(CLASS),                                        \
+         #EVENT,                                                              \
+         Diluculum::wrapMethod<CLASS, decltype(&CLASS::METHOD),               \
+                               &CLASS::METHOD>());                            \
+}
+
+
+#endif // _DILUCULUM_LUA_TYPED_WRAPPERS_HPP_
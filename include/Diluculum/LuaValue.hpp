@@ -31,6 +31,7 @@
 #include <map>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <Diluculum/CppObject.hpp>
 #include <Diluculum/LuaUserData.hpp>
 #include <Diluculum/LuaFunction.hpp>
@@ -196,23 +197,27 @@ namespace Diluculum
 
          /** Assuming that the value stores a C++ object exported to or
           *  instantiated in Lua, returns a pointer to the (\c const) C++
-          *  object.
+          *  object. \c T is a pointer to the class of the object or to one
+          *  of its base classes (as declared with \c DILUCULUM_CLASS_BASE()).
+          *  @throw TypeMismatchError If the value is not a C++ object of
+          *         this class or of a class derived from it.
           */
          template<class T>
          T asObjectPtr() const
          {
-            return static_cast<T>(
-               static_cast<const Impl::CppObject*>(asUserData().getData())->ptr);
+            typedef typename std::remove_cv<
+               typename std::remove_pointer<T>::type>::type Class;
+            return static_cast<T>(castObject (Impl::GetClassInfo<Class>()));
          }
 
          /** Assuming that the value stores a C++ object exported to or
-          *  instantiated in Lua, returns a pointer to the C++ object.
+          *  instantiated in Lua, returns a pointer to the C++ object. Just
+          *  like the \c const version.
           */
          template<class T>
          T asObjectPtr()
          {
-            return static_cast<T>(
-               static_cast<Impl::CppObject*>(asUserData().getData())->ptr);
+            return static_cast<const LuaValue*>(this)->asObjectPtr<T>();
          }
 
          /** "Less than" operator for <tt>LuaValue</tt>s.
@@ -283,6 +288,13 @@ namespace Diluculum
           */
          void destroyObjectAtData();
 
+         /** Returns the C++ object stored in this user data, converted to
+          *  a pointer to the class described by \c info.
+          *  @throw TypeMismatchError If this is not a C++ object of this class
+          *         or of a class derived from it.
+          */
+         void* castObject (const Impl::ClassInfo* info) const;
+
          /// This is used just to know the size of the \c data_ member.
          union PossibleTypes
          {
@@ -28,11 +28,18 @@
 #define _DILUCULUM_LUA_VARIABLE_HPP_
 
 #include <vector>
+#include <Diluculum/LuaCall.hpp>
+#include <Diluculum/LuaResult.hpp>
 #include <Diluculum/LuaValue.hpp>
 
 
 namespace Diluculum
 {
+   namespace Impl
+   {
+      class LuaRegistryRef;
+   }
+
    /** A variable living in a Lua state. Notice the crucial difference: unlike a
     *  \c LuaValue, a \c LuaVariable necessarily has a real counterpart in a Lua
     *  state. Thus, when something is assigned to a \c LuaVariable, the value of
@@ -43,6 +50,7 @@ namespace Diluculum
    class LuaVariable
    {
       friend class LuaState;
+      friend class Impl::LuaRegistryRef;
 
       public:
          /** Assigns a new value to this \c LuaVariable. The corresponding
@@ -114,27 +122,23 @@ namespace Diluculum
           */
          LuaValueList operator()();
 
-         /** Assuming that this \c LuaVariable holds a function, calls this
-          *  function and returns its return values. Both "pure" Lua functions
-          *  and functions written in C/C++ and "exported" to Lua are supported.
-          *  @param param The one and only parameter to be passed to the
-          *         function being called
-          *  @return All the values returned by the called function. The first
-          *          return value at index 0, the second at index 1 and so on.
+         /** Just like \c operator()(), but reports errors raised while
+          *  executing the function through the returned \c LuaResult, instead
+          *  of throwing exceptions. Use this when errors are expected to be
+          *  frequent.
           *  @throw TypeMismatchError If this \c LuaVariable tries to subscript
           *         something that is not a table.
-          *  @throw LuaRunTimeError If something bad happens while executing the
-          *         function.
           */
-         LuaValueList operator() (const LuaValue& param);
+         LuaResult tryCall (const LuaValueList& params = LuaValueList());
 
          /** Assuming that this \c LuaVariable holds a function, calls this
           *  function and returns its return values. Both "pure" Lua functions
           *  and functions written in C/C++ and "exported" to Lua are supported.
-          *  @param param1 The first parameter to be passed to the function
-          *         being called
-          *  @param param2 The second parameter to be passed to the function
-          *         being called
+          *  <p>The parameters are pushed directly onto the Lua stack (using
+          *  \c LuaStack), so no \c LuaValueList is created for them. Any type
+          *  supported by \c LuaStack or convertible to \c LuaValue can be
+          *  passed.
+          *  @param params The parameters to be passed to the function.
           *  @return All the values returned by the called function. The first
           *          return value at index 0, the second at index 1 and so on.
           *  @throw TypeMismatchError If this \c LuaVariable tries to subscript
@@ -142,77 +146,37 @@ namespace Diluculum
           *  @throw LuaRunTimeError If something bad happens while executing the
           *         function.
           */
-         LuaValueList operator() (const LuaValue& param1,
-                                  const LuaValue& param2);
+         template <typename... Params>
+         LuaValueList operator() (const Params&... params)
+         {
+            pushTheReferencedValue();
+            return Impl::CallOnTop<LuaValueList> (state_, params...);
+         }
 
-         /** Assuming that this \c LuaVariable holds a function, calls this
-          *  function and returns its return values. Both "pure" Lua functions
-          *  and functions written in C/C++ and "exported" to Lua are supported.
-          *  @param param1 The first parameter to be passed to the function
-          *         being called
-          *  @param param2 The second parameter to be passed to the function
-          *         being called
-          *  @param param3 The third parameter to be passed to the function
-          *         being called
-          *  @return All the values returned by the called function. The first
-          *          return value at index 0, the second at index 1 and so on.
+         /** Just like \c operator()(), but requests a fixed number of return
+          *  values from Lua and returns them as an \c R, without creating any
+          *  \c LuaValueList. \c R can be:
+          *  <ul>
+          *     <li>\c void, to ignore the return values;
+          *     <li>a type supported by \c LuaStack (like \c double or
+          *        \c std::string), to get the first return value;
+          *     <li>an \c std::tuple of such types, to get several return
+          *        values (like <tt>std::tuple<double, std::string></tt>);
+          *     <li>\c LuaValueList, to get all the return values.
+          *  </ul>
+          *  Missing return values are \c nil, as usual in Lua.
           *  @throw TypeMismatchError If this \c LuaVariable tries to subscript
-          *         something that is not a table.
-          *  @throw LuaRunTimeError If something bad happens while executing the
-          *         function.
-          */
-         LuaValueList operator() (const LuaValue& param1,
-                                  const LuaValue& param2,
-                                  const LuaValue& param3);
-
-         /** Assuming that this \c LuaVariable holds a function, calls this
-          *  function and returns its return values. Both "pure" Lua functions
-          *  and functions written in C/C++ and "exported" to Lua are supported.
-          *  @param param1 The first parameter to be passed to the function
-          *         being called
-          *  @param param2 The second parameter to be passed to the function
-          *         being called
-          *  @param param3 The third parameter to be passed to the function
-          *         being called
-          *  @param param4 The fourth parameter to be passed to the function
-          *         being called
-          *  @return All the values returned by the called function. The first
-          *          return value at index 0, the second at index 1 and so on.
-          *  @throw TypeMismatchError If this \c LuaVariable tries to subscript
-          *         something that is not a table.
-          *  @throw LuaRunTimeError If something bad happens while executing the
-          *         function.
-          */
-         LuaValueList operator() (const LuaValue& param1,
-                                  const LuaValue& param2,
-                                  const LuaValue& param3,
-                                  const LuaValue& param4);
-
-         /** Assuming that this \c LuaVariable holds a function, calls this
-          *  function and returns its return values. Both "pure" Lua functions
-          *  and functions written in C/C++ and "exported" to Lua are supported.
-          *  @param param1 The first parameter to be passed to the function
-          *         being called
-          *  @param param2 The second parameter to be passed to the function
-          *         being called
-          *  @param param3 The third parameter to be passed to the function
-          *         being called
-          *  @param param4 The fourth parameter to be passed to the function
-          *         being called
-          *  @param param5 The fifth parameter to be passed to the function
-          *         being called
-          *  @return All the values returned by the called function. The first
-          *          return value at index 0, the second at index 1 and so on.
-          *  @throw TypeMismatchError If this \c LuaVariable tries to subscript
-          *         something that is not a table.
+          *         something that is not a table, or if some return value is
+          *         not of the requested type.
           *  @throw LuaRunTimeError If something bad happens while executing the
           *         function.
           */
-         LuaValueList operator() (const LuaValue& param1,
-                                  const LuaValue& param2,
-                                  const LuaValue& param3,
-                                  const LuaValue& param4,
-                                  const LuaValue& param5);
+         template <typename R, typename... Params>
+         R call (const Params&... params)
+         {
+            pushTheReferencedValue();
+            return Impl::CallOnTop<R> (state_, params...);
+         }
 
          /** Checks whether the value stored in this variable is equal to the
           *  value at \c rhs.
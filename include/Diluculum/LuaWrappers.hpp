@@ -28,10 +28,15 @@
 #define _DILUCULUM_LUA_WRAPPERS_HPP_
 
 #include <algorithm>
+#include <cstddef>
+#include <new>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <boost/bind.hpp>
 #include <Diluculum/CppObject.hpp>
 #include <Diluculum/LuaExceptions.hpp>
+#include <Diluculum/LuaStack.hpp>
 #include <Diluculum/LuaState.hpp>
 #include <Diluculum/LuaUtils.hpp>
 
@@ -52,6 +57,274 @@ namespace Diluculum
 
 
 
+      /** Pushes onto the stack the metatable of the objects of a class
+       *  exported to Lua. The metatable is stored in the registry, using the
+       *  address of the class \c ClassInfo as key. Pushes \c nil if the
+       *  class was not registered in \c ls. This costs a single raw access to
+       *  the registry.
+       *  @note This is not intended to be called by Diluculum users.
+       */
+      inline void PushClassMetatable (lua_State* ls, const ClassInfo* info)
+      {
+         lua_pushlightuserdata (ls, const_cast<ClassInfo*>(info));
+         lua_rawget (ls, LUA_REGISTRYINDEX);
+      }
+
+      /** Pops the table on the top of the stack and stores it as the
+       *  metatable of the objects of the class described by \c info.
+       *  @note This is not intended to be called by Diluculum users.
+       */
+      void SetClassMetatable (lua_State* ls, const ClassInfo* info);
+
+      /** Pushes onto the stack a table mapping the <tt>ClassInfo</tt>s (as
+       *  light userdata) of the classes registered in \c ls to their
+       *  metatables, or \c nil if no
+       *  class was registered. This is used to copy the metatables to other
+       *  states, as in \c LuaStateTemplate.
+       *  @note This is not intended to be called by Diluculum users.
+       */
+      void PushClassMetatables (lua_State* ls);
+
+
+
+      /** Pushes onto the stack a userdata representing the object \c ptr,
+       *  instantiated in C++, whose class is described by \c info. The
+       *  userdata is looked up in a per-state
+       *  cache (a table with weak values, indexed by the object address), so
+       *  that an object is represented by the same userdata while it is alive
+       *  in Lua. A new userdata is created (and cached) only if not found.
+       *  @note This is not intended to be called by Diluculum users.
+       */
+      void PushCppObject (lua_State* ls, void* ptr, const ClassInfo* info);
+
+      /** The slow path of \c ToObject() (below), which handles objects of
+       *  derived classes. Since the userdata may not even be a \c CppObject,
+       *  it is first checked to have the metatable of the class it claims to
+       *  be.
+       *  @note This is not intended to be called by Diluculum users.
+       */
+      void* ToBaseObject (lua_State* ls, int index, const ClassInfo* info);
+
+      /** Returns a pointer to the object of the class described by \c info
+       *  represented by the value at \c index, or a null pointer if the
+       *  value does not represent an object of this class (or of a class
+       *  derived from it). Objects of exactly this class are recognized just
+       *  by comparing their \c CppObject::classInfo, without touching
+       *  metatables.
+       *  @note This is not intended to be called by Diluculum users.
+       */
+      inline void* ToObject (lua_State* ls, int index, const ClassInfo* info)
+      {
+         if (lua_type (ls, index) != LUA_TUSERDATA
+             || lua_objlen (ls, index) < sizeof (CppObject))
+         {
+            return 0;
+         }
+
+         const CppObject* cppObj =
+            static_cast<const CppObject*>(lua_touserdata (ls, index));
+
+         if (cppObj->classInfo == info)
+            return cppObj->ptr;
+         else
+            return ToBaseObject (ls, index, info);
+      }
+
+      /** Returns the \c CppObject at \c index if it represents an object of
+       *  exactly the class described by \c info (not of a derived class), or
+       *  a null pointer otherwise. Used by the destructor wrappers, since
+       *  deleting an object through a pointer to a base class subobject is
+       *  not safe.
+       *  @note This is not intended to be called by Diluculum users.
+       */
+      inline CppObject* ToExactObject (lua_State* ls, int index,
+                                       const ClassInfo* info)
+      {
+         if (lua_type (ls, index) != LUA_TUSERDATA
+             || lua_objlen (ls, index) < sizeof (CppObject))
+         {
+            return 0;
+         }
+
+         CppObject* cppObj =
+            static_cast<CppObject*>(lua_touserdata (ls, index));
+         return cppObj->classInfo == info ? cppObj : 0;
+      }
+
+      /** Throws the \c TypeMismatchError telling that the value at \c index
+       *  is not an object of the class described by \c info.
+       *  @note This is not intended to be called by Diluculum users.
+       */
+      void ThrowNotAnObject (lua_State* ls, int index, const ClassInfo* info);
+
+
+
+      /** Converts a pointer to a \c Derived object to a pointer to its
+       *  \c Base subobject. Used as \c BaseClassLink::upcast.
+       */
+      template <typename Derived, typename Base>
+      void* Upcast (void* ptr)
+      {
+         return static_cast<Base*>(static_cast<Derived*>(ptr));
+      }
+
+      /** Helper class used by \c DILUCULUM_CLASS_BASE() to add a base class
+       *  to a \c ClassInfo during static initialization (just like
+       *  \c ClassTableFiller does with methods).
+       */
+      class BaseClassFiller
+      {
+         public:
+            /// Appends \c link to the list of base classes of \c info.
+            BaseClassFiller (ClassInfo* info, BaseClassLink& link)
+            {
+               BaseClassLink** p = &info->bases;
+               while (*p != 0)
+                  p = &(*p)->next;
+               *p = &link;
+            }
+      };
+
+      /** Copies to \c classTable the methods (and metamethods) of the base
+       *  classes of the class described by \c info which are not defined in
+       *  \c classTable itself. The methods are taken from the metatables of
+       *  the base classes, which therefore must be registered in \c ls.
+       *  Since these were flattened in the same way, \c classTable ends up
+       *  with the methods of all its ancestors, and method lookup is a single
+       *  table access regardless of the depth of the class hierarchy.
+       *  @throw LuaError If a base class is not registered in \c ls.
+       *  @note This is not intended to be called by Diluculum users.
+       */
+      void InheritMethods (lua_State* ls, const ClassInfo* info,
+                           LuaValueMap& classTable);
+
+
+
+      /** A type with the alignment Lua guarantees for the memory blocks of
+       *  full userdata (this mimics \c L_Umaxalign, from the Lua sources).
+       */
+      union UserDataAlignment
+      {
+         double d;
+         void* p;
+         long l;
+      };
+
+      /** The layout of the userdata of an object of class \c T constructed
+       *  in place, that is, inside the userdata block itself (as done for
+       *  classes exported with \c DILUCULUM_BEGIN_VALUE_CLASS()). The block
+       *  starts with a \c CppObject, whose \c ptr points to the object,
+       *  stored right after it.
+       *  @note This is not intended to be used by Diluculum users.
+       */
+      template <typename T>
+      struct InPlaceObject
+      {
+         static_assert (alignof(T) <= alignof(UserDataAlignment),
+                        "Lua cannot align the userdata memory block as "
+                        "required by this class.");
+
+         /// The offset of the object from the start of the userdata block.
+         static const std::size_t offset =
+            (sizeof(CppObject) + alignof(T) - 1) / alignof(T) * alignof(T);
+
+         /** Creates a userdata (leaving it on the top of the stack) and
+          *  constructs in it a \c T, passing \c args to its constructor.
+          *  Returns a pointer to the constructed object. The metatable of the
+          *  userdata is not set.
+          */
+         template <typename... Args>
+         static T* create (lua_State* ls, Args&&... args)
+         {
+            void* ud = lua_newuserdata (ls, offset + sizeof(T));
+            CppObject* cppObj = static_cast<CppObject*>(ud);
+            cppObj->ptr = 0;
+            cppObj->classInfo = GetClassInfo<T>();
+            cppObj->deleteMe = false;
+
+            T* obj = new (static_cast<char*>(ud) + offset)
+               T (std::forward<Args>(args)...);
+
+            cppObj->ptr = obj;
+            cppObj->deleteMe = true;
+
+            return obj;
+         }
+
+         /** Calls the destructor of the object stored in the userdata whose
+          *  block starts with \c cppObj, unless already destroyed (or not
+          *  constructed in place at all).
+          */
+         static void destroy (CppObject* cppObj)
+         {
+            if (cppObj->deleteMe)
+            {
+               cppObj->deleteMe = false; // don't destroy again when gc'ed!
+               static_cast<T*>(cppObj->ptr)->~T();
+            }
+         }
+      };
+
+      template <typename T>
+      const std::size_t InPlaceObject<T>::offset;
+
+      /** Helper class, used by \c DILUCULUM_BEGIN_VALUE_CLASS() to mark a
+       *  class as constructed in place during static initialization.
+       */
+      class InPlaceClassMarker
+      {
+         public:
+            /// Sets the \c inPlace flag of \c info.
+            explicit InPlaceClassMarker (ClassInfo* info)
+            {
+               info->inPlace = true;
+            }
+      };
+
+      /** Pushes onto the stack of \c ls a new object owned by Lua, which is a
+       *  copy of \c value. The copy is constructed in place if \c T was
+       *  exported with \c DILUCULUM_BEGIN_VALUE_CLASS(), and allocated with
+       *  \c new otherwise (so that it is destroyed properly in both cases).
+       *  This is how objects returned by value by the typed wrappers (like
+       *  the result of an arithmetic metamethod) are passed to Lua.
+       *  @throw LuaError If \c T is not registered in \c ls.
+       *  @note This is not intended to be called by Diluculum users.
+       */
+      template <typename T>
+      void PushObjectCopy (lua_State* ls, const T& value)
+      {
+         const ClassInfo* info = GetClassInfo<T>();
+
+         PushClassMetatable (ls, info);
+         if (lua_isnil (ls, -1))
+         {
+            lua_pop (ls, 1);
+            throw LuaError ("Cannot return an object of a class not "
+                            "registered in this Lua state.");
+         }
+
+         if (info->inPlace)
+         {
+            InPlaceObject<T>::create (ls, value);
+         }
+         else
+         {
+            void* ud = lua_newuserdata (ls, sizeof(CppObject));
+            CppObject* cppObj = static_cast<CppObject*>(ud);
+            cppObj->ptr = 0;
+            cppObj->classInfo = info;
+            cppObj->deleteMe = false;
+
+            cppObj->ptr = new T (value);
+            cppObj->deleteMe = true;
+         }
+
+         lua_insert (ls, -2);
+         lua_setmetatable (ls, -2);
+      }
+
+
+
       /** Helper class, used by the \c DILUCULUM_CLASS_METHOD() macro, as a
        *  means register a method in the table that represents a class being
        *  exported to Lua. Everything is done in the constructor. This is just
@@ -76,7 +349,130 @@ namespace Diluculum
                classTable[name] = func;
             }
       };
+
+
+
+      /** Helper class, used by the \c DILUCULUM_CLASS_PROPERTY() family of
+       *  macros to register a property in the table that represents a class
+       *  being exported to Lua. Works just like \c ClassTableFiller.
+       *  <p>The getters and setters of the properties are stored in the
+       *  class table, in the \c __getters and \c __setters tables (indexed
+       *  by property name). When the class is registered,
+       *  \c SetUpProperties() creates the \c __index and \c __newindex
+       *  metamethods that use them.
+       */
+      class PropertyFiller
+      {
+         public:
+            /** Adds a property to the table \c classTable.
+             *  @param classTable The table representing the class being
+             *         exported to Lua.
+             *  @param name The name of the property.
+             *  @param getter The C function returning the property value,
+             *         taking the object as its first argument.
+             *  @param setter The C function setting the property value,
+             *         taking the object and the new value as arguments. Null
+             *         for read-only properties.
+             */
+            PropertyFiller (Diluculum::LuaValueMap& classTable,
+                            const std::string& name,
+                            lua_CFunction getter,
+                            lua_CFunction setter = 0)
+            {
+               add (classTable, "__getters", name, getter);
+               if (setter != 0)
+                  add (classTable, "__setters", name, setter);
+            }
+
+         private:
+            static void add (Diluculum::LuaValueMap& classTable,
+                             const char* table, const std::string& name,
+                             lua_CFunction func)
+            {
+               Diluculum::LuaValueMap funcs;
+               if (classTable.count (table) > 0)
+                  funcs = classTable[table].asTable();
+               funcs[name] = func;
+               classTable[table] = funcs;
+            }
+      };
+
+
+
+      /** If the class whose metatable is on the top of the stack has
+       *  properties (see \c PropertyFiller), sets the metatable \c __index
+       *  and \c __newindex metamethods to functions that look up the
+       *  properties (and, for \c __index, then the methods). Classes without
+       *  properties keep the plain table lookup.
+       *  @note This is not intended to be called by Diluculum users.
+       */
+      void SetUpProperties (lua_State* ls);
    }
+
+
+
+   /** Returns a pointer to the C++ object represented by the value at index
+    *  \c index of the stack of \c ls. This object must be of the class \c T
+    *  (or of a class derived from \c T), exported to Lua with the
+    *  \c DILUCULUM_BEGIN_CLASS() family of macros. The check takes constant
+    *  time for objects of class \c T itself.
+    *  @throw TypeMismatchError If the value is not an object of class \c T.
+    */
+   template <typename T>
+   inline T* checkObject (lua_State* ls, int index)
+   {
+      const Impl::ClassInfo* info = Impl::GetClassInfo<T>();
+      void* ptr = Impl::ToObject (ls, index, info);
+
+      if (ptr == 0)
+         Impl::ThrowNotAnObject (ls, index, info);
+
+      return static_cast<T*>(ptr);
+   }
+
+
+
+   /** \c LuaStack specialization for pointers to objects of classes exported
+    *  to Lua. Pushing a pointer does the same as
+    *  \c DILUCULUM_REGISTER_OBJECT() (the object is not owned by Lua); a null
+    *  pointer is pushed as \c nil. Reading is done with \c checkObject(),
+    *  except that \c nil is read as a null pointer.
+    *  <p>Pointers to \c const objects can be read, but not pushed: Lua has
+    *  no notion of constness, and could call non \c const methods on them.
+    *  @note Pushing a pointer to an object owned by Lua (that is,
+    *        instantiated in Lua code) creates a second, non-owning handle to
+    *        it, which dangles once the owning userdata is collected. Only
+    *        push pointers to objects that outlive their use in Lua.
+    */
+   template <typename T>
+   struct LuaStack<T*, typename std::enable_if<std::is_class<T>::value>::type>
+   {
+      typedef typename std::remove_cv<T>::type Class;
+
+      static void push (lua_State* ls, T* ptr)
+      {
+         static_assert (!std::is_const<T>::value,
+                        "Pointers to const objects cannot be pushed to Lua.");
+
+         if (ptr == 0)
+            lua_pushnil (ls);
+         else
+            Impl::PushCppObject (ls, ptr, Impl::GetClassInfo<Class>());
+      }
+
+      static bool is (lua_State* ls, int index)
+      {
+         return lua_isnil (ls, index)
+            || Impl::ToObject (ls, index, Impl::GetClassInfo<Class>()) != 0;
+      }
+
+      static T* get (lua_State* ls, int index)
+      {
+         if (lua_isnil (ls, index))
+            return 0;
+         return checkObject<Class> (ls, index);
+      }
+   };
 }
 
 
@@ -148,6 +544,66 @@ int DILUCULUM_WRAPPER_FUNCTION(FUNC) (lua_State* ls)                          \
 
 
 
+/** Creates a \c lua_CFunction that wraps a function that starts some
+ *  asynchronous operation. The wrapped function must have a signature like the
+ *  following one:
+ *  <p><tt>void Func (Diluculum::LuaState::AsyncCallId call,
+ *                    const Diluculum::LuaValueList& params)</tt>
+ *  <p>After \c FUNC returns, the Lua code calling the wrapper function is
+ *  suspended. When the asynchronous operation finishes, the host shall call
+ *  <tt>LuaState::resumeAsync(call, results)</tt>, and the Lua code will
+ *  continue, seeing \c results as the values returned by the wrapper.
+ *  <p>The wrapper function can only be called from code running in a call
+ *  started by \c LuaState::callAsync(). Calling it in any other context
+ *  raises a Lua error.
+ *  @note Like in \c DILUCULUM_WRAP_FUNCTION(), errors are reported by
+ *        <tt>throw</tt>ing a \c Diluculum::LuaError, and the name of the
+ *        created wrapper function is obtained with
+ *        \c DILUCULUM_WRAPPER_FUNCTION().
+ *  @param FUNC The function to be wrapped.
+ */
+#define DILUCULUM_WRAP_ASYNC_FUNCTION(FUNC)                                   \
+int DILUCULUM_WRAPPER_FUNCTION(FUNC) (lua_State* ls)                          \
+{                                                                             \
+   using Diluculum::Impl::ReportErrorFromCFunction;                           \
+                                                                              \
+   try                                                                        \
+   {                                                                          \
+      const Diluculum::LuaState::AsyncCallId call =                           \
+         Diluculum::LuaState::getAsyncCallId (ls);                            \
+                                                                              \
+      if (call == Diluculum::LuaState::NoAsyncCall)                           \
+      {                                                                       \
+         throw Diluculum::LuaError ("Asynchronous functions can only be "     \
+                                    "called from 'LuaState::callAsync()'.");  \
+      }                                                                       \
+                                                                              \
+      /* Read parameters and empty the stack */                               \
+      const int numParams = lua_gettop (ls);                                  \
+      Diluculum::LuaValueList params;                                         \
+      for (int i = 1; i <= numParams; ++i)                                    \
+         params.push_back (Diluculum::ToLuaValue (ls, i));                    \
+      lua_pop (ls, numParams);                                                \
+                                                                              \
+      /* Start the operation and suspend until it finishes */                 \
+      FUNC (call, params);                                                    \
+   }                                                                          \
+   catch (Diluculum::LuaError& e)                                             \
+   {                                                                          \
+      ReportErrorFromCFunction (ls, e.what());                                \
+      return 0;                                                               \
+   }                                                                          \
+   catch(...)                                                                 \
+   {                                                                          \
+      ReportErrorFromCFunction (ls, "Unknown exception caught by wrapper.");  \
+      return 0;                                                               \
+   }                                                                          \
+                                                                              \
+   return lua_yield (ls, 0);                                                  \
+}
+
+
+
 /** Returns the name of the table that represent the class \c CLASS.
  *  @note This is used internally. Users can ignore this macro.
  */
@@ -188,12 +644,12 @@ int Diluculum__ ## CLASS ## __Constructor_Wrapper_Function (lua_State* ls)    \
       void* ud = lua_newuserdata (ls, sizeof(CppObject));                     \
       CppObject* cppObj = reinterpret_cast<CppObject*>(ud);                   \
       cppObj->ptr = new CLASS (params);                                       \
+      cppObj->classInfo = Diluculum::Impl::GetClassInfo<CLASS>();             \
       cppObj->deleteMe = true;                                                \
                                                                               \
-      lua_getglobal (ls, "__Diluculum__Class_Metatables");                    \
-      lua_getfield (ls, -1, #CLASS);                                          \
-      lua_setmetatable (ls, -3);                                              \
-      lua_pop (ls, 1); /* pop the table of metatables */                      \
+      Diluculum::Impl::PushClassMetatable (                                   \
+         ls, Diluculum::Impl::GetClassInfo<CLASS>());                         \
+      lua_setmetatable (ls, -2);                                              \
                                                                               \
       return 1;                                                               \
    }                                                                          \
@@ -214,8 +670,14 @@ int Diluculum__ ## CLASS ## __Destructor_Wrapper_Function (lua_State* ls)     \
 {                                                                             \
    using Diluculum::Impl::CppObject;                                          \
                                                                               \
-   CppObject* cppObj =                                                        \
-      reinterpret_cast<CppObject*>(lua_touserdata (ls, -1));                  \
+   CppObject* cppObj = Diluculum::Impl::ToExactObject (                       \
+      ls, 1, Diluculum::Impl::GetClassInfo<CLASS>());                         \
+                                                                              \
+   if (cppObj == 0)                                                           \
+   {                                                                          \
+      Diluculum::Impl::ReportErrorFromCFunction (                             \
+         ls, "Expected an object of class '" #CLASS "'.");                    \
+   }                                                                          \
                                                                               \
    if (cppObj->deleteMe)                                                      \
    {                                                                          \
@@ -229,6 +691,85 @@ int Diluculum__ ## CLASS ## __Destructor_Wrapper_Function (lua_State* ls)     \
 
 
 
+/** Starts a block of class wrapping macro calls, just like
+ *  \c DILUCULUM_BEGIN_CLASS(), but for classes whose objects instantiated in
+ *  Lua are constructed in place, inside the userdata block itself (instead
+ *  of being allocated separately with \c new). When garbage-collected (or
+ *  when \c delete is called), the destructor is called in place. This halves
+ *  the number of allocations per object and keeps the object next to its
+ *  handle, and is meant for small classes, like vectors and colors.
+ *  <p>The block is closed by \c DILUCULUM_END_CLASS(), as usual. Objects
+ *  instantiated in C++ are registered with \c DILUCULUM_REGISTER_OBJECT(),
+ *  as usual, too (and are not copied into Lua).
+ *  @param CLASS The class being exported.
+ */
+#define DILUCULUM_BEGIN_VALUE_CLASS(CLASS)                                    \
+namespace                                                                     \
+{                                                                             \
+   /* the table representing the class */                                     \
+   Diluculum::LuaValueMap DILUCULUM_CLASS_TABLE(CLASS);                       \
+                                                                              \
+   Diluculum::Impl::InPlaceClassMarker                                        \
+      Diluculum__ ## CLASS ## __In_Place_Marker(                              \
+         Diluculum::Impl::GetClassInfo<CLASS>());                             \
+}                                                                             \
+                                                                              \
+/* The Constructor */                                                         \
+int Diluculum__ ## CLASS ## __Constructor_Wrapper_Function (lua_State* ls)    \
+{                                                                             \
+   using Diluculum::Impl::ReportErrorFromCFunction;                           \
+                                                                              \
+   try                                                                        \
+   {                                                                          \
+      /* Read parameters and empty the stack */                               \
+      const int numParams = lua_gettop (ls);                                  \
+      Diluculum::LuaValueList params;                                         \
+      for (int i = 1; i <= numParams; ++i)                                    \
+         params.push_back (Diluculum::ToLuaValue (ls, i));                    \
+      lua_pop (ls, numParams);                                                \
+                                                                              \
+      /* Construct the object inside a new userdata, and return */            \
+      Diluculum::Impl::InPlaceObject<CLASS>::create (ls, params);             \
+                                                                              \
+      Diluculum::Impl::PushClassMetatable (                                   \
+         ls, Diluculum::Impl::GetClassInfo<CLASS>());                         \
+      lua_setmetatable (ls, -2);                                              \
+                                                                              \
+      return 1;                                                               \
+   }                                                                          \
+   catch (Diluculum::LuaError& e)                                             \
+   {                                                                          \
+      ReportErrorFromCFunction (ls, e.what());                                \
+      return 0;                                                               \
+   }                                                                          \
+   catch(...)                                                                 \
+   {                                                                          \
+      ReportErrorFromCFunction (ls, "Unknown exception caught by wrapper.");  \
+      return 0;                                                               \
+   }                                                                          \
+}                                                                             \
+                                                                              \
+/* Destructor */                                                              \
+int Diluculum__ ## CLASS ## __Destructor_Wrapper_Function (lua_State* ls)     \
+{                                                                             \
+   using Diluculum::Impl::CppObject;                                          \
+                                                                              \
+   CppObject* cppObj = Diluculum::Impl::ToExactObject (                       \
+      ls, 1, Diluculum::Impl::GetClassInfo<CLASS>());                         \
+                                                                              \
+   if (cppObj == 0)                                                           \
+   {                                                                          \
+      Diluculum::Impl::ReportErrorFromCFunction (                             \
+         ls, "Expected an object of class '" #CLASS "'.");                    \
+   }                                                                          \
+                                                                              \
+   Diluculum::Impl::InPlaceObject<CLASS>::destroy (cppObj);                   \
+                                                                              \
+   return 0;                                                                  \
+}
+
+
+
 /** Returns the name of the function used to wrap a method \c METHOD of the
  *  class \c CLASS.
  *  @note This is used internally. Users can ignore this macro.
@@ -249,24 +790,21 @@ int DILUCULUM_METHOD_WRAPPER(CLASS, METHOD) (lua_State* ls)                   \
    using std::for_each;                                                       \
    using boost::bind;                                                         \
    using Diluculum::PushLuaValue;                                             \
-   using Diluculum::Impl::CppObject;                                          \
    using Diluculum::Impl::ReportErrorFromCFunction;                           \
                                                                               \
    try                                                                        \
    {                                                                          \
+      /* Get the object pointer */                                            \
+      CLASS* pObj = Diluculum::checkObject<CLASS> (ls, 1);                    \
+                                                                              \
       /* Read parameters and empty the stack */                               \
       const int numParams = lua_gettop (ls);                                  \
-      Diluculum::LuaValue ud = Diluculum::ToLuaValue (ls, 1);                 \
       Diluculum::LuaValueList params;                                         \
       for (int i = 2; i <= numParams; ++i)                                    \
          params.push_back (Diluculum::ToLuaValue (ls, i));                    \
       lua_pop (ls, numParams);                                                \
                                                                               \
-      /* Get the object pointer and call the method */                        \
-      CppObject* cppObj =                                                     \
-         reinterpret_cast<CppObject*>(ud.asUserData().getData());             \
-      CLASS* pObj = reinterpret_cast<CLASS*>(cppObj->ptr);                    \
-                                                                              \
+      /* Call the method */                                                   \
       Diluculum::LuaValueList ret = pObj->METHOD (params);                    \
                                                                               \
       /* Push the return values and return */                                 \
@@ -297,26 +835,52 @@ namespace                                                                     \
 
 
 
+/** Declares a base class of a class being exported. This macro must be
+ *  called between calls to \c DILUCULUM_BEGIN_CLASS() and
+ *  \c DILUCULUM_END_CLASS(), once for each base class (multiple inheritance
+ *  is supported). When the class is registered, the methods of \c BASE not
+ *  redefined in \c CLASS are copied into the \c CLASS table, so that
+ *  calling them costs no more than calling the \c CLASS own methods.
+ *  Furthermore, objects of class \c CLASS are accepted wherever objects of
+ *  class \c BASE are expected (and the pointers are properly adjusted).
+ *  @note \c BASE must be exported to Lua, too, and registered before
+ *        \c CLASS in the Lua state.
+ *  @param CLASS The class being exported.
+ *  @param BASE One of its public base classes.
+ */
+#define DILUCULUM_CLASS_BASE(CLASS, BASE)                                     \
+namespace                                                                     \
+{                                                                             \
+   Diluculum::Impl::BaseClassLink                                             \
+      Diluculum__ ## CLASS ## __ ## BASE ## __Base_Link = {                   \
+         Diluculum::Impl::GetClassInfo<BASE>(),                               \
+         &Diluculum::Impl::Upcast<CLASS, BASE>,                               \
+         0 };                                                                 \
+                                                                              \
+   Diluculum::Impl::BaseClassFiller                                           \
+      Diluculum__ ## CLASS ## __ ## BASE ## __Base_Filler(                    \
+         Diluculum::Impl::GetClassInfo<CLASS>(),                              \
+         Diluculum__ ## CLASS ## __ ## BASE ## __Base_Link);                  \
+}
+
+
+
 /** Ends a block of class wrapping macro calls (which was opened by a call to
  *  \c DILUCULUM_BEGIN_CLASS()).
  *  @param CLASS The class being exported.
  */
 #define DILUCULUM_END_CLASS(CLASS)                                            \
                                                                               \
-/* The function used to register the class in a 'LuaState' */                 \
-void Diluculum_Register_Class__ ## CLASS (Diluculum::LuaVariable className)   \
+/* The function used to register the class in a 'LuaState'. It is inline, so  \
+   that compilers don't warn about it if the class is never registered. */    \
+inline void                                                                   \
+Diluculum_Register_Class__ ## CLASS (Diluculum::LuaVariable className)        \
 {                                                                             \
-   Diluculum::LuaState ls (className.getState());                             \
-                                                                              \
-   if (ls["__Diluculum__Class_Metatables"].value().type() == LUA_TNIL)        \
-     ls["__Diluculum__Class_Metatables"] = Diluculum::EmptyLuaValueMap;       \
-                                                                              \
    static bool isInited = false;                                              \
    if (!isInited)                                                             \
    {                                                                          \
-      isInited = true;                                                        \
-                                                                              \
       DILUCULUM_CLASS_TABLE(CLASS)["classname"] = #CLASS;                     \
+      Diluculum::Impl::GetClassInfo<CLASS>()->name = #CLASS;                  \
                                                                               \
       DILUCULUM_CLASS_TABLE(CLASS)["new"] =                                   \
          Diluculum__ ## CLASS ## __Constructor_Wrapper_Function;              \
@@ -327,13 +891,22 @@ void Diluculum_Register_Class__ ## CLASS (Diluculum::LuaVariable className)   \
       DILUCULUM_CLASS_TABLE(CLASS)["__gc"] =                                  \
          Diluculum__ ## CLASS ## __Destructor_Wrapper_Function;               \
                                                                               \
+      Diluculum::Impl::InheritMethods (                                       \
+         className.getState(), Diluculum::Impl::GetClassInfo<CLASS>(),        \
+         DILUCULUM_CLASS_TABLE(CLASS));                                       \
+                                                                              \
       DILUCULUM_CLASS_TABLE(CLASS)["__index"] = DILUCULUM_CLASS_TABLE(CLASS); \
+                                                                              \
+      isInited = true;                                                        \
    }                                                                          \
                                                                               \
    className = DILUCULUM_CLASS_TABLE(CLASS);                                  \
                                                                               \
-   ls["__Diluculum__Class_Metatables"][#CLASS] =                              \
-      DILUCULUM_CLASS_TABLE(CLASS);                                           \
+   Diluculum::PushLuaValue (className.getState(),                             \
+                            DILUCULUM_CLASS_TABLE(CLASS));                    \
+   Diluculum::Impl::SetUpProperties (className.getState());                   \
+   Diluculum::Impl::SetClassMetatable (                                       \
+      className.getState(), Diluculum::Impl::GetClassInfo<CLASS>());          \
 } /* end of Diluculum_Register_Class__CLASS */
 
 
@@ -354,6 +927,11 @@ void Diluculum_Register_Class__ ## CLASS (Diluculum::LuaVariable className)   \
  *  object's methods can be called from Lua. The registered C++ object will
  *  \e not be destroyed when the corresponding Lua object is garbage-collected.
  *  Destroying it is responsibility of the programmer on the C++ side.
+ *  <p>Registering an object already known to the Lua state (that is, whose
+ *  userdata was not garbage-collected yet) reuses the existing userdata
+ *  instead of creating a new one. So, no garbage is created when the same
+ *  objects are registered over and over, and the Lua values representing
+ *  the same object compare equal.
  *  @param LUA_VARIABLE The \c Diluculum::LuaVariable where the object will be
  *         stored. Notice that a \c Diluculum::LuaVariable contains a reference
  *         to a <tt>lua_State*</tt>, so the Lua state in which the object will
@@ -372,24 +950,14 @@ void Diluculum_Register_Class__ ## CLASS (Diluculum::LuaVariable className)   \
    Diluculum::PushLuaValue (LUA_VARIABLE.getState(),                          \
                             LUA_VARIABLE.getKeys().back());                   \
                                                                               \
-   /* create the userdata, set its metatable */                               \
-   void* ud = lua_newuserdata (LUA_VARIABLE.getState(),                       \
-                               sizeof(Diluculum::Impl::CppObject));           \
-                                                                              \
-   Diluculum::Impl::CppObject* cppObj =                                       \
-      reinterpret_cast<Diluculum::Impl::CppObject*>(ud);                      \
-                                                                              \
-   cppObj->ptr = &OBJECT;                                                     \
-   cppObj->deleteMe = false;                                                  \
-                                                                              \
-   lua_getglobal (LUA_VARIABLE.getState(), "__Diluculum__Class_Metatables");  \
-   lua_getfield (LUA_VARIABLE.getState(), -1, #CLASS);                        \
-   lua_setmetatable (LUA_VARIABLE.getState(), -3);                            \
-                                                                              \
-   lua_pop (LUA_VARIABLE.getState(), 1); /* pop the table of metatables */    \
+   /* push the userdata representing the object (reused, if possible) */      \
+   Diluculum::Impl::PushCppObject (LUA_VARIABLE.getState(),                   \
+                                   static_cast<CLASS*>(&(OBJECT)),            \
+                                   Diluculum::Impl::GetClassInfo<CLASS>());   \
                                                                               \
    /* store the userdata */                                                   \
    lua_settable (LUA_VARIABLE.getState(), -3);                                \
+   lua_pop (LUA_VARIABLE.getState(), 1);                                      \
 }
 
 